@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+"""Run the headless benchmarks in bench/ and compare against a baseline.
+
+Each bench/*.sharo prints a "bench <ops> <seconds>" line (std/bench.sharo);
+the best of several runs is reported as ops/sec. Exits with status 1 when a
+benchmark is slower than the baseline by more than the threshold.
+"""
+
+import argparse
+import glob
+import json
+import os
+import subprocess
+import sys
+
+BENCH_DIR = "bench"
+DEFAULT_BASELINE = os.path.join(BENCH_DIR, "baseline.json")
+
+
+def run_once(sharo, path):
+    env = dict(os.environ, SHARO_HEADLESS="1", SHARO_NO_CACHE="1")
+    result = subprocess.run([sharo, path], env=env, capture_output=True, text=True)
+    if result.returncode != 0:
+        raise RuntimeError(f"{path} exited with {result.returncode}:\n{result.stderr}")
+    for line in reversed(result.stdout.splitlines()):
+        parts = line.split()
+        if len(parts) == 3 and parts[0] == "bench":
+            ops, seconds = int(parts[1]), float(parts[2])
+            return ops / max(seconds, 1e-9)
+    raise RuntimeError(f"{path} printed no bench line")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("names", nargs="*", help="benchmarks to run (default: all)")
+    parser.add_argument("--sharo", default="./sharo", help="interpreter to benchmark")
+    parser.add_argument("--runs", type=int, default=5, help="runs per benchmark, best is kept")
+    parser.add_argument("--baseline", default=DEFAULT_BASELINE)
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="percent slowdown that counts as a regression")
+    parser.add_argument("--save", action="store_true", help="write results as the new baseline")
+    args = parser.parse_args()
+
+    paths = sorted(glob.glob(os.path.join(BENCH_DIR, "*.sharo")))
+    if args.names:
+        paths = [p for p in paths if os.path.splitext(os.path.basename(p))[0] in args.names]
+
+    baseline = {}
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f).get("benchmarks", {})
+
+    results = {}
+    regressions = []
+    print(f"{'benchmark':<14} {'ops/sec':>14} {'baseline':>14} {'change':>9}")
+    for path in paths:
+        name = os.path.splitext(os.path.basename(path))[0]
+        try:
+            rate = max(run_once(args.sharo, path) for _ in range(args.runs))
+        except RuntimeError as error:
+            print(f"{name:<14} FAILED: {error}", file=sys.stderr)
+            return 1
+        results[name] = round(rate)
+
+        line = f"{name:<14} {rate:>14,.0f}"
+        if name in baseline:
+            change = (rate / baseline[name] - 1.0) * 100.0
+            line += f" {baseline[name]:>14,.0f} {change:>+8.1f}%"
+            if change < -args.threshold:
+                line += "  SLOWER"
+                regressions.append(name)
+        print(line)
+
+    if args.save:
+        with open(args.baseline, "w") as f:
+            json.dump({"benchmarks": results}, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print(f"Saved baseline to {args.baseline}")
+        return 0
+
+    if regressions:
+        print(f"Slower than baseline by more than {args.threshold:g}%: {', '.join(regressions)}")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,277 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "assets.h"
+#include "object.h"
+
+// Power of two, so a hash maps to a bucket with a mask
+#define TEXTURE_BUCKETS 256
+
+struct AssetLoad {
+    AssetLoad* next;            // Loader queue
+    char* path;
+    AssetDecoder decode;
+    AssetDiscard discard;
+    void* data;                 // Written by the loader before done is set
+    bool taken;
+    SDL_AtomicInt done;
+    int refs;                   // Under loader.lock
+};
+
+static struct {
+    SDL_Mutex* lock;
+    SDL_Condition* queued;      // A load was queued (or stopping)
+    SDL_Condition* finished;    // Some load finished
+    SDL_Thread* thread;
+    AssetLoad* head;            // Oldest first
+    AssetLoad* tail;
+    bool stopping;
+} loader;
+
+// ============ Loads ============
+
+static void destroyLoad(AssetLoad* load) {
+    if (!load->taken && load->data != NULL) load->discard(load->data);
+    free(load->path);
+    free(load);
+}
+
+static void finishLoad(AssetLoad* load, void* data) {
+    SDL_LockMutex(loader.lock);
+    load->data = data;
+    SDL_SetAtomicInt(&load->done, 1);
+    SDL_BroadcastCondition(loader.finished);
+    bool last = --load->refs == 0;
+    SDL_UnlockMutex(loader.lock);
+    if (last) destroyLoad(load);
+}
+
+static int loaderThread(void* data) {
+    (void)data;
+    SDL_LockMutex(loader.lock);
+    for (;;) {
+        while (loader.head == NULL && !loader.stopping) {
+            SDL_WaitCondition(loader.queued, loader.lock);
+        }
+        if (loader.stopping) break;
+
+        AssetLoad* load = loader.head;
+        loader.head = load->next;
+        if (loader.head == NULL) loader.tail = NULL;
+        // Nobody is waiting for it any more: skip the decode
+        bool wanted = load->refs > 1;
+        SDL_UnlockMutex(loader.lock);
+
+        finishLoad(load, wanted ? load->decode(load->path) : NULL);
+        SDL_LockMutex(loader.lock);
+    }
+    SDL_UnlockMutex(loader.lock);
+    return 0;
+}
+
+static bool prepareLoader(void) {
+    if (loader.thread != NULL) return true;
+    if (loader.lock == NULL) {
+        loader.lock = SDL_CreateMutex();
+        loader.queued = SDL_CreateCondition();
+        loader.finished = SDL_CreateCondition();
+        if (loader.lock == NULL || loader.queued == NULL || loader.finished == NULL) {
+            return false;
+        }
+    }
+    loader.thread = SDL_CreateThread(loaderThread, "sharo assets", NULL);
+    return loader.thread != NULL;
+}
+
+AssetLoad* startAssetLoad(const char* path, AssetDecoder decode, AssetDiscard discard) {
+    AssetLoad* load = calloc(1, sizeof(AssetLoad));
+    if (load == NULL) return NULL;
+    load->path = malloc(strlen(path) + 1);
+    if (load->path == NULL) {
+        free(load);
+        return NULL;
+    }
+    strcpy(load->path, path);
+    load->decode = decode;
+    load->discard = discard;
+
+    // Without a loader thread the load still works, it just blocks
+    if (!prepareLoader()) {
+        load->refs = 1;
+        load->data = decode(path);
+        SDL_SetAtomicInt(&load->done, 1);
+        return load;
+    }
+
+    SDL_LockMutex(loader.lock);
+    load->refs = 2;
+    if (loader.tail != NULL) loader.tail->next = load;
+    else loader.head = load;
+    loader.tail = load;
+    SDL_SignalCondition(loader.queued);
+    SDL_UnlockMutex(loader.lock);
+    return load;
+}
+
+bool assetLoadDone(AssetLoad* load) {
+    return SDL_GetAtomicInt(&load->done) != 0;
+}
+
+void waitAssetLoad(AssetLoad* load) {
+    if (assetLoadDone(load)) return;
+    SDL_LockMutex(loader.lock);
+    while (!assetLoadDone(load)) SDL_WaitCondition(loader.finished, loader.lock);
+    SDL_UnlockMutex(loader.lock);
+}
+
+void* takeAssetData(AssetLoad* load) {
+    if (!assetLoadDone(load) || load->taken) return NULL;
+    load->taken = true;
+    return load->data;
+}
+
+const char* assetLoadPath(AssetLoad* load) {
+    return load->path;
+}
+
+void releaseAssetLoad(AssetLoad* load) {
+    if (loader.lock == NULL) {
+        destroyLoad(load);
+        return;
+    }
+    SDL_LockMutex(loader.lock);
+    bool last = --load->refs == 0;
+    SDL_UnlockMutex(loader.lock);
+    if (last) destroyLoad(load);
+}
+
+// ============ Texture Cache ============
+
+typedef struct TextureEntry {
+    SDL_Renderer* renderer;
+    SDL_Texture* texture;
+    char* path;
+    uint32_t hash;              // Of the path
+    int refs;
+    struct TextureEntry* pathChain;     // Next in pathBuckets
+    struct TextureEntry* textureChain;  // Next in textureBuckets
+} TextureEntry;
+
+// Each entry is in two tables: by path for loads, by pointer for destroys
+static TextureEntry* pathBuckets[TEXTURE_BUCKETS];
+static TextureEntry* textureBuckets[TEXTURE_BUCKETS];
+static int textureEntries = 0;
+
+static uint32_t pointerBucket(const void* pointer) {
+    uintptr_t bits = (uintptr_t)pointer;
+    return ((uint32_t)(bits >> 4) * 2654435761u) >> 24 & (TEXTURE_BUCKETS - 1);
+}
+
+SDL_Texture* assetCacheFindTexture(SDL_Renderer* renderer, const char* path) {
+    int length = (int)strlen(path);
+    uint32_t hash = hashChars(path, length);
+    for (TextureEntry* entry = pathBuckets[hash & (TEXTURE_BUCKETS - 1)];
+         entry != NULL; entry = entry->pathChain) {
+        if (entry->hash == hash && entry->renderer == renderer &&
+            strcmp(entry->path, path) == 0) {
+            entry->refs++;
+            return entry->texture;
+        }
+    }
+    return NULL;
+}
+
+void assetCacheAddTexture(SDL_Renderer* renderer, const char* path, SDL_Texture* texture) {
+    TextureEntry* entry = malloc(sizeof(TextureEntry));
+    if (entry == NULL) return;
+    entry->path = malloc(strlen(path) + 1);
+    if (entry->path == NULL) {
+        free(entry);
+        return;
+    }
+    strcpy(entry->path, path);
+    entry->renderer = renderer;
+    entry->texture = texture;
+    entry->hash = hashChars(path, (int)strlen(path));
+    entry->refs = 1;
+
+    TextureEntry** pathBucket = &pathBuckets[entry->hash & (TEXTURE_BUCKETS - 1)];
+    entry->pathChain = *pathBucket;
+    *pathBucket = entry;
+    TextureEntry** textureBucket = &textureBuckets[pointerBucket(texture)];
+    entry->textureChain = *textureBucket;
+    *textureBucket = entry;
+    textureEntries++;
+}
+
+// Unlink an entry from both tables and free it (not its texture)
+static void removeTextureEntry(TextureEntry* entry) {
+    TextureEntry** link = &pathBuckets[entry->hash & (TEXTURE_BUCKETS - 1)];
+    while (*link != entry) link = &(*link)->pathChain;
+    *link = entry->pathChain;
+    link = &textureBuckets[pointerBucket(entry->texture)];
+    while (*link != entry) link = &(*link)->textureChain;
+    *link = entry->textureChain;
+
+    textureEntries--;
+    free(entry->path);
+    free(entry);
+}
+
+bool assetCacheReleaseTexture(SDL_Texture* texture) {
+    if (textureEntries == 0) return false;
+    for (TextureEntry* entry = textureBuckets[pointerBucket(texture)];
+         entry != NULL; entry = entry->textureChain) {
+        if (entry->texture != texture) continue;
+        if (--entry->refs == 0) {
+            removeTextureEntry(entry);
+            SDL_DestroyTexture(texture);
+        }
+        return true;
+    }
+    return false;
+}
+
+void assetCacheForgetRenderer(SDL_Renderer* renderer) {
+    for (int i = 0; i < TEXTURE_BUCKETS && textureEntries > 0; i++) {
+        TextureEntry* entry = pathBuckets[i];
+        while (entry != NULL) {
+            TextureEntry* next = entry->pathChain;
+            // SDL destroys the textures along with their renderer
+            if (entry->renderer == renderer) removeTextureEntry(entry);
+            entry = next;
+        }
+    }
+}
+
+void freeAssets(void) {
+    for (int i = 0; i < TEXTURE_BUCKETS && textureEntries > 0; i++) {
+        while (pathBuckets[i] != NULL) {
+            SDL_Texture* texture = pathBuckets[i]->texture;
+            removeTextureEntry(pathBuckets[i]);
+            SDL_DestroyTexture(texture);
+        }
+    }
+
+    if (loader.lock == NULL) return;
+    if (loader.thread != NULL) {
+        SDL_LockMutex(loader.lock);
+        loader.stopping = true;
+        SDL_SignalCondition(loader.queued);
+        SDL_UnlockMutex(loader.lock);
+        SDL_WaitThread(loader.thread, NULL);
+        loader.thread = NULL;
+        loader.stopping = false;
+    }
+    // Loads still queued have lost their requesters along with the heap
+    while (loader.head != NULL) {
+        AssetLoad* load = loader.head;
+        loader.head = load->next;
+        destroyLoad(load);
+    }
+    loader.tail = NULL;
+    SDL_DestroyCondition(loader.finished);
+    SDL_DestroyCondition(loader.queued);
+    SDL_DestroyMutex(loader.lock);
+    loader.lock = NULL;
+}
@@ -0,0 +1,48 @@
+#ifndef sharo_assets_h
+#define sharo_assets_h
+
+#include <SDL3/SDL.h>
+#include "common.h"
+
+// Background asset loading and the texture cache behind loadTexture.
+//
+// A load reads and decodes a file on the loader thread, which is started on
+// first use. What it produces (a surface, a sound, a parsed MIDI file) is
+// handed back to the caller, who does anything that has to happen on the
+// render thread, like uploading a texture. A load is reference counted by
+// its requester and the loader, so either side may let go first. Like
+// rendering, all of this is for the main thread.
+
+typedef struct AssetLoad AssetLoad;
+
+// Decode the file at path on the loader thread; NULL on failure
+typedef void* (*AssetDecoder)(const char* path);
+// Free a decoded result nobody took
+typedef void (*AssetDiscard)(void* data);
+
+// Queue a load; NULL if it couldn't be queued
+AssetLoad* startAssetLoad(const char* path, AssetDecoder decode, AssetDiscard discard);
+// Whether the decoder has finished (successfully or not)
+bool assetLoadDone(AssetLoad* load);
+void waitAssetLoad(AssetLoad* load);
+// The decoded result, once done; the caller owns it from then on. NULL if
+// decoding failed or it was already taken.
+void* takeAssetData(AssetLoad* load);
+const char* assetLoadPath(AssetLoad* load);
+void releaseAssetLoad(AssetLoad* load);
+
+// Textures loaded from a file are shared per (renderer, path): a second
+// load returns the same texture with its count bumped, and destroying it
+// only drops one reference.
+SDL_Texture* assetCacheFindTexture(SDL_Renderer* renderer, const char* path);
+void assetCacheAddTexture(SDL_Renderer* renderer, const char* path, SDL_Texture* texture);
+// Drop one reference to a cached texture, destroying it with the last; false
+// if texture isn't in the cache
+bool assetCacheReleaseTexture(SDL_Texture* texture);
+// Forget a renderer's textures before it is destroyed
+void assetCacheForgetRenderer(SDL_Renderer* renderer);
+
+// Destroy cached textures and stop the loader thread
+void freeAssets(void);
+
+#endif
@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bytecode.h"
+#include "chunk.h"
+#include "debug.h"
+#include "memory.h"
+#include "optimizer.h"
+#include "vm.h"
+
+// File layout: header, global name table, then the top-level function.
+// A function is arity, upvalue count, max stack height, name, constants
+// (nested functions inline), inline cache count, code and lines. Global slot operands are
+// process-local, so the code stores indices into the file's name table and
+// the loader maps them back to this VM's slots.
+//
+// Bump SHAROC_VERSION when an instruction's operand layout changes; adding,
+// removing or renaming opcodes is caught by the opcode fingerprint. The
+// fingerprint also covers the optimizer setting, so a --no-opt run never
+// loads superinstructions from an optimized run's cache (it recompiles and
+// rewrites the file instead).
+
+#define SHAROC_VERSION 3
+
+typedef struct {
+    char magic[6];          // "SHAROC"
+    uint16_t version;
+    uint32_t opcodeHash;    // Fingerprint of the instruction set and --no-opt
+    int64_t sourceMtime;
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+} SharocHeader;
+
+typedef enum {
+    CONST_NIL,
+    CONST_FALSE,
+    CONST_TRUE,
+    CONST_INT,
+    CONST_FLOAT,
+    CONST_STRING,
+    CONST_FUNCTION,
+} ConstantTag;
+
+static uint64_t hashBytes(const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t hash = 14695981039346656037ULL;   // FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint32_t opcodeFingerprint(void) {
+    uint64_t hash = 0;
+    for (int op = 0; op < 256; op++) {
+        const char* name = opcodeName((uint8_t)op);
+        hash = hash * 31 + hashBytes(name, strlen(name));
+    }
+    if (!optimizerIsEnabled()) hash = hash * 31 + 1;
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static bool cacheEnabled(void) {
+    const char* off = getenv("SHARO_NO_CACHE");
+    return off == NULL || off[0] == '\0' || strcmp(off, "0") == 0;
+}
+
+// "dir/mod.sharo" -> "dir/mod.sharoc", or "$SHARO_CACHE_DIR/dir_mod.sharoc"
+static char* cachePath(const char* sourcePath) {
+    const char* dir = getenv("SHARO_CACHE_DIR");
+    size_t length = strlen(sourcePath);
+
+    if (dir == NULL || dir[0] == '\0') {
+        char* path = malloc(length + 2);
+        if (path != NULL) snprintf(path, length + 2, "%sc", sourcePath);
+        return path;
+    }
+
+    size_t size = strlen(dir) + 1 + length + 2;
+    char* path = malloc(size);
+    if (path == NULL) return NULL;
+    snprintf(path, size, "%s/%sc", dir, sourcePath);
+    for (char* c = path + strlen(dir) + 1; *c != '\0'; c++) {
+        if (*c == '/') *c = '_';
+    }
+    return path;
+}
+
+// ============ Writing ============
+
+typedef struct {
+    uint8_t* data;
+    size_t count;
+    size_t capacity;
+    bool ok;
+} Writer;
+
+typedef struct {
+    Writer names;           // Global name table entries
+    uint32_t nameCount;
+    int* indexOfSlot;       // VM global slot -> name table index, or -1
+    int slotCount;
+} GlobalNames;
+
+static void writeBytes(Writer* writer, const void* bytes, size_t length) {
+    if (!writer->ok) return;
+    if (writer->count + length > writer->capacity) {
+        size_t capacity = writer->capacity < 256 ? 256 : writer->capacity;
+        while (capacity < writer->count + length) capacity *= 2;
+        uint8_t* data = realloc(writer->data, capacity);
+        if (data == NULL) {
+            writer->ok = false;
+            return;
+        }
+        writer->data = data;
+        writer->capacity = capacity;
+    }
+    memcpy(writer->data + writer->count, bytes, length);
+    writer->count += length;
+}
+
+static void writeU8(Writer* writer, uint8_t value) {
+    writeBytes(writer, &value, sizeof(value));
+}
+
+static void writeU32(Writer* writer, uint32_t value) {
+    writeBytes(writer, &value, sizeof(value));
+}
+
+static void writeString(Writer* writer, ObjString* string) {
+    writeU32(writer, (uint32_t)string->length);
+    writeBytes(writer, string->chars, (size_t)string->length);
+}
+
+static int nameIndex(GlobalNames* globals, int slot) {
+    if (globals->indexOfSlot[slot] < 0) {
+        globals->indexOfSlot[slot] = (int)globals->nameCount++;
+        writeString(&globals->names, AS_STRING(vm.globalNames.values[slot]));
+    }
+    return globals->indexOfSlot[slot];
+}
+
+static bool isGlobalSlotOp(uint8_t op) {
+    return op == OP_GET_GLOBAL_SLOT || op == OP_DEFINE_GLOBAL_SLOT ||
+           op == OP_SET_GLOBAL_SLOT;
+}
+
+static void writeFunction(Writer* writer, GlobalNames* globals,
+                          ObjFunction* function) {
+    Chunk* chunk = function->chunk;
+
+    writeU32(writer, (uint32_t)function->arity);
+    writeU32(writer, (uint32_t)function->upvalueCount);
+    writeU32(writer, (uint32_t)function->maxSlots);
+    writeU8(writer, function->name != NULL);
+    if (function->name != NULL) writeString(writer, function->name);
+
+    writeU32(writer, (uint32_t)chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value value = chunk->constants.values[i];
+        if (IS_NIL(value)) {
+            writeU8(writer, CONST_NIL);
+        } else if (IS_BOOL(value)) {
+            writeU8(writer, AS_BOOL(value) ? CONST_TRUE : CONST_FALSE);
+        } else if (IS_INT(value)) {
+            int64_t integer = AS_INT(value);
+            writeU8(writer, CONST_INT);
+            writeBytes(writer, &integer, sizeof(integer));
+        } else if (IS_FLOAT(value)) {
+            double floating = AS_FLOAT(value);
+            writeU8(writer, CONST_FLOAT);
+            writeBytes(writer, &floating, sizeof(floating));
+        } else if (IS_STRING(value)) {
+            writeU8(writer, CONST_STRING);
+            writeString(writer, AS_STRING(value));
+        } else if (IS_FUNCTION(value)) {
+            writeU8(writer, CONST_FUNCTION);
+            writeFunction(writer, globals, AS_FUNCTION(value));
+        } else {
+            writer->ok = false;     // Nothing else is a compile-time constant
+        }
+    }
+
+    writeU32(writer, (uint32_t)chunk->cacheCount);
+
+    // Code with global slots swapped for name table indices
+    uint8_t* code = malloc((size_t)chunk->count + 1);
+    if (code == NULL) {
+        writer->ok = false;
+        return;
+    }
+    memcpy(code, chunk->code, (size_t)chunk->count);
+    for (int offset = 0; offset < chunk->count;
+         offset += instructionLength(chunk, offset)) {
+        if (!isGlobalSlotOp(code[offset])) continue;
+        int slot = (code[offset + 1] << 8) | code[offset + 2];
+        int index = nameIndex(globals, slot);
+        code[offset + 1] = (uint8_t)((index >> 8) & 0xff);
+        code[offset + 2] = (uint8_t)(index & 0xff);
+    }
+    writeU32(writer, (uint32_t)chunk->count);
+    writeBytes(writer, code, (size_t)chunk->count);
+    writeBytes(writer, chunk->lines, sizeof(int) * (size_t)chunk->count);
+    free(code);
+}
+
+void saveCachedModule(const char* sourcePath, const char* source,
+                      ObjFunction* function) {
+    if (!cacheEnabled()) return;
+
+    struct stat info;
+    if (stat(sourcePath, &info) != 0) return;
+
+    SharocHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "SHAROC", sizeof(header.magic));
+    header.version = SHAROC_VERSION;
+    header.opcodeHash = opcodeFingerprint();
+    header.sourceMtime = (int64_t)info.st_mtime;
+    header.sourceSize = (uint64_t)info.st_size;
+    header.sourceHash = hashBytes(source, strlen(source));
+
+    GlobalNames globals = {{NULL, 0, 0, true}, 0, NULL, vm.globalValues.count};
+    globals.indexOfSlot = malloc(sizeof(int) * ((size_t)globals.slotCount + 1));
+    if (globals.indexOfSlot == NULL) return;
+    for (int i = 0; i < globals.slotCount; i++) globals.indexOfSlot[i] = -1;
+
+    Writer body = {NULL, 0, 0, true};
+    writeFunction(&body, &globals, function);
+
+    Writer file = {NULL, 0, 0, true};
+    writeBytes(&file, &header, sizeof(header));
+    writeU32(&file, globals.nameCount);
+    writeBytes(&file, globals.names.data, globals.names.count);
+    writeBytes(&file, body.data, body.count);
+
+    char* path = cachePath(sourcePath);
+    if (file.ok && body.ok && globals.names.ok && path != NULL) {
+        // Write aside and rename, so a reader never sees a partial file
+        size_t tempSize = strlen(path) + 32;
+        char* temp = malloc(tempSize);
+        if (temp != NULL) {
+            // Worker threads share the pid; &vm differs per thread
+            snprintf(temp, tempSize, "%s.%ld.%lx.tmp", path, (long)getpid(),
+                     (unsigned long)(uintptr_t)&vm);
+            FILE* out = fopen(temp, "wb");
+            if (out != NULL) {
+                bool written = fwrite(file.data, 1, file.count, out) == file.count;
+                if (fclose(out) == 0 && written) {
+                    if (rename(temp, path) != 0) remove(temp);
+                } else {
+                    remove(temp);
+                }
+            }
+            free(temp);
+        }
+    }
+
+    free(path);
+    free(file.data);
+    free(body.data);
+    free(globals.names.data);
+    free(globals.indexOfSlot);
+}
+
+// ============ Loading ============
+
+typedef struct {
+    const uint8_t* current;
+    const uint8_t* end;
+    bool ok;
+    int* slots;             // Name table index -> VM global slot
+    uint32_t slotCount;
+} Reader;
+
+static bool readBytes(Reader* reader, void* out, size_t length) {
+    if (!reader->ok || (size_t)(reader->end - reader->current) < length) {
+        reader->ok = false;
+        return false;
+    }
+    memcpy(out, reader->current, length);
+    reader->current += length;
+    return true;
+}
+
+static uint8_t readU8(Reader* reader) {
+    uint8_t value = 0;
+    readBytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static uint32_t readU32(Reader* reader) {
+    uint32_t value = 0;
+    readBytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static ObjString* readString(Reader* reader) {
+    uint32_t length = readU32(reader);
+    if (!reader->ok || (size_t)(reader->end - reader->current) < length) {
+        reader->ok = false;
+        return NULL;
+    }
+    ObjString* string = copyString((const char*)reader->current, (int)length);
+    reader->current += length;
+    return string;
+}
+
+// Leaves the function pushed on the VM stack so it stays rooted
+static ObjFunction* readFunction(Reader* reader) {
+    ObjFunction* function = newFunction();
+    push(OBJ_VAL(function));
+    Chunk* chunk = function->chunk;
+
+    function->arity = (int)readU32(reader);
+    function->upvalueCount = (int)readU32(reader);
+    function->maxSlots = (int)readU32(reader);
+    if (function->maxSlots > STACK_HEIGHT_LIMIT) reader->ok = false;
+    if (readU8(reader)) function->name = readString(reader);
+
+    uint32_t constantCount = readU32(reader);
+    for (uint32_t i = 0; i < constantCount && reader->ok; i++) {
+        switch (readU8(reader)) {
+            case CONST_NIL:   addConstant(chunk, NIL_VAL); break;
+            case CONST_FALSE: addConstant(chunk, FALSE_VAL); break;
+            case CONST_TRUE:  addConstant(chunk, TRUE_VAL); break;
+            case CONST_INT: {
+                int64_t integer = 0;
+                readBytes(reader, &integer, sizeof(integer));
+                addConstant(chunk, INT_VAL(integer));
+                break;
+            }
+            case CONST_FLOAT: {
+                double floating = 0;
+                readBytes(reader, &floating, sizeof(floating));
+                addConstant(chunk, FLOAT_VAL(floating));
+                break;
+            }
+            case CONST_STRING: {
+                ObjString* string = readString(reader);
+                if (string != NULL) addConstant(chunk, OBJ_VAL(string));
+                break;
+            }
+            case CONST_FUNCTION: {
+                ObjFunction* nested = readFunction(reader);
+                addConstant(chunk, OBJ_VAL(nested));
+                pop();
+                break;
+            }
+            default:
+                reader->ok = false;
+                break;
+        }
+    }
+
+    uint32_t cacheCount = readU32(reader);
+    for (uint32_t i = 0; i < cacheCount && reader->ok; i++) {
+        addInlineCache(chunk);
+    }
+
+    uint32_t count = readU32(reader);
+    if (!reader->ok || count == 0 ||
+        (size_t)(reader->end - reader->current) < count * (1 + sizeof(int))) {
+        reader->ok = false;
+        return function;
+    }
+    uint8_t* code = ALLOCATE(uint8_t, count);
+    int* lines = ALLOCATE(int, count);
+    chunk->code = code;
+    chunk->lines = lines;
+    chunk->capacity = (int)count;
+    chunk->count = (int)count;
+    readBytes(reader, chunk->code, count);
+    readBytes(reader, chunk->lines, sizeof(int) * count);
+
+    // Map name table indices back to this VM's global slots
+    for (int offset = 0; offset < chunk->count && reader->ok;) {
+        uint8_t op = chunk->code[offset];
+        if (op == OP_CLOSURE &&
+            (offset + 1 >= chunk->count ||
+             chunk->code[offset + 1] >= chunk->constants.count ||
+             !IS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]))) {
+            reader->ok = false;
+            break;
+        }
+        int length = instructionLength(chunk, offset);
+        if (offset + length > chunk->count) {
+            reader->ok = false;
+            break;
+        }
+        if (isGlobalSlotOp(op)) {
+            uint32_t index = (uint32_t)((chunk->code[offset + 1] << 8) |
+                                        chunk->code[offset + 2]);
+            if (index >= reader->slotCount) {
+                reader->ok = false;
+                break;
+            }
+            int slot = reader->slots[index];
+            chunk->code[offset + 1] = (uint8_t)((slot >> 8) & 0xff);
+            chunk->code[offset + 2] = (uint8_t)(slot & 0xff);
+        }
+        offset += length;
+    }
+    return function;
+}
+
+static ObjFunction* readModule(const uint8_t* data, size_t size) {
+    Value* stackBase = vm.stackTop;
+    Reader reader = {data, data + size, true, NULL, 0};
+
+    reader.slotCount = readU32(&reader);
+    if (!reader.ok || reader.slotCount > UINT16_MAX + 1) return NULL;
+    reader.slots = malloc(sizeof(int) * ((size_t)reader.slotCount + 1));
+    if (reader.slots == NULL) return NULL;
+    for (uint32_t i = 0; i < reader.slotCount && reader.ok; i++) {
+        ObjString* name = readString(&reader);
+        if (name == NULL) break;
+        reader.slots[i] = globalSlot(name);
+        if (reader.slots[i] > UINT16_MAX) reader.ok = false;
+    }
+
+    ObjFunction* function = NULL;
+    if (reader.ok) function = readFunction(&reader);
+    free(reader.slots);
+
+    vm.stackTop = stackBase;
+    return reader.ok && reader.current == reader.end ? function : NULL;
+}
+
+static bool headerMatches(const SharocHeader* header, const char* sourcePath,
+                          const struct stat* source) {
+    if (memcmp(header->magic, "SHAROC", sizeof(header->magic)) != 0 ||
+        header->version != SHAROC_VERSION ||
+        header->opcodeHash != opcodeFingerprint() ||
+        header->sourceSize != (uint64_t)source->st_size) {
+        return false;
+    }
+    if (header->sourceMtime == (int64_t)source->st_mtime) return true;
+
+    // Touched but maybe not changed (checkout, copy): compare contents
+    FILE* file = fopen(sourcePath, "rb");
+    if (file == NULL) return false;
+    size_t size = (size_t)source->st_size;
+    char* text = malloc(size + 1);
+    bool matches = false;
+    if (text != NULL) {
+        size_t read = fread(text, 1, size, file);
+        text[read] = '\0';
+        matches = read == size &&
+                  hashBytes(text, strlen(text)) == header->sourceHash;
+        free(text);
+    }
+    fclose(file);
+    return matches;
+}
+
+ObjFunction* loadCachedModule(const char* sourcePath) {
+    if (!cacheEnabled()) return NULL;
+
+    struct stat source;
+    if (stat(sourcePath, &source) != 0) return NULL;
+
+    char* path = cachePath(sourcePath);
+    if (path == NULL) return NULL;
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) return NULL;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SharocHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)info.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    ObjFunction* function = NULL;
+    SharocHeader header;
+    memcpy(&header, map, sizeof(header));
+    if (headerMatches(&header, sourcePath, &source)) {
+        function = readModule((const uint8_t*)map + sizeof(header),
+                              size - sizeof(header));
+    }
+
+    munmap(map, size);
+    return function;
+}
@@ -0,0 +1,17 @@
+#ifndef sharo_bytecode_h
+#define sharo_bytecode_h
+
+#include "object.h"
+
+// Compiled module cache (.sharoc). Written next to the source, or into
+// $SHARO_CACHE_DIR when set; SHARO_NO_CACHE=1 turns it off.
+
+// The cached function for a module, or NULL when there is no cache or it is
+// stale (source size/mtime changed and its hash no longer matches)
+ObjFunction* loadCachedModule(const char* sourcePath);
+
+// Best effort: failures to write leave the import uncached
+void saveCachedModule(const char* sourcePath, const char* source,
+                      ObjFunction* function);
+
+#endif
@@ -8,6 +8,7 @@
 typedef enum {
     // Constants and literals
     OP_CONSTANT,        // Load constant from pool
+    OP_CONSTANT_LONG,   // Load constant with 16-bit index
     OP_NIL,
     OP_TRUE,
     OP_FALSE,
@@ -15,13 +16,20 @@ typedef enum {
     // Stack operations
     OP_POP,
     OP_DUP,             // Duplicate top of stack
+    OP_DUP_TWO,         // Duplicate top two stack values
 
     // Variables
     OP_GET_LOCAL,
     OP_SET_LOCAL,
     OP_GET_GLOBAL,
+    OP_GET_GLOBAL_LONG,
     OP_DEFINE_GLOBAL,
+    OP_DEFINE_GLOBAL_LONG,
     OP_SET_GLOBAL,
+    OP_SET_GLOBAL_LONG,
+    OP_GET_GLOBAL_SLOT,     // Load global by slot index (16-bit)
+    OP_DEFINE_GLOBAL_SLOT,  // Define global by slot index (16-bit)
+    OP_SET_GLOBAL_SLOT,     // Store global by slot index (16-bit)
     OP_GET_UPVALUE,
     OP_SET_UPVALUE,
 
@@ -59,6 +67,7 @@ typedef enum {
     OP_DIVIDE,
     OP_MODULO,
     OP_NEGATE,
+    OP_CONCAT,          // a + b + ... over count operands, one allocation
 
     // Logical
     OP_NOT,
@@ -71,9 +80,15 @@ typedef enum {
     OP_JUMP,
     OP_JUMP_IF_FALSE,
     OP_LOOP,
+    // Fused compare-and-branch: pop a, b; jump if !(a op b) (16-bit offset)
+    OP_JUMP_IF_NOT_LESS,
+    OP_JUMP_IF_NOT_LESS_EQUAL,
+    OP_JUMP_IF_NOT_GREATER,
+    OP_JUMP_IF_NOT_GREATER_EQUAL,
 
     // Functions
     OP_CALL,
+    OP_TAIL_CALL,       // Call in return position: reuses the caller's frame
     OP_CLOSURE,
     OP_CLOSE_UPVALUE,
     OP_RETURN,
@@ -86,23 +101,31 @@ typedef enum {
 
     // Structs
     OP_STRUCT_DEF,      // Define struct type (field count follows)
-    OP_STRUCT_FIELD,    // Add field name to struct def (name constant follows)
+    OP_STRUCT_FIELD,    // Add field to struct def (name constant, FieldKind)
     OP_STRUCT_CALL,     // Constructor call: create instance with N args
-    OP_GET_FIELD,       // Get field by name
-    OP_SET_FIELD,       // Set field by name
+    OP_GET_FIELD,       // Get field by name (name, 16-bit cache slot)
+    OP_GET_FIELD_LONG,  // Get field by name (16-bit constant index, cache slot)
+    OP_SET_FIELD,       // Set field by name (name, 16-bit cache slot)
+    OP_SET_FIELD_LONG,  // Set field by name (16-bit constant index, cache slot)
 
     // Arrays
     OP_ARRAY,           // Create array from N stack elements
     OP_INDEX_GET,       // arr[index] - get element
     OP_INDEX_SET,       // arr[index] = value - set element
+    OP_INDEX_GET_FIELD, // arr[index].field (name, 16-bit cache slot)
+    OP_INDEX_SET_FIELD, // arr[index].field = value (name, 16-bit cache slot)
+    OP_MAP,             // Create map from N key/value pairs on the stack
 
     // Methods
     OP_METHOD,          // Define a method on struct type
-    OP_INVOKE,          // Invoke method directly (optimization)
+    OP_INVOKE,          // Invoke method directly (name, argCount, cache slot)
+    OP_INVOKE_LONG,     // Invoke method (16-bit name index, argCount, cache slot)
+    OP_TAIL_INVOKE,     // OP_INVOKE in return position, reusing the frame
     OP_GET_SELF,        // Get 'self' for method body
 
     // Modules
     OP_IMPORT,          // Import a module
+    OP_IMPORT_LAZY,     // Register a module to run on first use of its globals
 
     // === Superinstructions ===
     // Single-byte local access (no operand - slot encoded in opcode)
@@ -125,20 +148,50 @@ typedef enum {
     // Array index with local: push(stack[-1][local[slot]])
     // Operand: slot (1 byte)
     OP_INDEX_GET_LOCAL,
+
+    // --- Emitted only by the peephole optimizer (optimizer.c) ---
+    // Store and drop: local[slot] = pop() (operand: slot)
+    OP_SET_LOCAL_POP,
+
+    // push(local[a] + local[b]) (operands: a, b)
+    OP_ADD_LOCALS,
+
+    // push(local[slot].name) (operands: slot, then GET_FIELD's name + cache)
+    OP_GET_LOCAL_FIELD,
+
+    // Jump if !(local[a] < local[b]) (operands: a, b, 16-bit offset)
+    OP_JUMP_IF_NOT_LESS_LOCALS,
+
+    // Jump if !(local[slot] < const[idx]) (operands: slot, idx, 16-bit offset)
+    OP_JUMP_IF_NOT_LESS_LOCAL_CONST,
 } OpCode;
 
 // Bytecode chunk - use struct tag for forward declaration compatibility
+struct ObjStructDef;
+struct ObjClosure;
+
+// Monomorphic inline cache for one field access or invoke instruction
+typedef struct {
+    struct ObjStructDef* def;   // Struct type last seen here (NULL = empty)
+    int index;                  // Field slot, or -1 when the name is a method
+    struct ObjClosure* method;  // Resolved method when index == -1
+} InlineCache;
+
 typedef struct Chunk {
     int count;
     int capacity;
     uint8_t* code;
     int* lines;         // Line numbers for debugging
     ValueArray constants;
+    int cacheCount;
+    int cacheCapacity;
+    InlineCache* caches;
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 int addConstant(Chunk* chunk, Value value);
+int addInlineCache(Chunk* chunk);
 
 #endif
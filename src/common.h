@@ -22,6 +22,10 @@
 #define NAN_BOXING
 #endif
 
+// Interpreter state is per thread, so each worker (worker.h) runs a VM of
+// its own
+#define THREAD_LOCAL __thread
+
 #define UINT8_COUNT (UINT8_MAX + 1)
 
 #endif
@@ -6,18 +6,32 @@
 #include "compiler.h"
 #include "scanner.h"
 #include "chunk.h"
+#include "memory.h"
 #include "object.h"
+#include "optimizer.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
 #endif
 
+// Compile-time type hint, from literals, annotations and local inference.
+// Hints pick typed opcodes; those check at runtime and fall back to the
+// generic instruction, so a wrong hint only costs speed.
+typedef enum {
+    HINT_UNKNOWN,
+    HINT_INT,
+    HINT_FLOAT,
+    HINT_BOOL,
+    HINT_STR,
+} TypeHint;
+
 // Parser state
 typedef struct {
     Token current;
     Token previous;
     bool hadError;
     bool panicMode;
+    TypeHint lastHint;  // Static type of the expression just compiled
 } Parser;
 
 // Precedence levels (lowest to highest)
@@ -48,6 +62,8 @@ typedef struct {
     Token name;
     int depth;
     bool isCaptured;
+    TypeHint hint;
+    bool annotated;     // Hint came from a type annotation and stays fixed
 } Local;
 
 // Upvalue
@@ -79,11 +95,14 @@ typedef struct Compiler {
     int localCount;
     Upvalue upvalues[UINT8_COUNT];
     int scopeDepth;
+    int compareEnd;     // Chunk offset just past the last relational compare
+    int callStart;      // Chunk offset of the last OP_CALL or OP_INVOKE
+    int callEnd;        // ...and just past it
 } Compiler;
 
-Parser parser;
-Compiler* current = NULL;
-TypeCompiler* currentType = NULL;
+THREAD_LOCAL Parser parser;
+THREAD_LOCAL Compiler* current = NULL;
+THREAD_LOCAL TypeCompiler* currentType = NULL;
 
 static Chunk* currentChunk(void) {
     return current->function->chunk;
@@ -192,6 +211,16 @@ static void emitConstant(Value value) {
     emitBytes(OP_CONSTANT, makeConstant(value));
 }
 
+// Reserve an inline cache entry and emit its 16-bit index
+static void emitCacheSlot(void) {
+    int slot = addInlineCache(currentChunk());
+    if (slot > UINT16_MAX) {
+        error("Too many field accesses in one chunk.");
+    }
+    emitByte((slot >> 8) & 0xff);
+    emitByte(slot & 0xff);
+}
+
 static void patchJump(int offset) {
     // -2 to adjust for the bytecode for the jump offset itself
     int jump = currentChunk()->count - offset - 2;
@@ -210,6 +239,8 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
     compiler->type = type;
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
+    compiler->compareEnd = -1;
+    compiler->callEnd = -1;
     compiler->function = newFunction();
     current = compiler;
 
@@ -222,6 +253,8 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
     Local* local = &current->locals[current->localCount++];
     local->depth = 0;
     local->isCaptured = false;
+    local->hint = HINT_UNKNOWN;
+    local->annotated = false;
     if (type == TYPE_METHOD) {
         local->name.start = "self";
         local->name.length = 4;
@@ -234,6 +267,12 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
 static ObjFunction* endCompiler(void) {
     emitReturn();
     ObjFunction* function = current->function;
+    if (!parser.hadError) optimizeChunk(currentChunk());
+    // Frames reserve this much stack when they're pushed
+    function->maxSlots = maxStackHeight(currentChunk(), function->arity + 1);
+    if (function->maxSlots >= STACK_HEIGHT_LIMIT) {
+        error("Too many values on the stack in one function.");
+    }
 
 #ifdef DEBUG_PRINT_CODE
     if (!parser.hadError) {
@@ -277,6 +316,37 @@ static uint8_t identifierConstant(Token* name) {
     return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
 }
 
+// Name constant that may go past 255, for ops with a _LONG form
+static int identifierConstantLong(Token* name) {
+    return addConstant(currentChunk(),
+                       OBJ_VAL(copyString(name->start, name->length)));
+}
+
+// Emit op with an 8-bit constant operand, or longOp with a 16-bit one
+static void emitNamedOp(uint8_t op, uint8_t longOp, int constant) {
+    if (constant <= UINT8_MAX) {
+        emitBytes(op, (uint8_t)constant);
+    } else if (constant <= UINT16_MAX) {
+        emitByte(longOp);
+        emitByte((constant >> 8) & 0xff);
+        emitByte(constant & 0xff);
+    } else {
+        error("Too many constants in one chunk.");
+    }
+}
+
+// Globals are resolved to a slot in the VM's shared global array
+static void emitGlobalOp(uint8_t op, Token* name) {
+    int slot = globalSlot(copyString(name->start, name->length));
+    if (slot > UINT16_MAX) {
+        error("Too many global variables.");
+        return;
+    }
+    emitByte(op);
+    emitByte((slot >> 8) & 0xff);
+    emitByte(slot & 0xff);
+}
+
 static bool identifiersEqual(Token* a, Token* b) {
     if (a->length != b->length) return false;
     return memcmp(a->start, b->start, a->length) == 0;
@@ -342,6 +412,8 @@ static void addLocal(Token name) {
     local->name = name;
     local->depth = -1;
     local->isCaptured = false;
+    local->hint = HINT_UNKNOWN;
+    local->annotated = false;
 }
 
 static void declareVariable(void) {
@@ -376,6 +448,32 @@ static void markInitialized(void) {
     current->locals[current->localCount - 1].depth = current->scopeDepth;
 }
 
+static TypeHint annotationHint(TokenType type) {
+    switch (type) {
+        case TOKEN_INT:   return HINT_INT;
+        case TOKEN_FLOAT: return HINT_FLOAT;
+        case TOKEN_BOOL:  return HINT_BOOL;
+        case TOKEN_STR:   return HINT_STR;
+        default:          return HINT_UNKNOWN;
+    }
+}
+
+// Attach a hint to the most recently declared local
+static void setLocalHint(TypeHint hint, bool annotated) {
+    if (current->scopeDepth == 0) return;
+    Local* local = &current->locals[current->localCount - 1];
+    local->hint = hint;
+    local->annotated = annotated;
+}
+
+// A reassignment with a different hint demotes an inferred local to unknown
+static void assignLocalHint(int slot) {
+    Local* local = &current->locals[slot];
+    if (!local->annotated && local->hint != parser.lastHint) {
+        local->hint = HINT_UNKNOWN;
+    }
+}
+
 static void defineVariable(uint8_t global) {
     if (current->scopeDepth > 0) {
         markInitialized();
@@ -393,6 +491,9 @@ static void and_(bool canAssign) {
     parsePrecedence(PREC_AND);
 
     patchJump(endJump);
+    // The short-circuit jump lands past the right operand's compare
+    current->compareEnd = -1;
+    parser.lastHint = HINT_UNKNOWN;
 }
 
 static void or_(bool canAssign) {
@@ -405,27 +506,98 @@ static void or_(bool canAssign) {
 
     parsePrecedence(PREC_OR);
     patchJump(endJump);
+    current->compareEnd = -1;
+    parser.lastHint = HINT_UNKNOWN;
 }
 
 // Expression parsing
+static TypeHint arithmeticHint(TypeHint a, TypeHint b) {
+    if (a == HINT_INT && b == HINT_INT) return HINT_INT;
+    if ((a == HINT_INT || a == HINT_FLOAT) &&
+        (b == HINT_INT || b == HINT_FLOAT)) {
+        return HINT_FLOAT;
+    }
+    return HINT_UNKNOWN;
+}
+
+// Pick the typed opcode when both operand hints agree
+static void emitArithmetic(OpCode intOp, OpCode floatOp, OpCode genericOp,
+                           TypeHint a, TypeHint b) {
+    if (a == HINT_INT && b == HINT_INT) {
+        emitByte(intOp);
+    } else if (a == HINT_FLOAT && b == HINT_FLOAT) {
+        emitByte(floatOp);
+    } else {
+        emitByte(genericOp);
+    }
+}
+
+static void emitCompare(OpCode op) {
+    emitByte(op);
+    current->compareEnd = currentChunk()->count;
+}
+
+// "a" + b + c + ...: the first + already involves a string, so every
+// later + in the chain is a concatenation. Collect the remaining operands
+// and build the result with one OP_CONCAT instead of a string per +.
+static void concatChain(void) {
+    int count = 2;
+    while (match(TOKEN_PLUS)) {
+        parsePrecedence(PREC_FACTOR);
+        if (++count == UINT8_MAX) {
+            emitBytes(OP_CONCAT, (uint8_t)count);
+            count = 1;
+        }
+    }
+    if (count > 1) emitBytes(OP_CONCAT, (uint8_t)count);
+}
+
 static void binary(bool canAssign) {
     (void)canAssign;
     TokenType operatorType = parser.previous.type;
+    TypeHint left = parser.lastHint;
     ParseRule* rule = getRule(operatorType);
     parsePrecedence((Precedence)(rule->precedence + 1));
+    TypeHint right = parser.lastHint;
 
+    parser.lastHint = HINT_BOOL;
     switch (operatorType) {
         case TOKEN_BANG_EQUAL:    emitByte(OP_NOT_EQUAL); break;
         case TOKEN_EQUAL_EQUAL:   emitByte(OP_EQUAL); break;
-        case TOKEN_GREATER:       emitByte(OP_GREATER); break;
-        case TOKEN_GREATER_EQUAL: emitByte(OP_GREATER_EQUAL); break;
-        case TOKEN_LESS:          emitByte(OP_LESS); break;
-        case TOKEN_LESS_EQUAL:    emitByte(OP_LESS_EQUAL); break;
-        case TOKEN_PLUS:          emitByte(OP_ADD); break;
-        case TOKEN_MINUS:         emitByte(OP_SUBTRACT); break;
-        case TOKEN_STAR:          emitByte(OP_MULTIPLY); break;
-        case TOKEN_SLASH:         emitByte(OP_DIVIDE); break;
-        case TOKEN_PERCENT:       emitByte(OP_MODULO); break;
+        case TOKEN_GREATER:       emitCompare(OP_GREATER); break;
+        case TOKEN_GREATER_EQUAL: emitCompare(OP_GREATER_EQUAL); break;
+        case TOKEN_LESS:          emitCompare(OP_LESS); break;
+        case TOKEN_LESS_EQUAL:    emitCompare(OP_LESS_EQUAL); break;
+        case TOKEN_PLUS:
+            if ((left == HINT_STR || right == HINT_STR) && check(TOKEN_PLUS)) {
+                concatChain();
+                parser.lastHint = HINT_STR;
+                break;
+            }
+            emitArithmetic(OP_ADD_INT, OP_ADD_FLOAT, OP_ADD, left, right);
+            parser.lastHint = (left == HINT_STR || right == HINT_STR)
+                ? HINT_STR : arithmeticHint(left, right);
+            break;
+        case TOKEN_MINUS:
+            emitArithmetic(OP_SUBTRACT_INT, OP_SUBTRACT_FLOAT, OP_SUBTRACT,
+                           left, right);
+            parser.lastHint = arithmeticHint(left, right);
+            break;
+        case TOKEN_STAR:
+            emitArithmetic(OP_MULTIPLY_INT, OP_MULTIPLY_FLOAT, OP_MULTIPLY,
+                           left, right);
+            parser.lastHint = arithmeticHint(left, right);
+            break;
+        case TOKEN_SLASH:
+            emitArithmetic(OP_DIVIDE_INT, OP_DIVIDE_FLOAT, OP_DIVIDE,
+                           left, right);
+            parser.lastHint = arithmeticHint(left, right);
+            break;
+        case TOKEN_PERCENT:
+            emitByte(left == HINT_INT && right == HINT_INT
+                ? OP_MODULO_INT : OP_MODULO);
+            parser.lastHint = HINT_INT;
+            break;
         default: return; // Unreachable
     }
 }
@@ -448,17 +620,21 @@ static uint8_t argumentList(void) {
 static void call(bool canAssign) {
     (void)canAssign;
     uint8_t argCount = argumentList();
+    current->callStart = currentChunk()->count;
     emitBytes(OP_CALL, argCount);
+    current->callEnd = currentChunk()->count;
+    parser.lastHint = HINT_UNKNOWN;
 }
 
 static void literal(bool canAssign) {
     (void)canAssign;
     switch (parser.previous.type) {
         case TOKEN_FALSE: emitByte(OP_FALSE); break;
-        case TOKEN_NIL:   emitByte(OP_NIL); break;
+        case TOKEN_NIL:   emitByte(OP_NIL); return;
         case TOKEN_TRUE:  emitByte(OP_TRUE); break;
         default: return; // Unreachable
     }
+    parser.lastHint = HINT_BOOL;
 }
 
 static void grouping(bool canAssign) {
@@ -477,6 +653,7 @@ static void number(bool canAssign) {
     if (length > 2 && start[0] == '0' && (start[1] == 'x' || start[1] == 'X')) {
         int64_t value = strtoll(start, NULL, 16);
         emitConstant(INT_VAL(value));
+        parser.lastHint = HINT_INT;
         return;
     }
 
@@ -484,6 +661,7 @@ static void number(bool canAssign) {
     if (length > 2 && start[0] == '0' && (start[1] == 'b' || start[1] == 'B')) {
         int64_t value = strtoll(start + 2, NULL, 2);
         emitConstant(INT_VAL(value));
+        parser.lastHint = HINT_INT;
         return;
     }
 
@@ -499,9 +677,11 @@ static void number(bool canAssign) {
     if (isFloat || parser.previous.type == TOKEN_NUMBER_FLOAT) {
         double value = strtod(start, NULL);
         emitConstant(FLOAT_VAL(value));
+        parser.lastHint = HINT_FLOAT;
     } else {
         int64_t value = strtoll(start, NULL, 10);
         emitConstant(INT_VAL(value));
+        parser.lastHint = HINT_INT;
     }
 }
 
@@ -510,6 +690,7 @@ static void string(bool canAssign) {
     // Strip the quotes
     emitConstant(OBJ_VAL(copyString(parser.previous.start + 1,
                                      parser.previous.length - 2)));
+    parser.lastHint = HINT_STR;
 }
 
 static void arrayLiteral(bool canAssign) {
@@ -528,6 +709,71 @@ static void arrayLiteral(bool canAssign) {
 
     consume(TOKEN_RIGHT_BRACKET, "Expect ']' after array elements.");
     emitBytes(OP_ARRAY, (uint8_t)elementCount);
+    parser.lastHint = HINT_UNKNOWN;
+}
+
+static void mapLiteral(bool canAssign) {
+    (void)canAssign;
+    int entryCount = 0;
+
+    if (!check(TOKEN_RIGHT_BRACE)) {
+        do {
+            expression();
+            consume(TOKEN_COLON, "Expect ':' after map key.");
+            expression();
+            if (entryCount == 255) {
+                error("Can't have more than 255 entries in map literal.");
+            }
+            entryCount++;
+        } while (match(TOKEN_COMMA));
+    }
+
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after map entries.");
+    emitBytes(OP_MAP, (uint8_t)entryCount);
+    parser.lastHint = HINT_UNKNOWN;
+}
+
+// The part of obj.name after the name, shared by dot() and subscript()
+static void property(int name, bool canAssign) {
+    if (canAssign && match(TOKEN_EQUAL)) {
+        expression();
+        emitNamedOp(OP_SET_FIELD, OP_SET_FIELD_LONG, name);
+        emitCacheSlot();
+    } else if (match(TOKEN_LEFT_PAREN)) {
+        // obj.method(args): fused into one invoke, no bound method allocated
+        uint8_t argCount = argumentList();
+        current->callStart = currentChunk()->count;
+        emitNamedOp(OP_INVOKE, OP_INVOKE_LONG, name);
+        emitByte(argCount);
+        emitCacheSlot();
+        current->callEnd = currentChunk()->count;
+    } else {
+        emitNamedOp(OP_GET_FIELD, OP_GET_FIELD_LONG, name);
+        emitCacheSlot();
+    }
+    parser.lastHint = HINT_UNKNOWN;
+}
+
+// arr[i].name as one instruction, so a StructArray reads or writes its
+// column directly instead of materializing element i
+static void indexedProperty(bool canAssign) {
+    consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
+    int name = identifierConstantLong(&parser.previous);
+
+    if (name > UINT8_MAX || check(TOKEN_LEFT_PAREN)) {
+        emitByte(OP_INDEX_GET);
+        property(name, canAssign);
+        return;
+    }
+
+    if (canAssign && match(TOKEN_EQUAL)) {
+        expression();
+        emitBytes(OP_INDEX_SET_FIELD, (uint8_t)name);
+    } else {
+        emitBytes(OP_INDEX_GET_FIELD, (uint8_t)name);
+    }
+    emitCacheSlot();
+    parser.lastHint = HINT_UNKNOWN;
 }
 
 static void subscript(bool canAssign) {
@@ -535,24 +781,23 @@ static void subscript(bool canAssign) {
     expression();
     consume(TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
 
+    if (match(TOKEN_DOT)) {
+        indexedProperty(canAssign);
+        return;
+    }
+
     if (canAssign && match(TOKEN_EQUAL)) {
         expression();
         emitByte(OP_INDEX_SET);
     } else {
         emitByte(OP_INDEX_GET);
     }
+    parser.lastHint = HINT_UNKNOWN;
 }
 
 static void dot(bool canAssign) {
     consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
-    uint8_t name = identifierConstant(&parser.previous);
-
-    if (canAssign && match(TOKEN_EQUAL)) {
-        expression();
-        emitBytes(OP_SET_FIELD, name);
-    } else {
-        emitBytes(OP_GET_FIELD, name);
-    }
+    property(identifierConstantLong(&parser.previous), canAssign);
 }
 
 static void self_(bool canAssign) {
@@ -576,14 +821,18 @@ static void namedVariable(Token name, bool canAssign) {
         getOp = OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
     } else {
-        arg = identifierConstant(&name);
-        getOp = OP_GET_GLOBAL;
-        setOp = OP_SET_GLOBAL;
+        getOp = OP_GET_GLOBAL_SLOT;
+        setOp = OP_SET_GLOBAL_SLOT;
     }
 
     if (canAssign && match(TOKEN_EQUAL)) {
         expression();
-        emitBytes(setOp, (uint8_t)arg);
+        if (setOp == OP_SET_GLOBAL_SLOT) {
+            emitGlobalOp(setOp, &name);
+        } else {
+            emitBytes(setOp, (uint8_t)arg);
+        }
+        if (setOp == OP_SET_LOCAL) assignLocalHint(arg);
     } else if (canAssign && match(TOKEN_COLON_EQUAL)) {
         // := is only for declaration, not reassignment
         error("Use '=' for assignment, ':=' is for declaration.");
@@ -591,9 +840,13 @@ static void namedVariable(Token name, bool canAssign) {
         // Superinstruction: single-byte local access for slots 0-3
         if (getOp == OP_GET_LOCAL && arg >= 0 && arg <= 3) {
             emitByte(OP_GET_LOCAL_0 + arg);
+        } else if (getOp == OP_GET_GLOBAL_SLOT) {
+            emitGlobalOp(getOp, &name);
         } else {
             emitBytes(getOp, (uint8_t)arg);
         }
+        parser.lastHint = getOp == OP_GET_LOCAL
+            ? current->locals[arg].hint : HINT_UNKNOWN;
     }
 }
 
@@ -613,9 +866,17 @@ static void unary(bool canAssign) {
         case TOKEN_BANG:
         case TOKEN_NOT:
             emitByte(OP_NOT);
+            parser.lastHint = HINT_BOOL;
             break;
         case TOKEN_MINUS:
-            emitByte(OP_NEGATE);
+            if (parser.lastHint == HINT_INT) {
+                emitByte(OP_NEGATE_INT);
+            } else if (parser.lastHint == HINT_FLOAT) {
+                emitByte(OP_NEGATE_FLOAT);
+            } else {
+                emitByte(OP_NEGATE);
+                parser.lastHint = HINT_UNKNOWN;
+            }
             break;
         default: return; // Unreachable
     }
@@ -625,7 +886,7 @@ static void unary(bool canAssign) {
 ParseRule rules[] = {
     [TOKEN_LEFT_PAREN]    = {grouping, call,   PREC_CALL},
     [TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_LEFT_BRACE]    = {mapLiteral, NULL, PREC_NONE},
     [TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   PREC_NONE},
     [TOKEN_LEFT_BRACKET]  = {arrayLiteral, subscript, PREC_CALL},
     [TOKEN_RIGHT_BRACKET] = {NULL,     NULL,   PREC_NONE},
@@ -695,6 +956,7 @@ static void parsePrecedence(Precedence precedence) {
     }
 
     bool canAssign = precedence <= PREC_ASSIGNMENT;
+    parser.lastHint = HINT_UNKNOWN;
     prefixRule(canAssign);
 
     while (precedence <= getRule(parser.current.type)->precedence) {
@@ -708,6 +970,20 @@ static void parsePrecedence(Precedence precedence) {
     }
 }
 
+// Compile the infix/postfix rest of an expression whose first operand
+// was already emitted (statement-level `name.field...` chains)
+static void finishExpression(void) {
+    while (PREC_ASSIGNMENT <= getRule(parser.current.type)->precedence) {
+        advance();
+        ParseFn infixRule = getRule(parser.previous.type)->infix;
+        infixRule(true);
+    }
+
+    if (match(TOKEN_EQUAL)) {
+        error("Invalid assignment target.");
+    }
+}
+
 static ParseRule* getRule(TokenType type) {
     return &rules[type];
 }
@@ -730,11 +1006,30 @@ static void expressionStatement(void) {
     emitByte(OP_POP);
 }
 
+// Emit the exit branch of an if/for condition. A condition ending in a
+// relational compare is fused with the branch, which consumes both operands
+// and leaves nothing to pop.
+static int emitConditionJump(bool* fused) {
+    Chunk* chunk = currentChunk();
+    *fused = current->compareEnd == chunk->count;
+    if (!*fused) return emitJump(OP_JUMP_IF_FALSE);
+
+    OpCode compare = (OpCode)chunk->code[--chunk->count];
+    current->compareEnd = -1;
+    switch (compare) {
+        case OP_LESS:          return emitJump(OP_JUMP_IF_NOT_LESS);
+        case OP_LESS_EQUAL:    return emitJump(OP_JUMP_IF_NOT_LESS_EQUAL);
+        case OP_GREATER:       return emitJump(OP_JUMP_IF_NOT_GREATER);
+        default:               return emitJump(OP_JUMP_IF_NOT_GREATER_EQUAL);
+    }
+}
+
 static void ifStatement(void) {
     expression();
 
-    int thenJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
+    bool fused;
+    int thenJump = emitConditionJump(&fused);
+    if (!fused) emitByte(OP_POP);
 
     consume(TOKEN_LEFT_BRACE, "Expect '{' after if condition.");
     beginScope();
@@ -744,7 +1039,7 @@ static void ifStatement(void) {
     int elseJump = emitJump(OP_JUMP);
 
     patchJump(thenJump);
-    emitByte(OP_POP);
+    if (!fused) emitByte(OP_POP);
 
     if (match(TOKEN_ELSE)) {
         if (match(TOKEN_IF)) {
@@ -776,6 +1071,15 @@ static void returnStatement(void) {
         emitReturn();
     } else {
         expression();
+        // return f(args): the callee takes over this frame, so tail
+        // recursion runs in constant stack. OP_RETURN stays behind for
+        // callees that can't (natives, constructors).
+        Chunk* chunk = currentChunk();
+        if (current->callEnd == chunk->count) {
+            uint8_t* op = &chunk->code[current->callStart];
+            if (*op == OP_CALL) *op = OP_TAIL_CALL;
+            else if (*op == OP_INVOKE) *op = OP_TAIL_INVOKE;
+        }
         emitByte(OP_RETURN);
     }
 }
@@ -794,8 +1098,9 @@ static void forStatement(void) {
     } else {
         // for condition { body }
         expression();
-        int exitJump = emitJump(OP_JUMP_IF_FALSE);
-        emitByte(OP_POP);
+        bool fused;
+        int exitJump = emitConditionJump(&fused);
+        if (!fused) emitByte(OP_POP);
 
         consume(TOKEN_LEFT_BRACE, "Expect '{' after for condition.");
         beginScope();
@@ -804,7 +1109,7 @@ static void forStatement(void) {
 
         emitLoop(loopStart);
         patchJump(exitJump);
-        emitByte(OP_POP);
+        if (!fused) emitByte(OP_POP);
     }
 
     endScope();
@@ -840,10 +1145,11 @@ static void method(Token methodName) {
             uint8_t paramConstant = parseVariable("Expect parameter name.");
             (void)paramConstant;
 
-            // Skip type annotation
+            // Type annotation: not enforced, but hints typed opcodes
             if (check(TOKEN_INT) || check(TOKEN_FLOAT) || check(TOKEN_BOOL) ||
                 check(TOKEN_STR) || check(TOKEN_PTR) || check(TOKEN_IDENTIFIER)) {
                 advance();
+                setLocalHint(annotationHint(parser.previous.type), true);
             }
 
             markInitialized();
@@ -883,7 +1189,8 @@ static void typeDeclaration(void) {
 
     // Count fields first (fields are name: type, methods are name(...))
     int fieldCount = 0;
-    ObjString* fieldNames[256];
+    uint8_t fieldConstants[256];
+    uint8_t fieldKinds[256];
 
     // Set up type compiler for method compilation (needed before parsing)
     TypeCompiler typeCompiler;
@@ -907,8 +1214,8 @@ static void typeDeclaration(void) {
 
                 // Emit field names
                 for (int i = 0; i < fieldCount; i++) {
-                    uint8_t fieldNameConstant = makeConstant(OBJ_VAL(fieldNames[i]));
-                    emitBytes(OP_STRUCT_FIELD, fieldNameConstant);
+                    emitBytes(OP_STRUCT_FIELD, fieldConstants[i]);
+                    emitByte(fieldKinds[i]);
                 }
 
                 // Mark that we've emitted the struct def
@@ -920,16 +1227,23 @@ static void typeDeclaration(void) {
             continue;
         }
 
-        // This is a field
-        fieldNames[fieldCount] = copyString(name.start, name.length);
+        // This is a field (stored as a constant right away so the GC sees it)
+        if (fieldCount < 256) {
+            fieldConstants[fieldCount] = identifierConstant(&name);
+        }
 
         consume(TOKEN_COLON, "Expect ':' after field name.");
 
-        // Skip type annotation (for now, not enforced)
+        // Type annotation: not enforced, but float fields get unboxed
+        // storage in a StructArray
+        uint8_t kind = check(TOKEN_FLOAT) ? FIELD_FLOAT : FIELD_ANY;
         if (check(TOKEN_INT) || check(TOKEN_FLOAT) || check(TOKEN_BOOL) ||
             check(TOKEN_STR) || check(TOKEN_PTR) || check(TOKEN_IDENTIFIER)) {
             advance();
         }
+        if (fieldCount < 256) {
+            fieldKinds[fieldCount] = kind;
+        }
 
         fieldCount++;
         if (fieldCount > 255) {
@@ -948,8 +1262,8 @@ static void typeDeclaration(void) {
 
         // Emit field names
         for (int i = 0; i < fieldCount; i++) {
-            uint8_t fieldNameConstant = makeConstant(OBJ_VAL(fieldNames[i]));
-            emitBytes(OP_STRUCT_FIELD, fieldNameConstant);
+            emitBytes(OP_STRUCT_FIELD, fieldConstants[i]);
+            emitByte(fieldKinds[i]);
         }
     }
 
@@ -962,17 +1276,24 @@ static void typeDeclaration(void) {
         addLocal(typeName);
         markInitialized();
     } else {
-        emitBytes(OP_DEFINE_GLOBAL, nameConstant);
+        emitGlobalOp(OP_DEFINE_GLOBAL_SLOT, &typeName);
     }
 }
 
 static void importStatement(void) {
     // import "path/to/module.sharo"
+    // import lazy "path/to/module.sharo"  (runs on first use of its globals)
+    bool lazy = false;
+    if (check(TOKEN_IDENTIFIER) && parser.current.length == 4 &&
+        memcmp(parser.current.start, "lazy", 4) == 0) {
+        advance();
+        lazy = true;
+    }
     consume(TOKEN_STRING, "Expect module path after 'import'.");
     uint8_t pathConstant = makeConstant(OBJ_VAL(copyString(
         parser.previous.start + 1,
         parser.previous.length - 2)));
-    emitBytes(OP_IMPORT, pathConstant);
+    emitBytes(lazy ? OP_IMPORT_LAZY : OP_IMPORT, pathConstant);
 }
 
 static void statement(void) {
@@ -1004,18 +1325,20 @@ static void statement(void) {
             if (current->scopeDepth > 0) {
                 addLocal(name);
                 markInitialized();
+                setLocalHint(parser.lastHint, false);
             } else {
-                uint8_t global = makeConstant(OBJ_VAL(copyString(name.start, name.length)));
-                emitBytes(OP_DEFINE_GLOBAL, global);
+                emitGlobalOp(OP_DEFINE_GLOBAL_SLOT, &name);
             }
         } else if (check(TOKEN_COLON)) {
             // Constant or typed declaration: x : type = expr OR x : value
             advance(); // consume :
 
-            // Skip type annotation if present
+            // Type annotation if present (not enforced, hints typed opcodes)
+            TypeHint declared = HINT_UNKNOWN;
             if (check(TOKEN_INT) || check(TOKEN_FLOAT) || check(TOKEN_BOOL) ||
                 check(TOKEN_STR) || check(TOKEN_PTR) || check(TOKEN_IDENTIFIER)) {
                 advance(); // skip type
+                declared = annotationHint(parser.previous.type);
             }
 
             if (match(TOKEN_COLON)) {
@@ -1025,9 +1348,13 @@ static void statement(void) {
                 if (current->scopeDepth > 0) {
                     addLocal(name);
                     markInitialized();
+                    if (declared != HINT_UNKNOWN) {
+                        setLocalHint(declared, true);
+                    } else {
+                        setLocalHint(parser.lastHint, false);
+                    }
                 } else {
-                    uint8_t global = makeConstant(OBJ_VAL(copyString(name.start, name.length)));
-                    emitBytes(OP_DEFINE_GLOBAL, global);
+                    emitGlobalOp(OP_DEFINE_GLOBAL_SLOT, &name);
                 }
             } else if (match(TOKEN_EQUAL)) {
                 // Typed mutable: x : type = value
@@ -1036,9 +1363,13 @@ static void statement(void) {
                 if (current->scopeDepth > 0) {
                     addLocal(name);
                     markInitialized();
+                    if (declared != HINT_UNKNOWN) {
+                        setLocalHint(declared, true);
+                    } else {
+                        setLocalHint(parser.lastHint, false);
+                    }
                 } else {
-                    uint8_t global = makeConstant(OBJ_VAL(copyString(name.start, name.length)));
-                    emitBytes(OP_DEFINE_GLOBAL, global);
+                    emitGlobalOp(OP_DEFINE_GLOBAL_SLOT, &name);
                 }
             } else {
                 error("Expect '=' or ':' after type annotation.");
@@ -1051,11 +1382,11 @@ static void statement(void) {
             int arg = resolveLocal(current, &name);
             if (arg != -1) {
                 emitBytes(OP_SET_LOCAL, (uint8_t)arg);
+                assignLocalHint(arg);
             } else if ((arg = resolveUpvalue(current, &name)) != -1) {
                 emitBytes(OP_SET_UPVALUE, (uint8_t)arg);
             } else {
-                uint8_t global = makeConstant(OBJ_VAL(copyString(name.start, name.length)));
-                emitBytes(OP_SET_GLOBAL, global);
+                emitGlobalOp(OP_SET_GLOBAL_SLOT, &name);
             }
             emitByte(OP_POP);
         } else if (check(TOKEN_LEFT_PAREN)) {
@@ -1128,8 +1459,7 @@ static void statement(void) {
                     }
 
                     if (current->scopeDepth == 0) {
-                        uint8_t global = makeConstant(OBJ_VAL(copyString(name.start, name.length)));
-                        emitBytes(OP_DEFINE_GLOBAL, global);
+                        emitGlobalOp(OP_DEFINE_GLOBAL_SLOT, &name);
                     }
                     return;
                 } else {
@@ -1167,50 +1497,16 @@ static void statement(void) {
                 emitByte(OP_POP);
             }
         } else if (check(TOKEN_LEFT_BRACKET)) {
-            // Array subscript access/assignment: arr[0] or arr[0] = value
+            // Array subscript access/assignment, possibly chained:
+            // arr[0], arr[0] = value, arr[i].x = value, grid[y][x] = value
             namedVariable(name, false);  // Get the array
-
-            advance();  // consume '['
-            expression();  // Parse index
-            consume(TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
-
-            if (match(TOKEN_EQUAL)) {
-                expression();  // Parse value
-                emitByte(OP_INDEX_SET);
-            } else {
-                emitByte(OP_INDEX_GET);
-            }
+            finishExpression();
             emitByte(OP_POP);
         } else if (check(TOKEN_DOT)) {
-            // Field access/assignment/method call: p.x, p.x = value, p.method()
+            // Field access/assignment/method call, possibly chained:
+            // p.x, p.x = value, p.method(), p.a.b().c = value
             namedVariable(name, false);  // Get the struct
-
-            advance();  // consume '.'
-            consume(TOKEN_IDENTIFIER, "Expect field name after '.'.");
-            uint8_t fieldName = identifierConstant(&parser.previous);
-
-            if (match(TOKEN_EQUAL)) {
-                expression();  // Parse value
-                emitBytes(OP_SET_FIELD, fieldName);
-            } else if (check(TOKEN_LEFT_PAREN)) {
-                // Method call
-                emitBytes(OP_GET_FIELD, fieldName);
-                advance();  // consume '('
-                uint8_t argCount = 0;
-                if (!check(TOKEN_RIGHT_PAREN)) {
-                    do {
-                        expression();
-                        if (argCount == 255) {
-                            error("Can't have more than 255 arguments.");
-                        }
-                        argCount++;
-                    } while (match(TOKEN_COMMA));
-                }
-                consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
-                emitBytes(OP_CALL, argCount);
-            } else {
-                emitBytes(OP_GET_FIELD, fieldName);
-            }
+            finishExpression();
             emitByte(OP_POP);
         } else {
             // Just an expression statement starting with identifier
@@ -1241,10 +1537,11 @@ static void function(FunctionType type, bool parenConsumed) {
             uint8_t constant = parseVariable("Expect parameter name.");
             (void)constant;
 
-            // Skip type annotation
+            // Type annotation: not enforced, but hints typed opcodes
             if (check(TOKEN_INT) || check(TOKEN_FLOAT) || check(TOKEN_BOOL) ||
                 check(TOKEN_STR) || check(TOKEN_PTR) || check(TOKEN_IDENTIFIER)) {
                 advance();
+                setLocalHint(annotationHint(parser.previous.type), true);
             }
 
             markInitialized();
@@ -1283,8 +1580,7 @@ static void funDeclaration(bool parenConsumed) {
     function(TYPE_FUNCTION, parenConsumed);
 
     if (current->scopeDepth == 0) {
-        uint8_t global = makeConstant(OBJ_VAL(copyString(name.start, name.length)));
-        emitBytes(OP_DEFINE_GLOBAL, global);
+        emitGlobalOp(OP_DEFINE_GLOBAL_SLOT, &name);
     }
 }
 
@@ -1321,3 +1617,11 @@ ObjFunction* compile(const char* source) {
     ObjFunction* function = endCompiler();
     return parser.hadError ? NULL : function;
 }
+
+void markCompilerRoots(void) {
+    Compiler* compiler = current;
+    while (compiler != NULL) {
+        markObject((Obj*)compiler->function);
+        compiler = compiler->enclosing;
+    }
+}
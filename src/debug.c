@@ -3,6 +3,115 @@
 #include "debug.h"
 #include "object.h"
 #include "value.h"
+#include "vm.h"
+
+static const char* opcodeNames[] = {
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_CONSTANT_LONG] = "OP_CONSTANT_LONG",
+    [OP_NIL] = "OP_NIL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_POP] = "OP_POP",
+    [OP_DUP] = "OP_DUP",
+    [OP_DUP_TWO] = "OP_DUP_TWO",
+    [OP_GET_LOCAL] = "OP_GET_LOCAL",
+    [OP_SET_LOCAL] = "OP_SET_LOCAL",
+    [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+    [OP_GET_GLOBAL_LONG] = "OP_GET_GLOBAL_LONG",
+    [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+    [OP_DEFINE_GLOBAL_LONG] = "OP_DEFINE_GLOBAL_LONG",
+    [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+    [OP_SET_GLOBAL_LONG] = "OP_SET_GLOBAL_LONG",
+    [OP_GET_GLOBAL_SLOT] = "OP_GET_GLOBAL_SLOT",
+    [OP_DEFINE_GLOBAL_SLOT] = "OP_DEFINE_GLOBAL_SLOT",
+    [OP_SET_GLOBAL_SLOT] = "OP_SET_GLOBAL_SLOT",
+    [OP_GET_UPVALUE] = "OP_GET_UPVALUE",
+    [OP_SET_UPVALUE] = "OP_SET_UPVALUE",
+    [OP_GET_PROPERTY] = "OP_GET_PROPERTY",
+    [OP_SET_PROPERTY] = "OP_SET_PROPERTY",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_NOT_EQUAL] = "OP_NOT_EQUAL",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_GREATER_EQUAL] = "OP_GREATER_EQUAL",
+    [OP_LESS] = "OP_LESS",
+    [OP_LESS_EQUAL] = "OP_LESS_EQUAL",
+    [OP_ADD_INT] = "OP_ADD_INT",
+    [OP_SUBTRACT_INT] = "OP_SUBTRACT_INT",
+    [OP_MULTIPLY_INT] = "OP_MULTIPLY_INT",
+    [OP_DIVIDE_INT] = "OP_DIVIDE_INT",
+    [OP_MODULO_INT] = "OP_MODULO_INT",
+    [OP_NEGATE_INT] = "OP_NEGATE_INT",
+    [OP_ADD_FLOAT] = "OP_ADD_FLOAT",
+    [OP_SUBTRACT_FLOAT] = "OP_SUBTRACT_FLOAT",
+    [OP_MULTIPLY_FLOAT] = "OP_MULTIPLY_FLOAT",
+    [OP_DIVIDE_FLOAT] = "OP_DIVIDE_FLOAT",
+    [OP_NEGATE_FLOAT] = "OP_NEGATE_FLOAT",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUBTRACT] = "OP_SUBTRACT",
+    [OP_MULTIPLY] = "OP_MULTIPLY",
+    [OP_DIVIDE] = "OP_DIVIDE",
+    [OP_MODULO] = "OP_MODULO",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_CONCAT] = "OP_CONCAT",
+    [OP_NOT] = "OP_NOT",
+    [OP_INT_TO_FLOAT] = "OP_INT_TO_FLOAT",
+    [OP_FLOAT_TO_INT] = "OP_FLOAT_TO_INT",
+    [OP_JUMP] = "OP_JUMP",
+    [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+    [OP_LOOP] = "OP_LOOP",
+    [OP_JUMP_IF_NOT_LESS] = "OP_JUMP_IF_NOT_LESS",
+    [OP_JUMP_IF_NOT_LESS_EQUAL] = "OP_JUMP_IF_NOT_LESS_EQUAL",
+    [OP_JUMP_IF_NOT_GREATER] = "OP_JUMP_IF_NOT_GREATER",
+    [OP_JUMP_IF_NOT_GREATER_EQUAL] = "OP_JUMP_IF_NOT_GREATER_EQUAL",
+    [OP_CALL] = "OP_CALL",
+    [OP_TAIL_CALL] = "OP_TAIL_CALL",
+    [OP_CLOSURE] = "OP_CLOSURE",
+    [OP_CLOSE_UPVALUE] = "OP_CLOSE_UPVALUE",
+    [OP_RETURN] = "OP_RETURN",
+    [OP_NATIVE_CALL] = "OP_NATIVE_CALL",
+    [OP_PRINT] = "OP_PRINT",
+    [OP_STRUCT_DEF] = "OP_STRUCT_DEF",
+    [OP_STRUCT_FIELD] = "OP_STRUCT_FIELD",
+    [OP_STRUCT_CALL] = "OP_STRUCT_CALL",
+    [OP_GET_FIELD] = "OP_GET_FIELD",
+    [OP_GET_FIELD_LONG] = "OP_GET_FIELD_LONG",
+    [OP_SET_FIELD] = "OP_SET_FIELD",
+    [OP_SET_FIELD_LONG] = "OP_SET_FIELD_LONG",
+    [OP_ARRAY] = "OP_ARRAY",
+    [OP_INDEX_GET] = "OP_INDEX_GET",
+    [OP_INDEX_SET] = "OP_INDEX_SET",
+    [OP_INDEX_GET_FIELD] = "OP_INDEX_GET_FIELD",
+    [OP_INDEX_SET_FIELD] = "OP_INDEX_SET_FIELD",
+    [OP_MAP] = "OP_MAP",
+    [OP_METHOD] = "OP_METHOD",
+    [OP_INVOKE] = "OP_INVOKE",
+    [OP_INVOKE_LONG] = "OP_INVOKE_LONG",
+    [OP_TAIL_INVOKE] = "OP_TAIL_INVOKE",
+    [OP_GET_SELF] = "OP_GET_SELF",
+    [OP_IMPORT] = "OP_IMPORT",
+    [OP_IMPORT_LAZY] = "OP_IMPORT_LAZY",
+    [OP_GET_LOCAL_0] = "OP_GET_LOCAL_0",
+    [OP_GET_LOCAL_1] = "OP_GET_LOCAL_1",
+    [OP_GET_LOCAL_2] = "OP_GET_LOCAL_2",
+    [OP_GET_LOCAL_3] = "OP_GET_LOCAL_3",
+    [OP_INC_LOCAL] = "OP_INC_LOCAL",
+    [OP_ADD_LOCAL_CONST] = "OP_ADD_LOCAL_CONST",
+    [OP_LESS_LOCAL_CONST] = "OP_LESS_LOCAL_CONST",
+    [OP_INDEX_GET_LOCAL] = "OP_INDEX_GET_LOCAL",
+    [OP_SET_LOCAL_POP] = "OP_SET_LOCAL_POP",
+    [OP_ADD_LOCALS] = "OP_ADD_LOCALS",
+    [OP_GET_LOCAL_FIELD] = "OP_GET_LOCAL_FIELD",
+    [OP_JUMP_IF_NOT_LESS_LOCALS] = "OP_JUMP_IF_NOT_LESS_LOCALS",
+    [OP_JUMP_IF_NOT_LESS_LOCAL_CONST] = "OP_JUMP_IF_NOT_LESS_LOCAL_CONST",
+};
+
+const char* opcodeName(uint8_t opcode) {
+    if (opcode >= sizeof(opcodeNames) / sizeof(opcodeNames[0]) ||
+        opcodeNames[opcode] == NULL) {
+        return "OP_UNKNOWN";
+    }
+    return opcodeNames[opcode];
+}
 
 void disassembleChunk(Chunk* chunk, const char* name) {
     printf("== %s ==\n", name);
@@ -38,6 +147,35 @@ static int constantInstruction(const char* name, Chunk* chunk, int offset) {
     return offset + 2;
 }
 
+// Global access by 16-bit slot in the VM's global array
+static int globalSlotInstruction(const char* name, Chunk* chunk, int offset) {
+    uint16_t slot = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    printf("%-20s %4d '", name, slot);
+    if (slot < vm.globalNames.count) printValue(vm.globalNames.values[slot]);
+    printf("'\n");
+    return offset + 3;
+}
+
+// Field access: constant name + 16-bit inline cache slot
+static int fieldInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t constant = chunk->code[offset + 1];
+    uint16_t cache = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+    printf("%-20s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' [ic %d]\n", cache);
+    return offset + 4;
+}
+
+// Field access with a 16-bit constant index + cache slot
+static int fieldLongInstruction(const char* name, Chunk* chunk, int offset) {
+    uint16_t constant = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    uint16_t cache = (uint16_t)((chunk->code[offset + 3] << 8) | chunk->code[offset + 4]);
+    printf("%-20s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' [ic %d]\n", cache);
+    return offset + 5;
+}
+
 // For superinstructions with slot + constant index
 static int twoByteConstInstruction(const char* name, Chunk* chunk, int offset) {
     uint8_t slot = chunk->code[offset + 1];
@@ -48,6 +186,12 @@ static int twoByteConstInstruction(const char* name, Chunk* chunk, int offset) {
     return offset + 3;
 }
 
+// For superinstructions over two local slots
+static int localPairInstruction(const char* name, Chunk* chunk, int offset) {
+    printf("%-20s %4d %4d\n", name, chunk->code[offset + 1], chunk->code[offset + 2]);
+    return offset + 3;
+}
+
 int disassembleInstruction(Chunk* chunk, int offset) {
     printf("%04d ", offset);
 
@@ -81,6 +225,12 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
         case OP_SET_GLOBAL:
             return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+        case OP_GET_GLOBAL_SLOT:
+            return globalSlotInstruction("OP_GET_GLOBAL_SLOT", chunk, offset);
+        case OP_DEFINE_GLOBAL_SLOT:
+            return globalSlotInstruction("OP_DEFINE_GLOBAL_SLOT", chunk, offset);
+        case OP_SET_GLOBAL_SLOT:
+            return globalSlotInstruction("OP_SET_GLOBAL_SLOT", chunk, offset);
         case OP_GET_UPVALUE:
             return byteInstruction("OP_GET_UPVALUE", chunk, offset);
         case OP_SET_UPVALUE:
@@ -135,6 +285,8 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return simpleInstruction("OP_MODULO", offset);
         case OP_NEGATE:
             return simpleInstruction("OP_NEGATE", offset);
+        case OP_CONCAT:
+            return byteInstruction("OP_CONCAT", chunk, offset);
         case OP_NOT:
             return simpleInstruction("OP_NOT", offset);
         case OP_INT_TO_FLOAT:
@@ -147,15 +299,32 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
         case OP_LOOP:
             return jumpInstruction("OP_LOOP", -1, chunk, offset);
+        case OP_JUMP_IF_NOT_LESS:
+            return jumpInstruction("OP_JUMP_IF_NOT_LESS", 1, chunk, offset);
+        case OP_JUMP_IF_NOT_LESS_EQUAL:
+            return jumpInstruction("OP_JUMP_IF_NOT_LESS_EQUAL", 1, chunk, offset);
+        case OP_JUMP_IF_NOT_GREATER:
+            return jumpInstruction("OP_JUMP_IF_NOT_GREATER", 1, chunk, offset);
+        case OP_JUMP_IF_NOT_GREATER_EQUAL:
+            return jumpInstruction("OP_JUMP_IF_NOT_GREATER_EQUAL", 1, chunk, offset);
         case OP_CALL:
             return byteInstruction("OP_CALL", chunk, offset);
+        case OP_TAIL_CALL:
+            return byteInstruction("OP_TAIL_CALL", chunk, offset);
         case OP_CLOSURE: {
             offset++;
             uint8_t constant = chunk->code[offset++];
             printf("%-20s %4d ", "OP_CLOSURE", constant);
             printValue(chunk->constants.values[constant]);
             printf("\n");
-            // TODO: print upvalue info
+
+            ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
+            for (int i = 0; i < function->upvalueCount; i++) {
+                int isLocal = chunk->code[offset++];
+                int index = chunk->code[offset++];
+                printf("%04d      |                     %s %d\n",
+                       offset - 2, isLocal ? "local" : "upvalue", index);
+            }
             return offset;
         }
         case OP_CLOSE_UPVALUE:
@@ -166,36 +335,71 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return byteInstruction("OP_NATIVE_CALL", chunk, offset);
         case OP_PRINT:
             return simpleInstruction("OP_PRINT", offset);
-        case OP_STRUCT_DEF:
-            return byteInstruction("OP_STRUCT_DEF", chunk, offset);
-        case OP_STRUCT_FIELD:
-            return constantInstruction("OP_STRUCT_FIELD", chunk, offset);
+        case OP_STRUCT_DEF: {
+            uint8_t fieldCount = chunk->code[offset + 1];
+            uint8_t constant = chunk->code[offset + 2];
+            printf("%-20s (%d fields) %4d '", "OP_STRUCT_DEF", fieldCount, constant);
+            printValue(chunk->constants.values[constant]);
+            printf("'\n");
+            return offset + 3;
+        }
+        case OP_STRUCT_FIELD: {
+            uint8_t constant = chunk->code[offset + 1];
+            uint8_t kind = chunk->code[offset + 2];
+            printf("%-20s %4d '", "OP_STRUCT_FIELD", constant);
+            printValue(chunk->constants.values[constant]);
+            printf("'%s\n", kind == FIELD_FLOAT ? " float" : "");
+            return offset + 3;
+        }
         case OP_STRUCT_CALL:
             return byteInstruction("OP_STRUCT_CALL", chunk, offset);
         case OP_GET_FIELD:
-            return constantInstruction("OP_GET_FIELD", chunk, offset);
+            return fieldInstruction("OP_GET_FIELD", chunk, offset);
+        case OP_GET_FIELD_LONG:
+            return fieldLongInstruction("OP_GET_FIELD_LONG", chunk, offset);
         case OP_SET_FIELD:
-            return constantInstruction("OP_SET_FIELD", chunk, offset);
+            return fieldInstruction("OP_SET_FIELD", chunk, offset);
+        case OP_SET_FIELD_LONG:
+            return fieldLongInstruction("OP_SET_FIELD_LONG", chunk, offset);
         case OP_ARRAY:
             return byteInstruction("OP_ARRAY", chunk, offset);
         case OP_INDEX_GET:
             return simpleInstruction("OP_INDEX_GET", offset);
         case OP_INDEX_SET:
             return simpleInstruction("OP_INDEX_SET", offset);
+        case OP_INDEX_GET_FIELD:
+            return fieldInstruction("OP_INDEX_GET_FIELD", chunk, offset);
+        case OP_INDEX_SET_FIELD:
+            return fieldInstruction("OP_INDEX_SET_FIELD", chunk, offset);
+        case OP_MAP:
+            return byteInstruction("OP_MAP", chunk, offset);
         case OP_METHOD:
             return constantInstruction("OP_METHOD", chunk, offset);
-        case OP_INVOKE: {
+        case OP_INVOKE:
+        case OP_TAIL_INVOKE: {
             uint8_t constant = chunk->code[offset + 1];
             uint8_t argCount = chunk->code[offset + 2];
-            printf("%-20s (%d args) %4d '", "OP_INVOKE", argCount, constant);
+            uint16_t cache = (uint16_t)((chunk->code[offset + 3] << 8) | chunk->code[offset + 4]);
+            printf("%-20s (%d args) %4d '", opcodeName(chunk->code[offset]), argCount, constant);
             printValue(chunk->constants.values[constant]);
-            printf("'\n");
-            return offset + 3;
+            printf("' [ic %d]\n", cache);
+            return offset + 5;
+        }
+        case OP_INVOKE_LONG: {
+            uint16_t constant = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+            uint8_t argCount = chunk->code[offset + 3];
+            uint16_t cache = (uint16_t)((chunk->code[offset + 4] << 8) | chunk->code[offset + 5]);
+            printf("%-20s (%d args) %4d '", "OP_INVOKE_LONG", argCount, constant);
+            printValue(chunk->constants.values[constant]);
+            printf("' [ic %d]\n", cache);
+            return offset + 6;
         }
         case OP_GET_SELF:
             return simpleInstruction("OP_GET_SELF", offset);
         case OP_IMPORT:
             return constantInstruction("OP_IMPORT", chunk, offset);
+        case OP_IMPORT_LAZY:
+            return constantInstruction("OP_IMPORT_LAZY", chunk, offset);
 
         // Superinstructions
         case OP_GET_LOCAL_0:
@@ -214,6 +418,31 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return twoByteConstInstruction("OP_LESS_LOCAL_CONST", chunk, offset);
         case OP_INDEX_GET_LOCAL:
             return byteInstruction("OP_INDEX_GET_LOCAL", chunk, offset);
+        case OP_SET_LOCAL_POP:
+            return byteInstruction("OP_SET_LOCAL_POP", chunk, offset);
+        case OP_ADD_LOCALS:
+            return localPairInstruction("OP_ADD_LOCALS", chunk, offset);
+        case OP_GET_LOCAL_FIELD: {
+            uint8_t constant = chunk->code[offset + 2];
+            uint16_t cache = (uint16_t)((chunk->code[offset + 3] << 8) | chunk->code[offset + 4]);
+            printf("%-20s %4d '", "OP_GET_LOCAL_FIELD", chunk->code[offset + 1]);
+            printValue(chunk->constants.values[constant]);
+            printf("' [ic %d]\n", cache);
+            return offset + 5;
+        }
+        case OP_JUMP_IF_NOT_LESS_LOCALS: {
+            uint16_t jump = (uint16_t)((chunk->code[offset + 3] << 8) | chunk->code[offset + 4]);
+            printf("%-20s %4d %4d -> %d\n", "OP_JUMP_IF_NOT_LESS_LOCALS",
+                   chunk->code[offset + 1], chunk->code[offset + 2], offset + 5 + jump);
+            return offset + 5;
+        }
+        case OP_JUMP_IF_NOT_LESS_LOCAL_CONST: {
+            uint16_t jump = (uint16_t)((chunk->code[offset + 3] << 8) | chunk->code[offset + 4]);
+            printf("%-20s %4d '", "OP_JUMP_IF_NOT_LESS_LOCAL_CONST", chunk->code[offset + 1]);
+            printValue(chunk->constants.values[chunk->code[offset + 2]]);
+            printf("' -> %d\n", offset + 5 + jump);
+            return offset + 5;
+        }
 
         default:
             printf("Unknown opcode %d\n", instruction);
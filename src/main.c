@@ -6,6 +6,8 @@
 #include "chunk.h"
 #include "debug.h"
 #include "object.h"
+#include "optimizer.h"
+#include "profiler.h"
 #include "scanner.h"
 #include "vm.h"
 
@@ -322,31 +324,67 @@ static void repl(void) {
     }
 }
 
-static void runFile(const char* path) {
+static InterpretResult runFile(const char* path) {
     char* source = readFile(path);
     InterpretResult result = interpret(source);
     free(source);
+    return result;
+}
 
-    if (result == INTERPRET_COMPILE_ERROR) exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+static void usage(void) {
+    fprintf(stderr, "Usage: sharo [--no-opt] [--opt-stats] [--profile[=out.folded]] "
+                    "[path] | --test\n");
+    exit(64);
 }
 
 int main(int argc, char* argv[]) {
     initVM();
 
-    if (argc == 1) {
-        repl();
-    } else if (argc == 2) {
-        if (strcmp(argv[1], "--test") == 0) {
+    // Leading flags
+    bool optStats = false;
+    const char* profilePath = NULL;
+    int argi = 1;
+    for (; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi++) {
+        if (strcmp(argv[argi], "--no-opt") == 0) {
+            setOptimizerEnabled(false);
+        } else if (strcmp(argv[argi], "--opt-stats") == 0) {
+            enableOptimizerStats();
+            optStats = true;
+        } else if (strcmp(argv[argi], "--profile") == 0) {
+            profilePath = "sharo.folded";
+        } else if (strncmp(argv[argi], "--profile=", 10) == 0) {
+            profilePath = argv[argi] + 10;
+        } else if (strcmp(argv[argi], "--test") == 0 && argc == 2) {
             testVM();
+            freeVM();
+            return 0;
         } else {
-            runFile(argv[1]);
+            usage();
         }
+    }
+
+    InterpretResult result = INTERPRET_OK;
+    if (profilePath != NULL) profileStart();
+    if (argi == argc) {
+        repl();
+    } else if (argi == argc - 1) {
+        result = runFile(argv[argi]);
     } else {
-        fprintf(stderr, "Usage: sharo [path] | --test\n");
-        exit(64);
+        usage();
     }
 
+    if (profilePath != NULL) {
+        profileStop();
+        profileReport(stderr);
+        if (profileWriteFolded(profilePath)) {
+            fprintf(stderr, "Collapsed stacks written to %s\n", profilePath);
+        } else {
+            fprintf(stderr, "Could not write \"%s\".\n", profilePath);
+        }
+    }
+    if (result == INTERPRET_COMPILE_ERROR) exit(65);
+    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+    if (optStats) printOptimizerStats();
     freeVM();
     return 0;
 }
@@ -1,13 +1,39 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 
+#include "chunk.h"
+#include "compiler.h"
 #include "memory.h"
 #include "object.h"
 #include "vm.h"
 
+#ifdef DEBUG_LOG_GC
+#include "debug.h"
+#endif
+
+// Called whenever the heap grows, before the new memory is handed out
+static void maybeCollect(void) {
+#ifdef DEBUG_STRESS_GC
+    collectGarbage();
+#endif
+    if (vm.bytesAllocated > vm.nextGC) {
+        // In incremental mode allocation only nudges the collector along,
+        // unless the heap has run well past its threshold.
+        if (vm.gcIncremental &&
+            vm.bytesAllocated < vm.nextGC * GC_HEAP_GROW_FACTOR) {
+            gcStep(GC_ALLOC_STEP_US);
+        } else {
+            collectGarbage();
+        }
+    }
+}
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
     vm.bytesAllocated += newSize - oldSize;
 
+    if (newSize > oldSize) maybeCollect();
+
     if (newSize == 0) {
         free(pointer);
         return NULL;
@@ -21,6 +47,373 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
     return result;
 }
 
+// ============ Size-class pools ============
+// Small objects are carved out of 64 KiB slabs and recycled through one
+// free list per 16-byte size class instead of going through realloc.
+
+typedef struct PoolBlock {
+    struct PoolBlock* next;
+} PoolBlock;
+
+typedef struct PoolSlab {
+    struct PoolSlab* next;
+    // Blocks follow (aligned to POOL_GRANULE)
+} PoolSlab;
+
+static THREAD_LOCAL PoolBlock* freeLists[POOL_CLASSES];
+static THREAD_LOCAL PoolSlab* slabs = NULL;
+
+static void refillPool(int sizeClass) {
+    size_t blockSize = (size_t)(sizeClass + 1) * POOL_GRANULE;
+    PoolSlab* slab = (PoolSlab*)malloc(POOL_SLAB_SIZE);
+    if (slab == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    slab->next = slabs;
+    slabs = slab;
+
+    char* start = (char*)slab + POOL_GRANULE;
+    char* end = (char*)slab + POOL_SLAB_SIZE;
+    for (char* block = start; block + blockSize <= end; block += blockSize) {
+        PoolBlock* entry = (PoolBlock*)block;
+        entry->next = freeLists[sizeClass];
+        freeLists[sizeClass] = entry;
+    }
+}
+
+void* poolAllocate(size_t size) {
+    if (size > POOL_MAX_SIZE) return reallocate(NULL, 0, size);
+
+    int sizeClass = (int)((size - 1) / POOL_GRANULE);
+    vm.bytesAllocated += (size_t)(sizeClass + 1) * POOL_GRANULE;
+    maybeCollect();
+
+    if (freeLists[sizeClass] == NULL) refillPool(sizeClass);
+    PoolBlock* block = freeLists[sizeClass];
+    freeLists[sizeClass] = block->next;
+    return block;
+}
+
+void poolFree(void* pointer, size_t size) {
+    if (size > POOL_MAX_SIZE) {
+        reallocate(pointer, size, 0);
+        return;
+    }
+
+    int sizeClass = (int)((size - 1) / POOL_GRANULE);
+    vm.bytesAllocated -= (size_t)(sizeClass + 1) * POOL_GRANULE;
+
+    PoolBlock* block = (PoolBlock*)pointer;
+    block->next = freeLists[sizeClass];
+    freeLists[sizeClass] = block;
+}
+
+static void freePools(void) {
+    while (slabs != NULL) {
+        PoolSlab* next = slabs->next;
+        free(slabs);
+        slabs = next;
+    }
+    for (int i = 0; i < POOL_CLASSES; i++) {
+        freeLists[i] = NULL;
+    }
+}
+
+void markObject(Obj* object) {
+    if (object == NULL) return;
+    if (object->isMarked) return;
+
+#ifdef DEBUG_LOG_GC
+    printf("%p mark ", (void*)object);
+    printValue(OBJ_VAL(object));
+    printf("\n");
+#endif
+
+    object->isMarked = true;
+
+    if (vm.grayCapacity < vm.grayCount + 1) {
+        vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
+        // Use the system allocator so growing the gray stack can't recurse into the GC
+        Obj** grayStack = (Obj**)realloc(vm.grayStack, sizeof(Obj*) * vm.grayCapacity);
+        if (grayStack == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        vm.grayStack = grayStack;
+    }
+
+    vm.grayStack[vm.grayCount++] = object;
+}
+
+void markValue(Value value) {
+    if (IS_OBJ(value)) markObject(AS_OBJ(value));
+}
+
+static void markArray(ValueArray* array) {
+    for (int i = 0; i < array->count; i++) {
+        markValue(array->values[i]);
+    }
+}
+
+static void blackenObject(Obj* object) {
+#ifdef DEBUG_LOG_GC
+    printf("%p blacken ", (void*)object);
+    printValue(OBJ_VAL(object));
+    printf("\n");
+#endif
+
+    switch (object->type) {
+        case OBJ_STRING: {
+            ObjString* string = (ObjString*)object;
+            if (string->parent != NULL) markObject((Obj*)string->parent);
+            break;
+        }
+        case OBJ_NATIVE:
+        case OBJ_STRING_BUILDER:
+        case OBJ_TYPED_ARRAY:
+        case OBJ_SPATIAL_GRID:
+        case OBJ_CHANNEL:
+        case OBJ_ASSET:
+            break;
+        case OBJ_UPVALUE:
+            markValue(((ObjUpvalue*)object)->closed);
+            break;
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            markObject((Obj*)function->name);
+            if (function->chunk != NULL) {
+                markArray(&function->chunk->constants);
+                // Cached types are strong so a recycled address can't alias them
+                for (int i = 0; i < function->chunk->cacheCount; i++) {
+                    markObject((Obj*)function->chunk->caches[i].def);
+                    markObject((Obj*)function->chunk->caches[i].method);
+                }
+            }
+            break;
+        }
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)object;
+            markObject((Obj*)closure->function);
+            for (int i = 0; i < closure->upvalueCount; i++) {
+                markObject((Obj*)closure->upvalues[i]);
+            }
+            break;
+        }
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            for (int i = 0; i < array->count; i++) {
+                markValue(array->elements[i]);
+            }
+            break;
+        }
+        case OBJ_STRUCT_DEF: {
+            ObjStructDef* def = (ObjStructDef*)object;
+            markObject((Obj*)def->name);
+            if (def->fieldNames != NULL) {
+                for (int i = 0; i < def->fieldCount; i++) {
+                    markObject((Obj*)def->fieldNames[i]);
+                }
+            }
+            markTable(&def->fieldIndices);
+            markTable(&def->methods);
+            break;
+        }
+        case OBJ_STRUCT: {
+            ObjStruct* instance = (ObjStruct*)object;
+            markObject((Obj*)instance->definition);
+            for (int i = 0; i < instance->fieldCount; i++) {
+                markValue(instance->fields[i]);
+            }
+            break;
+        }
+        case OBJ_MAP:
+            markValueTable(&((ObjMap*)object)->table);
+            break;
+        case OBJ_STRUCT_ARRAY: {
+            ObjStructArray* array = (ObjStructArray*)object;
+            markObject((Obj*)array->definition);
+            for (int i = 0; i < array->fieldCount; i++) {
+                markObject(array->columns[i]);
+            }
+            break;
+        }
+        case OBJ_BOUND_METHOD: {
+            ObjBoundMethod* bound = (ObjBoundMethod*)object;
+            markValue(bound->receiver);
+            markObject((Obj*)bound->method);
+            break;
+        }
+    }
+}
+
+static void markRoots(void) {
+    // Value stack
+    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+        markValue(*slot);
+    }
+
+    // Closures of active call frames
+    for (int i = 0; i < vm.frameCount; i++) {
+        markObject((Obj*)vm.frames[i].closure);
+    }
+
+    // Open upvalues still pointing into the stack
+    for (ObjUpvalue* upvalue = vm.openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+        markObject((Obj*)upvalue);
+    }
+
+    markTable(&vm.globals);
+    markArray(&vm.globalValues);
+    markArray(&vm.globalNames);
+    markTable(&vm.modules);
+    markCompilerRoots();
+}
+
+static void traceReferences(void) {
+    while (vm.grayCount > 0) {
+        Obj* object = vm.grayStack[--vm.grayCount];
+        blackenObject(object);
+    }
+}
+
+static uint64_t elapsedUs(clock_t start) {
+    return (uint64_t)(clock() - start) * 1000000 / CLOCKS_PER_SEC;
+}
+
+static void recordPause(uint64_t pause) {
+    vm.gcLastPauseUs = pause;
+    vm.gcTotalPauseUs += pause;
+    if (pause > vm.gcMaxPauseUs) vm.gcMaxPauseUs = pause;
+}
+
+static void beginCycle(void) {
+#ifdef DEBUG_LOG_GC
+    printf("-- gc begin\n");
+#endif
+    vm.gcCycleStartBytes = vm.bytesAllocated;
+    vm.gcPhase = GC_PHASE_MARK;
+    markRoots();
+}
+
+// Roots aren't covered by the write barrier, so rescan them and drain
+// the gray stack in one go before switching to sweep.
+static void finishMark(void) {
+    markRoots();
+    traceReferences();
+    // Interned strings are weak references
+    tableRemoveWhite(&vm.strings);
+
+    vm.gcPhase = GC_PHASE_SWEEP;
+    vm.sweepCursor = vm.objects;
+    vm.sweepPrev = NULL;
+}
+
+// Sweep up to `limit` objects (all of them if limit < 0). Returns true when done.
+// Objects allocated mid-sweep are linked in at the head, behind the cursor,
+// so they stay white and are never visited here.
+static bool sweepSome(int limit) {
+    while (vm.sweepCursor != NULL && limit != 0) {
+        Obj* object = vm.sweepCursor;
+        vm.sweepCursor = object->next;
+        if (limit > 0) limit--;
+
+        if (object->isMarked) {
+            object->isMarked = false;
+            vm.sweepPrev = object;
+            continue;
+        }
+
+        if (vm.sweepPrev != NULL) {
+            vm.sweepPrev->next = object->next;
+        } else if (vm.objects == object) {
+            vm.objects = object->next;
+        } else {
+            // New objects were linked in ahead of us; find our predecessor
+            Obj* prev = vm.objects;
+            while (prev->next != object) prev = prev->next;
+            prev->next = object->next;
+            vm.sweepPrev = prev;
+        }
+        freeObject(object);
+    }
+    return vm.sweepCursor == NULL;
+}
+
+static void finishCycle(void) {
+    vm.gcPhase = GC_PHASE_IDLE;
+
+    vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+    if (vm.nextGC < GC_MIN_HEAP) vm.nextGC = GC_MIN_HEAP;
+
+    vm.gcCount++;
+    vm.gcLastFreed = vm.gcCycleStartBytes > vm.bytesAllocated
+                   ? vm.gcCycleStartBytes - vm.bytesAllocated : 0;
+
+#ifdef DEBUG_LOG_GC
+    printf("-- gc end\n");
+    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
+           vm.gcLastFreed, vm.gcCycleStartBytes, vm.bytesAllocated, vm.nextGC);
+#endif
+}
+
+void collectGarbage(void) {
+    // Allocations made while freeing must not start a nested collection
+    if (vm.gcRunning) return;
+    vm.gcRunning = true;
+
+    clock_t start = clock();
+
+    // Finish any incremental cycle in flight; its marks are still valid
+    if (vm.gcPhase == GC_PHASE_IDLE) beginCycle();
+    if (vm.gcPhase == GC_PHASE_MARK) finishMark();
+    sweepSome(-1);
+    finishCycle();
+
+    recordPause(elapsedUs(start));
+    vm.gcRunning = false;
+}
+
+// Do up to budgetUs microseconds of collection work.
+// Returns true if the collector is idle afterwards.
+bool gcStep(uint64_t budgetUs) {
+    if (vm.gcRunning) return false;
+    vm.gcIncremental = true;
+
+    // Start a cycle once the heap is halfway to the threshold, so it can
+    // finish in idle time before allocation would force one.
+    if (vm.gcPhase == GC_PHASE_IDLE && vm.bytesAllocated < vm.nextGC / 2) {
+        return true;
+    }
+
+    vm.gcRunning = true;
+    clock_t start = clock();
+
+    if (vm.gcPhase == GC_PHASE_IDLE) beginCycle();
+
+    if (vm.gcPhase == GC_PHASE_MARK) {
+        // Only check the clock every few objects
+        while (vm.grayCount > 0 && elapsedUs(start) < budgetUs) {
+            for (int i = 0; i < 64 && vm.grayCount > 0; i++) {
+                blackenObject(vm.grayStack[--vm.grayCount]);
+            }
+        }
+        if (vm.grayCount == 0) finishMark();
+    }
+
+    if (vm.gcPhase == GC_PHASE_SWEEP) {
+        bool done = false;
+        while (!done && elapsedUs(start) < budgetUs) {
+            done = sweepSome(256);
+        }
+        if (done) finishCycle();
+    }
+
+    recordPause(elapsedUs(start));
+    vm.gcRunning = false;
+    return vm.gcPhase == GC_PHASE_IDLE;
+}
+
 void freeObjects(void) {
     Obj* object = vm.objects;
     while (object != NULL) {
@@ -30,4 +423,5 @@ void freeObjects(void) {
     }
 
     free(vm.grayStack);
+    freePools();
 }
@@ -2,6 +2,7 @@
 #define sharo_memory_h
 
 #include "common.h"
+#include "object.h"
 
 #define GROW_CAPACITY(capacity) \
     ((capacity) < 8 ? 8 : (capacity) * 2)
@@ -18,7 +19,38 @@
 
 #define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
 
+// Heap objects come from the size-class pools
+#define FREE_OBJ(type, pointer) poolFree(pointer, sizeof(type))
+
+#define POOL_GRANULE 16
+#define POOL_CLASSES 16                                 // 16..256 bytes
+#define POOL_MAX_SIZE (POOL_GRANULE * POOL_CLASSES)
+#define POOL_SLAB_SIZE (64 * 1024)
+
+// Heap grows by this factor after each collection
+#define GC_HEAP_GROW_FACTOR 2
+#define GC_MIN_HEAP (1024 * 1024)
+
+// Budget for steps forced by allocation in incremental mode
+#define GC_ALLOC_STEP_US 100
+
+// Incremental marking write barrier: storing into an already-marked object
+// must gray the value, or a black object could end up pointing at a white one.
+// Expands at the use site, which must include vm.h.
+#define WRITE_BARRIER(owner, value) \
+    do { \
+        if (vm.gcPhase == GC_PHASE_MARK && ((Obj*)(owner))->isMarked) { \
+            markValue(value); \
+        } \
+    } while (false)
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+void* poolAllocate(size_t size);
+void poolFree(void* pointer, size_t size);
+void markObject(Obj* object);
+void markValue(Value value);
+void collectGarbage(void);
+bool gcStep(uint64_t budgetUs);
 void freeObjects(void);
 
 #endif
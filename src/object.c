@@ -1,20 +1,23 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "assets.h"
 #include "memory.h"
 #include "object.h"
 #include "chunk.h"
 #include "table.h"
 #include "vm.h"
+#include "worker.h"
 
 // Allocate an object of given type and size
 #define ALLOCATE_OBJ(type, objectType) \
     (type*)allocateObject(sizeof(type), objectType)
 
 static Obj* allocateObject(size_t size, ObjType type) {
-    Obj* object = (Obj*)reallocate(NULL, 0, size);
+    Obj* object = (Obj*)poolAllocate(size);
     object->type = type;
-    object->isMarked = false;
+    // Allocate black while an incremental mark is running
+    object->isMarked = vm.gcPhase == GC_PHASE_MARK;
 
     // Add to VM's object list for GC
     object->next = vm.objects;
@@ -27,9 +30,13 @@ ObjFunction* newFunction(void) {
     ObjFunction* function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
     function->upvalueCount = 0;
+    function->maxSlots = 0;
     function->name = NULL;
+    function->chunk = NULL;
+    push(OBJ_VAL(function));
     function->chunk = ALLOCATE(Chunk, 1);
     initChunk(function->chunk);
+    pop();
     return function;
 }
 
@@ -40,9 +47,12 @@ ObjNative* newNative(NativeFn function) {
 }
 
 ObjClosure* newClosure(ObjFunction* function) {
-    ObjUpvalue** upvalues = ALLOCATE(ObjUpvalue*, function->upvalueCount);
-    for (int i = 0; i < function->upvalueCount; i++) {
-        upvalues[i] = NULL;
+    ObjUpvalue** upvalues = NULL;
+    if (function->upvalueCount > 0) {
+        upvalues = ALLOCATE(ObjUpvalue*, function->upvalueCount);
+        for (int i = 0; i < function->upvalueCount; i++) {
+            upvalues[i] = NULL;
+        }
     }
 
     ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
@@ -76,14 +86,41 @@ void writeArray(ObjArray* array, Value value) {
                                       oldCapacity, array->capacity);
     }
     array->elements[array->count] = value;
+    WRITE_BARRIER(array, value);
     array->count++;
 }
 
+ObjMap* newMap(void) {
+    ObjMap* map = ALLOCATE_OBJ(ObjMap, OBJ_MAP);
+    initValueTable(&map->table);
+    return map;
+}
+
+ObjChannel* newChannel(Channel* channel, int end) {
+    ObjChannel* object = ALLOCATE_OBJ(ObjChannel, OBJ_CHANNEL);
+    object->channel = channel;
+    object->end = end;
+    retainChannel(channel, end);
+    return object;
+}
+
+ObjAsset* newAsset(AssetLoad* load, int kind, void* renderer) {
+    ObjAsset* asset = ALLOCATE_OBJ(ObjAsset, OBJ_ASSET);
+    asset->load = load;
+    asset->kind = kind;
+    asset->renderer = renderer;
+    asset->data = NULL;
+    asset->ready = false;
+    return asset;
+}
+
 ObjStructDef* newStructDef(ObjString* name) {
     ObjStructDef* def = ALLOCATE_OBJ(ObjStructDef, OBJ_STRUCT_DEF);
     def->name = name;
     def->fieldCount = 0;
     def->fieldNames = NULL;
+    def->fieldKinds = NULL;
+    initTable(&def->fieldIndices);
     initTable(&def->methods);
     return def;
 }
@@ -92,13 +129,162 @@ ObjBoundMethod* newBoundMethod(Value receiver, ObjClosure* method) {
     ObjBoundMethod* bound = ALLOCATE_OBJ(ObjBoundMethod, OBJ_BOUND_METHOD);
     bound->receiver = receiver;
     bound->method = method;
+    WRITE_BARRIER(bound, receiver);
     return bound;
 }
 
+ObjStringBuilder* newStringBuilder(void) {
+    ObjStringBuilder* builder = ALLOCATE_OBJ(ObjStringBuilder, OBJ_STRING_BUILDER);
+    builder->length = 0;
+    builder->capacity = 0;
+    builder->chars = NULL;
+    return builder;
+}
+
+void appendStringBuilder(ObjStringBuilder* builder, const char* chars, int length) {
+    if (builder->length + length > builder->capacity) {
+        int oldCapacity = builder->capacity;
+        int capacity = GROW_CAPACITY(oldCapacity);
+        while (capacity < builder->length + length) capacity *= 2;
+        builder->chars = GROW_ARRAY(char, builder->chars, oldCapacity, capacity);
+        builder->capacity = capacity;
+    }
+    memcpy(builder->chars + builder->length, chars, length);
+    builder->length += length;
+}
+
+size_t typedElementSize(TypedArrayKind kind) {
+    switch (kind) {
+        case TYPED_F32: return sizeof(float);
+        case TYPED_F64: return sizeof(double);
+        case TYPED_I32: return sizeof(int32_t);
+        case TYPED_U8:  return sizeof(uint8_t);
+    }
+    return 1;
+}
+
+ObjTypedArray* newTypedArray(TypedArrayKind kind, int count) {
+    ObjTypedArray* array = ALLOCATE_OBJ(ObjTypedArray, OBJ_TYPED_ARRAY);
+    array->kind = kind;
+    array->count = 0;
+    array->capacity = 0;
+    array->data = NULL;
+    if (count > 0) {
+        push(OBJ_VAL(array));
+        size_t bytes = typedElementSize(kind) * (size_t)count;
+        array->data = ALLOCATE(char, bytes);
+        memset(array->data, 0, bytes);
+        array->count = count;
+        array->capacity = count;
+        pop();
+    }
+    return array;
+}
+
+static void reserveColumn(Obj* column, int capacity) {
+    if (column->type == OBJ_TYPED_ARRAY) {
+        ObjTypedArray* typed = (ObjTypedArray*)column;
+        typed->data = GROW_ARRAY(char, typed->data, sizeof(double) * typed->capacity,
+                                 sizeof(double) * capacity);
+        typed->capacity = capacity;
+    } else {
+        ObjArray* values = (ObjArray*)column;
+        values->elements = GROW_ARRAY(Value, values->elements, values->capacity, capacity);
+        values->capacity = capacity;
+    }
+}
+
+ObjStructArray* newStructArray(ObjStructDef* definition, int capacity) {
+    ObjStructArray* array = (ObjStructArray*)allocateObject(
+        sizeof(ObjStructArray) + sizeof(Obj*) * definition->fieldCount,
+        OBJ_STRUCT_ARRAY);
+    array->definition = definition;
+    array->count = 0;
+    array->capacity = 0;
+    array->fieldCount = definition->fieldCount;
+    for (int i = 0; i < array->fieldCount; i++) {
+        array->columns[i] = NULL;
+    }
+
+    push(OBJ_VAL(array));
+    for (int i = 0; i < array->fieldCount; i++) {
+        Obj* column = definition->fieldKinds[i] == FIELD_FLOAT
+            ? (Obj*)newTypedArray(TYPED_F64, 0)
+            : (Obj*)newArray();
+        array->columns[i] = column;
+        WRITE_BARRIER(array, OBJ_VAL(column));
+    }
+    if (capacity > 0) {
+        for (int i = 0; i < array->fieldCount; i++) {
+            reserveColumn(array->columns[i], capacity);
+        }
+        array->capacity = capacity;
+    }
+    pop();
+    return array;
+}
+
+ObjSpatialGrid* newSpatialGrid(double cellSize) {
+    ObjSpatialGrid* grid = ALLOCATE_OBJ(ObjSpatialGrid, OBJ_SPATIAL_GRID);
+    grid->cellSize = cellSize;
+    grid->count = 0;
+    grid->capacity = 0;
+    grid->xs = NULL;
+    grid->ys = NULL;
+    grid->dirty = false;
+    grid->bucketCount = 0;
+    grid->bucketStarts = NULL;
+    grid->sorted = NULL;
+    grid->cellXs = NULL;
+    grid->cellYs = NULL;
+    grid->results = NULL;
+    grid->resultCount = 0;
+    grid->resultCapacity = 0;
+    return grid;
+}
+
+void appendStructArray(ObjStructArray* array) {
+    if (array->count == array->capacity) {
+        int capacity = GROW_CAPACITY(array->capacity);
+        for (int i = 0; i < array->fieldCount; i++) {
+            reserveColumn(array->columns[i], capacity);
+        }
+        array->capacity = capacity;
+    }
+    int row = array->count;
+    for (int i = 0; i < array->fieldCount; i++) {
+        Obj* column = array->columns[i];
+        if (column->type == OBJ_TYPED_ARRAY) {
+            ObjTypedArray* typed = (ObjTypedArray*)column;
+            ((double*)typed->data)[row] = 0.0;
+            typed->count = row + 1;
+        } else {
+            ObjArray* values = (ObjArray*)column;
+            values->elements[row] = NIL_VAL;
+            values->count = row + 1;
+        }
+    }
+    array->count++;
+}
+
+bool structArraySet(ObjStructArray* array, int field, int index, Value value) {
+    Obj* column = array->columns[field];
+    if (column->type == OBJ_TYPED_ARRAY) {
+        if (!IS_NUMBER(value)) return false;
+        ((double*)((ObjTypedArray*)column)->data)[index] = AS_NUMBER(value);
+        return true;
+    }
+    ((ObjArray*)column)->elements[index] = value;
+    WRITE_BARRIER(column, value);
+    return true;
+}
+
 ObjStruct* newStruct(ObjStructDef* definition) {
-    ObjStruct* instance = ALLOCATE_OBJ(ObjStruct, OBJ_STRUCT);
+    // Fields live inline after the header: one allocation per instance
+    ObjStruct* instance = (ObjStruct*)allocateObject(
+        sizeof(ObjStruct) + sizeof(Value) * definition->fieldCount, OBJ_STRUCT);
     instance->definition = definition;
-    instance->fields = ALLOCATE(Value, definition->fieldCount);
+    instance->fieldCount = definition->fieldCount;
     // Initialize all fields to nil
     for (int i = 0; i < definition->fieldCount; i++) {
         instance->fields[i] = NIL_VAL;
@@ -107,7 +293,7 @@ ObjStruct* newStruct(ObjStructDef* definition) {
 }
 
 // FNV-1a hash function
-static uint32_t hashString(const char* key, int length) {
+uint32_t hashChars(const char* key, int length) {
     uint32_t hash = 2166136261u;
     for (int i = 0; i < length; i++) {
         hash ^= (uint8_t)key[i];
@@ -119,17 +305,21 @@ static uint32_t hashString(const char* key, int length) {
 static ObjString* allocateString(char* chars, int length, uint32_t hash) {
     ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
     string->length = length;
+    string->interned = true;
     string->chars = chars;
     string->hash = hash;
+    string->parent = NULL;
 
-    // Intern the string
+    // Intern the string (rooted in case growing the table triggers a GC)
+    push(OBJ_VAL(string));
     tableSet(&vm.strings, string, NIL_VAL);
+    pop();
 
     return string;
 }
 
 ObjString* takeString(char* chars, int length) {
-    uint32_t hash = hashString(chars, length);
+    uint32_t hash = hashChars(chars, length);
 
     // Check if already interned
     ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
@@ -142,7 +332,7 @@ ObjString* takeString(char* chars, int length) {
 }
 
 ObjString* copyString(const char* chars, int length) {
-    uint32_t hash = hashString(chars, length);
+    uint32_t hash = hashChars(chars, length);
 
     // Check if already interned
     ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
@@ -156,6 +346,53 @@ ObjString* copyString(const char* chars, int length) {
     return allocateString(heapChars, length, hash);
 }
 
+// Below this a copy costs about as much as a slice and may find an
+// interned string to reuse, without keeping a large parent alive
+#define SLICE_MIN_LENGTH 16
+
+ObjString* newStringSlice(ObjString* parent, int start, int length) {
+    if (length < SLICE_MIN_LENGTH) return copyString(parent->chars + start, length);
+    if (start == 0 && length == parent->length) return parent;
+    // Slices of slices view the owner directly, so chains don't build up
+    if (parent->parent != NULL) {
+        start += (int)(parent->chars - parent->parent->chars);
+        parent = parent->parent;
+    }
+
+    ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+    string->length = length;
+    string->interned = false;
+    string->chars = parent->chars + start;
+    string->hash = 0;
+    string->parent = parent;
+    WRITE_BARRIER(string, OBJ_VAL(parent));
+    return string;
+}
+
+ObjString* internString(ObjString* string) {
+    if (string->interned) return string;
+    ObjString* interned = tableFindString(&vm.strings, string->chars,
+                                          string->length, stringHash(string));
+    if (interned != NULL) return interned;
+    return copyString(string->chars, string->length);
+}
+
+const char* stringCString(ObjString* string) {
+    if (string->parent == NULL) return string->chars;
+    char* chars = ALLOCATE(char, string->length + 1);
+    memcpy(chars, string->chars, string->length);
+    chars[string->length] = '\0';
+    string->chars = chars;
+    string->parent = NULL;
+    return chars;
+}
+
+bool stringsEqual(ObjString* a, ObjString* b) {
+    if (a == b) return true;
+    if (a->interned && b->interned) return false;
+    return a->length == b->length && memcmp(a->chars, b->chars, a->length) == 0;
+}
+
 static void printFunction(ObjFunction* function) {
     if (function->name == NULL) {
         printf("<script>");
@@ -167,7 +404,7 @@ static void printFunction(ObjFunction* function) {
 void printObject(Value value) {
     switch (OBJ_TYPE(value)) {
         case OBJ_STRING:
-            printf("%s", AS_CSTRING(value));
+            printf("%.*s", AS_STRING(value)->length, AS_STRING(value)->chars);
             break;
         case OBJ_FUNCTION:
             printFunction(AS_FUNCTION(value));
@@ -210,6 +447,61 @@ void printObject(Value value) {
         case OBJ_BOUND_METHOD:
             printFunction(AS_BOUND_METHOD(value)->method->function);
             break;
+        case OBJ_STRING_BUILDER:
+            printf("<string builder>");
+            break;
+        case OBJ_TYPED_ARRAY: {
+            ObjTypedArray* array = AS_TYPED_ARRAY(value);
+            printf("[");
+            for (int i = 0; i < array->count; i++) {
+                if (i > 0) printf(", ");
+                printValue(typedArrayGet(array, i));
+            }
+            printf("]");
+            break;
+        }
+        case OBJ_STRUCT_ARRAY: {
+            ObjStructArray* array = AS_STRUCT_ARRAY(value);
+            ObjStructDef* def = array->definition;
+            printf("[");
+            for (int row = 0; row < array->count; row++) {
+                if (row > 0) printf(", ");
+                printf("%s(", def->name->chars);
+                for (int i = 0; i < array->fieldCount; i++) {
+                    if (i > 0) printf(", ");
+                    printf("%s: ", def->fieldNames[i]->chars);
+                    printValue(structArrayGet(array, i, row));
+                }
+                printf(")");
+            }
+            printf("]");
+            break;
+        }
+        case OBJ_SPATIAL_GRID:
+            printf("<spatial grid %d>", AS_SPATIAL_GRID(value)->count);
+            break;
+        case OBJ_CHANNEL:
+            printf("<channel>");
+            break;
+        case OBJ_ASSET:
+            printf(AS_ASSET(value)->ready ? "<asset>" : "<asset loading>");
+            break;
+        case OBJ_MAP: {
+            ValueTable* table = &AS_MAP(value)->table;
+            printf("{");
+            bool first = true;
+            for (int i = 0; i < table->capacity; i++) {
+                ValueEntry* entry = &table->entries[i];
+                if (IS_NIL(entry->key)) continue;
+                if (!first) printf(", ");
+                first = false;
+                printValue(entry->key);
+                printf(": ");
+                printValue(entry->value);
+            }
+            printf("}");
+            break;
+        }
     }
 }
 
@@ -217,50 +509,103 @@ void freeObject(Obj* object) {
     switch (object->type) {
         case OBJ_STRING: {
             ObjString* string = (ObjString*)object;
-            FREE_ARRAY(char, string->chars, string->length + 1);
-            FREE(ObjString, object);
+            if (string->parent == NULL) {
+                FREE_ARRAY(char, string->chars, string->length + 1);
+            }
+            FREE_OBJ(ObjString, object);
             break;
         }
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
-            freeChunk(function->chunk);
-            FREE(Chunk, function->chunk);
-            FREE(ObjFunction, object);
+            if (function->chunk != NULL) {
+                freeChunk(function->chunk);
+                FREE(Chunk, function->chunk);
+            }
+            FREE_OBJ(ObjFunction, object);
             break;
         }
         case OBJ_NATIVE:
-            FREE(ObjNative, object);
+            FREE_OBJ(ObjNative, object);
             break;
         case OBJ_CLOSURE: {
             ObjClosure* closure = (ObjClosure*)object;
             FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
-            FREE(ObjClosure, object);
+            FREE_OBJ(ObjClosure, object);
             break;
         }
         case OBJ_UPVALUE:
-            FREE(ObjUpvalue, object);
+            FREE_OBJ(ObjUpvalue, object);
             break;
         case OBJ_ARRAY: {
             ObjArray* array = (ObjArray*)object;
             FREE_ARRAY(Value, array->elements, array->capacity);
-            FREE(ObjArray, object);
+            FREE_OBJ(ObjArray, object);
             break;
         }
         case OBJ_STRUCT_DEF: {
             ObjStructDef* def = (ObjStructDef*)object;
             FREE_ARRAY(ObjString*, def->fieldNames, def->fieldCount);
+            FREE_ARRAY(uint8_t, def->fieldKinds, def->fieldCount);
+            freeTable(&def->fieldIndices);
             freeTable(&def->methods);
-            FREE(ObjStructDef, object);
+            FREE_OBJ(ObjStructDef, object);
             break;
         }
         case OBJ_STRUCT: {
             ObjStruct* instance = (ObjStruct*)object;
-            FREE_ARRAY(Value, instance->fields, instance->definition->fieldCount);
-            FREE(ObjStruct, object);
+            poolFree(object, sizeof(ObjStruct) + sizeof(Value) * instance->fieldCount);
             break;
         }
         case OBJ_BOUND_METHOD:
-            FREE(ObjBoundMethod, object);
+            FREE_OBJ(ObjBoundMethod, object);
+            break;
+        case OBJ_STRING_BUILDER: {
+            ObjStringBuilder* builder = (ObjStringBuilder*)object;
+            FREE_ARRAY(char, builder->chars, builder->capacity);
+            FREE_OBJ(ObjStringBuilder, object);
+            break;
+        }
+        case OBJ_TYPED_ARRAY: {
+            ObjTypedArray* array = (ObjTypedArray*)object;
+            FREE_ARRAY(char, array->data, typedElementSize(array->kind) * array->capacity);
+            FREE_OBJ(ObjTypedArray, object);
+            break;
+        }
+        case OBJ_STRUCT_ARRAY: {
+            ObjStructArray* array = (ObjStructArray*)object;
+            poolFree(object, sizeof(ObjStructArray) + sizeof(Obj*) * array->fieldCount);
+            break;
+        }
+        case OBJ_MAP:
+            freeValueTable(&((ObjMap*)object)->table);
+            FREE_OBJ(ObjMap, object);
+            break;
+        case OBJ_CHANNEL: {
+            ObjChannel* channel = (ObjChannel*)object;
+            releaseChannel(channel->channel, channel->end);
+            FREE_OBJ(ObjChannel, object);
             break;
+        }
+        case OBJ_ASSET: {
+            // The loaded asset itself belongs to the script, like loadTexture's
+            ObjAsset* asset = (ObjAsset*)object;
+            if (asset->load != NULL) releaseAssetLoad(asset->load);
+            FREE_OBJ(ObjAsset, object);
+            break;
+        }
+        case OBJ_SPATIAL_GRID: {
+            ObjSpatialGrid* grid = (ObjSpatialGrid*)object;
+            FREE_ARRAY(double, grid->xs, grid->capacity);
+            FREE_ARRAY(double, grid->ys, grid->capacity);
+            FREE_ARRAY(int, grid->sorted, grid->capacity);
+            FREE_ARRAY(int32_t, grid->cellXs, grid->capacity);
+            FREE_ARRAY(int32_t, grid->cellYs, grid->capacity);
+            if (grid->bucketStarts != NULL) {
+                FREE_ARRAY(int, grid->bucketStarts, grid->bucketCount + 1);
+            }
+            FREE_ARRAY(int32_t, grid->results, grid->resultCapacity);
+            FREE_OBJ(ObjSpatialGrid, object);
+            break;
+        }
     }
 }
@@ -19,6 +19,13 @@ typedef enum {
     OBJ_STRUCT_DEF,     // Struct type definition
     OBJ_STRUCT,         // Struct instance
     OBJ_BOUND_METHOD,   // Bound method (closure + receiver)
+    OBJ_STRING_BUILDER, // Mutable buffer for building strings
+    OBJ_TYPED_ARRAY,    // Unboxed numeric array (f32, f64, i32, u8)
+    OBJ_STRUCT_ARRAY,   // Struct collection stored one column per field
+    OBJ_SPATIAL_GRID,   // Uniform-grid broadphase index over 2D points
+    OBJ_MAP,            // Hash map from any non-nil Value to a Value
+    OBJ_CHANNEL,        // One end of a channel to another VM's thread
+    OBJ_ASSET,          // Handle to a background asset load
 } ObjType;
 
 // Base object structure (header for all heap objects)
@@ -33,6 +40,7 @@ typedef struct ObjFunction {
     Obj obj;
     int arity;
     int upvalueCount;
+    int maxSlots;       // Stack height its frame can reach (maxStackHeight)
     Chunk* chunk;       // Pointer to avoid needing full Chunk definition
     ObjString* name;
 } ObjFunction;
@@ -62,12 +70,18 @@ typedef struct ObjClosure {
     int upvalueCount;
 } ObjClosure;
 
-// String object
+// String object. Most strings are interned, so equal strings are the same
+// object. A slice (parent != NULL) instead views length chars of its
+// parent's buffer without a NUL after them: it isn't interned and its hash
+// is computed on first use. Use AS_CSTRING, not chars, where C needs a
+// terminated string.
 struct ObjString {
     Obj obj;
     int length;
+    bool interned;
     char* chars;
-    uint32_t hash;      // Cached hash for interning
+    uint32_t hash;      // Cached hash; 0 until computed for a slice
+    ObjString* parent;  // Slices only: the string that owns chars
 };
 
 // Array object
@@ -78,12 +92,27 @@ typedef struct {
     Value* elements;
 } ObjArray;
 
-// Struct definition (the "type Point { x: int, y: int }" part)
+// Map object ({key: value} literals)
 typedef struct {
+    Obj obj;
+    ValueTable table;
+} ObjMap;
+
+// Declared field type, as far as storage cares: a StructArray keeps float
+// fields unboxed and everything else as plain Values
+typedef enum {
+    FIELD_ANY,
+    FIELD_FLOAT,
+} FieldKind;
+
+// Struct definition (the "type Point { x: int, y: int }" part)
+typedef struct ObjStructDef {
     Obj obj;
     ObjString* name;
     int fieldCount;
     ObjString** fieldNames;     // Ordered field names for constructor
+    uint8_t* fieldKinds;        // FieldKind per field
+    Table fieldIndices;         // fieldName -> index (for large structs)
     Table methods;              // Methods table
 } ObjStructDef;
 
@@ -91,7 +120,8 @@ typedef struct {
 typedef struct {
     Obj obj;
     ObjStructDef* definition;
-    Value* fields;              // Field values in same order as fieldNames
+    int fieldCount;             // Copied from definition (may be swept first)
+    Value fields[];             // Inline, in same order as fieldNames
 } ObjStruct;
 
 // Bound method (method + receiver instance)
@@ -101,6 +131,86 @@ typedef struct {
     ObjClosure* method;         // The method closure
 } ObjBoundMethod;
 
+// String builder (appends grow the buffer geometrically, not per call)
+typedef struct {
+    Obj obj;
+    int length;
+    int capacity;
+    char* chars;                // Not NUL-terminated
+} ObjStringBuilder;
+
+typedef enum {
+    TYPED_F32,
+    TYPED_F64,
+    TYPED_I32,
+    TYPED_U8,
+} TypedArrayKind;
+
+// Typed array: elements stored unboxed and contiguous, so bulk natives
+// can run vectorized loops over them
+typedef struct {
+    Obj obj;
+    TypedArrayKind kind;
+    int count;
+    int capacity;               // Elements allocated (only StructArray columns grow)
+    void* data;
+} ObjTypedArray;
+
+// Struct-of-arrays collection: element i is row i across the columns, so
+// arr[i].x reads one slot of a contiguous column and no instance exists.
+// Columns are ObjTypedArray (f64) for float fields, ObjArray otherwise.
+typedef struct {
+    Obj obj;
+    ObjStructDef* definition;
+    int count;
+    int capacity;               // Rows allocated in every column
+    int fieldCount;             // Copied from definition (may be swept first)
+    Obj* columns[];
+} ObjStructArray;
+
+// Spatial hash over points: each entry sits in the grid cell holding its
+// position, and cells hash into buckets. The bucket index is rebuilt with a
+// counting sort on the first query after entries change (see spatial.c).
+typedef struct {
+    Obj obj;
+    double cellSize;
+    int count;
+    int capacity;
+    double* xs;
+    double* ys;
+
+    bool dirty;                 // Entries changed since the index was built
+    int bucketCount;            // Power of two
+    int* bucketStarts;          // bucketCount + 1 offsets into sorted
+    int* sorted;                // Entry ids grouped by bucket
+    int32_t* cellXs;            // Cell of each entry when the index was built
+    int32_t* cellYs;
+
+    int32_t* results;           // Scratch output of the last query
+    int resultCount;
+    int resultCapacity;
+} ObjSpatialGrid;
+
+// One end of a channel between VMs (see worker.h). Holds a reference to
+// its end, released when the object is freed.
+typedef struct {
+    Obj obj;
+    struct Channel* channel;
+    int end;
+} ObjChannel;
+
+// An asset being loaded in the background (see assets.h). Holds a reference
+// to the load until it is finished on the main thread; data is the texture,
+// sound or MIDI file after that (NULL if loading failed).
+typedef struct {
+    Obj obj;
+    struct AssetLoad* load;
+    int kind;                   // What the load decodes; see vm.c
+    void* renderer;             // Textures: where the upload goes
+    void* data;
+    bool ready;
+} ObjAsset;
+
 // Object type checking
 #define OBJ_TYPE(value)     (AS_OBJ(value)->type)
 
@@ -112,10 +222,17 @@ typedef struct {
 #define IS_STRUCT_DEF(value) isObjType(value, OBJ_STRUCT_DEF)
 #define IS_STRUCT(value)    isObjType(value, OBJ_STRUCT)
 #define IS_BOUND_METHOD(value) isObjType(value, OBJ_BOUND_METHOD)
+#define IS_STRING_BUILDER(value) isObjType(value, OBJ_STRING_BUILDER)
+#define IS_TYPED_ARRAY(value) isObjType(value, OBJ_TYPED_ARRAY)
+#define IS_STRUCT_ARRAY(value) isObjType(value, OBJ_STRUCT_ARRAY)
+#define IS_SPATIAL_GRID(value) isObjType(value, OBJ_SPATIAL_GRID)
+#define IS_MAP(value)       isObjType(value, OBJ_MAP)
+#define IS_CHANNEL(value)   isObjType(value, OBJ_CHANNEL)
+#define IS_ASSET(value)     isObjType(value, OBJ_ASSET)
 
 // Object casting
 #define AS_STRING(value)    ((ObjString*)AS_OBJ(value))
-#define AS_CSTRING(value)   (((ObjString*)AS_OBJ(value))->chars)
+#define AS_CSTRING(value)   stringCString(AS_STRING(value))
 #define AS_FUNCTION(value)  ((ObjFunction*)AS_OBJ(value))
 #define AS_NATIVE(value)    (((ObjNative*)AS_OBJ(value))->function)
 #define AS_CLOSURE(value)   ((ObjClosure*)AS_OBJ(value))
@@ -123,11 +240,25 @@ typedef struct {
 #define AS_STRUCT_DEF(value) ((ObjStructDef*)AS_OBJ(value))
 #define AS_STRUCT(value)    ((ObjStruct*)AS_OBJ(value))
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))
+#define AS_STRING_BUILDER(value) ((ObjStringBuilder*)AS_OBJ(value))
+#define AS_TYPED_ARRAY(value) ((ObjTypedArray*)AS_OBJ(value))
+#define AS_STRUCT_ARRAY(value) ((ObjStructArray*)AS_OBJ(value))
+#define AS_SPATIAL_GRID(value) ((ObjSpatialGrid*)AS_OBJ(value))
+#define AS_MAP(value)       ((ObjMap*)AS_OBJ(value))
+#define AS_CHANNEL(value)   ((ObjChannel*)AS_OBJ(value))
+#define AS_ASSET(value)     ((ObjAsset*)AS_OBJ(value))
 
 static inline bool isObjType(Value value, ObjType type) {
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+uint32_t hashChars(const char* key, int length);
+
+static inline uint32_t stringHash(ObjString* string) {
+    if (string->hash == 0) string->hash = hashChars(string->chars, string->length);
+    return string->hash;
+}
+
 // Object creation
 ObjFunction* newFunction(void);
 ObjNative* newNative(NativeFn function);
@@ -135,11 +266,102 @@ ObjClosure* newClosure(ObjFunction* function);
 ObjUpvalue* newUpvalue(Value* slot);
 ObjString* takeString(char* chars, int length);
 ObjString* copyString(const char* chars, int length);
+// chars[start .. start + length) of parent, sharing its buffer when the
+// piece is long enough to be worth it (short ones are copied and interned)
+ObjString* newStringSlice(ObjString* parent, int start, int length);
+// The interned string equal to string (string itself unless it's a slice)
+ObjString* internString(ObjString* string);
+// NUL-terminated chars; a slice gets a buffer of its own on first call
+const char* stringCString(ObjString* string);
+bool stringsEqual(ObjString* a, ObjString* b);
 ObjArray* newArray(void);
 void writeArray(ObjArray* array, Value value);
+ObjMap* newMap(void);
+ObjChannel* newChannel(struct Channel* channel, int end);
+ObjAsset* newAsset(struct AssetLoad* load, int kind, void* renderer);
 ObjStructDef* newStructDef(ObjString* name);
 ObjStruct* newStruct(ObjStructDef* definition);
 ObjBoundMethod* newBoundMethod(Value receiver, ObjClosure* method);
+ObjStringBuilder* newStringBuilder(void);
+void appendStringBuilder(ObjStringBuilder* builder, const char* chars, int length);
+ObjTypedArray* newTypedArray(TypedArrayKind kind, int count);
+size_t typedElementSize(TypedArrayKind kind);
+ObjStructArray* newStructArray(ObjStructDef* definition, int capacity);
+// Append a row of zeroes (float fields) and nils, growing every column
+void appendStructArray(ObjStructArray* array);
+ObjSpatialGrid* newSpatialGrid(double cellSize);
+
+static inline double typedArrayGetNumber(ObjTypedArray* array, int index) {
+    switch (array->kind) {
+        case TYPED_F32: return ((float*)array->data)[index];
+        case TYPED_F64: return ((double*)array->data)[index];
+        case TYPED_I32: return ((int32_t*)array->data)[index];
+        case TYPED_U8:  return ((uint8_t*)array->data)[index];
+    }
+    return 0;
+}
+
+// Stores into i32/u8 truncate toward zero and keep the low 32 or 8 bits, so
+// u8 300 is 44 and -1 is 255. NaN, infinities and numbers outside the int64
+// range store 0: converting those to an integer is undefined in C.
+static inline int64_t typedTruncate(double value) {
+    // -2^63 is exact as a double, 2^63 is the first value past the range
+    if (value >= -9223372036854775808.0 && value < 9223372036854775808.0) {
+        return (int64_t)value;
+    }
+    return 0;
+}
+
+// The low 32 bits as two's complement, without an out-of-range signed cast
+static inline int32_t typedWrapI32(int64_t n) {
+    uint32_t bits = (uint32_t)n;
+    return bits <= INT32_MAX ? (int32_t)bits : (int32_t)(bits - 0x80000000u) + INT32_MIN;
+}
+
+static inline void typedArraySetNumber(ObjTypedArray* array, int index, double value) {
+    switch (array->kind) {
+        case TYPED_F32: ((float*)array->data)[index] = (float)value; break;
+        case TYPED_F64: ((double*)array->data)[index] = value; break;
+        case TYPED_I32: ((int32_t*)array->data)[index] = typedWrapI32(typedTruncate(value)); break;
+        case TYPED_U8:  ((uint8_t*)array->data)[index] = (uint8_t)typedTruncate(value); break;
+    }
+}
+
+// Elements read back as floats for f32/f64 and ints for i32/u8
+static inline Value typedArrayGet(ObjTypedArray* array, int index) {
+    switch (array->kind) {
+        case TYPED_F32: return FLOAT_VAL(((float*)array->data)[index]);
+        case TYPED_F64: return FLOAT_VAL(((double*)array->data)[index]);
+        case TYPED_I32: return INT_VAL(((int32_t*)array->data)[index]);
+        case TYPED_U8:  return INT_VAL(((uint8_t*)array->data)[index]);
+    }
+    return NIL_VAL;
+}
+
+// value must be a number
+static inline void typedArraySet(ObjTypedArray* array, int index, Value value) {
+    if (IS_INT(value)) {
+        int64_t n = AS_INT(value);
+        switch (array->kind) {
+            case TYPED_F32: ((float*)array->data)[index] = (float)n; return;
+            case TYPED_F64: ((double*)array->data)[index] = (double)n; return;
+            case TYPED_I32: ((int32_t*)array->data)[index] = typedWrapI32(n); return;
+            case TYPED_U8:  ((uint8_t*)array->data)[index] = (uint8_t)n; return;
+        }
+    }
+    typedArraySetNumber(array, index, AS_FLOAT(value));
+}
+
+static inline Value structArrayGet(ObjStructArray* array, int field, int index) {
+    Obj* column = array->columns[field];
+    if (column->type == OBJ_TYPED_ARRAY) {
+        return FLOAT_VAL(((double*)((ObjTypedArray*)column)->data)[index]);
+    }
+    return ((ObjArray*)column)->elements[index];
+}
+
+// False when a float column is given something other than a number
+bool structArraySet(ObjStructArray* array, int field, int index, Value value);
 
 void printObject(Value value);
 void freeObject(Obj* object);
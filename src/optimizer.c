@@ -0,0 +1,535 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "optimizer.h"
+#include "debug.h"
+#include "object.h"
+
+// Patterns, picked from the static opcode pairs of the example games
+// (sharo --opt-stats) and the loop shapes the compiler emits:
+//
+//   GET_LOCAL a, CONSTANT 1, ADD, SET_LOCAL a, POP  -> INC_LOCAL a
+//   GET_LOCAL a, GET_LOCAL b, JUMP_IF_NOT_LESS      -> JUMP_IF_NOT_LESS_LOCALS a b
+//   GET_LOCAL a, CONSTANT k, JUMP_IF_NOT_LESS       -> JUMP_IF_NOT_LESS_LOCAL_CONST a k
+//   GET_LOCAL a, GET_LOCAL b, ADD                   -> ADD_LOCALS a b
+//   GET_LOCAL a, CONSTANT k, ADD                    -> ADD_LOCAL_CONST a k
+//   GET_LOCAL a, CONSTANT k, LESS                   -> LESS_LOCAL_CONST a k
+//   GET_LOCAL a, GET_FIELD f                        -> GET_LOCAL_FIELD a f
+//   GET_LOCAL i, INDEX_GET                          -> INDEX_GET_LOCAL i
+//   SET_LOCAL a, POP                                -> SET_LOCAL_POP a
+//
+// Rewrites compose left to right, so `c = a + b` becomes ADD_LOCALS a b,
+// SET_LOCAL_POP c. A sequence is only fused when no jump lands inside it.
+
+static bool optimizerEnabled = true;
+static bool statsEnabled = false;
+static THREAD_LOCAL long statsBefore[256];
+static THREAD_LOCAL long statsAfter[256];
+
+void setOptimizerEnabled(bool enabled) {
+    optimizerEnabled = enabled;
+}
+
+bool optimizerIsEnabled(void) {
+    return optimizerEnabled;
+}
+
+void enableOptimizerStats(void) {
+    statsEnabled = true;
+}
+
+int instructionLength(Chunk* chunk, int offset) {
+    switch (chunk->code[offset]) {
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_NATIVE_CALL:
+        case OP_STRUCT_CALL:
+        case OP_ARRAY:
+        case OP_MAP:
+        case OP_METHOD:
+        case OP_IMPORT:
+        case OP_IMPORT_LAZY:
+        case OP_CONCAT:
+        case OP_INC_LOCAL:
+        case OP_INDEX_GET_LOCAL:
+        case OP_SET_LOCAL_POP:
+            return 2;
+        case OP_CONSTANT_LONG:
+        case OP_GET_GLOBAL_LONG:
+        case OP_DEFINE_GLOBAL_LONG:
+        case OP_SET_GLOBAL_LONG:
+        case OP_GET_GLOBAL_SLOT:
+        case OP_DEFINE_GLOBAL_SLOT:
+        case OP_SET_GLOBAL_SLOT:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_NOT_LESS_EQUAL:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_NOT_GREATER_EQUAL:
+        case OP_STRUCT_DEF:
+        case OP_STRUCT_FIELD:
+        case OP_ADD_LOCAL_CONST:
+        case OP_LESS_LOCAL_CONST:
+        case OP_ADD_LOCALS:
+            return 3;
+        case OP_GET_FIELD:
+        case OP_SET_FIELD:
+        case OP_INDEX_GET_FIELD:
+        case OP_INDEX_SET_FIELD:
+            return 4;
+        case OP_GET_FIELD_LONG:
+        case OP_SET_FIELD_LONG:
+        case OP_INVOKE:
+        case OP_TAIL_INVOKE:
+        case OP_GET_LOCAL_FIELD:
+        case OP_JUMP_IF_NOT_LESS_LOCALS:
+        case OP_JUMP_IF_NOT_LESS_LOCAL_CONST:
+            return 5;
+        case OP_INVOKE_LONG:
+            return 6;
+        case OP_CLOSURE: {
+            Value constant = chunk->constants.values[chunk->code[offset + 1]];
+            return 2 + AS_FUNCTION(constant)->upvalueCount * 2;
+        }
+        default:
+            return 1;
+    }
+}
+
+// Jump instructions all end in their 16-bit distance
+static bool isJump(uint8_t op) {
+    switch (op) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_NOT_LESS_EQUAL:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_NOT_GREATER_EQUAL:
+        case OP_JUMP_IF_NOT_LESS_LOCALS:
+        case OP_JUMP_IF_NOT_LESS_LOCAL_CONST:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static int jumpTarget(Chunk* chunk, int offset) {
+    int end = offset + instructionLength(chunk, offset);
+    int jump = (chunk->code[end - 2] << 8) | chunk->code[end - 1];
+    return chunk->code[offset] == OP_LOOP ? end - jump : end + jump;
+}
+
+static void countOpcodes(Chunk* chunk, long* histogram) {
+    for (int offset = 0; offset < chunk->count;
+         offset += instructionLength(chunk, offset)) {
+        histogram[chunk->code[offset]]++;
+    }
+}
+
+// ============ Stack Height ============
+
+// Values pushed minus values popped by the instruction at offset, on every
+// path out of it (the fused compare-and-branch ops pop both operands either
+// way). Transient values inside one instruction are left to STACK_HEADROOM.
+static int stackEffect(Chunk* chunk, int offset) {
+    uint8_t* code = &chunk->code[offset];
+    switch (code[0]) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_DUP:
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_GET_GLOBAL_LONG:
+        case OP_GET_GLOBAL_SLOT:
+        case OP_GET_UPVALUE:
+        case OP_CLOSURE:
+        case OP_STRUCT_DEF:
+        case OP_GET_LOCAL_0:
+        case OP_GET_LOCAL_1:
+        case OP_GET_LOCAL_2:
+        case OP_GET_LOCAL_3:
+        case OP_ADD_LOCAL_CONST:
+        case OP_LESS_LOCAL_CONST:
+        case OP_ADD_LOCALS:
+        case OP_GET_LOCAL_FIELD:
+            return 1;
+        case OP_DUP_TWO:
+            return 2;
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_DEFINE_GLOBAL_LONG:
+        case OP_DEFINE_GLOBAL_SLOT:
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+        case OP_ADD_INT:
+        case OP_SUBTRACT_INT:
+        case OP_MULTIPLY_INT:
+        case OP_DIVIDE_INT:
+        case OP_MODULO_INT:
+        case OP_ADD_FLOAT:
+        case OP_SUBTRACT_FLOAT:
+        case OP_MULTIPLY_FLOAT:
+        case OP_DIVIDE_FLOAT:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MODULO:
+        case OP_CLOSE_UPVALUE:
+        case OP_RETURN:
+        case OP_PRINT:
+        case OP_SET_FIELD:
+        case OP_SET_FIELD_LONG:
+        case OP_INDEX_GET:
+        case OP_INDEX_GET_FIELD:
+        case OP_METHOD:
+        case OP_SET_LOCAL_POP:
+            return -1;
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_NOT_LESS_EQUAL:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_NOT_GREATER_EQUAL:
+        case OP_INDEX_SET:
+        case OP_INDEX_SET_FIELD:
+            return -2;
+        case OP_CONCAT:
+            return 1 - code[1];
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            return -code[1];
+        case OP_INVOKE:
+        case OP_TAIL_INVOKE:
+            return -code[2];
+        case OP_INVOKE_LONG:
+            return -code[3];
+        case OP_ARRAY:
+            return 1 - code[1];
+        case OP_MAP:
+            return 1 - 2 * code[1];
+        default:
+            return 0;
+    }
+}
+
+int maxStackHeight(Chunk* chunk, int base) {
+    // Height on entry to each offset (-1 until reached) and a worklist of
+    // jump targets whose height went up. Compiled code reaches every
+    // offset at one height, so this settles after a pass or two.
+    int* heights = malloc(sizeof(int) * (chunk->count + 1));
+    int* pending = malloc(sizeof(int) * (chunk->count + 1));
+    bool* queued = calloc(chunk->count + 1, sizeof(bool));
+    if (heights == NULL || pending == NULL || queued == NULL) {
+        fprintf(stderr, "Out of memory in stack height analysis.\n");
+        exit(1);
+    }
+    for (int i = 0; i <= chunk->count; i++) heights[i] = -1;
+
+    int max = base;
+    int pendingCount = 1;
+    pending[0] = 0;
+    queued[0] = true;
+    heights[0] = base;
+    while (pendingCount > 0) {
+        int offset = pending[--pendingCount];
+        queued[offset] = false;
+        int height = heights[offset];
+        while (offset < chunk->count && height <= STACK_HEIGHT_LIMIT) {
+            uint8_t op = chunk->code[offset];
+            height += stackEffect(chunk, offset);
+            if (height > max) max = height;
+            if (isJump(op)) {
+                int target = jumpTarget(chunk, offset);
+                if (target >= 0 && target <= chunk->count && heights[target] < height) {
+                    heights[target] = height;
+                    if (!queued[target]) {
+                        queued[target] = true;
+                        pending[pendingCount++] = target;
+                    }
+                }
+            }
+            if (op == OP_RETURN || op == OP_JUMP || op == OP_LOOP) break;
+            offset += instructionLength(chunk, offset);
+            if (offset <= chunk->count && heights[offset] >= height) break;
+            if (offset <= chunk->count) heights[offset] = height;
+        }
+    }
+
+    free(heights);
+    free(pending);
+    free(queued);
+    return max > STACK_HEIGHT_LIMIT ? STACK_HEIGHT_LIMIT : max;
+}
+
+// Slot read by any GET_LOCAL form, or -1
+static int localSlot(Chunk* chunk, int offset) {
+    uint8_t op = chunk->code[offset];
+    if (op == OP_GET_LOCAL) return chunk->code[offset + 1];
+    if (op >= OP_GET_LOCAL_0 && op <= OP_GET_LOCAL_3) return op - OP_GET_LOCAL_0;
+    return -1;
+}
+
+static bool isAdd(uint8_t op) {
+    return op == OP_ADD || op == OP_ADD_INT || op == OP_ADD_FLOAT;
+}
+
+typedef struct {
+    Chunk* chunk;
+    int* starts;        // Byte offset of each original instruction
+    int instructionCount;
+    bool* isTarget;     // Per original byte offset: some jump lands here
+    int* remap;         // Original byte offset -> rewritten offset
+
+    uint8_t* code;      // Rewritten code and its line table
+    int* lines;
+    int count;
+
+    int* jumps;         // Rewritten offsets of jumps, patched at the end
+    int* oldTargets;
+    int jumpCount;
+} Peephole;
+
+static uint8_t opAt(Peephole* p, int i) {
+    return p->chunk->code[p->starts[i]];
+}
+
+static uint8_t operandAt(Peephole* p, int i, int n) {
+    return p->chunk->code[p->starts[i] + n];
+}
+
+static int slotAt(Peephole* p, int i) {
+    if (i >= p->instructionCount) return -1;
+    return localSlot(p->chunk, p->starts[i]);
+}
+
+// Instructions i..i+n-1 can become one when no jump lands past the first
+static bool fusable(Peephole* p, int i, int n) {
+    if (i + n > p->instructionCount) return false;
+    for (int k = 1; k < n; k++) {
+        if (p->isTarget[p->starts[i + k]]) return false;
+    }
+    return true;
+}
+
+static void emitByte(Peephole* p, uint8_t byte, int line) {
+    p->code[p->count] = byte;
+    p->lines[p->count] = line;
+    p->count++;
+}
+
+// Emit a jump-ending instruction whose distance is patched later, taking
+// the target from the original jump at instruction i
+static void emitJumpTail(Peephole* p, int start, int i, int line) {
+    p->jumps[p->jumpCount] = start;
+    p->oldTargets[p->jumpCount] = jumpTarget(p->chunk, p->starts[i]);
+    p->jumpCount++;
+    emitByte(p, 0xff, line);
+    emitByte(p, 0xff, line);
+}
+
+// Try the patterns at instruction i; returns how many were consumed
+static int rewrite(Peephole* p, int i) {
+    Chunk* chunk = p->chunk;
+    int line = chunk->lines[p->starts[i]];
+    int start = p->count;
+    int a = slotAt(p, i);
+
+    if (a >= 0 && fusable(p, i, 5) && opAt(p, i + 1) == OP_CONSTANT &&
+        isAdd(opAt(p, i + 2)) && opAt(p, i + 3) == OP_SET_LOCAL &&
+        operandAt(p, i + 3, 1) == a && opAt(p, i + 4) == OP_POP) {
+        Value k = chunk->constants.values[operandAt(p, i + 1, 1)];
+        if (IS_INT(k) && AS_INT(k) == 1) {
+            emitByte(p, OP_INC_LOCAL, line);
+            emitByte(p, (uint8_t)a, line);
+            return 5;
+        }
+    }
+
+    if (a >= 0 && fusable(p, i, 3)) {
+        int b = slotAt(p, i + 1);
+        uint8_t third = opAt(p, i + 2);
+
+        if (b >= 0 && third == OP_JUMP_IF_NOT_LESS) {
+            emitByte(p, OP_JUMP_IF_NOT_LESS_LOCALS, line);
+            emitByte(p, (uint8_t)a, line);
+            emitByte(p, (uint8_t)b, line);
+            emitJumpTail(p, start, i + 2, line);
+            return 3;
+        }
+        if (b >= 0 && isAdd(third)) {
+            emitByte(p, OP_ADD_LOCALS, line);
+            emitByte(p, (uint8_t)a, line);
+            emitByte(p, (uint8_t)b, line);
+            return 3;
+        }
+
+        if (opAt(p, i + 1) == OP_CONSTANT) {
+            uint8_t k = operandAt(p, i + 1, 1);
+            if (third == OP_JUMP_IF_NOT_LESS) {
+                emitByte(p, OP_JUMP_IF_NOT_LESS_LOCAL_CONST, line);
+                emitByte(p, (uint8_t)a, line);
+                emitByte(p, k, line);
+                emitJumpTail(p, start, i + 2, line);
+                return 3;
+            }
+            if (isAdd(third) || third == OP_LESS) {
+                emitByte(p, isAdd(third) ? OP_ADD_LOCAL_CONST : OP_LESS_LOCAL_CONST,
+                         line);
+                emitByte(p, (uint8_t)a, line);
+                emitByte(p, k, line);
+                return 3;
+            }
+        }
+    }
+
+    if (a >= 0 && fusable(p, i, 2)) {
+        if (opAt(p, i + 1) == OP_GET_FIELD) {
+            emitByte(p, OP_GET_LOCAL_FIELD, line);
+            emitByte(p, (uint8_t)a, line);
+            for (int n = 1; n < 4; n++) emitByte(p, operandAt(p, i + 1, n), line);
+            return 2;
+        }
+        if (opAt(p, i + 1) == OP_INDEX_GET) {
+            emitByte(p, OP_INDEX_GET_LOCAL, line);
+            emitByte(p, (uint8_t)a, line);
+            return 2;
+        }
+    }
+
+    if (opAt(p, i) == OP_SET_LOCAL && fusable(p, i, 2) &&
+        opAt(p, i + 1) == OP_POP) {
+        emitByte(p, OP_SET_LOCAL_POP, line);
+        emitByte(p, operandAt(p, i, 1), line);
+        return 2;
+    }
+
+    // No pattern: copy the instruction as is
+    int length = instructionLength(chunk, p->starts[i]);
+    if (isJump(opAt(p, i))) {
+        for (int n = 0; n < length - 2; n++) emitByte(p, operandAt(p, i, n), line);
+        emitJumpTail(p, start, i, line);
+    } else {
+        for (int n = 0; n < length; n++) emitByte(p, operandAt(p, i, n), line);
+    }
+    return 1;
+}
+
+void optimizeChunk(Chunk* chunk) {
+    if (statsEnabled) countOpcodes(chunk, statsBefore);
+    if (!optimizerEnabled || chunk->count == 0) {
+        if (statsEnabled) countOpcodes(chunk, statsAfter);
+        return;
+    }
+
+    Peephole p;
+    p.chunk = chunk;
+    p.starts = malloc(sizeof(int) * chunk->count);
+    p.isTarget = calloc(chunk->count + 1, sizeof(bool));
+    p.remap = malloc(sizeof(int) * (chunk->count + 1));
+    p.code = malloc(chunk->count);
+    p.lines = malloc(sizeof(int) * chunk->count);
+    p.jumps = malloc(sizeof(int) * chunk->count);
+    p.oldTargets = malloc(sizeof(int) * chunk->count);
+    p.instructionCount = 0;
+    p.count = 0;
+    p.jumpCount = 0;
+    if (p.starts == NULL || p.isTarget == NULL || p.remap == NULL ||
+        p.code == NULL || p.lines == NULL || p.jumps == NULL ||
+        p.oldTargets == NULL) {
+        fprintf(stderr, "Out of memory in peephole optimizer.\n");
+        exit(1);
+    }
+
+    for (int offset = 0; offset < chunk->count;
+         offset += instructionLength(chunk, offset)) {
+        p.starts[p.instructionCount++] = offset;
+        if (isJump(chunk->code[offset])) {
+            int target = jumpTarget(chunk, offset);
+            if (target >= 0 && target <= chunk->count) p.isTarget[target] = true;
+        }
+    }
+
+    for (int i = 0; i < p.instructionCount;) {
+        int start = p.count;
+        int consumed = rewrite(&p, i);
+        for (int k = 0; k < consumed; k++) p.remap[p.starts[i + k]] = start;
+        i += consumed;
+    }
+    p.remap[chunk->count] = p.count;
+
+    // Fused code only shrinks, so every distance still fits in 16 bits
+    for (int j = 0; j < p.jumpCount; j++) {
+        int at = p.jumps[j];
+        int op = p.code[at];
+        int end = at + (op == OP_JUMP_IF_NOT_LESS_LOCALS ||
+                        op == OP_JUMP_IF_NOT_LESS_LOCAL_CONST ? 5 : 3);
+        int target = p.remap[p.oldTargets[j]];
+        int jump = op == OP_LOOP ? end - target : target - end;
+        p.code[end - 2] = (jump >> 8) & 0xff;
+        p.code[end - 1] = jump & 0xff;
+    }
+
+    memcpy(chunk->code, p.code, p.count);
+    memcpy(chunk->lines, p.lines, sizeof(int) * p.count);
+    chunk->count = p.count;
+
+    free(p.starts);
+    free(p.isTarget);
+    free(p.remap);
+    free(p.code);
+    free(p.lines);
+    free(p.jumps);
+    free(p.oldTargets);
+
+    if (statsEnabled) countOpcodes(chunk, statsAfter);
+}
+
+void printOptimizerStats(void) {
+    int order[256];
+    int used = 0;
+    long totalBefore = 0;
+    long totalAfter = 0;
+
+    for (int op = 0; op < 256; op++) {
+        totalBefore += statsBefore[op];
+        totalAfter += statsAfter[op];
+        if (statsBefore[op] == 0 && statsAfter[op] == 0) continue;
+
+        // Insertion sort, most frequent before the pass first
+        int i = used++;
+        while (i > 0 && (statsBefore[order[i - 1]] < statsBefore[op] ||
+                         (statsBefore[order[i - 1]] == statsBefore[op] &&
+                          statsAfter[order[i - 1]] < statsAfter[op]))) {
+            order[i] = order[i - 1];
+            i--;
+        }
+        order[i] = op;
+    }
+
+    fprintf(stderr, "%-34s %8s %8s\n", "opcode", "before", "after");
+    for (int i = 0; i < used; i++) {
+        fprintf(stderr, "%-34s %8ld %8ld\n", opcodeName((uint8_t)order[i]),
+                statsBefore[order[i]], statsAfter[order[i]]);
+    }
+    fprintf(stderr, "%-34s %8ld %8ld\n", "total", totalBefore, totalAfter);
+}
@@ -0,0 +1,27 @@
+#ifndef sharo_optimizer_h
+#define sharo_optimizer_h
+
+#include "chunk.h"
+
+// Peephole pass run over each function's chunk once it is compiled.
+// Rewrites common instruction sequences into superinstructions and fixes
+// up jump offsets around them.
+void optimizeChunk(Chunk* chunk);
+
+// Byte length of the instruction at offset, operands included
+int instructionLength(Chunk* chunk, int offset);
+
+// Largest stack height reached by a chunk whose frame starts with base
+// slots (the callee and its parameters), capped at STACK_HEIGHT_LIMIT
+#define STACK_HEIGHT_LIMIT UINT16_MAX
+int maxStackHeight(Chunk* chunk, int base);
+
+// sharo --no-opt turns the pass off (to compare against unoptimized code)
+void setOptimizerEnabled(bool enabled);
+bool optimizerIsEnabled(void);
+
+// Static opcode histogram of everything compiled, before and after the pass
+void enableOptimizerStats(void);
+void printOptimizerStats(void);
+
+#endif
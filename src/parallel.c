@@ -0,0 +1,177 @@
+#include <stdlib.h>
+
+#include <SDL3/SDL.h>
+
+#include "parallel.h"
+
+#define PARALLEL_MAX_THREADS 64
+// Below this many chunks, waking the pool costs more than it saves
+#define PARALLEL_MIN_CHUNKS 4
+
+// The chunks owned by one participant; next only ever increases, so an
+// owner and thieves can all claim with one atomic add
+typedef struct {
+    SDL_AtomicInt next;
+    int end;
+    uint8_t padding[56];        // One cursor per cache line
+} ChunkRun;
+
+static struct {
+    SDL_Mutex* lock;
+    SDL_Condition* wake;        // A new job was posted (or stopping)
+    SDL_Condition* done;        // The last helper left the job
+    SDL_Thread* threads[PARALLEL_MAX_THREADS];
+    int startGeneration[PARALLEL_MAX_THREADS + 1]; // Per participant: the
+                                // last job posted before it started
+    int threadCount;            // Helpers started so far
+    SDL_AtomicInt wanted;       // Participants per job, caller included;
+                                // any VM's thread may set it
+    SDL_AtomicInt busy;         // A job holds the pool
+    bool stopping;
+
+    // The current job, written under lock before generation is bumped
+    int generation;
+    int participants;
+    int active;                 // Helpers that haven't finished the job
+    int count;
+    ParallelBody body;
+    void* context;
+    ChunkRun runs[PARALLEL_MAX_THREADS];
+} pool;
+
+// Claim chunks from our own run first, then from everyone else's
+static void workOn(int self) {
+    int participants = pool.participants;
+    for (int k = 0; k < participants; k++) {
+        ChunkRun* run = &pool.runs[(self + k) % participants];
+        for (;;) {
+            int chunk = SDL_AddAtomicInt(&run->next, 1);
+            if (chunk >= run->end) break;
+            int start = chunk * PARALLEL_CHUNK;
+            int end = pool.count - start < PARALLEL_CHUNK ? pool.count : start + PARALLEL_CHUNK;
+            pool.body(pool.context, start, end);
+        }
+    }
+}
+
+static int poolThread(void* data) {
+    int self = (int)(intptr_t)data;
+    SDL_LockMutex(pool.lock);
+    int seen = pool.startGeneration[self];
+    for (;;) {
+        while (pool.generation == seen && !pool.stopping) {
+            SDL_WaitCondition(pool.wake, pool.lock);
+        }
+        if (pool.stopping) break;
+        seen = pool.generation;
+        if (self >= pool.participants) continue;
+
+        SDL_UnlockMutex(pool.lock);
+        workOn(self);
+        SDL_LockMutex(pool.lock);
+        if (--pool.active == 0) SDL_SignalCondition(pool.done);
+    }
+    SDL_UnlockMutex(pool.lock);
+    return 0;
+}
+
+static int defaultThreads(void) {
+    const char* env = getenv("SHARO_THREADS");
+    int threads = env != NULL ? atoi(env) : SDL_GetNumLogicalCPUCores();
+    return threads < 1 ? 1 : threads;
+}
+
+void setParallelThreads(int count) {
+    if (count < 1) count = 1;
+    if (count > PARALLEL_MAX_THREADS) count = PARALLEL_MAX_THREADS;
+    SDL_SetAtomicInt(&pool.wanted, count);
+}
+
+int parallelThreads(void) {
+    if (SDL_GetAtomicInt(&pool.wanted) == 0) setParallelThreads(defaultThreads());
+    return SDL_GetAtomicInt(&pool.wanted);
+}
+
+// Create the lock and enough helpers for the wanted thread count; false if
+// the pool can't be used (SDL couldn't provide them)
+static bool preparePool(int participants) {
+    if (pool.lock == NULL) {
+        pool.lock = SDL_CreateMutex();
+        pool.wake = SDL_CreateCondition();
+        pool.done = SDL_CreateCondition();
+        if (pool.lock == NULL || pool.wake == NULL || pool.done == NULL) return false;
+    }
+    while (pool.threadCount < participants - 1) {
+        // Helper i is participant i + 1; the caller is participant 0
+        int self = pool.threadCount + 1;
+        pool.startGeneration[self] = pool.generation;
+        SDL_Thread* thread = SDL_CreateThread(poolThread, "sharo pool", (void*)(intptr_t)self);
+        if (thread == NULL) break;
+        pool.threads[pool.threadCount++] = thread;
+    }
+    return pool.threadCount > 0;
+}
+
+static void runSerially(int count, ParallelBody body, void* context) {
+    for (int start = 0; start < count; start += PARALLEL_CHUNK) {
+        int end = count - start < PARALLEL_CHUNK ? count : start + PARALLEL_CHUNK;
+        body(context, start, end);
+    }
+}
+
+void parallelFor(int count, ParallelBody body, void* context) {
+    int chunks = (count + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+    int participants = parallelThreads();
+    if (participants > chunks) participants = chunks;
+    if (chunks < PARALLEL_MIN_CHUNKS || participants < 2 ||
+        !SDL_CompareAndSwapAtomicInt(&pool.busy, 0, 1)) {
+        runSerially(count, body, context);
+        return;
+    }
+    if (!preparePool(participants)) {
+        SDL_SetAtomicInt(&pool.busy, 0);
+        runSerially(count, body, context);
+        return;
+    }
+    if (participants > pool.threadCount + 1) participants = pool.threadCount + 1;
+
+    SDL_LockMutex(pool.lock);
+    pool.count = count;
+    pool.body = body;
+    pool.context = context;
+    pool.participants = participants;
+    for (int i = 0; i < participants; i++) {
+        SDL_SetAtomicInt(&pool.runs[i].next, (int)((int64_t)chunks * i / participants));
+        pool.runs[i].end = (int)((int64_t)chunks * (i + 1) / participants);
+    }
+    pool.active = participants - 1;
+    pool.generation++;
+    SDL_BroadcastCondition(pool.wake);
+    SDL_UnlockMutex(pool.lock);
+
+    workOn(0);
+
+    SDL_LockMutex(pool.lock);
+    while (pool.active > 0) SDL_WaitCondition(pool.done, pool.lock);
+    SDL_UnlockMutex(pool.lock);
+    SDL_SetAtomicInt(&pool.busy, 0);
+}
+
+void freeParallel(void) {
+    // A worker VM still inside a job keeps the pool
+    if (pool.lock == NULL || !SDL_CompareAndSwapAtomicInt(&pool.busy, 0, 1)) return;
+    SDL_LockMutex(pool.lock);
+    pool.stopping = true;
+    SDL_BroadcastCondition(pool.wake);
+    SDL_UnlockMutex(pool.lock);
+    for (int i = 0; i < pool.threadCount; i++) {
+        SDL_WaitThread(pool.threads[i], NULL);
+    }
+    pool.threadCount = 0;
+    pool.stopping = false;
+    SDL_DestroyCondition(pool.done);
+    SDL_DestroyCondition(pool.wake);
+    SDL_DestroyMutex(pool.lock);
+    pool.lock = NULL;
+    SDL_SetAtomicInt(&pool.busy, 0);
+}
@@ -0,0 +1,33 @@
+#ifndef sharo_parallel_h
+#define sharo_parallel_h
+
+#include "common.h"
+
+// Fork-join pool for bulk typed-array work. A range is cut into chunks of
+// PARALLEL_CHUNK items; each thread takes an equal run of chunks and, once
+// its own run is done, steals chunks from the others until none are left.
+// Bodies run on pool threads, so they may only touch the memory they are
+// handed: no VM state, no allocation.
+
+// Items per chunk. Chunk boundaries never depend on the thread count, so a
+// reduction that combines per-chunk results in order gives the same answer
+// however many threads ran it.
+#define PARALLEL_CHUNK 4096
+
+// Work on [start, end), a whole number of chunks except at the very end
+typedef void (*ParallelBody)(void* context, int start, int end);
+
+// Run body over [0, count) and return when every chunk is done. Ranges
+// under a few chunks, and calls made while another thread's job holds the
+// pool, run serially on the calling thread.
+void parallelFor(int count, ParallelBody body, void* context);
+
+// Threads used per job, counting the caller. Defaults to SHARO_THREADS or
+// the number of logical cores.
+void setParallelThreads(int count);
+int parallelThreads(void);
+
+// Stop and join the pool threads
+void freeParallel(void);
+
+#endif
@@ -0,0 +1,364 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL3/SDL.h>
+
+#include "debug.h"
+#include "profiler.h"
+#include "vm.h"
+
+#define SAMPLE_INTERVAL_NS 1000000  // 1 ms
+#define CLOCK_CHECK_EVERY 128       // Instructions between clock reads
+#define MAX_STACK_TEXT 4096
+#define REPORT_ROWS 20
+
+// String-keyed accumulator for stacks and lines. Plain malloc, so the
+// profiler never shows up in the GC's byte count.
+typedef struct {
+    char* key;
+    uint32_t hash;
+    uint64_t samples;
+    uint64_t weightNs;
+} ProfileEntry;
+
+typedef struct {
+    int count;
+    int capacity;
+    ProfileEntry* entries;
+} ProfileMap;
+
+typedef struct {
+    NativeFn function;
+    uint64_t calls;
+    uint64_t totalNs;
+} NativeStat;
+
+static THREAD_LOCAL ProfileMap stacks;
+static THREAD_LOCAL ProfileMap lines;
+static THREAD_LOCAL NativeStat* natives = NULL;
+static THREAD_LOCAL int nativeCount = 0;
+static THREAD_LOCAL int nativeCapacity = 0;     // Power of two
+
+static THREAD_LOCAL uint64_t opcodeCounts[256];
+static THREAD_LOCAL uint64_t startNs;
+static THREAD_LOCAL uint64_t endNs;
+static THREAD_LOCAL uint64_t lastSampleNs;
+static THREAD_LOCAL uint64_t sampleCount;
+static THREAD_LOCAL uint64_t gcPauseStartUs;
+static THREAD_LOCAL uint64_t gcPauseUs;
+static THREAD_LOCAL uint64_t gcCountStart;
+static THREAD_LOCAL uint64_t gcCycles;
+static THREAD_LOCAL int countdown;
+
+// ============ Maps ============
+
+static uint32_t hashText(const char* text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)text[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static void freeMap(ProfileMap* map) {
+    for (int i = 0; i < map->capacity; i++) {
+        free(map->entries[i].key);
+    }
+    free(map->entries);
+    map->entries = NULL;
+    map->count = 0;
+    map->capacity = 0;
+}
+
+static ProfileEntry* findSlot(ProfileEntry* entries, int capacity,
+                              const char* key, uint32_t hash) {
+    uint32_t index = hash & (uint32_t)(capacity - 1);
+    for (;;) {
+        ProfileEntry* entry = &entries[index];
+        if (entry->key == NULL ||
+            (entry->hash == hash && strcmp(entry->key, key) == 0)) {
+            return entry;
+        }
+        index = (index + 1) & (uint32_t)(capacity - 1);
+    }
+}
+
+static bool growMap(ProfileMap* map) {
+    int capacity = map->capacity < 64 ? 64 : map->capacity * 2;
+    ProfileEntry* entries = calloc((size_t)capacity, sizeof(ProfileEntry));
+    if (entries == NULL) return false;
+    for (int i = 0; i < map->capacity; i++) {
+        ProfileEntry* old = &map->entries[i];
+        if (old->key == NULL) continue;
+        *findSlot(entries, capacity, old->key, old->hash) = *old;
+    }
+    free(map->entries);
+    map->entries = entries;
+    map->capacity = capacity;
+    return true;
+}
+
+static void addWeight(ProfileMap* map, const char* key, size_t length, uint64_t weightNs) {
+    if ((map->count + 1) * 4 > map->capacity * 3 && !growMap(map)) return;
+
+    uint32_t hash = hashText(key, length);
+    ProfileEntry* entry = findSlot(map->entries, map->capacity, key, hash);
+    if (entry->key == NULL) {
+        entry->key = malloc(length + 1);
+        if (entry->key == NULL) return;
+        memcpy(entry->key, key, length + 1);
+        entry->hash = hash;
+        map->count++;
+    }
+    entry->samples++;
+    entry->weightNs += weightNs;
+}
+
+static NativeStat* nativeStat(NativeFn function) {
+    if ((nativeCount + 1) * 2 > nativeCapacity) {
+        int capacity = nativeCapacity < 64 ? 64 : nativeCapacity * 2;
+        NativeStat* grown = calloc((size_t)capacity, sizeof(NativeStat));
+        if (grown == NULL) return NULL;
+        for (int i = 0; i < nativeCapacity; i++) {
+            if (natives[i].function == NULL) continue;
+            uint32_t index = hashText((const char*)&natives[i].function,
+                                      sizeof(NativeFn)) & (uint32_t)(capacity - 1);
+            while (grown[index].function != NULL) {
+                index = (index + 1) & (uint32_t)(capacity - 1);
+            }
+            grown[index] = natives[i];
+        }
+        free(natives);
+        natives = grown;
+        nativeCapacity = capacity;
+    }
+
+    uint32_t index = hashText((const char*)&function, sizeof(NativeFn)) &
+                     (uint32_t)(nativeCapacity - 1);
+    while (natives[index].function != NULL && natives[index].function != function) {
+        index = (index + 1) & (uint32_t)(nativeCapacity - 1);
+    }
+    if (natives[index].function == NULL) {
+        natives[index].function = function;
+        nativeCount++;
+    }
+    return &natives[index];
+}
+
+static void resetProfile(void) {
+    freeMap(&stacks);
+    freeMap(&lines);
+    free(natives);
+    natives = NULL;
+    nativeCount = 0;
+    nativeCapacity = 0;
+    memset(opcodeCounts, 0, sizeof(opcodeCounts));
+    sampleCount = 0;
+}
+
+// ============ Sampling ============
+
+static void takeSample(uint64_t now) {
+    uint64_t weight = now - lastSampleNs;
+    lastSampleNs = now;
+    sampleCount++;
+
+    char stack[MAX_STACK_TEXT];
+    size_t length = 0;
+    size_t leafStart = 0;
+    for (int i = 0; i < vm.frameCount; i++) {
+        ObjFunction* function = vm.frames[i].closure->function;
+        Chunk* chunk = function->chunk;
+        // ip is past the current instruction's opcode (or a call's operands)
+        int offset = (int)(vm.frames[i].ip - chunk->code) - 1;
+        if (offset < 0) offset = 0;
+        if (offset >= chunk->count) offset = chunk->count - 1;
+        int line = chunk->count > 0 ? chunk->lines[offset] : 0;
+        const char* name = function->name != NULL ? function->name->chars : "<script>";
+
+        size_t start = length + (i > 0 ? 1 : 0);
+        int written = snprintf(stack + length, sizeof(stack) - length, "%s%s:%d",
+                               i > 0 ? ";" : "", name, line);
+        if (written < 0 || length + (size_t)written >= sizeof(stack)) break;
+        leafStart = start;
+        length += (size_t)written;
+    }
+
+    addWeight(&stacks, stack, length, weight);
+    addWeight(&lines, stack + leafStart, length - leafStart, weight);
+}
+
+void profileInstruction(uint8_t instruction) {
+    opcodeCounts[instruction]++;
+    if (--countdown > 0) return;
+    countdown = CLOCK_CHECK_EVERY;
+
+    uint64_t now = SDL_GetTicksNS();
+    if (now - lastSampleNs >= SAMPLE_INTERVAL_NS) takeSample(now);
+}
+
+Value profileNativeCall(NativeFn native, int argCount, Value* args) {
+    uint64_t start = SDL_GetTicksNS();
+    Value result = native(argCount, args);
+    uint64_t elapsed = SDL_GetTicksNS() - start;
+
+    // profileStop() itself runs as a native
+    if (vm.profiling) {
+        NativeStat* stat = nativeStat(native);
+        if (stat != NULL) {
+            stat->calls++;
+            stat->totalNs += elapsed;
+        }
+        // Charge a long call to its call site right away
+        if (elapsed >= SAMPLE_INTERVAL_NS) countdown = 1;
+    }
+    return result;
+}
+
+// ============ Control ============
+
+void profileStart(void) {
+    resetProfile();
+    startNs = SDL_GetTicksNS();
+    lastSampleNs = startNs;
+    endNs = startNs;
+    countdown = CLOCK_CHECK_EVERY;
+    gcPauseStartUs = vm.gcTotalPauseUs;
+    gcCountStart = vm.gcCount;
+    gcPauseUs = 0;
+    gcCycles = 0;
+    vm.profiling = true;
+}
+
+void profileStop(void) {
+    if (!vm.profiling) return;
+    endNs = SDL_GetTicksNS();
+    if (vm.frameCount > 0 && endNs > lastSampleNs) takeSample(endNs);
+    gcPauseUs = vm.gcTotalPauseUs - gcPauseStartUs;
+    gcCycles = vm.gcCount - gcCountStart;
+    vm.profiling = false;
+}
+
+void profileSkip(void) {
+    lastSampleNs = SDL_GetTicksNS();
+}
+
+void freeProfiler(void) {
+    vm.profiling = false;
+    resetProfile();
+}
+
+// ============ Output ============
+
+static int compareEntries(const void* a, const void* b) {
+    const ProfileEntry* x = *(const ProfileEntry* const*)a;
+    const ProfileEntry* y = *(const ProfileEntry* const*)b;
+    if (x->weightNs != y->weightNs) return x->weightNs < y->weightNs ? 1 : -1;
+    return 0;
+}
+
+static int compareOpcodes(const void* a, const void* b) {
+    uint64_t x = opcodeCounts[*(const uint8_t*)a];
+    uint64_t y = opcodeCounts[*(const uint8_t*)b];
+    if (x != y) return x < y ? 1 : -1;
+    return 0;
+}
+
+static int compareNatives(const void* a, const void* b) {
+    const NativeStat* x = a;
+    const NativeStat* y = b;
+    if (x->totalNs != y->totalNs) return x->totalNs < y->totalNs ? 1 : -1;
+    return 0;
+}
+
+static const char* nativeName(NativeFn function) {
+    for (int i = 0; i < vm.globalValues.count; i++) {
+        Value value = vm.globalValues.values[i];
+        if (IS_NATIVE(value) && AS_NATIVE(value) == function) {
+            return AS_CSTRING(vm.globalNames.values[i]);
+        }
+    }
+    return "<native>";
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole > 0 ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+void profileReport(FILE* out) {
+    uint64_t end = vm.profiling ? SDL_GetTicksNS() : endNs;
+    uint64_t totalNs = end - startNs;
+    fprintf(out, "=== Profile: %.1f ms, %llu samples ===\n",
+            totalNs / 1e6, (unsigned long long)sampleCount);
+
+    // Hot lines, by time with the line on top of the stack
+    ProfileEntry** sorted = malloc(sizeof(ProfileEntry*) * (size_t)(lines.count + 1));
+    if (sorted != NULL) {
+        int count = 0;
+        for (int i = 0; i < lines.capacity; i++) {
+            if (lines.entries[i].key != NULL) sorted[count++] = &lines.entries[i];
+        }
+        qsort(sorted, (size_t)count, sizeof(ProfileEntry*), compareEntries);
+        fprintf(out, "\nHot lines (self time):\n");
+        fprintf(out, "%10s %6s %8s  %s\n", "ms", "%", "samples", "function:line");
+        for (int i = 0; i < count && i < REPORT_ROWS; i++) {
+            fprintf(out, "%10.2f %6.1f %8llu  %s\n", sorted[i]->weightNs / 1e6,
+                    percent(sorted[i]->weightNs, totalNs),
+                    (unsigned long long)sorted[i]->samples, sorted[i]->key);
+        }
+        free(sorted);
+    }
+
+    uint64_t instructions = 0;
+    uint8_t order[256];
+    for (int i = 0; i < 256; i++) {
+        order[i] = (uint8_t)i;
+        instructions += opcodeCounts[i];
+    }
+    qsort(order, 256, sizeof(uint8_t), compareOpcodes);
+    fprintf(out, "\nInstructions: %llu\n", (unsigned long long)instructions);
+    fprintf(out, "%14s %6s  %s\n", "count", "%", "opcode");
+    for (int i = 0; i < REPORT_ROWS && opcodeCounts[order[i]] > 0; i++) {
+        fprintf(out, "%14llu %6.1f  %s\n", (unsigned long long)opcodeCounts[order[i]],
+                percent(opcodeCounts[order[i]], instructions), opcodeName(order[i]));
+    }
+
+    if (nativeCount > 0) {
+        NativeStat* packed = malloc(sizeof(NativeStat) * (size_t)nativeCount);
+        if (packed != NULL) {
+            int count = 0;
+            for (int i = 0; i < nativeCapacity; i++) {
+                if (natives[i].function != NULL) packed[count++] = natives[i];
+            }
+            qsort(packed, (size_t)count, sizeof(NativeStat), compareNatives);
+            fprintf(out, "\nNatives:\n");
+            fprintf(out, "%10s %10s %6s %10s  %s\n", "calls", "ms", "%", "avg us", "name");
+            for (int i = 0; i < count && i < REPORT_ROWS; i++) {
+                fprintf(out, "%10llu %10.2f %6.1f %10.2f  %s\n",
+                        (unsigned long long)packed[i].calls, packed[i].totalNs / 1e6,
+                        percent(packed[i].totalNs, totalNs),
+                        packed[i].totalNs / 1e3 / (double)packed[i].calls,
+                        nativeName(packed[i].function));
+            }
+            free(packed);
+        }
+    }
+
+    uint64_t pauseUs = vm.profiling ? vm.gcTotalPauseUs - gcPauseStartUs : gcPauseUs;
+    uint64_t cycles = vm.profiling ? vm.gcCount - gcCountStart : gcCycles;
+    fprintf(out, "\nGC: %llu collections, %.2f ms paused (%.1f%%)\n",
+            (unsigned long long)cycles, pauseUs / 1e3, percent(pauseUs * 1000, totalNs));
+}
+
+bool profileWriteFolded(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return false;
+    for (int i = 0; i < stacks.capacity; i++) {
+        ProfileEntry* entry = &stacks.entries[i];
+        if (entry->key == NULL) continue;
+        uint64_t us = entry->weightNs / 1000;
+        fprintf(file, "%s %llu\n", entry->key, (unsigned long long)(us > 0 ? us : 1));
+    }
+    return fclose(file) == 0;
+}
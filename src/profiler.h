@@ -0,0 +1,37 @@
+#ifndef sharo_profiler_h
+#define sharo_profiler_h
+
+#include <stdio.h>
+
+#include "object.h"
+
+// Sampling profiler. While vm.profiling is set the interpreter dispatches
+// through a hook that counts every instruction and, about once per
+// millisecond, records the call stack (function and line per frame) weighted
+// by the time elapsed since the previous sample. Native calls are timed
+// individually. Results stay available after profileStop() until the next
+// profileStart().
+
+void profileStart(void);
+void profileStop(void);
+
+// Don't charge the time since the last sample to the next one (used after
+// compiling the entry script, which happens outside any frame)
+void profileSkip(void);
+
+// Per-instruction hook (the current frame's ip is just past the opcode)
+void profileInstruction(uint8_t instruction);
+
+// Call a native and charge its wall time to it
+Value profileNativeCall(NativeFn native, int argCount, Value* args);
+
+// Hot lines, opcode counts, native and GC time
+void profileReport(FILE* out);
+
+// Collapsed stacks ("outer:line;inner:line weight_us" per line), the input
+// format of flamegraph.pl and speedscope
+bool profileWriteFolded(const char* path);
+
+void freeProfiler(void);
+
+#endif
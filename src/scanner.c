@@ -10,7 +10,7 @@ typedef struct {
     int line;
 } Scanner;
 
-Scanner scanner;
+THREAD_LOCAL Scanner scanner;
 
 void initScanner(const char* source) {
     scanner.start = source;
@@ -0,0 +1,226 @@
+#include <math.h>
+#include <string.h>
+
+#include "memory.h"
+#include "spatial.h"
+
+// Cell coordinates are clamped so the neighbourhood arithmetic can't
+// overflow, whatever the positions
+#define CELL_LIMIT 1000000000.0
+
+static int32_t cellOf(double v, double cellSize) {
+    double cell = floor(v / cellSize);
+    if (!(cell > -CELL_LIMIT)) return (int32_t)-CELL_LIMIT;     // Also NaN
+    if (cell > CELL_LIMIT) return (int32_t)CELL_LIMIT;
+    return (int32_t)cell;
+}
+
+static int bucketOf(ObjSpatialGrid* grid, int32_t cx, int32_t cy) {
+    uint32_t hash = (uint32_t)cx * 73856093u ^ (uint32_t)cy * 19349663u;
+    return (int)(hash & (uint32_t)(grid->bucketCount - 1));
+}
+
+static void reserveEntries(ObjSpatialGrid* grid, int capacity) {
+    if (capacity <= grid->capacity) return;
+    int old = grid->capacity;
+    grid->xs = GROW_ARRAY(double, grid->xs, old, capacity);
+    grid->ys = GROW_ARRAY(double, grid->ys, old, capacity);
+    grid->sorted = GROW_ARRAY(int, grid->sorted, old, capacity);
+    grid->cellXs = GROW_ARRAY(int32_t, grid->cellXs, old, capacity);
+    grid->cellYs = GROW_ARRAY(int32_t, grid->cellYs, old, capacity);
+    grid->capacity = capacity;
+}
+
+static void addResult(ObjSpatialGrid* grid, int32_t value) {
+    if (grid->resultCount == grid->resultCapacity) {
+        int capacity = GROW_CAPACITY(grid->resultCapacity);
+        grid->results = GROW_ARRAY(int32_t, grid->results, grid->resultCapacity, capacity);
+        grid->resultCapacity = capacity;
+    }
+    grid->results[grid->resultCount++] = value;
+}
+
+// Counting sort of the entries by bucket: afterwards the ids in bucket b
+// are sorted[bucketStarts[b] .. bucketStarts[b + 1]), in ascending order
+static void rebuildIndex(ObjSpatialGrid* grid) {
+    int buckets = 16;
+    while (buckets < grid->count * 2) buckets *= 2;
+    if (buckets != grid->bucketCount) {
+        int oldSize = grid->bucketStarts == NULL ? 0 : grid->bucketCount + 1;
+        grid->bucketStarts = GROW_ARRAY(int, grid->bucketStarts, oldSize, buckets + 1);
+        grid->bucketCount = buckets;
+    }
+
+    int* starts = grid->bucketStarts;
+    memset(starts, 0, sizeof(int) * (size_t)(buckets + 1));
+    for (int i = 0; i < grid->count; i++) {
+        grid->cellXs[i] = cellOf(grid->xs[i], grid->cellSize);
+        grid->cellYs[i] = cellOf(grid->ys[i], grid->cellSize);
+        starts[bucketOf(grid, grid->cellXs[i], grid->cellYs[i])]++;
+    }
+    // Running totals give each bucket's end; filling backwards walks every
+    // end down to its start
+    for (int b = 1; b < buckets; b++) starts[b] += starts[b - 1];
+    starts[buckets] = grid->count;
+    for (int i = grid->count - 1; i >= 0; i--) {
+        grid->sorted[--starts[bucketOf(grid, grid->cellXs[i], grid->cellYs[i])]] = i;
+    }
+    grid->dirty = false;
+}
+
+static void ensureIndex(ObjSpatialGrid* grid) {
+    if (grid->dirty || grid->bucketCount == 0) rebuildIndex(grid);
+}
+
+void spatialClear(ObjSpatialGrid* grid) {
+    grid->count = 0;
+    grid->resultCount = 0;
+    grid->dirty = true;
+}
+
+int spatialInsert(ObjSpatialGrid* grid, double x, double y) {
+    if (grid->count == grid->capacity) {
+        reserveEntries(grid, GROW_CAPACITY(grid->capacity));
+    }
+    int id = grid->count++;
+    grid->xs[id] = x;
+    grid->ys[id] = y;
+    grid->dirty = true;
+    return id;
+}
+
+void spatialUpdate(ObjSpatialGrid* grid, int id, double x, double y) {
+    grid->xs[id] = x;
+    grid->ys[id] = y;
+    grid->dirty = true;
+}
+
+void spatialQueryPairs(ObjSpatialGrid* grid, double distance) {
+    grid->resultCount = 0;
+    if (!(distance > 0) || grid->count < 2) return;
+    double limit = distance * distance;
+    int count = grid->count;
+    const double* xs = grid->xs;
+    const double* ys = grid->ys;
+
+    // A distance many cells wide would visit more cells than there are
+    // entries; comparing every pair is cheaper then
+    double reach = ceil(distance / grid->cellSize);
+    if ((2 * reach + 1) * (2 * reach + 1) > count) {
+        for (int a = 0; a < count; a++) {
+            for (int b = a + 1; b < count; b++) {
+                double dx = xs[b] - xs[a];
+                double dy = ys[b] - ys[a];
+                if (dx * dx + dy * dy < limit) {
+                    addResult(grid, a);
+                    addResult(grid, b);
+                }
+            }
+        }
+        return;
+    }
+
+    ensureIndex(grid);
+    int k = (int)reach;
+    const int* starts = grid->bucketStarts;
+    for (int a = 0; a < count; a++) {
+        int32_t cx = grid->cellXs[a];
+        int32_t cy = grid->cellYs[a];
+        for (int32_t ty = cy - k; ty <= cy + k; ty++) {
+            for (int32_t tx = cx - k; tx <= cx + k; tx++) {
+                int bucket = bucketOf(grid, tx, ty);
+                for (int s = starts[bucket]; s < starts[bucket + 1]; s++) {
+                    int b = grid->sorted[s];
+                    // Other cells share buckets; the cell check keeps a
+                    // pair from being reported once per shared bucket
+                    if (b <= a || grid->cellXs[b] != tx || grid->cellYs[b] != ty) continue;
+                    double dx = xs[b] - xs[a];
+                    double dy = ys[b] - ys[a];
+                    if (dx * dx + dy * dy < limit) {
+                        addResult(grid, a);
+                        addResult(grid, b);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void spatialQueryRect(ObjSpatialGrid* grid, double x0, double y0,
+                      double x1, double y1) {
+    grid->resultCount = 0;
+    if (!(x0 <= x1) || !(y0 <= y1) || grid->count == 0) return;
+
+    int32_t cx0 = cellOf(x0, grid->cellSize);
+    int32_t cy0 = cellOf(y0, grid->cellSize);
+    int32_t cx1 = cellOf(x1, grid->cellSize);
+    int32_t cy1 = cellOf(y1, grid->cellSize);
+    double cells = ((double)cx1 - cx0 + 1) * ((double)cy1 - cy0 + 1);
+    if (cells > grid->count) {
+        for (int i = 0; i < grid->count; i++) {
+            if (grid->xs[i] >= x0 && grid->xs[i] <= x1 &&
+                grid->ys[i] >= y0 && grid->ys[i] <= y1) {
+                addResult(grid, i);
+            }
+        }
+        return;
+    }
+
+    ensureIndex(grid);
+    const int* starts = grid->bucketStarts;
+    for (int32_t ty = cy0; ty <= cy1; ty++) {
+        for (int32_t tx = cx0; tx <= cx1; tx++) {
+            int bucket = bucketOf(grid, tx, ty);
+            for (int s = starts[bucket]; s < starts[bucket + 1]; s++) {
+                int i = grid->sorted[s];
+                if (grid->cellXs[i] != tx || grid->cellYs[i] != ty) continue;
+                if (grid->xs[i] >= x0 && grid->xs[i] <= x1 &&
+                    grid->ys[i] >= y0 && grid->ys[i] <= y1) {
+                    addResult(grid, i);
+                }
+            }
+        }
+    }
+}
+
+int spatialResolve(ObjSpatialGrid* grid, double* xs, double* ys,
+                   double* vxs, double* vys, int count, double diameter) {
+    reserveEntries(grid, count);
+    memcpy(grid->xs, xs, sizeof(double) * (size_t)count);
+    memcpy(grid->ys, ys, sizeof(double) * (size_t)count);
+    grid->count = count;
+    grid->dirty = true;
+    spatialQueryPairs(grid, diameter);
+
+    // Pairs are resolved in order against the live positions, the same
+    // separate-and-reflect step as examples/cowllision.sharo
+    int collisions = 0;
+    for (int p = 0; p < grid->resultCount; p += 2) {
+        int a = grid->results[p];
+        int b = grid->results[p + 1];
+        double dx = xs[b] - xs[a];
+        double dy = ys[b] - ys[a];
+        double dist = sqrt(dx * dx + dy * dy);
+        if (dist >= diameter || dist <= 0.1) continue;
+
+        double nx = dx / dist;
+        double ny = dy / dist;
+        double overlap = (diameter - dist) / 2.0;
+        xs[a] -= nx * overlap;
+        ys[a] -= ny * overlap;
+        xs[b] += nx * overlap;
+        ys[b] += ny * overlap;
+
+        double dvn = (vxs[a] - vxs[b]) * nx + (vys[a] - vys[b]) * ny;
+        vxs[a] -= dvn * nx;
+        vys[a] -= dvn * ny;
+        vxs[b] += dvn * nx;
+        vys[b] += dvn * ny;
+        collisions++;
+    }
+
+    memcpy(grid->xs, xs, sizeof(double) * (size_t)count);
+    memcpy(grid->ys, ys, sizeof(double) * (size_t)count);
+    grid->dirty = true;
+    return collisions;
+}
@@ -0,0 +1,31 @@
+#ifndef sharo_spatial_h
+#define sharo_spatial_h
+
+#include "object.h"
+
+// Broadphase for ObjSpatialGrid. Entries are points with dense ids in
+// insertion order; queries leave their ids in grid->results. A query
+// looks ceil(distance / cellSize) cells around each entry, so a cell
+// about the size of the largest query distance keeps that to 3x3.
+
+void spatialClear(ObjSpatialGrid* grid);
+// Add a point and return its id
+int spatialInsert(ObjSpatialGrid* grid, double x, double y);
+void spatialUpdate(ObjSpatialGrid* grid, int id, double x, double y);
+
+// Pairs (a, b), a < b, whose points are closer than distance, flattened
+// as a0, b0, a1, b1, ...
+void spatialQueryPairs(ObjSpatialGrid* grid, double distance);
+
+// Ids of the points inside [x0, x1] x [y0, y1]
+void spatialQueryRect(ObjSpatialGrid* grid, double x0, double y0,
+                      double x1, double y1);
+
+// Replace the grid's points with count bodies, then push apart and bounce
+// every pair of circles of the given diameter that overlap. Body i is read
+// and written at xs[i], ys[i], vxs[i], vys[i]. Returns the number of
+// collisions resolved.
+int spatialResolve(ObjSpatialGrid* grid, double* xs, double* ys,
+                   double* vxs, double* vys, int count, double diameter);
+
+#endif
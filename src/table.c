@@ -1,6 +1,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "memory.h"
 #include "object.h"
 #include "table.h"
@@ -8,97 +12,239 @@
 
 #define TABLE_MAX_LOAD 0.75
 
+// ============ Control bytes ============
+// A full slot's control byte is the low 7 bits of its key's hash (H2); the
+// rest of the hash (H1) picks where probing starts. The first group of
+// control bytes is mirrored after the last, so a group load starting at
+// any slot reads GROUP_WIDTH bytes without wrapping.
+
+#define CTRL_EMPTY   0x80
+#define CTRL_DELETED 0xfe
+
+// Rehash once keys and tombstones fill 7/8 of the slots
+#define MAX_FILL_NUMERATOR 7
+#define MAX_FILL_DENOMINATOR 8
+
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((uint8_t)((hash) & 0x7f))
+
+#if defined(__SSE2__)
+
+#define GROUP_WIDTH 16
+typedef uint32_t GroupMask;
+
+static inline GroupMask matchByte(const uint8_t* group, uint8_t byte) {
+    __m128i control = _mm_loadu_si128((const __m128i*)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8((char)byte)));
+}
+
+static inline GroupMask matchEmpty(const uint8_t* group) {
+    return matchByte(group, CTRL_EMPTY);
+}
+
+// Only empty and deleted bytes have the high bit set
+static inline GroupMask matchFree(const uint8_t* group) {
+    return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+}
+
+static inline int maskFirst(GroupMask mask) {
+    return __builtin_ctz(mask);
+}
+
+#else
+
+// Portable fallback: eight control bytes per 64-bit word, matched with
+// bit tricks. A match sets the high bit of the matching byte.
+#define GROUP_WIDTH 8
+typedef uint64_t GroupMask;
+
+#define LSBS 0x0101010101010101ULL
+#define MSBS 0x8080808080808080ULL
+
+static inline uint64_t loadGroup(const uint8_t* group) {
+    uint64_t word = 0;
+    for (int i = 0; i < 8; i++) word |= (uint64_t)group[i] << (8 * i);
+    return word;
+}
+
+// May report a false match next to a true one; callers compare keys
+static inline GroupMask matchByte(const uint8_t* group, uint8_t byte) {
+    uint64_t x = loadGroup(group) ^ (LSBS * byte);
+    return (x - LSBS) & ~x & MSBS;
+}
+
+// Empty is 0x80 and deleted 0xfe: empty is the free byte with bit 1 clear
+static inline GroupMask matchEmpty(const uint8_t* group) {
+    uint64_t word = loadGroup(group);
+    return word & ~(word << 6) & MSBS;
+}
+
+static inline GroupMask matchFree(const uint8_t* group) {
+    return loadGroup(group) & MSBS;
+}
+
+static inline int maskFirst(GroupMask mask) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(mask) >> 3;
+#else
+    int index = 0;
+    while ((mask & 0x80) == 0) {
+        mask >>= 8;
+        index++;
+    }
+    return index;
+#endif
+}
+
+#endif
+
+static inline void setControl(Table* table, int index, uint8_t byte) {
+    table->control[index] = byte;
+    if (index < GROUP_WIDTH) table->control[table->capacity + index] = byte;
+}
+
+// Probe sequence over groups: start at H1, then jump 1, 2, 3... groups
+// further. With a power-of-two slot count this visits every group.
+#define PROBE_START(table, hash) ((int)(H1(hash) & (uint32_t)((table)->capacity - 1)))
+#define PROBE_NEXT(table, position, stride) \
+    (((position) + ((stride) += GROUP_WIDTH)) & ((table)->capacity - 1))
+
 void initTable(Table* table) {
     table->count = 0;
+    table->tombstones = 0;
     table->capacity = 0;
+    table->control = NULL;
     table->entries = NULL;
 }
 
 void freeTable(Table* table) {
+    if (table->capacity > 0) {
+        FREE_ARRAY(uint8_t, table->control, table->capacity + GROUP_WIDTH);
+    }
     FREE_ARRAY(Entry, table->entries, table->capacity);
     initTable(table);
 }
 
-static Entry* findEntry(Entry* entries, int capacity, ObjString* key) {
-    uint32_t index = key->hash & (capacity - 1);
-    Entry* tombstone = NULL;
-
+// Index of key's slot, or -1
+static int findSlot(Table* table, ObjString* key) {
+    uint32_t hash = key->hash;
+    uint8_t fragment = H2(hash);
+    int position = PROBE_START(table, hash);
+    int stride = 0;
     for (;;) {
-        Entry* entry = &entries[index];
-        if (entry->key == NULL) {
-            if (IS_NIL(entry->value)) {
-                // Empty entry
-                return tombstone != NULL ? tombstone : entry;
-            } else {
-                // Tombstone
-                if (tombstone == NULL) tombstone = entry;
-            }
-        } else if (entry->key == key) {
-            // Found the key
-            return entry;
+        const uint8_t* group = &table->control[position];
+        GroupMask mask = matchByte(group, fragment);
+        while (mask != 0) {
+            int index = (position + maskFirst(mask)) & (table->capacity - 1);
+            if (table->entries[index].key == key) return index;
+            mask &= mask - 1;
         }
+        if (matchEmpty(group) != 0) return -1;
+        position = PROBE_NEXT(table, position, stride);
+    }
+}
 
-        index = (index + 1) & (capacity - 1);
+// First empty or deleted slot on hash's probe sequence
+static int findFreeSlot(Table* table, uint32_t hash) {
+    int position = PROBE_START(table, hash);
+    int stride = 0;
+    for (;;) {
+        GroupMask mask = matchFree(&table->control[position]);
+        if (mask != 0) return (position + maskFirst(mask)) & (table->capacity - 1);
+        position = PROBE_NEXT(table, position, stride);
     }
 }
 
 bool tableGet(Table* table, ObjString* key, Value* value) {
     if (table->count == 0) return false;
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    int index = findSlot(table, key);
+    if (index < 0) return false;
 
-    *value = entry->value;
+    *value = table->entries[index].value;
     return true;
 }
 
-static void adjustCapacity(Table* table, int capacity) {
+// Reinsert every key into fresh arrays of the given size, dropping
+// tombstones
+static void resize(Table* table, int capacity) {
+    uint8_t* control = ALLOCATE(uint8_t, capacity + GROUP_WIDTH);
     Entry* entries = ALLOCATE(Entry, capacity);
+    memset(control, CTRL_EMPTY, (size_t)(capacity + GROUP_WIDTH));
     for (int i = 0; i < capacity; i++) {
         entries[i].key = NULL;
         entries[i].value = NIL_VAL;
     }
 
-    table->count = 0;
-    for (int i = 0; i < table->capacity; i++) {
-        Entry* entry = &table->entries[i];
+    Table old = *table;
+    table->control = control;
+    table->entries = entries;
+    table->capacity = capacity;
+    table->tombstones = 0;
+    for (int i = 0; i < old.capacity; i++) {
+        Entry* entry = &old.entries[i];
         if (entry->key == NULL) continue;
 
-        Entry* dest = findEntry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
-        table->count++;
+        int index = findFreeSlot(table, entry->key->hash);
+        setControl(table, index, H2(entry->key->hash));
+        table->entries[index] = *entry;
     }
 
-    FREE_ARRAY(Entry, table->entries, table->capacity);
-    table->entries = entries;
-    table->capacity = capacity;
+    if (old.capacity > 0) {
+        FREE_ARRAY(uint8_t, old.control, old.capacity + GROUP_WIDTH);
+    }
+    FREE_ARRAY(Entry, old.entries, old.capacity);
+}
+
+// Make room for one more key. Mostly-tombstone tables are rehashed at the
+// same size rather than grown.
+static void reserveOne(Table* table) {
+    if ((table->count + table->tombstones + 1) * MAX_FILL_DENOMINATOR <=
+        table->capacity * MAX_FILL_NUMERATOR) {
+        return;
+    }
+    int capacity = table->capacity < GROUP_WIDTH ? GROUP_WIDTH : table->capacity;
+    // Leave the keys at most 7/16 full after the rehash
+    while ((table->count + 1) * 2 * MAX_FILL_DENOMINATOR > capacity * MAX_FILL_NUMERATOR) {
+        capacity *= 2;
+    }
+    resize(table, capacity);
 }
 
 bool tableSet(Table* table, ObjString* key, Value value) {
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        int capacity = GROW_CAPACITY(table->capacity);
-        adjustCapacity(table, capacity);
+    if (table->count > 0) {
+        int index = findSlot(table, key);
+        if (index >= 0) {
+            table->entries[index].value = value;
+            return false;
+        }
     }
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    bool isNewKey = entry->key == NULL;
-    if (isNewKey && IS_NIL(entry->value)) table->count++;
+    reserveOne(table);
+    int index = findFreeSlot(table, key->hash);
+    if (table->control[index] == CTRL_DELETED) table->tombstones--;
+    setControl(table, index, H2(key->hash));
+    table->entries[index].key = key;
+    table->entries[index].value = value;
+    table->count++;
+    return true;
+}
 
-    entry->key = key;
-    entry->value = value;
-    return isNewKey;
+static void deleteSlot(Table* table, int index) {
+    setControl(table, index, CTRL_DELETED);
+    table->entries[index].key = NULL;
+    table->entries[index].value = NIL_VAL;
+    table->count--;
+    table->tombstones++;
 }
 
 bool tableDelete(Table* table, ObjString* key) {
     if (table->count == 0) return false;
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    int index = findSlot(table, key);
+    if (index < 0) return false;
 
-    // Place tombstone
-    entry->key = NULL;
-    entry->value = BOOL_VAL(true);
+    deleteSlot(table, index);
     return true;
 }
 
@@ -114,20 +260,24 @@ void tableAddAll(Table* from, Table* to) {
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
     if (table->count == 0) return NULL;
 
-    uint32_t index = hash & (table->capacity - 1);
+    uint8_t fragment = H2(hash);
+    int position = PROBE_START(table, hash);
+    int stride = 0;
     for (;;) {
-        Entry* entry = &table->entries[index];
-        if (entry->key == NULL) {
-            // Stop if we find an empty non-tombstone entry
-            if (IS_NIL(entry->value)) return NULL;
-        } else if (entry->key->length == length &&
-                   entry->key->hash == hash &&
-                   memcmp(entry->key->chars, chars, length) == 0) {
-            // Found it
-            return entry->key;
+        const uint8_t* group = &table->control[position];
+        GroupMask mask = matchByte(group, fragment);
+        while (mask != 0) {
+            int index = (position + maskFirst(mask)) & (table->capacity - 1);
+            ObjString* key = table->entries[index].key;
+            // A matching fragment is only 7 bits of evidence
+            if (key != NULL && key->hash == hash && key->length == length &&
+                memcmp(key->chars, chars, (size_t)length) == 0) {
+                return key;
+            }
+            mask &= mask - 1;
         }
-
-        index = (index + 1) & (table->capacity - 1);
+        if (matchEmpty(group) != 0) return NULL;
+        position = PROBE_NEXT(table, position, stride);
     }
 }
 
@@ -135,12 +285,145 @@ void tableRemoveWhite(Table* table) {
     for (int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
         if (entry->key != NULL && !entry->key->obj.isMarked) {
-            tableDelete(table, entry->key);
+            deleteSlot(table, i);
         }
     }
 }
 
 void markTable(Table* table) {
-    (void)table;
-    // Will be implemented with GC
+    for (int i = 0; i < table->capacity; i++) {
+        Entry* entry = &table->entries[i];
+        markObject((Obj*)entry->key);
+        markValue(entry->value);
+    }
+}
+
+// ============ Value-keyed tables ============
+
+static uint32_t hashBits(uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+static uint32_t hashValue(Value key) {
+    if (IS_OBJ(key)) {
+        if (AS_OBJ(key)->type == OBJ_STRING) return stringHash(AS_STRING(key));
+        return hashBits((uint64_t)(uintptr_t)AS_OBJ(key));
+    }
+    if (IS_INT(key)) return hashBits((uint64_t)AS_INT(key));
+    if (IS_FLOAT(key)) {
+        double d = AS_FLOAT(key);
+        // Whole floats equal the int key, so they must hash like it
+        if (d > -9.2e18 && d < 9.2e18 && d == (double)(int64_t)d) {
+            return hashBits((uint64_t)(int64_t)d);
+        }
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        return hashBits(bits);
+    }
+    if (IS_BOOL(key)) return AS_BOOL(key) ? 0x9e3779b9u : 0x7f4a7c15u;
+    return hashBits((uint64_t)(uintptr_t)AS_PTR(key));
+}
+
+void initValueTable(ValueTable* table) {
+    table->count = 0;
+    table->size = 0;
+    table->capacity = 0;
+    table->entries = NULL;
+}
+
+void freeValueTable(ValueTable* table) {
+    FREE_ARRAY(ValueEntry, table->entries, table->capacity);
+    initValueTable(table);
+}
+
+static ValueEntry* findValueEntry(ValueEntry* entries, int capacity, Value key) {
+    uint32_t index = hashValue(key) & (capacity - 1);
+    ValueEntry* tombstone = NULL;
+
+    for (;;) {
+        ValueEntry* entry = &entries[index];
+        if (IS_NIL(entry->key)) {
+            if (IS_NIL(entry->value)) {
+                return tombstone != NULL ? tombstone : entry;
+            } else if (tombstone == NULL) {
+                tombstone = entry;
+            }
+        } else if (valuesEqual(entry->key, key)) {
+            return entry;
+        }
+
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+bool valueTableGet(ValueTable* table, Value key, Value* value) {
+    if (table->count == 0 || IS_NIL(key)) return false;
+
+    ValueEntry* entry = findValueEntry(table->entries, table->capacity, key);
+    if (IS_NIL(entry->key)) return false;
+
+    *value = entry->value;
+    return true;
+}
+
+static void adjustValueCapacity(ValueTable* table, int capacity) {
+    ValueEntry* entries = ALLOCATE(ValueEntry, capacity);
+    for (int i = 0; i < capacity; i++) {
+        entries[i].key = NIL_VAL;
+        entries[i].value = NIL_VAL;
+    }
+
+    table->count = 0;
+    for (int i = 0; i < table->capacity; i++) {
+        ValueEntry* entry = &table->entries[i];
+        if (IS_NIL(entry->key)) continue;
+
+        ValueEntry* dest = findValueEntry(entries, capacity, entry->key);
+        dest->key = entry->key;
+        dest->value = entry->value;
+        table->count++;
+    }
+
+    FREE_ARRAY(ValueEntry, table->entries, table->capacity);
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+// The caller rejects nil keys
+bool valueTableSet(ValueTable* table, Value key, Value value) {
+    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
+        adjustValueCapacity(table, GROW_CAPACITY(table->capacity));
+    }
+
+    ValueEntry* entry = findValueEntry(table->entries, table->capacity, key);
+    bool isNewKey = IS_NIL(entry->key);
+    if (isNewKey && IS_NIL(entry->value)) table->count++;
+    if (isNewKey) table->size++;
+
+    entry->key = key;
+    entry->value = value;
+    return isNewKey;
+}
+
+bool valueTableDelete(ValueTable* table, Value key) {
+    if (table->count == 0 || IS_NIL(key)) return false;
+
+    ValueEntry* entry = findValueEntry(table->entries, table->capacity, key);
+    if (IS_NIL(entry->key)) return false;
+
+    entry->key = NIL_VAL;
+    entry->value = BOOL_VAL(true);
+    table->size--;
+    return true;
+}
+
+void markValueTable(ValueTable* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        ValueEntry* entry = &table->entries[i];
+        markValue(entry->key);
+        markValue(entry->value);
+    }
 }
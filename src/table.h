@@ -4,17 +4,39 @@
 #include "common.h"
 #include "value.h"
 
+// String-keyed table, laid out like a SwissTable: one control byte per
+// slot holds 7 bits of the key's hash (or marks the slot empty or deleted),
+// so a probe tests a whole group of slots against the hash fragment at
+// once and only touches entries whose fragment matches. Empty and deleted
+// slots have a NULL key in entries.
 typedef struct {
     ObjString* key;
     Value value;
 } Entry;
 
 typedef struct {
-    int count;
-    int capacity;
+    int count;                  // Keys
+    int tombstones;             // Deleted slots not yet reused
+    int capacity;               // Slots: 0 or a power of two, at least a group
+    uint8_t* control;           // capacity plus one group of bytes (see table.c)
     Entry* entries;
 } Table;
 
+// Keyed by any Value but nil (nil marks an empty slot), for maps. Keys
+// compare with valuesEqual, so 1 and 1.0 are the same key; strings are
+// interned, and other objects are keys by identity.
+typedef struct {
+    Value key;
+    Value value;
+} ValueEntry;
+
+typedef struct {
+    int count;                  // Keys and tombstones, for the load factor
+    int size;                   // Keys
+    int capacity;
+    ValueEntry* entries;
+} ValueTable;
+
 void initTable(Table* table);
 void freeTable(Table* table);
 bool tableGet(Table* table, ObjString* key, Value* value);
@@ -25,4 +47,11 @@ ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t
 void tableRemoveWhite(Table* table);
 void markTable(Table* table);
 
+void initValueTable(ValueTable* table);
+void freeValueTable(ValueTable* table);
+bool valueTableGet(ValueTable* table, Value key, Value* value);
+bool valueTableSet(ValueTable* table, Value key, Value value);
+bool valueTableDelete(ValueTable* table, Value key);
+void markValueTable(ValueTable* table);
+
 #endif
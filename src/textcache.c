@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "textcache.h"
+
+// Power of two, so a hash maps to a bucket with a mask
+#define TEXT_BUCKETS 1024
+#define WIDTH_SLOTS 1024
+
+typedef struct TextEntry {
+    SDL_Renderer* renderer;
+    TTF_Font* font;
+    SDL_Color color;
+    uint32_t hash;
+    int length;
+    char* chars;                // Own copy: the ObjString may be collected
+
+    SDL_Texture* texture;
+    float w;
+    float h;
+    size_t bytes;
+
+    struct TextEntry* chain;    // Next in bucket
+    struct TextEntry* newer;    // LRU list, newest at lruHead
+    struct TextEntry* older;
+} TextEntry;
+
+typedef struct {
+    TTF_Font* font;
+    uint32_t hash;
+    int length;
+    char* chars;
+    int width;
+} WidthSlot;
+
+static TextEntry* buckets[TEXT_BUCKETS];
+static TextEntry* lruHead = NULL;
+static TextEntry* lruTail = NULL;
+static WidthSlot widths[WIDTH_SLOTS];
+
+static int maxEntries = TEXT_CACHE_DEFAULT_ENTRIES;
+static size_t maxBytes = TEXT_CACHE_DEFAULT_BYTES;
+static TextCacheStats stats;
+
+static uint32_t mixPointer(uint32_t hash, const void* pointer) {
+    uintptr_t bits = (uintptr_t)pointer;
+    hash ^= (uint32_t)(bits >> 4) * 2654435761u;
+    hash ^= (uint32_t)((uint64_t)bits >> 32);
+    return hash;
+}
+
+static uint32_t entryHash(SDL_Renderer* renderer, TTF_Font* font,
+                          ObjString* text, SDL_Color color) {
+    uint32_t hash = mixPointer(stringHash(text), font);
+    hash = mixPointer(hash, renderer);
+    hash ^= ((uint32_t)color.r << 24 | (uint32_t)color.g << 16 |
+             (uint32_t)color.b << 8 | color.a) * 40503u;
+    return hash;
+}
+
+static char* copyChars(ObjString* text) {
+    char* chars = malloc((size_t)text->length + 1);
+    if (chars == NULL) return NULL;
+    memcpy(chars, text->chars, (size_t)text->length);
+    chars[text->length] = '\0';
+    return chars;
+}
+
+// ============ LRU list ============
+
+static void unlinkLru(TextEntry* entry) {
+    if (entry->newer != NULL) entry->newer->older = entry->older;
+    else lruHead = entry->older;
+    if (entry->older != NULL) entry->older->newer = entry->newer;
+    else lruTail = entry->newer;
+    entry->newer = NULL;
+    entry->older = NULL;
+}
+
+static void pushLru(TextEntry* entry) {
+    entry->newer = NULL;
+    entry->older = lruHead;
+    if (lruHead != NULL) lruHead->newer = entry;
+    lruHead = entry;
+    if (lruTail == NULL) lruTail = entry;
+}
+
+static void removeEntry(TextEntry* entry) {
+    TextEntry** link = &buckets[entry->hash & (TEXT_BUCKETS - 1)];
+    while (*link != entry) link = &(*link)->chain;
+    *link = entry->chain;
+
+    unlinkLru(entry);
+    stats.entries--;
+    stats.bytes -= entry->bytes;
+    SDL_DestroyTexture(entry->texture);
+    free(entry->chars);
+    free(entry);
+}
+
+static void enforceLimits(void) {
+    // The newest entry always stays, even if it alone exceeds maxBytes
+    while (lruTail != NULL && lruTail != lruHead &&
+           (stats.entries > maxEntries || stats.bytes > maxBytes)) {
+        removeEntry(lruTail);
+        stats.evictions++;
+    }
+}
+
+// ============ Public API ============
+
+bool textCacheDraw(SDL_Renderer* renderer, TTF_Font* font, ObjString* text,
+                   SDL_Color color, float x, float y) {
+    uint32_t hash = entryHash(renderer, font, text, color);
+    TextEntry* entry = buckets[hash & (TEXT_BUCKETS - 1)];
+    while (entry != NULL) {
+        if (entry->hash == hash && entry->renderer == renderer &&
+            entry->font == font && entry->length == text->length &&
+            entry->color.r == color.r && entry->color.g == color.g &&
+            entry->color.b == color.b && entry->color.a == color.a &&
+            memcmp(entry->chars, text->chars, (size_t)text->length) == 0) {
+            break;
+        }
+        entry = entry->chain;
+    }
+
+    if (entry != NULL) {
+        stats.hits++;
+        if (entry != lruHead) {
+            unlinkLru(entry);
+            pushLru(entry);
+        }
+    } else {
+        stats.misses++;
+        SDL_Surface* surface = TTF_RenderText_Blended(font, text->chars,
+                                                      (size_t)text->length, color);
+        if (surface == NULL) return false;
+        SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
+        SDL_DestroySurface(surface);
+        if (texture == NULL) return false;
+
+        entry = malloc(sizeof(TextEntry));
+        char* chars = copyChars(text);
+        if (entry == NULL || chars == NULL) {
+            // Out of memory: draw once, uncached
+            free(entry);
+            free(chars);
+            float w, h;
+            SDL_GetTextureSize(texture, &w, &h);
+            SDL_FRect dest = {x, y, w, h};
+            SDL_RenderTexture(renderer, texture, NULL, &dest);
+            SDL_DestroyTexture(texture);
+            return true;
+        }
+
+        entry->renderer = renderer;
+        entry->font = font;
+        entry->color = color;
+        entry->hash = hash;
+        entry->length = text->length;
+        entry->chars = chars;
+        entry->texture = texture;
+        SDL_GetTextureSize(texture, &entry->w, &entry->h);
+        entry->bytes = (size_t)entry->w * (size_t)entry->h * 4;
+
+        TextEntry** bucket = &buckets[hash & (TEXT_BUCKETS - 1)];
+        entry->chain = *bucket;
+        *bucket = entry;
+        pushLru(entry);
+        stats.entries++;
+        stats.bytes += entry->bytes;
+        enforceLimits();
+    }
+
+    SDL_FRect dest = {x, y, entry->w, entry->h};
+    SDL_RenderTexture(renderer, entry->texture, NULL, &dest);
+    return true;
+}
+
+int textCacheWidth(TTF_Font* font, ObjString* text) {
+    uint32_t hash = mixPointer(stringHash(text), font);
+    WidthSlot* slot = &widths[hash & (WIDTH_SLOTS - 1)];
+    if (slot->chars != NULL && slot->hash == hash && slot->font == font &&
+        slot->length == text->length &&
+        memcmp(slot->chars, text->chars, (size_t)text->length) == 0) {
+        stats.widthHits++;
+        return slot->width;
+    }
+
+    stats.widthMisses++;
+    int w = 0, h = 0;
+    TTF_GetStringSize(font, text->chars, (size_t)text->length, &w, &h);
+
+    // Direct-mapped: a colliding string simply replaces the old one
+    char* chars = copyChars(text);
+    if (chars != NULL) {
+        free(slot->chars);
+        slot->font = font;
+        slot->hash = hash;
+        slot->length = text->length;
+        slot->chars = chars;
+        slot->width = w;
+    }
+    return w;
+}
+
+void textCacheForgetFont(TTF_Font* font) {
+    TextEntry* entry = lruHead;
+    while (entry != NULL) {
+        TextEntry* older = entry->older;
+        if (entry->font == font) removeEntry(entry);
+        entry = older;
+    }
+    for (int i = 0; i < WIDTH_SLOTS; i++) {
+        if (widths[i].chars != NULL && widths[i].font == font) {
+            free(widths[i].chars);
+            widths[i].chars = NULL;
+        }
+    }
+}
+
+void textCacheForgetRenderer(SDL_Renderer* renderer) {
+    TextEntry* entry = lruHead;
+    while (entry != NULL) {
+        TextEntry* older = entry->older;
+        if (entry->renderer == renderer) removeEntry(entry);
+        entry = older;
+    }
+}
+
+void textCacheClear(void) {
+    while (lruHead != NULL) removeEntry(lruHead);
+    for (int i = 0; i < WIDTH_SLOTS; i++) {
+        free(widths[i].chars);
+        widths[i].chars = NULL;
+    }
+}
+
+void textCacheSetLimits(int entries, size_t bytes) {
+    maxEntries = entries < 1 ? 1 : entries;
+    maxBytes = bytes;
+    enforceLimits();
+}
+
+TextCacheStats textCacheStats(void) {
+    return stats;
+}
@@ -0,0 +1,40 @@
+#ifndef sharo_textcache_h
+#define sharo_textcache_h
+
+#include <SDL3/SDL.h>
+#include <SDL3_ttf/SDL_ttf.h>
+#include "object.h"
+
+// Rendered-text cache behind drawText and getTextWidth. Textures are kept
+// per (renderer, font, string, color) and evicted least-recently-used once
+// either limit is exceeded; measured widths live in a fixed-size table.
+
+#define TEXT_CACHE_DEFAULT_ENTRIES 512
+#define TEXT_CACHE_DEFAULT_BYTES (32 * 1024 * 1024)
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    int entries;
+    size_t bytes;               // Estimated texture memory (w * h * 4)
+    uint64_t widthHits;
+    uint64_t widthMisses;
+} TextCacheStats;
+
+// Draw text at (x, y), rasterizing and uploading it only on a cache miss
+bool textCacheDraw(SDL_Renderer* renderer, TTF_Font* font, ObjString* text,
+                   SDL_Color color, float x, float y);
+
+// Pixel width of text in font
+int textCacheWidth(TTF_Font* font, ObjString* text);
+
+// Drop everything cached for a font or renderer before it is destroyed
+void textCacheForgetFont(TTF_Font* font);
+void textCacheForgetRenderer(SDL_Renderer* renderer);
+
+void textCacheClear(void);
+void textCacheSetLimits(int maxEntries, size_t maxBytes);
+TextCacheStats textCacheStats(void);
+
+#endif
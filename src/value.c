@@ -74,8 +74,10 @@ bool valuesEqual(Value a, Value b) {
     if (IS_NUMBER(a) && IS_NUMBER(b)) {
         return AS_NUMBER(a) == AS_NUMBER(b);
     }
-    // For everything else (bool, nil, obj, ptr), bit equality works
-    return a == b;
+    // For everything else (bool, nil, obj, ptr), bit equality works,
+    // except that a string slice equals the string with the same chars
+    if (a == b) return true;
+    return IS_STRING(a) && IS_STRING(b) && stringsEqual(AS_STRING(a), AS_STRING(b));
 #else
     // Different types are never equal (except int/float comparison)
     if (a.type != b.type) {
@@ -92,7 +94,9 @@ bool valuesEqual(Value a, Value b) {
         case VAL_INT:    return AS_INT(a) == AS_INT(b);
         case VAL_FLOAT:  return AS_FLOAT(a) == AS_FLOAT(b);
         case VAL_PTR:    return AS_PTR(a) == AS_PTR(b);
-        case VAL_OBJ:    return AS_OBJ(a) == AS_OBJ(b); // Pointer comparison (interned strings)
+        case VAL_OBJ:
+            if (AS_OBJ(a) == AS_OBJ(b)) return true; // Interned strings are identical
+            return IS_STRING(a) && IS_STRING(b) && stringsEqual(AS_STRING(a), AS_STRING(b));
         default:         return false;
     }
 #endif
@@ -16,25 +16,40 @@
 // Directory operations (POSIX)
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#else
+#include <poll.h>
+#endif
 
 #include <SDL3/SDL.h>
 #include <SDL3_ttf/SDL_ttf.h>
 #include <SDL3_image/SDL_image.h>
 
 #include "common.h"
+#include "bytecode.h"
 #include "chunk.h"
 #include "compiler.h"
+#include "assets.h"
 #include "debug.h"
 #include "memory.h"
 #include "object.h"
+#include "optimizer.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "spatial.h"
 #include "table.h"
+#include "textcache.h"
 #include "value.h"
 #include "vm.h"
 
-VM vm;
+THREAD_LOCAL VM vm;
 
-// Forward declaration
+// Forward declarations
 static ObjString* valueToString(Value value);
+static int valueText(Value value, char* buffer, size_t size);
 
 // Read file for module loading
 static char* readFile(const char* path) {
@@ -59,6 +74,24 @@ static char* readFile(const char* path) {
     return buffer;
 }
 
+// Top-level function of an imported module, from its .sharoc cache when
+// that is fresh. *found is false when the source can't be read.
+static ObjFunction* compileModule(const char* path, bool* found) {
+    *found = true;
+    ObjFunction* function = loadCachedModule(path);
+    if (function != NULL) return function;
+
+    char* source = readFile(path);
+    if (source == NULL) {
+        *found = false;
+        return NULL;
+    }
+    function = compile(source);
+    if (function != NULL) saveCachedModule(path, source, function);
+    free(source);
+    return function;
+}
+
 static void resetStack(void) {
     vm.stackTop = vm.stack;
     vm.frameCount = 0;
@@ -87,6 +120,15 @@ static void runtimeError(const char* format, ...) {
     resetStack();
 }
 
+// For natives rejecting their arguments: report a runtime error, after
+// which the call fails and the script stops like on any other runtime
+// error. Returns nil for the native to return.
+static Value nativeError(const char* message) {
+    runtimeError("%s", message);
+    vm.nativeFailed = true;
+    return NIL_VAL;
+}
+
 // Native function: clock()
 static Value clockNative(int argCount, Value* args) {
     (void)argCount;
@@ -171,12 +213,80 @@ static Value typeNative(int argCount, Value* args) {
     else if (IS_STRING(args[0])) name = "str";
     else if (IS_ARRAY(args[0])) name = "array";
     else if (IS_STRUCT(args[0])) name = "struct";
+    else if (IS_STRING_BUILDER(args[0])) name = "builder";
+    else if (IS_TYPED_ARRAY(args[0])) name = "typedarray";
+    else if (IS_STRUCT_ARRAY(args[0])) name = "structarray";
+    else if (IS_SPATIAL_GRID(args[0])) name = "spatialgrid";
+    else if (IS_MAP(args[0])) name = "map";
+    else if (IS_CHANNEL(args[0])) name = "channel";
+    else if (IS_ASSET(args[0])) name = "asset";
     else if (IS_FUNCTION(args[0]) || IS_CLOSURE(args[0])) name = "function";
     else name = "unknown";
 
     return OBJ_VAL(copyString(name, (int)strlen(name)));
 }
 
+// ============ GC Native Functions ============
+
+// gcStats() -> array [collections, bytesAllocated, nextGC, lastPauseUs, maxPauseUs, totalPauseUs, lastFreed]
+static Value gcStatsNative(int argCount, Value* args) {
+    (void)argCount;
+    (void)args;
+    ObjArray* arr = newArray();
+    push(OBJ_VAL(arr)); // GC protection
+    writeArray(arr, INT_VAL((int64_t)vm.gcCount));
+    writeArray(arr, INT_VAL((int64_t)vm.bytesAllocated));
+    writeArray(arr, INT_VAL((int64_t)vm.nextGC));
+    writeArray(arr, INT_VAL((int64_t)vm.gcLastPauseUs));
+    writeArray(arr, INT_VAL((int64_t)vm.gcMaxPauseUs));
+    writeArray(arr, INT_VAL((int64_t)vm.gcTotalPauseUs));
+    writeArray(arr, INT_VAL((int64_t)vm.gcLastFreed));
+    pop();
+    return OBJ_VAL(arr);
+}
+
+// gcCollect() - Force a full collection
+static Value gcCollectNative(int argCount, Value* args) {
+    (void)argCount;
+    (void)args;
+    collectGarbage();
+    return NIL_VAL;
+}
+
+// gcStep(microseconds) -> bool
+// Incremental collection work within a time budget, e.g. once per frame
+// before present(). Returns true when no cycle is in progress.
+static Value gcStepNative(int argCount, Value* args) {
+    if (argCount != 1 || !IS_INT(args[0])) {
+        return nativeError("gcStep(microseconds) expects an int budget.");
+    }
+    int64_t budget = AS_INT(args[0]);
+    if (budget < 0) budget = 0;
+    return BOOL_VAL(gcStep((uint64_t)budget));
+}
+
+// ============ Profiler Native Functions ============
+
+// profileStart() - reset and start the sampling profiler
+static Value profileStartNative(int argCount, Value* args) {
+    (void)argCount;
+    (void)args;
+    profileStart();
+    return NIL_VAL;
+}
+
+// profileStop([foldedPath]) -> bool
+// Stops sampling and prints the report to stderr. With a path, also writes
+// collapsed stacks for flamegraph tools; false if that file can't be written.
+static Value profileStopNative(int argCount, Value* args) {
+    profileStop();
+    profileReport(stderr);
+    if (argCount >= 1 && IS_STRING(args[0])) {
+        return BOOL_VAL(profileWriteFolded(AS_CSTRING(args[0])));
+    }
+    return BOOL_VAL(true);
+}
+
 // ============ SDL3 Native Functions ============
 
 // Global event storage for pollEvent
@@ -186,6 +296,15 @@ static SDL_Event currentEvent;
 static Value initNative(int argCount, Value* args) {
     (void)argCount;
     uint32_t flags = (uint32_t)AS_INT(args[0]);
+    // SHARO_HEADLESS=1 runs windowed scripts with no display or audio device
+    // (benchmarks, CI): windows are offscreen and rendering is in software
+    const char* headless = getenv("SHARO_HEADLESS");
+    if (headless != NULL && headless[0] != '\0' && strcmp(headless, "0") != 0) {
+        SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "dummy");
+        SDL_SetHint(SDL_HINT_AUDIO_DRIVER, "dummy");
+        SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+        SDL_SetHint(SDL_HINT_RENDER_VSYNC, "0");
+    }
     return BOOL_VAL(SDL_Init(flags));
 }
 
@@ -193,6 +312,7 @@ static Value initNative(int argCount, Value* args) {
 static Value quitNative(int argCount, Value* args) {
     (void)argCount;
     (void)args;
+    textCacheClear();
     SDL_Quit();
     return NIL_VAL;
 }
@@ -237,6 +357,8 @@ static Value setLogicalSizeNative(int argCount, Value* args) {
 static Value destroyRendererNative(int argCount, Value* args) {
     (void)argCount;
     SDL_Renderer* renderer = (SDL_Renderer*)AS_PTR(args[0]);
+    textCacheForgetRenderer(renderer);
+    assetCacheForgetRenderer(renderer);
     SDL_DestroyRenderer(renderer);
     return NIL_VAL;
 }
@@ -290,6 +412,43 @@ static Value fillRectNative(int argCount, Value* args) {
     return BOOL_VAL(SDL_RenderFillRect(renderer, &rect));
 }
 
+// Scratch memory reused by the batch draw natives, grown as needed
+static void* batchScratch(size_t bytes) {
+    static THREAD_LOCAL void* scratch = NULL;
+    static THREAD_LOCAL size_t scratchCapacity = 0;
+    if (bytes > scratchCapacity) {
+        size_t capacity = scratchCapacity < 4096 ? 4096 : scratchCapacity;
+        while (capacity < bytes) capacity *= 2;
+        void* grown = realloc(scratch, capacity);
+        if (grown == NULL) return NULL;
+        scratch = grown;
+        scratchCapacity = capacity;
+    }
+    return scratch;
+}
+
+// fillRects(renderer, rects) -> bool
+// rects is a flat array [x, y, w, h, x, y, w, h, ...], drawn in one call
+static Value fillRectsNative(int argCount, Value* args) {
+    (void)argCount;
+    SDL_Renderer* renderer = (SDL_Renderer*)AS_PTR(args[0]);
+    if (!IS_ARRAY(args[1])) return BOOL_VAL(false);
+    ObjArray* values = AS_ARRAY(args[1]);
+    int count = values->count / 4;
+    if (count == 0) return BOOL_VAL(true);
+
+    SDL_FRect* rects = batchScratch((size_t)count * sizeof(SDL_FRect));
+    if (rects == NULL) return BOOL_VAL(false);
+    for (int i = 0; i < count; i++) {
+        Value* v = &values->elements[i * 4];
+        rects[i].x = (float)AS_NUMBER(v[0]);
+        rects[i].y = (float)AS_NUMBER(v[1]);
+        rects[i].w = (float)AS_NUMBER(v[2]);
+        rects[i].h = (float)AS_NUMBER(v[3]);
+    }
+    return BOOL_VAL(SDL_RenderFillRects(renderer, rects, count));
+}
+
 // drawRect(renderer, x, y, w, h) -> bool
 static Value drawRectNative(int argCount, Value* args) {
     (void)argCount;
@@ -323,6 +482,153 @@ static Value pollEventNative(int argCount, Value* args) {
     return INT_VAL(0);
 }
 
+#define EVENT_FIELDS 5           // Values per pollEvents record
+#define EVENT_BLOCK 64           // Events taken from SDL per SDL_PeepEvents
+
+static bool eventTypeWanted(Value types, Uint32 type) {
+    if (IS_NIL(types)) return true;
+    if (IS_INT(types)) return AS_INT(types) == (int64_t)type;
+    if (!IS_ARRAY(types)) return true;
+    ObjArray* array = AS_ARRAY(types);
+    for (int i = 0; i < array->count; i++) {
+        if (IS_INT(array->elements[i]) && AS_INT(array->elements[i]) == (int64_t)type) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Fold event into pending when it only updates the same state: a run of
+// motion becomes one move to the last position with the summed deltas, a run
+// of resizes the last size
+static bool coalesceEvent(SDL_Event* pending, const SDL_Event* event) {
+    if (pending->type != event->type) return false;
+    if (event->type == SDL_EVENT_MOUSE_MOTION) {
+        if (pending->motion.windowID != event->motion.windowID ||
+            pending->motion.which != event->motion.which) {
+            return false;
+        }
+        pending->motion.state = event->motion.state;
+        pending->motion.x = event->motion.x;
+        pending->motion.y = event->motion.y;
+        pending->motion.xrel += event->motion.xrel;
+        pending->motion.yrel += event->motion.yrel;
+        return true;
+    }
+    if (event->type == SDL_EVENT_WINDOW_RESIZED &&
+        pending->window.windowID == event->window.windowID) {
+        *pending = *event;
+        return true;
+    }
+    return false;
+}
+
+// Store event as events[index], reusing the record already there
+static void writeEventRecord(ObjArray* events, int index, const SDL_Event* event) {
+    Value fields[EVENT_FIELDS] = {INT_VAL((int64_t)event->type), INT_VAL(0), INT_VAL(0),
+                                  INT_VAL(0), INT_VAL(0)};
+    switch (event->type) {
+        case SDL_EVENT_KEY_DOWN:
+        case SDL_EVENT_KEY_UP:
+            fields[1] = INT_VAL((int64_t)event->key.scancode);
+            fields[2] = INT_VAL((int64_t)event->key.key);
+            fields[3] = INT_VAL((int64_t)event->key.mod);
+            fields[4] = INT_VAL(event->key.repeat ? 1 : 0);
+            break;
+        case SDL_EVENT_MOUSE_MOTION:
+            fields[1] = INT_VAL((int64_t)event->motion.x);
+            fields[2] = INT_VAL((int64_t)event->motion.y);
+            fields[3] = INT_VAL((int64_t)event->motion.xrel);
+            fields[4] = INT_VAL((int64_t)event->motion.yrel);
+            break;
+        case SDL_EVENT_MOUSE_BUTTON_DOWN:
+        case SDL_EVENT_MOUSE_BUTTON_UP:
+            fields[1] = INT_VAL((int64_t)event->button.x);
+            fields[2] = INT_VAL((int64_t)event->button.y);
+            fields[3] = INT_VAL((int64_t)event->button.button);
+            fields[4] = INT_VAL((int64_t)event->button.clicks);
+            break;
+        case SDL_EVENT_MOUSE_WHEEL:
+            fields[1] = INT_VAL((int64_t)event->wheel.x);
+            fields[2] = INT_VAL((int64_t)event->wheel.y);
+            fields[3] = INT_VAL((int64_t)event->wheel.mouse_x);
+            fields[4] = INT_VAL((int64_t)event->wheel.mouse_y);
+            break;
+        case SDL_EVENT_WINDOW_RESIZED:
+            fields[1] = INT_VAL((int64_t)event->window.data1);
+            fields[2] = INT_VAL((int64_t)event->window.data2);
+            fields[3] = INT_VAL((int64_t)event->window.windowID);
+            break;
+    }
+
+    ObjArray* record = NULL;
+    if (index < events->count && IS_ARRAY(events->elements[index]) &&
+        AS_ARRAY(events->elements[index])->count == EVENT_FIELDS) {
+        record = AS_ARRAY(events->elements[index]);
+    } else {
+        record = newArray();
+        push(OBJ_VAL(record)); // GC protection
+        for (int i = 0; i < EVENT_FIELDS; i++) writeArray(record, INT_VAL(0));
+        if (index < events->count) {
+            events->elements[index] = OBJ_VAL(record);
+            WRITE_BARRIER(events, events->elements[index]);
+        } else {
+            writeArray(events, OBJ_VAL(record));
+        }
+        pop();
+    }
+    for (int i = 0; i < EVENT_FIELDS; i++) record->elements[i] = fields[i];
+
+    if (event->type == SDL_EVENT_TEXT_INPUT) {
+        ObjString* text = copyString(event->text.text, (int)strlen(event->text.text));
+        record->elements[1] = OBJ_VAL(text);
+        WRITE_BARRIER(record, record->elements[1]);
+    }
+}
+
+// pollEvents(events[, types[, coalesce]]) -> int (events stored)
+// Drains the whole queue in one call. Record i is events[i], an array
+// [type, a, b, c, d]:
+//   key down/up       [type, scancode, keycode, mod, repeat]
+//   text input        [type, text, 0, 0, 0]
+//   mouse motion      [type, x, y, xrel, yrel]
+//   mouse button      [type, x, y, button, clicks]
+//   mouse wheel       [type, wheelX, wheelY, mouseX, mouseY]
+//   window resized    [type, w, h, windowID, 0]
+// Records are reused from call to call, so events only grows; entries from
+// the count on are stale. types (one type or an array of them) keeps only
+// those events and drops the rest. Runs of motion or resize events are
+// merged unless coalesce is false. The last event stored is also the one
+// eventKey() and the like read.
+static Value pollEventsNative(int argCount, Value* args) {
+    if (!IS_ARRAY(args[0])) return INT_VAL(0);
+    ObjArray* events = AS_ARRAY(args[0]);
+    Value types = argCount >= 2 ? args[1] : NIL_VAL;
+    bool coalesce = argCount < 3 || !IS_BOOL(args[2]) || AS_BOOL(args[2]);
+
+    SDL_Event block[EVENT_BLOCK];
+    SDL_Event pending;
+    bool havePending = false;
+    int count = 0;
+    int taken;
+    SDL_PumpEvents();
+    while ((taken = SDL_PeepEvents(block, EVENT_BLOCK, SDL_GETEVENT,
+                                   SDL_EVENT_FIRST, SDL_EVENT_LAST)) > 0) {
+        for (int i = 0; i < taken; i++) {
+            if (!eventTypeWanted(types, block[i].type)) continue;
+            if (havePending && coalesce && coalesceEvent(&pending, &block[i])) continue;
+            if (havePending) writeEventRecord(events, count++, &pending);
+            pending = block[i];
+            havePending = true;
+        }
+    }
+    if (havePending) {
+        writeEventRecord(events, count++, &pending);
+        currentEvent = pending;
+    }
+    return INT_VAL(count);
+}
+
 // eventKey() -> int (scancode of last key event)
 static Value eventKeyNative(int argCount, Value* args) {
     (void)argCount;
@@ -453,42 +759,93 @@ static Value getTicksNative(int argCount, Value* args) {
     return INT_VAL((int64_t)SDL_GetTicks());
 }
 
-// loadTexture(renderer, path) -> ptr (loads BMP image)
-static Value loadTextureNative(int argCount, Value* args) {
-    (void)argCount;
-    SDL_Renderer* renderer = (SDL_Renderer*)AS_PTR(args[0]);
-    const char* path = AS_CSTRING(args[1]);
-
+// Decoding is safe off the main thread (loadTextureAsync); uploading isn't
+static void* decodeImage(const char* path) {
     SDL_Surface* surface = IMG_Load(path);
     if (surface == NULL) {
         fprintf(stderr, "Failed to load image: %s\n", SDL_GetError());
-        return PTR_VAL(NULL);
     }
+    return surface;
+}
+
+static void discardImage(void* surface) {
+    SDL_DestroySurface((SDL_Surface*)surface);
+}
 
+// Upload a decoded image, consuming the surface, and add it to the texture
+// cache under path
+static SDL_Texture* uploadTexture(SDL_Renderer* renderer, const char* path,
+                                  SDL_Surface* surface) {
     SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
     SDL_DestroySurface(surface);
 
     if (texture == NULL) {
         fprintf(stderr, "Failed to create texture: %s\n", SDL_GetError());
-        return PTR_VAL(NULL);
+        return NULL;
     }
 
     // Enable alpha blending for transparency
     SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
 
-    return PTR_VAL(texture);
+    assetCacheAddTexture(renderer, path, texture);
+    return texture;
+}
+
+// loadTexture(renderer, path) -> ptr (loads BMP image)
+// Loading a path again returns the same texture (see assets.h)
+static Value loadTextureNative(int argCount, Value* args) {
+    (void)argCount;
+    SDL_Renderer* renderer = (SDL_Renderer*)AS_PTR(args[0]);
+    const char* path = AS_CSTRING(args[1]);
+
+    SDL_Texture* texture = assetCacheFindTexture(renderer, path);
+    if (texture != NULL) return PTR_VAL(texture);
+
+    SDL_Surface* surface = decodeImage(path);
+    if (surface == NULL) return PTR_VAL(NULL);
+    return PTR_VAL(uploadTexture(renderer, path, surface));
 }
 
 // destroyTexture(texture)
+// A texture from loadTexture is destroyed once every load has destroyed it
 static Value destroyTextureNative(int argCount, Value* args) {
     (void)argCount;
     SDL_Texture* texture = (SDL_Texture*)AS_PTR(args[0]);
-    if (texture != NULL) {
+    if (texture != NULL && !assetCacheReleaseTexture(texture)) {
         SDL_DestroyTexture(texture);
     }
     return NIL_VAL;
 }
 
+// createRenderTarget(renderer, w, h) -> ptr
+// A texture to draw into with setRenderTarget and then draw like any other;
+// free it with destroyTexture
+static Value createRenderTargetNative(int argCount, Value* args) {
+    (void)argCount;
+    SDL_Renderer* renderer = (SDL_Renderer*)AS_PTR(args[0]);
+    int w = (int)AS_NUMBER(args[1]);
+    int h = (int)AS_NUMBER(args[2]);
+    if (w <= 0 || h <= 0) return PTR_VAL(NULL);
+
+    SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+                                             SDL_TEXTUREACCESS_TARGET, w, h);
+    if (texture == NULL) {
+        fprintf(stderr, "Failed to create render target: %s\n", SDL_GetError());
+        return PTR_VAL(NULL);
+    }
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+    return PTR_VAL(texture);
+}
+
+// setRenderTarget(renderer, target) -> bool
+// Draw into target from now on; nil (or a null ptr) goes back to the window
+static Value setRenderTargetNative(int argCount, Value* args) {
+    (void)argCount;
+    SDL_Renderer* renderer = (SDL_Renderer*)AS_PTR(args[0]);
+    SDL_Texture* target = IS_PTR(args[1]) ? (SDL_Texture*)AS_PTR(args[1]) : NULL;
+    return BOOL_VAL(SDL_SetRenderTarget(renderer, target));
+}
+
 // drawTexture(renderer, texture, x, y, w, h) -> bool
 static Value drawTextureNative(int argCount, Value* args) {
     (void)argCount;
@@ -504,6 +861,69 @@ static Value drawTextureNative(int argCount, Value* args) {
     return BOOL_VAL(SDL_RenderTexture(renderer, texture, NULL, &dest));
 }
 
+// Coordinate lists for the batch natives: arrays of numbers or typed arrays
+static int coordinateCount(Value list) {
+    if (IS_ARRAY(list)) return AS_ARRAY(list)->count;
+    if (IS_TYPED_ARRAY(list)) return AS_TYPED_ARRAY(list)->count;
+    return -1;
+}
+
+static double coordinateAt(Value list, int index) {
+    if (IS_TYPED_ARRAY(list)) return typedArrayGetNumber(AS_TYPED_ARRAY(list), index);
+    return AS_NUMBER(AS_ARRAY(list)->elements[index]);
+}
+
+// drawTextures(renderer, texture, xs, ys[, w, h]) -> bool
+// One sprite per (xs[i], ys[i]), all submitted as a single geometry batch.
+// xs and ys may be typed arrays, such as StructArray float columns.
+// Without w and h each sprite is drawn at the texture's size.
+static Value drawTexturesNative(int argCount, Value* args) {
+    SDL_Renderer* renderer = (SDL_Renderer*)AS_PTR(args[0]);
+    SDL_Texture* texture = (SDL_Texture*)AS_PTR(args[1]);
+    int xCount = coordinateCount(args[2]);
+    int yCount = coordinateCount(args[3]);
+    if (xCount < 0 || yCount < 0) return BOOL_VAL(false);
+    int count = xCount < yCount ? xCount : yCount;
+    if (count == 0) return BOOL_VAL(true);
+
+    float w, h;
+    if (argCount >= 6) {
+        w = (float)AS_NUMBER(args[4]);
+        h = (float)AS_NUMBER(args[5]);
+    } else {
+        SDL_GetTextureSize(texture, &w, &h);
+    }
+
+    // Four vertices and six indices per sprite, in one scratch block
+    size_t vertexBytes = (size_t)count * 4 * sizeof(SDL_Vertex);
+    size_t indexBytes = (size_t)count * 6 * sizeof(int);
+    SDL_Vertex* vertices = batchScratch(vertexBytes + indexBytes);
+    if (vertices == NULL) return BOOL_VAL(false);
+    int* indices = (int*)(vertices + (size_t)count * 4);
+
+    SDL_FColor white = {1.0f, 1.0f, 1.0f, 1.0f};
+    for (int i = 0; i < count; i++) {
+        float x = (float)coordinateAt(args[2], i);
+        float y = (float)coordinateAt(args[3], i);
+        SDL_Vertex* v = &vertices[i * 4];
+        v[0] = (SDL_Vertex){{x, y}, white, {0.0f, 0.0f}};
+        v[1] = (SDL_Vertex){{x + w, y}, white, {1.0f, 0.0f}};
+        v[2] = (SDL_Vertex){{x + w, y + h}, white, {1.0f, 1.0f}};
+        v[3] = (SDL_Vertex){{x, y + h}, white, {0.0f, 1.0f}};
+
+        int base = i * 4;
+        int* idx = &indices[i * 6];
+        idx[0] = base;
+        idx[1] = base + 1;
+        idx[2] = base + 2;
+        idx[3] = base;
+        idx[4] = base + 2;
+        idx[5] = base + 3;
+    }
+    return BOOL_VAL(SDL_RenderGeometry(renderer, texture, vertices, count * 4,
+                                       indices, count * 6));
+}
+
 // getTextureSize(texture) -> array [width, height]
 static Value getTextureSizeNative(int argCount, Value* args) {
     (void)argCount;
@@ -513,8 +933,10 @@ static Value getTextureSizeNative(int argCount, Value* args) {
     SDL_GetTextureSize(texture, &w, &h);
 
     ObjArray* arr = newArray();
+    push(OBJ_VAL(arr)); // GC protection
     writeArray(arr, INT_VAL((int64_t)w));
     writeArray(arr, INT_VAL((int64_t)h));
+    pop();
     return OBJ_VAL(arr);
 }
 
@@ -526,6 +948,13 @@ static Value randomNative(int argCount, Value* args) {
     return INT_VAL(rand() % max);
 }
 
+// seedRandom(seed) - make random/randomFloat repeat the same sequence
+static Value seedRandomNative(int argCount, Value* args) {
+    (void)argCount;
+    srand((unsigned int)AS_INT(args[0]));
+    return NIL_VAL;
+}
+
 // randomFloat() -> float (0.0 to 1.0)
 static Value randomFloatNative(int argCount, Value* args) {
     (void)argCount;
@@ -661,6 +1090,7 @@ static Value initTTFNative(int argCount, Value* args) {
 static Value quitTTFNative(int argCount, Value* args) {
     (void)argCount;
     (void)args;
+    textCacheClear();
     TTF_Quit();
     return NIL_VAL;
 }
@@ -683,17 +1113,20 @@ static Value destroyFontNative(int argCount, Value* args) {
     (void)argCount;
     TTF_Font* font = (TTF_Font*)AS_PTR(args[0]);
     if (font != NULL) {
+        textCacheForgetFont(font);
         TTF_CloseFont(font);
     }
     return NIL_VAL;
 }
 
 // drawText(renderer, font, text, x, y, r, g, b) -> bool
+// Rendered strings are cached, so redrawing the same label each frame
+// costs one texture copy.
 static Value drawTextNative(int argCount, Value* args) {
     (void)argCount;
     SDL_Renderer* renderer = (SDL_Renderer*)AS_PTR(args[0]);
     TTF_Font* font = (TTF_Font*)AS_PTR(args[1]);
-    const char* text = AS_CSTRING(args[2]);
+    ObjString* text = AS_STRING(args[2]);
     float x = (float)AS_NUMBER(args[3]);
     float y = (float)AS_NUMBER(args[4]);
     Uint8 r = (Uint8)AS_INT(args[5]);
@@ -701,35 +1134,49 @@ static Value drawTextNative(int argCount, Value* args) {
     Uint8 b = (Uint8)AS_INT(args[7]);
 
     SDL_Color color = {r, g, b, 255};
-    SDL_Surface* surface = TTF_RenderText_Blended(font, text, 0, color);
-    if (surface == NULL) {
-        return BOOL_VAL(false);
-    }
-
-    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-    SDL_DestroySurface(surface);
-    if (texture == NULL) {
-        return BOOL_VAL(false);
-    }
-
-    float w, h;
-    SDL_GetTextureSize(texture, &w, &h);
-    SDL_FRect dest = {x, y, w, h};
-    SDL_RenderTexture(renderer, texture, NULL, &dest);
-    SDL_DestroyTexture(texture);
-
-    return BOOL_VAL(true);
+    return BOOL_VAL(textCacheDraw(renderer, font, text, color, x, y));
 }
 
 // getTextWidth(font, text) -> int (width in pixels)
 static Value getTextWidthNative(int argCount, Value* args) {
     (void)argCount;
     TTF_Font* font = (TTF_Font*)AS_PTR(args[0]);
-    const char* text = AS_CSTRING(args[1]);
+    return INT_VAL((int64_t)textCacheWidth(font, AS_STRING(args[1])));
+}
+
+// textCacheStats() -> array [hits, misses, evictions, entries, bytes, widthHits, widthMisses]
+static Value textCacheStatsNative(int argCount, Value* args) {
+    (void)argCount;
+    (void)args;
+    TextCacheStats stats = textCacheStats();
+    ObjArray* arr = newArray();
+    push(OBJ_VAL(arr)); // GC protection
+    writeArray(arr, INT_VAL((int64_t)stats.hits));
+    writeArray(arr, INT_VAL((int64_t)stats.misses));
+    writeArray(arr, INT_VAL((int64_t)stats.evictions));
+    writeArray(arr, INT_VAL((int64_t)stats.entries));
+    writeArray(arr, INT_VAL((int64_t)stats.bytes));
+    writeArray(arr, INT_VAL((int64_t)stats.widthHits));
+    writeArray(arr, INT_VAL((int64_t)stats.widthMisses));
+    pop();
+    return OBJ_VAL(arr);
+}
+
+// setTextCacheLimit(maxEntries, maxBytes)
+static Value setTextCacheLimitNative(int argCount, Value* args) {
+    (void)argCount;
+    int64_t entries = AS_INT(args[0]);
+    int64_t bytes = AS_INT(args[1]);
+    textCacheSetLimits((int)entries, bytes < 0 ? 0 : (size_t)bytes);
+    return NIL_VAL;
+}
 
-    int w = 0, h = 0;
-    TTF_GetStringSize(font, text, 0, &w, &h);
-    return INT_VAL((int64_t)w);
+// clearTextCache()
+static Value clearTextCacheNative(int argCount, Value* args) {
+    (void)argCount;
+    (void)args;
+    textCacheClear();
+    return NIL_VAL;
 }
 
 // ============ Array Native Functions ============
@@ -741,13 +1188,37 @@ static Value lenNative(int argCount, Value* args) {
         return INT_VAL(AS_ARRAY(args[0])->count);
     } else if (IS_STRING(args[0])) {
         return INT_VAL(AS_STRING(args[0])->length);
+    } else if (IS_STRING_BUILDER(args[0])) {
+        return INT_VAL(AS_STRING_BUILDER(args[0])->length);
+    } else if (IS_TYPED_ARRAY(args[0])) {
+        return INT_VAL(AS_TYPED_ARRAY(args[0])->count);
+    } else if (IS_STRUCT_ARRAY(args[0])) {
+        return INT_VAL(AS_STRUCT_ARRAY(args[0])->count);
+    } else if (IS_SPATIAL_GRID(args[0])) {
+        return INT_VAL(AS_SPATIAL_GRID(args[0])->count);
+    } else if (IS_MAP(args[0])) {
+        return INT_VAL(AS_MAP(args[0])->table.size);
     }
     return INT_VAL(0);
 }
 
 // push(arr, value) -> int (new length)
+// On a StructArray, value must be an instance of its type; its fields are
+// copied into a new row.
 static Value pushNative(int argCount, Value* args) {
     (void)argCount;
+    if (IS_STRUCT_ARRAY(args[0])) {
+        ObjStructArray* array = AS_STRUCT_ARRAY(args[0]);
+        if (!IS_STRUCT(args[1]) || AS_STRUCT(args[1])->definition != array->definition) {
+            return NIL_VAL;
+        }
+        ObjStruct* instance = AS_STRUCT(args[1]);
+        appendStructArray(array);
+        for (int i = 0; i < array->fieldCount; i++) {
+            structArraySet(array, i, array->count - 1, instance->fields[i]);
+        }
+        return INT_VAL(array->count);
+    }
     if (!IS_ARRAY(args[0])) {
         return NIL_VAL;
     }
@@ -769,99 +1240,1272 @@ static Value popNative(int argCount, Value* args) {
     return array->elements[--array->count];
 }
 
-// ============ TCP Socket Native Functions ============
+// ============ Map Native Functions ============
 
-// tcpListen(port) -> socket ptr or nil on error
-static Value tcpListenNative(int argCount, Value* args) {
-    (void)argCount;
-    int port = (int)AS_INT(args[0]);
+// m[key]; nil when absent
+static Value mapGet(ObjMap* map, Value key) {
+    Value value;
+    return valueTableGet(&map->table, key, &value) ? value : NIL_VAL;
+}
 
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        return NIL_VAL;
+// False (with nothing stored) for a nil key. A string slice key is
+// interned first, so the map doesn't keep the slice's parent alive.
+// Interning and growing the table can collect: the caller keeps map, key
+// and value reachable (on the stack) until this returns.
+static bool mapStore(ObjMap* map, Value key, Value value) {
+    if (IS_NIL(key)) return false;
+    if (IS_STRING(key) && !AS_STRING(key)->interned) {
+        key = OBJ_VAL(internString(AS_STRING(key)));
     }
+    valueTableSet(&map->table, key, value);
+    WRITE_BARRIER(map, key);
+    WRITE_BARRIER(map, value);
+    return true;
+}
 
-    // Allow address reuse
-    int opt = 1;
-    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+// The keys (or values) of a map, in table order
+static Value mapEntries(ObjMap* map, bool keys) {
+    ObjArray* result = newArray();
+    push(OBJ_VAL(result));
+    for (int i = 0; i < map->table.capacity; i++) {
+        ValueEntry* entry = &map->table.entries[i];
+        if (IS_NIL(entry->key)) continue;
+        writeArray(result, keys ? entry->key : entry->value);
+    }
+    pop();
+    return OBJ_VAL(result);
+}
 
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(port);
+// mapGet(m, key[, fallback]) -> value, or fallback (default nil) if absent
+static Value mapGetNative(int argCount, Value* args) {
+    if (!IS_MAP(args[0])) return NIL_VAL;
+    Value value;
+    if (valueTableGet(&AS_MAP(args[0])->table, args[1], &value)) return value;
+    return argCount >= 3 ? args[2] : NIL_VAL;
+}
 
-    if (bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        close(sockfd);
-        return NIL_VAL;
-    }
+// mapSet(m, key, value) -> bool (false for a nil key)
+static Value mapSetNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_MAP(args[0])) return BOOL_VAL(false);
+    return BOOL_VAL(mapStore(AS_MAP(args[0]), args[1], args[2]));
+}
 
-    if (listen(sockfd, 10) < 0) {
-        close(sockfd);
-        return NIL_VAL;
-    }
+// mapHas(m, key) -> bool
+static Value mapHasNative(int argCount, Value* args) {
+    (void)argCount;
+    Value value;
+    return BOOL_VAL(IS_MAP(args[0]) &&
+                    valueTableGet(&AS_MAP(args[0])->table, args[1], &value));
+}
 
-    return INT_VAL(sockfd);
+// mapDelete(m, key) -> bool (whether the key was there)
+static Value mapDeleteNative(int argCount, Value* args) {
+    (void)argCount;
+    return BOOL_VAL(IS_MAP(args[0]) && valueTableDelete(&AS_MAP(args[0])->table, args[1]));
 }
 
-// tcpAccept(socket) -> client socket or nil
-static Value tcpAcceptNative(int argCount, Value* args) {
+// mapKeys(m) -> array
+static Value mapKeysNative(int argCount, Value* args) {
     (void)argCount;
-    int sockfd = (int)AS_INT(args[0]);
+    if (!IS_MAP(args[0])) return NIL_VAL;
+    return mapEntries(AS_MAP(args[0]), true);
+}
 
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
+// mapValues(m) -> array, in the same order as mapKeys
+static Value mapValuesNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_MAP(args[0])) return NIL_VAL;
+    return mapEntries(AS_MAP(args[0]), false);
+}
 
-    int clientfd = accept(sockfd, (struct sockaddr*)&client_addr, &client_len);
-    if (clientfd < 0) {
+// ============ StructArray Native Functions ============
+// A StructArray stores each field of a type in its own column, so a field
+// is one contiguous run of memory. Float fields are f64 typed arrays that
+// the vector kernels below can update in place.
+
+// structArray(Type, capacity) -> empty StructArray with room for capacity rows
+static Value structArrayNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_STRUCT_DEF(args[0])) return NIL_VAL;
+    int64_t capacity = IS_INT(args[1]) ? AS_INT(args[1]) : 0;
+    if (capacity < 0 || capacity > INT32_MAX) return NIL_VAL;
+    return OBJ_VAL(newStructArray(AS_STRUCT_DEF(args[0]), (int)capacity));
+}
+
+// structArrayColumn(arr, "field") -> the field's column, shared with arr
+// (an f64 typed array for float fields, a plain array otherwise) or nil.
+// Its length follows push(arr, ...).
+static Value structArrayColumnNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_STRUCT_ARRAY(args[0]) || !IS_STRING(args[1])) return NIL_VAL;
+    ObjStructArray* array = AS_STRUCT_ARRAY(args[0]);
+    Value index;
+    ObjString* name = internString(AS_STRING(args[1]));
+    if (!tableGet(&array->definition->fieldIndices, name, &index)) {
         return NIL_VAL;
     }
+    return OBJ_VAL(array->columns[AS_INT(index)]);
+}
 
-    return INT_VAL(clientfd);
+// ============ Typed Array Native Functions ============
+// The kernels below are plain loops over float/double pointers that the
+// compiler auto-vectorizes; other kind combinations take a per-element
+// path through double.
+
+static bool typedKindFromName(ObjString* name, TypedArrayKind* kind) {
+    const char* chars = stringCString(name);
+    if (strcmp(chars, "f32") == 0) *kind = TYPED_F32;
+    else if (strcmp(chars, "f64") == 0) *kind = TYPED_F64;
+    else if (strcmp(chars, "i32") == 0) *kind = TYPED_I32;
+    else if (strcmp(chars, "u8") == 0) *kind = TYPED_U8;
+    else return false;
+    return true;
 }
 
-// tcpRecv(socket, maxLen) -> string or nil
-static Value tcpRecvNative(int argCount, Value* args) {
+// typedArray(kind, countOrArray) -> typed array or nil
+// kind is "f32", "f64", "i32" or "u8"; a count gives zeroed elements,
+// an array of numbers is copied.
+static Value typedArrayNative(int argCount, Value* args) {
     (void)argCount;
-    int sockfd = (int)AS_INT(args[0]);
-    int maxLen = (int)AS_INT(args[1]);
+    TypedArrayKind kind;
+    if (!IS_STRING(args[0]) || !typedKindFromName(AS_STRING(args[0]), &kind)) {
+        return NIL_VAL;
+    }
+    if (IS_ARRAY(args[1])) {
+        ObjArray* source = AS_ARRAY(args[1]);
+        ObjTypedArray* array = newTypedArray(kind, source->count);
+        for (int i = 0; i < source->count; i++) {
+            if (IS_NUMBER(source->elements[i])) {
+                typedArraySet(array, i, source->elements[i]);
+            }
+        }
+        return OBJ_VAL(array);
+    }
+    int64_t count = IS_INT(args[1]) ? AS_INT(args[1]) : 0;
+    if (count < 0 || count > INT32_MAX) return NIL_VAL;
+    return OBJ_VAL(newTypedArray(kind, (int)count));
+}
+
+// Element count shared by dst and the inputs, or -1 if any isn't typed
+static int typedCommonCount(Value* arrays, int n) {
+    int count = INT32_MAX;
+    for (int i = 0; i < n; i++) {
+        if (!IS_TYPED_ARRAY(arrays[i])) return -1;
+        int c = AS_TYPED_ARRAY(arrays[i])->count;
+        if (c < count) count = c;
+    }
+    return count;
+}
+
+// Four independent statements per iteration let the block vectorizer
+// pack them even at -O2, which won't vectorize loops needing a scalar tail
+#define UNROLLED(n, body) do { \
+    int i = 0; \
+    for (; i + 4 <= (n); i += 4) { \
+        { int j = i; body; } \
+        { int j = i + 1; body; } \
+        { int j = i + 2; body; } \
+        { int j = i + 3; body; } \
+    } \
+    for (; i < (n); i++) { int j = i; body; } \
+} while (0)
+
+// Only d is restrict in the first group: separate typed arrays never
+// overlap, so the in-place forms cover dst being one of the inputs and the
+// rest need no alias checks. The second group serves parallelMap, where d
+// may be any of the inputs, so the vectorizer checks overlap at run time.
+#define TYPED_KERNELS(T, suffix, SQRT) \
+    static void vadd##suffix(T* restrict d, const T* x, const T* y, int n) { \
+        UNROLLED(n, d[j] = x[j] + y[j]); \
+    } \
+    static void vaddInPlace##suffix(T* restrict d, const T* y, int n) { \
+        UNROLLED(n, d[j] += y[j]); \
+    } \
+    static void vscale##suffix(T* restrict d, const T* x, T k, int n) { \
+        UNROLLED(n, d[j] = x[j] * k); \
+    } \
+    static void vscaleInPlace##suffix(T* restrict d, T k, int n) { \
+        UNROLLED(n, d[j] *= k); \
+    } \
+    static void vfma##suffix(T* restrict d, const T* x, const T* y, T k, int n) { \
+        UNROLLED(n, d[j] = x[j] + y[j] * k); \
+    } \
+    static void vfmaInPlace##suffix(T* restrict d, const T* y, T k, int n) { \
+        UNROLLED(n, d[j] += y[j] * k); \
+    } \
+    static void vclamp##suffix(T* restrict d, T lo, T hi, int n) { \
+        UNROLLED(n, T v = d[j] < lo ? lo : d[j]; d[j] = v > hi ? hi : v); \
+    } \
+    static void vsub##suffix(T* d, const T* x, const T* y, int n) { \
+        UNROLLED(n, d[j] = x[j] - y[j]); \
+    } \
+    static void vmul##suffix(T* d, const T* x, const T* y, int n) { \
+        UNROLLED(n, d[j] = x[j] * y[j]); \
+    } \
+    static void voffset##suffix(T* d, const T* x, T k, int n) { \
+        UNROLLED(n, d[j] = x[j] + k); \
+    } \
+    static void vclampFrom##suffix(T* d, const T* x, T lo, T hi, int n) { \
+        UNROLLED(n, T v = x[j] < lo ? lo : x[j]; d[j] = v > hi ? hi : v); \
+    } \
+    static void vabs##suffix(T* d, const T* x, int n) { \
+        UNROLLED(n, d[j] = x[j] < 0 ? -x[j] : x[j]); \
+    } \
+    static void vsqrt##suffix(T* d, const T* x, int n) { \
+        UNROLLED(n, d[j] = SQRT(x[j])); \
+    }
 
-    char* buffer = malloc(maxLen + 1);
-    if (!buffer) return NIL_VAL;
+TYPED_KERNELS(float, F32, sqrtf)
+TYPED_KERNELS(double, F64, sqrt)
 
-    ssize_t received = recv(sockfd, buffer, maxLen, 0);
-    if (received <= 0) {
-        free(buffer);
-        return NIL_VAL;
+#undef TYPED_KERNELS
+
+// Element-wise kernels, cut into chunks for the thread pool (parallel.h)
+typedef enum {
+    KERNEL_ADD,         // a + b
+    KERNEL_SUB,         // a - b
+    KERNEL_MUL,         // a * b
+    KERNEL_OFFSET,      // a + s
+    KERNEL_SCALE,       // a * s
+    KERNEL_FMA,         // a + b * s
+    KERNEL_CLAMP,       // a clamped to [s, t]
+    KERNEL_ABS,
+    KERNEL_SQRT,
+} KernelOp;
+
+typedef struct {
+    KernelOp op;
+    ObjTypedArray* dst;
+    ObjTypedArray* a;
+    ObjTypedArray* b;           // Binary kernels only
+    double s;
+    double t;
+} KernelJob;
+
+static double applyKernel(const KernelJob* job, double x, double y) {
+    switch (job->op) {
+        case KERNEL_ADD:    return x + y;
+        case KERNEL_SUB:    return x - y;
+        case KERNEL_MUL:    return x * y;
+        case KERNEL_OFFSET: return x + job->s;
+        case KERNEL_SCALE:  return x * job->s;
+        case KERNEL_FMA:    return x + y * job->s;
+        case KERNEL_CLAMP:  return x < job->s ? job->s : (x > job->t ? job->t : x);
+        case KERNEL_ABS:    return fabs(x);
+        case KERNEL_SQRT:   return sqrt(x);
+    }
+    return x;
+}
+
+// One chunk of a job whose arrays all have element type T. The restrict
+// kernels only get operands that can't alias d; the other cases loop here.
+#define KERNEL_RUNNER(T, suffix) \
+    static void runKernel##suffix(const KernelJob* job, T* d, const T* x, const T* y, int n) { \
+        T s = (T)job->s; \
+        T t = (T)job->t; \
+        switch (job->op) { \
+            case KERNEL_ADD: \
+                if (d == x && d == y) UNROLLED(n, d[j] += d[j]); \
+                else if (d == x) vaddInPlace##suffix(d, y, n); \
+                else if (d == y) vaddInPlace##suffix(d, x, n); \
+                else vadd##suffix(d, x, y, n); \
+                break; \
+            case KERNEL_SUB: vsub##suffix(d, x, y, n); break; \
+            case KERNEL_MUL: vmul##suffix(d, x, y, n); break; \
+            case KERNEL_OFFSET: voffset##suffix(d, x, s, n); break; \
+            case KERNEL_SCALE: \
+                if (d == x) vscaleInPlace##suffix(d, s, n); \
+                else vscale##suffix(d, x, s, n); \
+                break; \
+            case KERNEL_FMA: \
+                if (d == y) UNROLLED(n, d[j] = x[j] + d[j] * s); \
+                else if (d == x) vfmaInPlace##suffix(d, y, s, n); \
+                else vfma##suffix(d, x, y, s, n); \
+                break; \
+            case KERNEL_CLAMP: \
+                if (d == x) vclamp##suffix(d, s, t, n); \
+                else vclampFrom##suffix(d, x, s, t, n); \
+                break; \
+            case KERNEL_ABS: vabs##suffix(d, x, n); break; \
+            case KERNEL_SQRT: vsqrt##suffix(d, x, n); break; \
+        } \
     }
 
-    buffer[received] = '\0';
-    ObjString* str = copyString(buffer, (int)received);
-    free(buffer);
-    return OBJ_VAL(str);
+KERNEL_RUNNER(float, F32)
+KERNEL_RUNNER(double, F64)
+
+#undef KERNEL_RUNNER
+#undef UNROLLED
+
+static void runKernel(void* context, int start, int end) {
+    const KernelJob* job = (const KernelJob*)context;
+    ObjTypedArray* dst = job->dst;
+    ObjTypedArray* a = job->a;
+    ObjTypedArray* b = job->b;
+    int n = end - start;
+    bool fast = (dst->kind == TYPED_F32 || dst->kind == TYPED_F64) &&
+                a->kind == dst->kind && (b == NULL || b->kind == dst->kind);
+    if (fast && dst->kind == TYPED_F32) {
+        runKernelF32(job, (float*)dst->data + start, (const float*)a->data + start,
+                     b == NULL ? NULL : (const float*)b->data + start, n);
+    } else if (fast) {
+        runKernelF64(job, (double*)dst->data + start, (const double*)a->data + start,
+                     b == NULL ? NULL : (const double*)b->data + start, n);
+    } else {
+        for (int i = start; i < end; i++) {
+            double y = b == NULL ? 0.0 : typedArrayGetNumber(b, i);
+            typedArraySetNumber(dst, i, applyKernel(job, typedArrayGetNumber(a, i), y));
+        }
+    }
 }
 
-// tcpSend(socket, data) -> bytes sent or -1
-static Value tcpSendNative(int argCount, Value* args) {
+static Value runKernelJob(KernelOp op, Value* args, ObjTypedArray* a, ObjTypedArray* b,
+                          double s, double t, int n) {
+    KernelJob job = {op, AS_TYPED_ARRAY(args[0]), a, b, s, t};
+    parallelFor(n, runKernel, &job);
+    return args[0];
+}
+
+// vadd(dst, a, b) -> dst   (dst[i] = a[i] + b[i])
+static Value vaddNative(int argCount, Value* args) {
     (void)argCount;
-    int sockfd = (int)AS_INT(args[0]);
-    ObjString* data = AS_STRING(args[1]);
+    int n = typedCommonCount(args, 3);
+    if (n < 0) return NIL_VAL;
+    return runKernelJob(KERNEL_ADD, args, AS_TYPED_ARRAY(args[1]), AS_TYPED_ARRAY(args[2]),
+                        0, 0, n);
+}
 
-    ssize_t sent = send(sockfd, data->chars, data->length, 0);
-    return INT_VAL(sent);
+// vscale(dst, a, s) -> dst   (dst[i] = a[i] * s)
+static Value vscaleNative(int argCount, Value* args) {
+    (void)argCount;
+    int n = typedCommonCount(args, 2);
+    if (n < 0 || !IS_NUMBER(args[2])) return NIL_VAL;
+    return runKernelJob(KERNEL_SCALE, args, AS_TYPED_ARRAY(args[1]), NULL,
+                        AS_NUMBER(args[2]), 0, n);
 }
 
-// tcpClose(socket)
-static Value tcpCloseNative(int argCount, Value* args) {
+// vfma(dst, a, b, s) -> dst   (dst[i] = a[i] + b[i] * s)
+// e.g. vfma(xs, xs, vxs, dt) advances every position by its velocity
+static Value vfmaNative(int argCount, Value* args) {
     (void)argCount;
-    int sockfd = (int)AS_INT(args[0]);
-    close(sockfd);
-    return NIL_VAL;
+    int n = typedCommonCount(args, 3);
+    if (n < 0 || !IS_NUMBER(args[3])) return NIL_VAL;
+    return runKernelJob(KERNEL_FMA, args, AS_TYPED_ARRAY(args[1]), AS_TYPED_ARRAY(args[2]),
+                        AS_NUMBER(args[3]), 0, n);
 }
 
-// ============ Audio Native Functions ============
+// vclamp(arr, lo, hi) -> arr   (in place)
+static Value vclampNative(int argCount, Value* args) {
+    (void)argCount;
+    int n = typedCommonCount(args, 1);
+    if (n < 0 || !IS_NUMBER(args[1]) || !IS_NUMBER(args[2])) return NIL_VAL;
+    return runKernelJob(KERNEL_CLAMP, args, AS_TYPED_ARRAY(args[0]), NULL,
+                        AS_NUMBER(args[1]), AS_NUMBER(args[2]), n);
+}
+
+// parallelMap(dst, kernel, a, ...) -> dst, or nil for an unknown kernel or
+// arguments that aren't typed arrays and numbers:
+//   "add", "sub", "mul" a, b     dst[i] = a[i] op b[i] (b may be a number)
+//   "fma" a, b, s                dst[i] = a[i] + b[i] * s
+//   "clamp" a, lo, hi            dst[i] = a[i] clamped to [lo, hi]
+//   "abs", "sqrt" a
+// Like every v* native, large arrays are split across parallelThreads().
+static Value parallelMapNative(int argCount, Value* args) {
+    if (argCount < 3 || !IS_STRING(args[1])) return NIL_VAL;
+    const char* kernel = AS_CSTRING(args[1]);
+    Value arrays[3] = {args[0], args[2], NIL_VAL};
+    int arrayCount = 2;
+    KernelOp op;
+    double s = 0;
+    double t = 0;
+
+    if (strcmp(kernel, "add") == 0 || strcmp(kernel, "sub") == 0 || strcmp(kernel, "mul") == 0) {
+        if (argCount < 4) return NIL_VAL;
+        bool add = kernel[0] == 'a';
+        bool sub = kernel[0] == 's';
+        if (IS_NUMBER(args[3])) {
+            s = sub ? -AS_NUMBER(args[3]) : AS_NUMBER(args[3]);
+            op = add || sub ? KERNEL_OFFSET : KERNEL_SCALE;
+        } else {
+            arrays[arrayCount++] = args[3];
+            op = add ? KERNEL_ADD : (sub ? KERNEL_SUB : KERNEL_MUL);
+        }
+    } else if (strcmp(kernel, "fma") == 0) {
+        if (argCount < 5 || !IS_NUMBER(args[4])) return NIL_VAL;
+        arrays[arrayCount++] = args[3];
+        s = AS_NUMBER(args[4]);
+        op = KERNEL_FMA;
+    } else if (strcmp(kernel, "clamp") == 0) {
+        if (argCount < 5 || !IS_NUMBER(args[3]) || !IS_NUMBER(args[4])) return NIL_VAL;
+        s = AS_NUMBER(args[3]);
+        t = AS_NUMBER(args[4]);
+        op = KERNEL_CLAMP;
+    } else if (strcmp(kernel, "abs") == 0) {
+        op = KERNEL_ABS;
+    } else if (strcmp(kernel, "sqrt") == 0) {
+        op = KERNEL_SQRT;
+    } else {
+        return NIL_VAL;
+    }
 
-// Simple sound structure for WAV playback
+    int n = typedCommonCount(arrays, arrayCount);
+    if (n < 0) return NIL_VAL;
+    ObjTypedArray* b = arrayCount == 3 ? AS_TYPED_ARRAY(arrays[2]) : NULL;
+    return runKernelJob(op, args, AS_TYPED_ARRAY(arrays[1]), b, s, t, n);
+}
+
+// Walls for vbounce: a position past lo or hi is put back on the wall and
+// its velocity reversed and scaled by that wall's bounce factor
+typedef struct {
+    ObjTypedArray* pos;
+    ObjTypedArray* vel;
+    double lo;
+    double hi;
+    double loBounce;
+    double hiBounce;
+} BounceJob;
+
+#define BOUNCE_RUNNER(T, suffix) \
+    static void bounce##suffix(const BounceJob* job, T* restrict p, T* restrict v, int n) { \
+        T lo = (T)job->lo, hi = (T)job->hi; \
+        T loBounce = (T)job->loBounce, hiBounce = (T)job->hiBounce; \
+        for (int i = 0; i < n; i++) { \
+            if (p[i] < lo) { \
+                p[i] = lo; \
+                v[i] = -v[i] * loBounce; \
+            } else if (p[i] > hi) { \
+                p[i] = hi; \
+                v[i] = -v[i] * hiBounce; \
+            } \
+        } \
+    }
+
+BOUNCE_RUNNER(float, F32)
+BOUNCE_RUNNER(double, F64)
+
+#undef BOUNCE_RUNNER
+
+static void runBounce(void* context, int start, int end) {
+    const BounceJob* job = (const BounceJob*)context;
+    ObjTypedArray* pos = job->pos;
+    ObjTypedArray* vel = job->vel;
+    if (pos->kind == vel->kind && pos->kind == TYPED_F32) {
+        bounceF32(job, (float*)pos->data + start, (float*)vel->data + start, end - start);
+    } else if (pos->kind == vel->kind && pos->kind == TYPED_F64) {
+        bounceF64(job, (double*)pos->data + start, (double*)vel->data + start, end - start);
+    } else {
+        for (int i = start; i < end; i++) {
+            double p = typedArrayGetNumber(pos, i);
+            double bounce = p < job->lo ? job->loBounce : job->hiBounce;
+            if (p < job->lo || p > job->hi) {
+                typedArraySetNumber(pos, i, p < job->lo ? job->lo : job->hi);
+                typedArraySetNumber(vel, i, -typedArrayGetNumber(vel, i) * bounce);
+            }
+        }
+    }
+}
+
+// vbounce(pos, vel, lo, hi[, loBounce[, hiBounce]]) -> pos
+// Keeps every pos[i] within [lo, hi], reversing vel[i] (scaled by the
+// bounce factor, default 1) at either wall
+static Value vbounceNative(int argCount, Value* args) {
+    int n = typedCommonCount(args, 2);
+    if (n < 0 || AS_TYPED_ARRAY(args[0]) == AS_TYPED_ARRAY(args[1]) ||
+        !IS_NUMBER(args[2]) || !IS_NUMBER(args[3])) {
+        return NIL_VAL;
+    }
+    BounceJob job = {AS_TYPED_ARRAY(args[0]), AS_TYPED_ARRAY(args[1]),
+                     AS_NUMBER(args[2]), AS_NUMBER(args[3]), 1.0, 1.0};
+    if (argCount >= 5 && IS_NUMBER(args[4])) job.loBounce = AS_NUMBER(args[4]);
+    if (argCount >= 6 && IS_NUMBER(args[5])) job.hiBounce = AS_NUMBER(args[5]);
+    parallelFor(n, runBounce, &job);
+    return args[0];
+}
+
+// Per-chunk partial sums, added in chunk order so the total doesn't
+// depend on how many threads ran
+typedef struct {
+    ObjTypedArray* array;
+    double* sums;               // Float kinds
+    int64_t* intSums;           // Integer kinds
+} SumJob;
+
+static void runSum(void* context, int start, int end) {
+    const SumJob* job = (const SumJob*)context;
+    int chunk = start / PARALLEL_CHUNK;
+    int n = end - start;
+    switch (job->array->kind) {
+        case TYPED_F32: {
+            // Four partial sums so the reduction can vectorize
+            const float* x = (const float*)job->array->data + start;
+            float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+            int i = 0;
+            for (; i + 4 <= n; i += 4) {
+                s0 += x[i];
+                s1 += x[i + 1];
+                s2 += x[i + 2];
+                s3 += x[i + 3];
+            }
+            double sum = (double)s0 + s1 + s2 + s3;
+            for (; i < n; i++) sum += x[i];
+            job->sums[chunk] = sum;
+            break;
+        }
+        case TYPED_F64: {
+            const double* x = (const double*)job->array->data + start;
+            double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+            int i = 0;
+            for (; i + 4 <= n; i += 4) {
+                s0 += x[i];
+                s1 += x[i + 1];
+                s2 += x[i + 2];
+                s3 += x[i + 3];
+            }
+            double sum = s0 + s1 + s2 + s3;
+            for (; i < n; i++) sum += x[i];
+            job->sums[chunk] = sum;
+            break;
+        }
+        case TYPED_I32: {
+            const int32_t* x = (const int32_t*)job->array->data + start;
+            int64_t sum = 0;
+            for (int i = 0; i < n; i++) sum += x[i];
+            job->intSums[chunk] = sum;
+            break;
+        }
+        case TYPED_U8: {
+            const uint8_t* x = (const uint8_t*)job->array->data + start;
+            int64_t sum = 0;
+            for (int i = 0; i < n; i++) sum += x[i];
+            job->intSums[chunk] = sum;
+            break;
+        }
+    }
+}
+
+// vsum(arr) -> number (float for f32/f64, int for i32/u8)
+static Value vsumNative(int argCount, Value* args) {
+    (void)argCount;
+    int n = typedCommonCount(args, 1);
+    if (n < 0) return NIL_VAL;
+    ObjTypedArray* a = AS_TYPED_ARRAY(args[0]);
+    bool isFloat = a->kind == TYPED_F32 || a->kind == TYPED_F64;
+    int chunks = (n + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+
+    // Arrays up to 64 chunks keep their partials on the stack
+    double localSums[64];
+    int64_t localIntSums[64];
+    SumJob job = {a, localSums, localIntSums};
+    if (chunks > 64) {
+        job.sums = malloc(sizeof(double) * (size_t)chunks);
+        job.intSums = malloc(sizeof(int64_t) * (size_t)chunks);
+        if (job.sums == NULL || job.intSums == NULL) {
+            free(job.sums);
+            free(job.intSums);
+            return NIL_VAL;
+        }
+    }
+    parallelFor(n, runSum, &job);
+
+    double sum = 0;
+    int64_t intSum = 0;
+    for (int i = 0; i < chunks; i++) {
+        if (isFloat) sum += job.sums[i];
+        else intSum += job.intSums[i];
+    }
+    if (chunks > 64) {
+        free(job.sums);
+        free(job.intSums);
+    }
+    return isFloat ? FLOAT_VAL(sum) : INT_VAL(intSum);
+}
+
+// setParallelThreads(n) - Threads per bulk typed-array call, counting the
+// calling one (1 runs everything serially)
+static Value setParallelThreadsNative(int argCount, Value* args) {
+    (void)argCount;
+    if (IS_INT(args[0])) setParallelThreads((int)AS_INT(args[0]));
+    return NIL_VAL;
+}
+
+// parallelThreads() -> int
+static Value parallelThreadsNative(int argCount, Value* args) {
+    (void)argCount;
+    (void)args;
+    return INT_VAL(parallelThreads());
+}
+
+// ============ Spatial Grid Native Functions ============
+
+// Coordinates of a body collection as double columns. A StructArray lends
+// its float columns directly; an array of structs is gathered into scratch
+// and scattered back by closeBodies.
+#define MAX_BODY_FIELDS 4
+
+typedef struct {
+    int count;
+    int fieldCount;
+    double* columns[MAX_BODY_FIELDS];
+    double* scratch;
+    int fields[MAX_BODY_FIELDS];    // Field indices, for the scatter
+} BodyView;
+
+static int fieldIndexByName(ObjStructDef* def, const char* name) {
+    for (int i = 0; i < def->fieldCount; i++) {
+        if (strcmp(def->fieldNames[i]->chars, name) == 0) return i;
+    }
+    return -1;
+}
+
+static bool openBodies(Value bodies, const char** names, int fieldCount, BodyView* view) {
+    view->fieldCount = fieldCount;
+    view->scratch = NULL;
+    if (IS_STRUCT_ARRAY(bodies)) {
+        ObjStructArray* array = AS_STRUCT_ARRAY(bodies);
+        view->count = array->count;
+        for (int f = 0; f < fieldCount; f++) {
+            int field = fieldIndexByName(array->definition, names[f]);
+            if (field < 0 || array->columns[field]->type != OBJ_TYPED_ARRAY) return false;
+            view->columns[f] = ((ObjTypedArray*)array->columns[field])->data;
+        }
+        return true;
+    }
+    if (!IS_ARRAY(bodies)) return false;
+
+    ObjArray* array = AS_ARRAY(bodies);
+    view->count = array->count;
+    if (array->count == 0) {
+        for (int f = 0; f < fieldCount; f++) view->columns[f] = NULL;
+        return true;
+    }
+    if (!IS_STRUCT(array->elements[0])) return false;
+    ObjStructDef* def = AS_STRUCT(array->elements[0])->definition;
+    for (int f = 0; f < fieldCount; f++) {
+        view->fields[f] = fieldIndexByName(def, names[f]);
+        if (view->fields[f] < 0) return false;
+    }
+    view->scratch = malloc(sizeof(double) * (size_t)array->count * fieldCount);
+    if (view->scratch == NULL) return false;
+    for (int f = 0; f < fieldCount; f++) {
+        view->columns[f] = view->scratch + (size_t)f * array->count;
+    }
+    for (int i = 0; i < array->count; i++) {
+        Value element = array->elements[i];
+        if (!IS_STRUCT(element) || AS_STRUCT(element)->definition != def) goto invalid;
+        for (int f = 0; f < fieldCount; f++) {
+            Value value = AS_STRUCT(element)->fields[view->fields[f]];
+            if (!IS_NUMBER(value)) goto invalid;
+            view->columns[f][i] = AS_NUMBER(value);
+        }
+    }
+    return true;
+
+invalid:
+    free(view->scratch);
+    return false;
+}
+
+static void closeBodies(Value bodies, BodyView* view, bool writeBack) {
+    if (view->scratch == NULL) return;
+    if (writeBack) {
+        ObjArray* array = AS_ARRAY(bodies);
+        for (int i = 0; i < view->count; i++) {
+            ObjStruct* instance = AS_STRUCT(array->elements[i]);
+            for (int f = 0; f < view->fieldCount; f++) {
+                instance->fields[view->fields[f]] = FLOAT_VAL(view->columns[f][i]);
+            }
+        }
+    }
+    free(view->scratch);
+}
+
+static Value gridResults(ObjSpatialGrid* grid) {
+    ObjTypedArray* result = newTypedArray(TYPED_I32, grid->resultCount);
+    if (grid->resultCount > 0) {
+        memcpy(result->data, grid->results, sizeof(int32_t) * (size_t)grid->resultCount);
+    }
+    return OBJ_VAL(result);
+}
+
+// spatialGrid(cellSize) -> grid or nil
+// Pick a cell about the size of the largest query distance.
+static Value spatialGridNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_NUMBER(args[0]) || !(AS_NUMBER(args[0]) > 0)) return NIL_VAL;
+    return OBJ_VAL(newSpatialGrid(AS_NUMBER(args[0])));
+}
+
+// gridClear(grid)
+static Value gridClearNative(int argCount, Value* args) {
+    (void)argCount;
+    if (IS_SPATIAL_GRID(args[0])) spatialClear(AS_SPATIAL_GRID(args[0]));
+    return NIL_VAL;
+}
+
+// gridInsert(grid, x, y) -> id (ids count up from 0 since the last clear)
+static Value gridInsertNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_SPATIAL_GRID(args[0]) || !IS_NUMBER(args[1]) || !IS_NUMBER(args[2])) {
+        return NIL_VAL;
+    }
+    return INT_VAL(spatialInsert(AS_SPATIAL_GRID(args[0]),
+                                 AS_NUMBER(args[1]), AS_NUMBER(args[2])));
+}
+
+// gridUpdate(grid, id, x, y) -> bool
+static Value gridUpdateNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_SPATIAL_GRID(args[0]) || !IS_INT(args[1]) ||
+        !IS_NUMBER(args[2]) || !IS_NUMBER(args[3])) {
+        return BOOL_VAL(false);
+    }
+    ObjSpatialGrid* grid = AS_SPATIAL_GRID(args[0]);
+    int64_t id = AS_INT(args[1]);
+    if (id < 0 || id >= grid->count) return BOOL_VAL(false);
+    spatialUpdate(grid, (int)id, AS_NUMBER(args[2]), AS_NUMBER(args[3]));
+    return BOOL_VAL(true);
+}
+
+// gridBuild(grid, bodies) or gridBuild(grid, xs, ys) -> count or nil
+// Replaces the grid's points, id i at body i. bodies is a StructArray
+// with float x and y fields or an array of structs with x and y; xs and
+// ys are typed arrays or arrays of numbers.
+static Value gridBuildNative(int argCount, Value* args) {
+    if (!IS_SPATIAL_GRID(args[0])) return NIL_VAL;
+    ObjSpatialGrid* grid = AS_SPATIAL_GRID(args[0]);
+
+    if (argCount >= 3) {
+        int xCount = coordinateCount(args[1]);
+        int yCount = coordinateCount(args[2]);
+        if (xCount < 0 || yCount < 0) return NIL_VAL;
+        int count = xCount < yCount ? xCount : yCount;
+        spatialClear(grid);
+        for (int i = 0; i < count; i++) {
+            spatialInsert(grid, coordinateAt(args[1], i), coordinateAt(args[2], i));
+        }
+        return INT_VAL(count);
+    }
+
+    static const char* names[] = {"x", "y"};
+    BodyView view;
+    if (!openBodies(args[1], names, 2, &view)) return NIL_VAL;
+    spatialClear(grid);
+    for (int i = 0; i < view.count; i++) {
+        spatialInsert(grid, view.columns[0][i], view.columns[1][i]);
+    }
+    closeBodies(args[1], &view, false);
+    return INT_VAL(view.count);
+}
+
+// gridQueryPairs(grid, distance) -> i32 typed array [a0, b0, a1, b1, ...]
+// Every pair of ids, a < b, whose points are closer than distance
+static Value gridQueryPairsNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_SPATIAL_GRID(args[0]) || !IS_NUMBER(args[1])) return NIL_VAL;
+    ObjSpatialGrid* grid = AS_SPATIAL_GRID(args[0]);
+    spatialQueryPairs(grid, AS_NUMBER(args[1]));
+    return gridResults(grid);
+}
+
+// gridQueryRect(grid, x0, y0, x1, y1) -> i32 typed array of ids
+static Value gridQueryRectNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_SPATIAL_GRID(args[0])) return NIL_VAL;
+    for (int i = 1; i <= 4; i++) {
+        if (!IS_NUMBER(args[i])) return NIL_VAL;
+    }
+    ObjSpatialGrid* grid = AS_SPATIAL_GRID(args[0]);
+    spatialQueryRect(grid, AS_NUMBER(args[1]), AS_NUMBER(args[2]),
+                     AS_NUMBER(args[3]), AS_NUMBER(args[4]));
+    return gridResults(grid);
+}
+
+// gridResolve(grid, bodies, diameter) or
+// gridResolve(grid, xs, ys, vxs, vys, diameter) -> collisions or nil
+// Rebuilds the grid from the bodies and bounces every overlapping pair of
+// circles apart, updating x, y, vx and vy in place. bodies is a StructArray
+// with float x, y, vx and vy fields or an array of such structs; the
+// columns form takes f64 typed arrays.
+static Value gridResolveNative(int argCount, Value* args) {
+    if (!IS_SPATIAL_GRID(args[0])) return NIL_VAL;
+    ObjSpatialGrid* grid = AS_SPATIAL_GRID(args[0]);
+
+    if (argCount >= 6) {
+        int count = typedCommonCount(&args[1], 4);
+        if (count < 0 || !IS_NUMBER(args[5])) return NIL_VAL;
+        for (int i = 1; i <= 4; i++) {
+            if (AS_TYPED_ARRAY(args[i])->kind != TYPED_F64) return NIL_VAL;
+        }
+        return INT_VAL(spatialResolve(grid,
+            AS_TYPED_ARRAY(args[1])->data, AS_TYPED_ARRAY(args[2])->data,
+            AS_TYPED_ARRAY(args[3])->data, AS_TYPED_ARRAY(args[4])->data,
+            count, AS_NUMBER(args[5])));
+    }
+
+    if (argCount < 3 || !IS_NUMBER(args[2])) return NIL_VAL;
+    static const char* names[] = {"x", "y", "vx", "vy"};
+    BodyView view;
+    if (!openBodies(args[1], names, 4, &view)) return NIL_VAL;
+    int collisions = spatialResolve(grid, view.columns[0], view.columns[1],
+                                    view.columns[2], view.columns[3],
+                                    view.count, AS_NUMBER(args[2]));
+    closeBodies(args[1], &view, true);
+    return INT_VAL(collisions);
+}
+
+// ============ TCP Socket Native Functions ============
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// tcpListen(port[, backlog[, reusePort]]) -> socket or nil on error
+// reusePort sets SO_REUSEPORT so several processes can share the port.
+static Value tcpListenNative(int argCount, Value* args) {
+    int port = (int)AS_INT(args[0]);
+    int backlog = argCount >= 2 ? (int)AS_INT(args[1]) : SOMAXCONN;
+    bool reusePort = argCount >= 3 && !isFalsey(args[2]);
+
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        return NIL_VAL;
+    }
+
+    // Allow address reuse
+    int opt = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+#ifdef SO_REUSEPORT
+    if (reusePort) {
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    }
+#else
+    (void)reusePort;
+#endif
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    if (bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(sockfd);
+        return NIL_VAL;
+    }
+
+    if (listen(sockfd, backlog > 0 ? backlog : SOMAXCONN) < 0) {
+        close(sockfd);
+        return NIL_VAL;
+    }
+
+    return INT_VAL(sockfd);
+}
+
+static bool setNonBlocking(int fd, bool enabled) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return false;
+    flags = enabled ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(fd, F_SETFL, flags) == 0;
+}
+
+static bool wouldBlock(void) {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+// tcpAccept(socket) -> client socket or nil
+// Clients of a non-blocking listener are non-blocking too; nil then also
+// means no connection is pending.
+static Value tcpAcceptNative(int argCount, Value* args) {
+    (void)argCount;
+    int sockfd = (int)AS_INT(args[0]);
+
+    struct sockaddr_in client_addr;
+    socklen_t client_len = sizeof(client_addr);
+
+    int clientfd = accept(sockfd, (struct sockaddr*)&client_addr, &client_len);
+    if (clientfd < 0) {
+        return NIL_VAL;
+    }
+
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    if (flags >= 0 && (flags & O_NONBLOCK)) setNonBlocking(clientfd, true);
+
+    return INT_VAL(clientfd);
+}
+
+// Receive buffer shared by every tcpRecv, grown to the largest maxLen seen
+static THREAD_LOCAL char* recvBuffer = NULL;
+static THREAD_LOCAL int recvCapacity = 0;
+
+// tcpRecv(socket, maxLen) -> string, "" if a non-blocking socket has no
+// data yet, or nil once the peer closed or on error
+static Value tcpRecvNative(int argCount, Value* args) {
+    (void)argCount;
+    int sockfd = (int)AS_INT(args[0]);
+    int maxLen = (int)AS_INT(args[1]);
+    if (maxLen <= 0) return NIL_VAL;
+
+    if (maxLen > recvCapacity) {
+        char* grown = realloc(recvBuffer, (size_t)maxLen);
+        if (!grown) return NIL_VAL;
+        recvBuffer = grown;
+        recvCapacity = maxLen;
+    }
+
+    ssize_t received = recv(sockfd, recvBuffer, (size_t)maxLen, 0);
+    if (received < 0 && wouldBlock()) {
+        return OBJ_VAL(copyString("", 0));
+    }
+    if (received <= 0) {
+        return NIL_VAL;
+    }
+
+    return OBJ_VAL(copyString(recvBuffer, (int)received));
+}
+
+// tcpSend(socket, data) -> bytes sent (0 if a non-blocking socket is full) or -1
+static Value tcpSendNative(int argCount, Value* args) {
+    (void)argCount;
+    int sockfd = (int)AS_INT(args[0]);
+    ObjString* data = AS_STRING(args[1]);
+
+    ssize_t sent = send(sockfd, data->chars, data->length, MSG_NOSIGNAL);
+    if (sent < 0 && wouldBlock()) sent = 0;
+    return INT_VAL(sent);
+}
+
+// Sends at most count bytes of the open file from offset; returns bytes
+// sent, stopping early when a non-blocking socket fills up
+static ssize_t sendFileRange(int sockfd, int filefd, off_t offset, size_t count) {
+    size_t total = 0;
+    while (total < count) {
+#ifdef __linux__
+        off_t position = offset + (off_t)total;
+        ssize_t sent = sendfile(sockfd, filefd, &position, count - total);
+        if (sent == 0) break;  // File shorter than expected
+#else
+        char chunk[65536];
+        size_t want = count - total < sizeof(chunk) ? count - total : sizeof(chunk);
+        if (lseek(filefd, offset + (off_t)total, SEEK_SET) < 0) break;
+        ssize_t got = read(filefd, chunk, want);
+        if (got <= 0) break;
+        ssize_t sent = send(sockfd, chunk, (size_t)got, MSG_NOSIGNAL);
+#endif
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (wouldBlock()) break;
+            return total > 0 ? (ssize_t)total : -1;
+        }
+        total += (size_t)sent;
+#ifndef __linux__
+        if (sent < got) break;  // Socket full: caller resumes later
+#endif
+    }
+    return (ssize_t)total;
+}
+
+// tcpSendFile(socket, path, offset, len) -> bytes sent or -1
+// The kernel copies the file straight to the socket (sendfile on Linux),
+// so the body never becomes a string. len <= 0 sends to the end of the
+// file. A non-blocking socket may take less; resume from offset + sent.
+static Value tcpSendFileNative(int argCount, Value* args) {
+    (void)argCount;
+    int sockfd = (int)AS_INT(args[0]);
+    const char* path = AS_CSTRING(args[1]);
+    int64_t offset = AS_INT(args[2]);
+    int64_t length = AS_INT(args[3]);
+    if (offset < 0) return INT_VAL(-1);
+
+    int filefd = open(path, O_RDONLY);
+    if (filefd < 0) return INT_VAL(-1);
+
+    struct stat st;
+    if (fstat(filefd, &st) != 0) {
+        close(filefd);
+        return INT_VAL(-1);
+    }
+    int64_t available = (int64_t)st.st_size - offset;
+    if (available < 0) available = 0;
+    if (length <= 0 || length > available) length = available;
+
+    ssize_t sent = sendFileRange(sockfd, filefd, (off_t)offset, (size_t)length);
+    close(filefd);
+    return INT_VAL((int64_t)sent);
+}
+
+// tcpSendParts(socket, parts) -> bytes sent or -1
+// Sends an array of strings (e.g. [headers, body]) with one gathered
+// write per batch instead of concatenating them first.
+static Value tcpSendPartsNative(int argCount, Value* args) {
+    (void)argCount;
+    int sockfd = (int)AS_INT(args[0]);
+    if (!IS_ARRAY(args[1])) return INT_VAL(-1);
+    ObjArray* parts = AS_ARRAY(args[1]);
+
+    enum { BATCH = 64 };
+    struct iovec iov[BATCH];
+    int64_t total = 0;
+    int next = 0;
+    while (next < parts->count) {
+        // Gather the next batch of non-empty strings
+        int used = 0;
+        size_t batchBytes = 0;
+        int batchEnd = next;
+        while (batchEnd < parts->count && used < BATCH) {
+            Value part = parts->elements[batchEnd++];
+            if (!IS_STRING(part) || AS_STRING(part)->length == 0) continue;
+            iov[used].iov_base = AS_STRING(part)->chars;
+            iov[used].iov_len = (size_t)AS_STRING(part)->length;
+            batchBytes += iov[used].iov_len;
+            used++;
+        }
+        next = batchEnd;
+
+        struct iovec* pending = iov;
+        int pendingCount = used;
+        size_t remaining = batchBytes;
+        while (remaining > 0) {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = pending;
+            msg.msg_iovlen = pendingCount;
+            ssize_t sent = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                if (wouldBlock()) return INT_VAL(total);
+                return INT_VAL(total > 0 ? total : -1);
+            }
+            total += sent;
+            remaining -= (size_t)sent;
+
+            // Skip what went out; a partial part keeps its tail
+            size_t done = (size_t)sent;
+            while (pendingCount > 0 && done >= pending->iov_len) {
+                done -= pending->iov_len;
+                pending++;
+                pendingCount--;
+            }
+            if (pendingCount > 0) {
+                pending->iov_base = (char*)pending->iov_base + done;
+                pending->iov_len -= done;
+            }
+        }
+    }
+    return INT_VAL(total);
+}
+
+// tcpSetNonBlocking(socket, enabled) -> bool
+static Value tcpSetNonBlockingNative(int argCount, Value* args) {
+    (void)argCount;
+    int sockfd = (int)AS_INT(args[0]);
+    return BOOL_VAL(setNonBlocking(sockfd, !isFalsey(args[1])));
+}
+
+// ============ Readiness Polling ============
+// netWatch(fd, events) registers interest in NET_READ / NET_WRITE;
+// netPoll(timeoutMs) waits and returns a flat array [fd, events, ...] of
+// the ready ones, with NET_HUP / NET_ERROR set when the peer went away.
+// Uses epoll on Linux and poll() elsewhere.
+
+#define NET_READ 1
+#define NET_WRITE 2
+#define NET_HUP 4
+#define NET_ERROR 8
+#define NET_MAX_EVENTS 1024
+
+#ifdef __linux__
+static THREAD_LOCAL int epollFd = -1;
+
+static bool netWatchFd(int fd, int events) {
+    if (epollFd < 0) {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0) return false;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = ((events & NET_READ) ? EPOLLIN : 0) |
+                   ((events & NET_WRITE) ? EPOLLOUT : 0) | EPOLLRDHUP;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) == 0) return true;
+    return errno == ENOENT && epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+static void netUnwatchFd(int fd) {
+    if (epollFd >= 0) epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static Value netPollFds(int timeoutMs) {
+    static THREAD_LOCAL struct epoll_event events[NET_MAX_EVENTS];
+    ObjArray* ready = newArray();
+    if (epollFd < 0) return OBJ_VAL(ready);
+
+    int count = epoll_wait(epollFd, events, NET_MAX_EVENTS, timeoutMs);
+    push(OBJ_VAL(ready)); // GC protection
+    for (int i = 0; i < count; i++) {
+        uint32_t e = events[i].events;
+        int flags = ((e & EPOLLIN) ? NET_READ : 0) |
+                    ((e & EPOLLOUT) ? NET_WRITE : 0) |
+                    ((e & (EPOLLHUP | EPOLLRDHUP)) ? NET_HUP : 0) |
+                    ((e & EPOLLERR) ? NET_ERROR : 0);
+        writeArray(ready, INT_VAL(events[i].data.fd));
+        writeArray(ready, INT_VAL(flags));
+    }
+    pop();
+    return OBJ_VAL(ready);
+}
+#else
+static THREAD_LOCAL struct pollfd* watched = NULL;
+static THREAD_LOCAL int watchedCount = 0;
+static THREAD_LOCAL int watchedCapacity = 0;
+
+static bool netWatchFd(int fd, int events) {
+    short mask = (short)(((events & NET_READ) ? POLLIN : 0) |
+                         ((events & NET_WRITE) ? POLLOUT : 0));
+    for (int i = 0; i < watchedCount; i++) {
+        if (watched[i].fd == fd) {
+            watched[i].events = mask;
+            return true;
+        }
+    }
+    if (watchedCount == watchedCapacity) {
+        int capacity = watchedCapacity < 16 ? 16 : watchedCapacity * 2;
+        struct pollfd* grown = realloc(watched, sizeof(struct pollfd) * capacity);
+        if (grown == NULL) return false;
+        watched = grown;
+        watchedCapacity = capacity;
+    }
+    watched[watchedCount].fd = fd;
+    watched[watchedCount].events = mask;
+    watched[watchedCount].revents = 0;
+    watchedCount++;
+    return true;
+}
+
+static void netUnwatchFd(int fd) {
+    for (int i = 0; i < watchedCount; i++) {
+        if (watched[i].fd == fd) {
+            watched[i] = watched[--watchedCount];
+            return;
+        }
+    }
+}
+
+static Value netPollFds(int timeoutMs) {
+    ObjArray* ready = newArray();
+    int count = poll(watched, (nfds_t)watchedCount, timeoutMs);
+    push(OBJ_VAL(ready)); // GC protection
+    for (int i = 0; i < watchedCount && count > 0; i++) {
+        short e = watched[i].revents;
+        if (e == 0) continue;
+        count--;
+        int flags = ((e & POLLIN) ? NET_READ : 0) |
+                    ((e & POLLOUT) ? NET_WRITE : 0) |
+                    ((e & POLLHUP) ? NET_HUP : 0) |
+                    ((e & (POLLERR | POLLNVAL)) ? NET_ERROR : 0);
+        writeArray(ready, INT_VAL(watched[i].fd));
+        writeArray(ready, INT_VAL(flags));
+    }
+    pop();
+    return OBJ_VAL(ready);
+}
+#endif
+
+// netWatch(fd, events) -> bool (events: NET_READ | NET_WRITE)
+static Value netWatchNative(int argCount, Value* args) {
+    (void)argCount;
+    return BOOL_VAL(netWatchFd((int)AS_INT(args[0]), (int)AS_INT(args[1])));
+}
+
+// netUnwatch(fd)
+static Value netUnwatchNative(int argCount, Value* args) {
+    (void)argCount;
+    netUnwatchFd((int)AS_INT(args[0]));
+    return NIL_VAL;
+}
+
+// netPoll(timeoutMs) -> array [fd, events, fd, events, ...]
+// timeoutMs 0 returns at once (for polling from a game loop), -1 waits.
+static Value netPollNative(int argCount, Value* args) {
+    (void)argCount;
+    return netPollFds((int)AS_INT(args[0]));
+}
+
+// tcpClose(socket) - Also stops watching it
+static Value tcpCloseNative(int argCount, Value* args) {
+    (void)argCount;
+    int sockfd = (int)AS_INT(args[0]);
+    netUnwatchFd(sockfd);
+    close(sockfd);
+    return NIL_VAL;
+}
+
+// ============ Worker Native Functions ============
+// A worker is a script running on its own thread and VM; values cross
+// between the two as copies (see worker.h).
+
+// spawnWorker(path) -> channel to the new worker, or nil if it couldn't start
+static Value spawnWorkerNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_STRING(args[0])) return NIL_VAL;
+    Channel* channel = createChannel();
+    if (channel == NULL) return NIL_VAL;
+    ObjChannel* parentEnd = newChannel(channel, 0);
+    if (!spawnWorker(AS_CSTRING(args[0]), channel)) return NIL_VAL;
+    return OBJ_VAL(parentEnd);
+}
+
+// workerChannel() -> channel to the parent script, or nil on the main thread
+static Value workerChannelNative(int argCount, Value* args) {
+    (void)argCount;
+    (void)args;
+    if (vm.workerChannel == NULL) return NIL_VAL;
+    return OBJ_VAL(newChannel(vm.workerChannel, 1));
+}
+
+// send(channel, value) -> bool (false if the value can't be copied, e.g. a
+// function, or the other end is closed)
+static Value sendNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_CHANNEL(args[0])) return BOOL_VAL(false);
+    ObjChannel* channel = AS_CHANNEL(args[0]);
+    Message* message = encodeMessage(args[1]);
+    if (message == NULL) return BOOL_VAL(false);
+    return BOOL_VAL(channelSend(channel->channel, channel->end, message));
+}
+
+// recv(channel[, timeoutMs]) -> next value, or nil once timeoutMs passes
+// (0 polls, default -1 waits) or the other end closes
+static Value recvNative(int argCount, Value* args) {
+    if (!IS_CHANNEL(args[0])) return NIL_VAL;
+    ObjChannel* channel = AS_CHANNEL(args[0]);
+    int timeoutMs = argCount >= 2 && IS_INT(args[1]) ? (int)AS_INT(args[1]) : -1;
+    Message* message = channelReceive(channel->channel, channel->end, timeoutMs);
+    if (message == NULL) return NIL_VAL;
+    return decodeMessage(message);
+}
+
+// channelOpen(channel) -> bool (false once the other end has closed and
+// everything it sent has been received)
+static Value channelOpenNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_CHANNEL(args[0])) return BOOL_VAL(false);
+    ObjChannel* channel = AS_CHANNEL(args[0]);
+    return BOOL_VAL(channelIsOpen(channel->channel, channel->end));
+}
+
+// channelClose(channel) - The other end's recv returns nil once drained
+static Value channelCloseNative(int argCount, Value* args) {
+    (void)argCount;
+    if (IS_CHANNEL(args[0])) {
+        closeChannel(AS_CHANNEL(args[0])->channel, AS_CHANNEL(args[0])->end);
+    }
+    return NIL_VAL;
+}
+
+// ============ Audio Native Functions ============
+
+// Simple sound structure for WAV playback
 typedef struct {
     SDL_AudioSpec spec;
     Uint8* buffer;
@@ -871,23 +2515,33 @@ typedef struct {
 static SDL_AudioStream* audioStream = NULL;
 
 // ============ Synthesizer for MIDI ============
+// The audio callback runs on SDL's audio thread with the stream locked, so
+// it never allocates: voices and mix buffers are set up by initSynth, and
+// the natives that change voices take the same lock.
 
-#define MAX_VOICES 32
+#define DEFAULT_VOICES 32
+#define MAX_POLYPHONY 1024
 #define SAMPLE_RATE 44100
+#define SYNTH_BLOCK 64          // Envelopes step once per block, gain ramps within it
+#define SYNTH_CHUNK 1024        // Samples converted per SDL_PutAudioStreamData
+#define WAVETABLE_SIZE 2048     // Power of two
 
 typedef struct {
-    bool active;
     int note;           // MIDI note number
-    float frequency;
-    float phase;
+    float increment;    // Phase step per sample (frequency / SAMPLE_RATE)
+    float phase;        // 0-1
     float velocity;     // 0.0-1.0
     float envelope;     // ADSR envelope value
     int stage;          // 0=attack, 1=decay, 2=sustain, 3=release
     bool releasing;
+    uint32_t started;   // noteOn order, for stealing the oldest voice
 } Voice;
 
 typedef struct {
-    Voice voices[MAX_VOICES];
+    Voice* voices;      // voices[0..activeCount) are sounding, packed
+    int activeCount;
+    int maxVoices;
+    uint32_t noteCounter;
     float attack;       // seconds
     float decay;        // seconds
     float sustain;      // level 0-1
@@ -899,79 +2553,127 @@ typedef struct {
 
 static Synth synth = {0};
 
+// One cycle of sine + 2nd and 3rd harmonics, plus a guard sample so
+// interpolation never wraps
+static float wavetable[WAVETABLE_SIZE + 1];
+static float mixBuffer[SYNTH_BLOCK];
+static int16_t outBuffer[SYNTH_CHUNK];
+
+static void initWavetable(void) {
+    for (int i = 0; i <= WAVETABLE_SIZE; i++) {
+        float t = (float)i / WAVETABLE_SIZE * 2.0f * 3.14159265f;
+        wavetable[i] = 0.5f * (sinf(t) + 0.3f * sinf(2.0f * t) + 0.1f * sinf(3.0f * t));
+    }
+}
+
 static float midiNoteToFreq(int note) {
     return 440.0f * powf(2.0f, (note - 69) / 12.0f);
 }
 
+// Step a voice's ADSR by one block; false once its release has finished
+static bool advanceEnvelope(Voice* voice, float dt) {
+    switch (voice->stage) {
+        case 0: // Attack
+            voice->envelope += dt / synth.attack;
+            if (voice->envelope >= 1.0f) {
+                voice->envelope = 1.0f;
+                voice->stage = 1;
+            }
+            break;
+        case 1: // Decay
+            voice->envelope -= dt / synth.decay * (1.0f - synth.sustain);
+            if (voice->envelope <= synth.sustain) {
+                voice->envelope = synth.sustain;
+                voice->stage = 2;
+            }
+            break;
+        case 2: // Sustain
+            if (voice->releasing) voice->stage = 3;
+            break;
+        case 3: // Release
+            voice->envelope -= dt / synth.release;
+            if (voice->envelope <= 0.0f) {
+                voice->envelope = 0.0f;
+                return false;
+            }
+            break;
+    }
+    return true;
+}
+
+// Add count samples of voice into mix, ramping gain to the block's end value
+static void renderVoice(Voice* voice, float* restrict mix, int count, float dt) {
+    float gain = voice->envelope * voice->velocity;
+    bool sounding = advanceEnvelope(voice, dt);
+    float gainStep = (voice->envelope * voice->velocity - gain) / count;
+
+    float phase = voice->phase;
+    float increment = voice->increment;
+    for (int i = 0; i < count; i++) {
+        float position = phase * WAVETABLE_SIZE;
+        int index = (int)position;
+        float frac = position - (float)index;
+        float wave = wavetable[index] + (wavetable[index + 1] - wavetable[index]) * frac;
+        mix[i] += wave * gain;
+        gain += gainStep;
+        phase += increment;
+        if (phase >= 1.0f) phase -= 1.0f;
+    }
+    voice->phase = phase;
+    if (!sounding) voice->envelope = -1.0f;  // Finished: removed after the block
+}
+
 static void synthCallback(void* userdata, SDL_AudioStream* stream, int additional_amount, int total_amount) {
     (void)userdata;
     (void)total_amount;
 
-    if (additional_amount <= 0) return;
-
-    int samples = additional_amount / sizeof(int16_t);
-    int16_t* buffer = malloc(additional_amount);
-    if (!buffer) return;
-
-    float dt = 1.0f / SAMPLE_RATE;
+    int remaining = additional_amount / (int)sizeof(int16_t);
+    float volume = synth.masterVolume;
 
-    for (int i = 0; i < samples; i++) {
-        float sample = 0.0f;
+    while (remaining > 0) {
+        int chunk = remaining < SYNTH_CHUNK ? remaining : SYNTH_CHUNK;
 
-        for (int v = 0; v < MAX_VOICES; v++) {
-            Voice* voice = &synth.voices[v];
-            if (!voice->active) continue;
+        for (int start = 0; start < chunk; start += SYNTH_BLOCK) {
+            int count = chunk - start < SYNTH_BLOCK ? chunk - start : SYNTH_BLOCK;
+            float dt = (float)count / SAMPLE_RATE;
+            memset(mixBuffer, 0, sizeof(mixBuffer));
 
-            // Update envelope
-            switch (voice->stage) {
-                case 0: // Attack
-                    voice->envelope += dt / synth.attack;
-                    if (voice->envelope >= 1.0f) {
-                        voice->envelope = 1.0f;
-                        voice->stage = 1;
-                    }
-                    break;
-                case 1: // Decay
-                    voice->envelope -= dt / synth.decay * (1.0f - synth.sustain);
-                    if (voice->envelope <= synth.sustain) {
-                        voice->envelope = synth.sustain;
-                        voice->stage = 2;
-                    }
-                    break;
-                case 2: // Sustain
-                    if (voice->releasing) voice->stage = 3;
-                    break;
-                case 3: // Release
-                    voice->envelope -= dt / synth.release;
-                    if (voice->envelope <= 0.0f) {
-                        voice->envelope = 0.0f;
-                        voice->active = false;
-                    }
-                    break;
+            for (int v = 0; v < synth.activeCount; v++) {
+                renderVoice(&synth.voices[v], mixBuffer, count, dt);
+            }
+            // Drop finished voices, keeping the active ones packed
+            for (int v = 0; v < synth.activeCount;) {
+                if (synth.voices[v].envelope < 0.0f) {
+                    synth.voices[v] = synth.voices[--synth.activeCount];
+                } else {
+                    v++;
+                }
             }
 
-            // Generate waveform (sine + slight harmonics for richness)
-            float wave = sinf(voice->phase * 2.0f * 3.14159265f);
-            wave += 0.3f * sinf(voice->phase * 4.0f * 3.14159265f); // 2nd harmonic
-            wave += 0.1f * sinf(voice->phase * 6.0f * 3.14159265f); // 3rd harmonic
-            wave *= 0.5f; // Normalize
-
-            sample += wave * voice->envelope * voice->velocity;
-
-            // Advance phase
-            voice->phase += voice->frequency * dt;
-            if (voice->phase >= 1.0f) voice->phase -= 1.0f;
+            // Clip and convert to int16
+            int16_t* out = outBuffer + start;
+            for (int i = 0; i < count; i++) {
+                float sample = mixBuffer[i] * volume;
+                sample = sample > 1.0f ? 1.0f : sample;
+                sample = sample < -1.0f ? -1.0f : sample;
+                out[i] = (int16_t)(sample * 32000);
+            }
         }
 
-        // Soft clip and convert to int16
-        sample *= synth.masterVolume;
-        if (sample > 1.0f) sample = 1.0f;
-        if (sample < -1.0f) sample = -1.0f;
-        buffer[i] = (int16_t)(sample * 32000);
+        SDL_PutAudioStreamData(stream, outBuffer, chunk * (int)sizeof(int16_t));
+        remaining -= chunk;
     }
+}
 
-    SDL_PutAudioStreamData(stream, buffer, additional_amount);
-    free(buffer);
+// Resize the voice pool; extra sounding voices are cut. Caller holds the
+// stream lock once the device is running.
+static bool setVoiceCapacity(int maxVoices) {
+    Voice* voices = realloc(synth.voices, sizeof(Voice) * (size_t)maxVoices);
+    if (voices == NULL) return false;
+    synth.voices = voices;
+    synth.maxVoices = maxVoices;
+    if (synth.activeCount > maxVoices) synth.activeCount = maxVoices;
+    return true;
 }
 
 // initAudio() -> bool
@@ -997,21 +2699,30 @@ static Value initAudioNative(int argCount, Value* args) {
     return BOOL_VAL(true);
 }
 
-// loadSound(path) -> ptr (SoundData*)
-static Value loadSoundNative(int argCount, Value* args) {
-    (void)argCount;
-    const char* path = AS_CSTRING(args[0]);
-
+// Decodes the whole WAV; safe off the main thread (loadSoundAsync)
+static void* readSound(const char* path) {
     SoundData* sound = malloc(sizeof(SoundData));
-    if (!sound) return PTR_VAL(NULL);
+    if (!sound) return NULL;
 
     if (!SDL_LoadWAV(path, &sound->spec, &sound->buffer, &sound->length)) {
         fprintf(stderr, "Failed to load WAV: %s\n", SDL_GetError());
         free(sound);
-        return PTR_VAL(NULL);
+        return NULL;
     }
 
-    return PTR_VAL(sound);
+    return sound;
+}
+
+static void freeSound(void* data) {
+    SoundData* sound = (SoundData*)data;
+    if (sound->buffer) SDL_free(sound->buffer);
+    free(sound);
+}
+
+// loadSound(path) -> ptr (SoundData*)
+static Value loadSoundNative(int argCount, Value* args) {
+    (void)argCount;
+    return PTR_VAL(readSound(AS_CSTRING(args[0])));
 }
 
 // playSound(sound) -> bool
@@ -1057,20 +2768,16 @@ static Value playSoundNative(int argCount, Value* args) {
 static Value destroySoundNative(int argCount, Value* args) {
     (void)argCount;
     SoundData* sound = (SoundData*)AS_PTR(args[0]);
-    if (sound) {
-        if (sound->buffer) SDL_free(sound->buffer);
-        free(sound);
-    }
+    if (sound) freeSound(sound);
     return NIL_VAL;
 }
 
 // ============ Synthesizer Native Functions ============
 
-// initSynth() -> bool
+// initSynth([maxVoices]) -> bool
+// maxVoices (default 32) is how many notes can sound at once; see
+// setSynthPolyphony.
 static Value initSynthNative(int argCount, Value* args) {
-    (void)argCount;
-    (void)args;
-
     if (synth.initialized) return BOOL_VAL(true);
 
     // Initialize audio subsystem if not already done
@@ -1088,10 +2795,15 @@ static Value initSynthNative(int argCount, Value* args) {
     synth.release = 0.3f;
     synth.masterVolume = 0.5f;
 
-    // Clear voices
-    for (int i = 0; i < MAX_VOICES; i++) {
-        synth.voices[i].active = false;
+    int maxVoices = DEFAULT_VOICES;
+    if (argCount >= 1 && IS_INT(args[0])) {
+        int64_t requested = AS_INT(args[0]);
+        maxVoices = requested < 1 ? 1 : (requested > MAX_POLYPHONY ? MAX_POLYPHONY
+                                                                    : (int)requested);
     }
+    synth.activeCount = 0;
+    if (!setVoiceCapacity(maxVoices)) return BOOL_VAL(false);
+    initWavetable();
 
     SDL_AudioSpec spec;
     SDL_zero(spec);
@@ -1113,6 +2825,19 @@ static Value initSynthNative(int argCount, Value* args) {
     return BOOL_VAL(true);
 }
 
+// setSynthPolyphony(maxVoices) -> bool - 1 to 1024 simultaneous notes
+static Value setSynthPolyphonyNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!synth.initialized || !IS_INT(args[0])) return BOOL_VAL(false);
+    int64_t maxVoices = AS_INT(args[0]);
+    if (maxVoices < 1 || maxVoices > MAX_POLYPHONY) return BOOL_VAL(false);
+
+    SDL_LockAudioStream(synth.stream);
+    bool ok = setVoiceCapacity((int)maxVoices);
+    SDL_UnlockAudioStream(synth.stream);
+    return BOOL_VAL(ok);
+}
+
 // noteOn(note, velocity) - note: 0-127 MIDI, velocity: 0-127
 static Value noteOnNative(int argCount, Value* args) {
     (void)argCount;
@@ -1121,27 +2846,32 @@ static Value noteOnNative(int argCount, Value* args) {
 
     if (!synth.initialized) return NIL_VAL;
 
-    // Find free voice or steal oldest
-    int freeVoice = -1;
-    for (int i = 0; i < MAX_VOICES; i++) {
-        if (!synth.voices[i].active) {
-            freeVoice = i;
-            break;
+    SDL_LockAudioStream(synth.stream);
+    // Take the next free slot, or steal the oldest voice
+    int slot = synth.activeCount;
+    if (slot < synth.maxVoices) {
+        synth.activeCount++;
+    } else {
+        slot = 0;
+        for (int i = 1; i < synth.activeCount; i++) {
+            if (synth.voices[i].started - synth.voices[slot].started > UINT32_MAX / 2) {
+                slot = i;
+            }
         }
     }
-    if (freeVoice < 0) freeVoice = 0; // Steal first voice
 
-    Voice* v = &synth.voices[freeVoice];
-    v->active = true;
+    Voice* v = &synth.voices[slot];
     v->note = note;
-    v->frequency = midiNoteToFreq(note);
+    v->increment = midiNoteToFreq(note) / SAMPLE_RATE;
     v->phase = 0.0f;
     v->velocity = velocity / 127.0f;
     v->envelope = 0.0f;
     v->stage = 0;
     v->releasing = false;
+    v->started = synth.noteCounter++;
+    SDL_UnlockAudioStream(synth.stream);
 
-    return INT_VAL(freeVoice);
+    return INT_VAL(slot);
 }
 
 // noteOff(note) - release note
@@ -1151,11 +2881,13 @@ static Value noteOffNative(int argCount, Value* args) {
 
     if (!synth.initialized) return NIL_VAL;
 
-    for (int i = 0; i < MAX_VOICES; i++) {
-        if (synth.voices[i].active && synth.voices[i].note == note) {
+    SDL_LockAudioStream(synth.stream);
+    for (int i = 0; i < synth.activeCount; i++) {
+        if (synth.voices[i].note == note) {
             synth.voices[i].releasing = true;
         }
     }
+    SDL_UnlockAudioStream(synth.stream);
     return NIL_VAL;
 }
 
@@ -1164,9 +2896,13 @@ static Value allNotesOffNative(int argCount, Value* args) {
     (void)argCount;
     (void)args;
 
-    for (int i = 0; i < MAX_VOICES; i++) {
+    if (!synth.initialized) return NIL_VAL;
+
+    SDL_LockAudioStream(synth.stream);
+    for (int i = 0; i < synth.activeCount; i++) {
         synth.voices[i].releasing = true;
     }
+    SDL_UnlockAudioStream(synth.stream);
     return NIL_VAL;
 }
 
@@ -1244,15 +2980,13 @@ static int compareMidiEvents(const void* a, const void* b) {
     return ea->track - eb->track;
 }
 
-// loadMidi(path) -> ptr (MidiFile*)
-static Value loadMidiNative(int argCount, Value* args) {
-    (void)argCount;
-    const char* path = AS_CSTRING(args[0]);
-
+// Reads, parses and sorts the whole file; safe off the main thread
+// (loadMidiAsync)
+static void* parseMidiFile(const char* path) {
     FILE* f = fopen(path, "rb");
     if (!f) {
         fprintf(stderr, "Failed to open MIDI file: %s\n", path);
-        return PTR_VAL(NULL);
+        return NULL;
     }
 
     fseek(f, 0, SEEK_END);
@@ -1263,7 +2997,7 @@ static Value loadMidiNative(int argCount, Value* args) {
     if (!data || fread(data, 1, length, f) != length) {
         fclose(f);
         free(data);
-        return PTR_VAL(NULL);
+        return NULL;
     }
     fclose(f);
 
@@ -1272,7 +3006,7 @@ static Value loadMidiNative(int argCount, Value* args) {
     // Check header "MThd"
     if (buf.length < 14 || memcmp(buf.data, "MThd", 4) != 0) {
         free(data);
-        return PTR_VAL(NULL);
+        return NULL;
     }
     buf.pos = 4;
 
@@ -1353,7 +3087,19 @@ static Value loadMidiNative(int argCount, Value* args) {
         qsort(midi->events, midi->eventCount, sizeof(MidiEvent), compareMidiEvents);
     }
 
-    return PTR_VAL(midi);
+    return midi;
+}
+
+static void freeMidiFile(void* data) {
+    MidiFile* midi = (MidiFile*)data;
+    free(midi->events);
+    free(midi);
+}
+
+// loadMidi(path) -> ptr (MidiFile*)
+static Value loadMidiNative(int argCount, Value* args) {
+    (void)argCount;
+    return PTR_VAL(parseMidiFile(AS_CSTRING(args[0])));
 }
 
 // getMidiEventCount(midi) -> int
@@ -1374,10 +3120,12 @@ static Value getMidiEventNative(int argCount, Value* args) {
 
     MidiEvent* ev = &midi->events[index];
     ObjArray* arr = newArray();
+    push(OBJ_VAL(arr)); // GC protection
     writeArray(arr, INT_VAL(ev->tick));
     writeArray(arr, INT_VAL(ev->status));
     writeArray(arr, INT_VAL(ev->data1));
     writeArray(arr, INT_VAL(ev->data2));
+    pop();
     return OBJ_VAL(arr);
 }
 
@@ -1401,13 +3149,106 @@ static Value getMidiTempoNative(int argCount, Value* args) {
 static Value destroyMidiNative(int argCount, Value* args) {
     (void)argCount;
     MidiFile* midi = (MidiFile*)AS_PTR(args[0]);
-    if (midi) {
-        free(midi->events);
-        free(midi);
-    }
+    if (midi) freeMidiFile(midi);
     return NIL_VAL;
 }
 
+// ============ Async Asset Native Functions ============
+// The file is read and decoded on the loader thread (assets.h); the handle
+// finishes the job (uploading a texture) the first time it's polled and
+// found done.
+
+typedef enum {
+    ASSET_TEXTURE,
+    ASSET_SOUND,
+    ASSET_MIDI,
+} AssetKind;
+
+// Finish a load whose decoding is done; false while it is still running
+static bool finishAsset(ObjAsset* asset) {
+    if (asset->ready) return true;
+    if (!assetLoadDone(asset->load)) return false;
+
+    void* data = takeAssetData(asset->load);
+    if (asset->kind == ASSET_TEXTURE && data != NULL) {
+        SDL_Renderer* renderer = (SDL_Renderer*)asset->renderer;
+        const char* path = assetLoadPath(asset->load);
+        // An earlier load of the same path may have finished first
+        SDL_Texture* texture = assetCacheFindTexture(renderer, path);
+        if (texture != NULL) discardImage(data);
+        else texture = uploadTexture(renderer, path, (SDL_Surface*)data);
+        data = texture;
+    }
+    asset->data = data;
+    asset->ready = true;
+    releaseAssetLoad(asset->load);
+    asset->load = NULL;
+    return true;
+}
+
+static Value startAsset(AssetKind kind, SDL_Renderer* renderer, Value path,
+                        AssetDecoder decode, AssetDiscard discard) {
+    // The loader belongs to the main thread, like rendering and audio
+    if (vm.workerChannel != NULL || !IS_STRING(path)) return NIL_VAL;
+    AssetLoad* load = startAssetLoad(AS_CSTRING(path), decode, discard);
+    if (load == NULL) return NIL_VAL;
+    return OBJ_VAL(newAsset(load, kind, renderer));
+}
+
+// loadTextureAsync(renderer, path) -> asset
+// A path already in the texture cache gives a handle that's ready at once
+static Value loadTextureAsyncNative(int argCount, Value* args) {
+    (void)argCount;
+    SDL_Renderer* renderer = (SDL_Renderer*)AS_PTR(args[0]);
+    if (IS_STRING(args[1]) && vm.workerChannel == NULL) {
+        SDL_Texture* texture = assetCacheFindTexture(renderer, AS_CSTRING(args[1]));
+        if (texture != NULL) {
+            ObjAsset* asset = newAsset(NULL, ASSET_TEXTURE, renderer);
+            asset->data = texture;
+            asset->ready = true;
+            return OBJ_VAL(asset);
+        }
+    }
+    return startAsset(ASSET_TEXTURE, renderer, args[1], decodeImage, discardImage);
+}
+
+// loadSoundAsync(path) -> asset
+static Value loadSoundAsyncNative(int argCount, Value* args) {
+    (void)argCount;
+    return startAsset(ASSET_SOUND, NULL, args[0], readSound, freeSound);
+}
+
+// loadMidiAsync(path) -> asset
+static Value loadMidiAsyncNative(int argCount, Value* args) {
+    (void)argCount;
+    return startAsset(ASSET_MIDI, NULL, args[0], parseMidiFile, freeMidiFile);
+}
+
+// isReady(asset) -> bool
+// Call from the game loop; a texture is uploaded by the call that sees it done
+static Value isReadyNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_ASSET(args[0])) return BOOL_VAL(false);
+    return BOOL_VAL(finishAsset(AS_ASSET(args[0])));
+}
+
+// assetValue(asset) -> ptr, or nil while loading (a null ptr if it failed)
+static Value assetValueNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_ASSET(args[0]) || !finishAsset(AS_ASSET(args[0]))) return NIL_VAL;
+    return PTR_VAL(AS_ASSET(args[0])->data);
+}
+
+// waitAsset(asset) -> ptr (blocks until the load is done)
+static Value waitAssetNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_ASSET(args[0])) return NIL_VAL;
+    ObjAsset* asset = AS_ASSET(args[0]);
+    if (!asset->ready) waitAssetLoad(asset->load);
+    finishAsset(asset);
+    return PTR_VAL(asset->data);
+}
+
 // ============ String Native Functions ============
 
 // chr(code) -> single character string
@@ -1437,7 +3278,7 @@ static Value substringNative(int argCount, Value* args) {
     if (length < 0) length = 0;
     if (start + length > str->length) length = str->length - start;
 
-    return OBJ_VAL(copyString(str->chars + start, length));
+    return OBJ_VAL(newStringSlice(str, start, length));
 }
 
 // indexOf(str, search) -> int (-1 if not found)
@@ -1508,21 +3349,27 @@ static Value splitNative(int argCount, Value* args) {
         // Split into characters
         for (int i = 0; i < str->length; i++) {
             ObjString* ch = copyString(str->chars + i, 1);
+            push(OBJ_VAL(ch));
             writeArray(result, OBJ_VAL(ch));
+            pop();
         }
     } else {
         int start = 0;
         for (int i = 0; i <= str->length - delim->length; i++) {
             if (memcmp(str->chars + i, delim->chars, delim->length) == 0) {
-                ObjString* part = copyString(str->chars + start, i - start);
+                ObjString* part = newStringSlice(str, start, i - start);
+                push(OBJ_VAL(part));
                 writeArray(result, OBJ_VAL(part));
+                pop();
                 i += delim->length - 1;
                 start = i + 1;
             }
         }
         // Add remaining
-        ObjString* part = copyString(str->chars + start, str->length - start);
+        ObjString* part = newStringSlice(str, start, str->length - start);
+        push(OBJ_VAL(part));
         writeArray(result, OBJ_VAL(part));
+        pop();
     }
 
     pop(); // GC protection
@@ -1548,7 +3395,7 @@ static Value trimNative(int argCount, Value* args) {
         end--;
     }
 
-    return OBJ_VAL(copyString(str->chars + start, end - start));
+    return OBJ_VAL(newStringSlice(str, start, end - start));
 }
 
 // toUpper(str) -> str
@@ -1640,6 +3487,58 @@ static Value charCodeAtNative(int argCount, Value* args) {
     return INT_VAL((unsigned char)str->chars[index]);
 }
 
+// ============ String Builder Native Functions ============
+
+// stringBuilder() -> builder
+static Value stringBuilderNative(int argCount, Value* args) {
+    (void)argCount;
+    (void)args;
+    return OBJ_VAL(newStringBuilder());
+}
+
+// sbAppend(builder, value) -> builder (any value, formatted as by +)
+static Value sbAppendNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_STRING_BUILDER(args[0])) return NIL_VAL;
+    ObjStringBuilder* builder = AS_STRING_BUILDER(args[0]);
+    if (IS_STRING(args[1])) {
+        ObjString* string = AS_STRING(args[1]);
+        appendStringBuilder(builder, string->chars, string->length);
+    } else {
+        char buffer[64];
+        int length = valueText(args[1], buffer, sizeof(buffer));
+        appendStringBuilder(builder, buffer, length);
+    }
+    return args[0];
+}
+
+// sbAppendInt(builder, n) -> builder
+static Value sbAppendIntNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_STRING_BUILDER(args[0])) return NIL_VAL;
+    char buffer[32];
+    int length = snprintf(buffer, sizeof(buffer), "%lld",
+                          (long long)AS_NUMBER(args[1]));
+    appendStringBuilder(AS_STRING_BUILDER(args[0]), buffer, length);
+    return args[0];
+}
+
+// sbToString(builder) -> str
+static Value sbToStringNative(int argCount, Value* args) {
+    (void)argCount;
+    if (!IS_STRING_BUILDER(args[0])) return NIL_VAL;
+    ObjStringBuilder* builder = AS_STRING_BUILDER(args[0]);
+    if (builder->length == 0) return OBJ_VAL(copyString("", 0));
+    return OBJ_VAL(copyString(builder->chars, builder->length));
+}
+
+// sbClear(builder) - Keeps the buffer for reuse
+static Value sbClearNative(int argCount, Value* args) {
+    (void)argCount;
+    if (IS_STRING_BUILDER(args[0])) AS_STRING_BUILDER(args[0])->length = 0;
+    return NIL_VAL;
+}
+
 // ============ File I/O Native Functions ============
 
 // readFileNative(path) -> string or nil
@@ -1740,7 +3639,9 @@ static Value listDirNative(int argCount, Value* args) {
         if (strcmp(entry->d_name, "..") == 0) continue;
 
         ObjString* name = copyString(entry->d_name, strlen(entry->d_name));
+        push(OBJ_VAL(name));
         writeArray(arr, OBJ_VAL(name));
+        pop();
     }
 
     closedir(dir);
@@ -1820,24 +3721,81 @@ static Value getMimeTypeNative(int argCount, Value* args) {
     return OBJ_VAL(copyString("application/octet-stream", 24));
 }
 
+// ============ Global Slots ============
+
+// Its address marks a slot whose global hasn't been defined yet
+static char undefinedGlobal;
+#define UNDEFINED_GLOBAL PTR_VAL(&undefinedGlobal)
+#define IS_UNDEFINED_GLOBAL(value) \
+    (IS_PTR(value) && AS_PTR(value) == (void*)&undefinedGlobal)
+
+// Slot for a global name, allocated on first use. The compiler resolves
+// names through this, so every module shares the same slots and a use
+// compiled before its definition still finds the value at runtime.
+int globalSlot(ObjString* name) {
+    Value index;
+    if (tableGet(&vm.globals, name, &index)) return (int)AS_INT(index);
+
+    push(OBJ_VAL(name)); // GC protection
+    int slot = vm.globalValues.count;
+    writeValueArray(&vm.globalValues, UNDEFINED_GLOBAL);
+    writeValueArray(&vm.globalNames, OBJ_VAL(name));
+    tableSet(&vm.globals, name, INT_VAL(slot));
+    pop();
+    return slot;
+}
+
 static void defineNative(const char* name, NativeFn function) {
     push(OBJ_VAL(copyString(name, (int)strlen(name))));
     push(OBJ_VAL(newNative(function)));
-    tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+    int slot = globalSlot(AS_STRING(vm.stack[0]));
+    vm.globalValues.values[slot] = vm.stack[1];
     pop();
     pop();
 }
 
+static void defineConstant(const char* name, Value value) {
+    push(OBJ_VAL(copyString(name, (int)strlen(name))));
+    int slot = globalSlot(AS_STRING(vm.stack[0]));
+    vm.globalValues.values[slot] = value;
+    pop();
+}
+
 void initVM(void) {
+    vm.frames = malloc(sizeof(CallFrame) * FRAMES_INITIAL);
+    vm.stack = malloc(sizeof(Value) * STACK_INITIAL);
+    if (vm.frames == NULL || vm.stack == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    vm.frameCapacity = FRAMES_INITIAL;
+    vm.stackCapacity = STACK_INITIAL;
     resetStack();
     vm.objects = NULL;
     vm.bytesAllocated = 0;
-    vm.nextGC = 1024 * 1024;
+    vm.nextGC = GC_MIN_HEAP;
     vm.grayCount = 0;
     vm.grayCapacity = 0;
     vm.grayStack = NULL;
+    vm.gcRunning = false;
+    vm.gcIncremental = false;
+    vm.gcPhase = GC_PHASE_IDLE;
+    vm.sweepCursor = NULL;
+    vm.sweepPrev = NULL;
+    vm.gcCycleStartBytes = 0;
+    vm.gcCount = 0;
+    vm.profiling = false;
+    vm.nativeFailed = false;
+    vm.workerChannel = NULL;
+    vm.gcLastPauseUs = 0;
+    vm.gcMaxPauseUs = 0;
+    vm.gcTotalPauseUs = 0;
+    vm.gcLastFreed = 0;
 
     initTable(&vm.globals);
+    initValueArray(&vm.globalValues);
+    initValueArray(&vm.globalNames);
+    initTable(&vm.modules);
     initTable(&vm.strings);
 
     defineNative("clock", clockNative);
@@ -1845,6 +3803,15 @@ void initVM(void) {
     defineNative("assert", assertNative);
     defineNative("typeof", typeNative);
 
+    // GC functions
+    defineNative("gcStats", gcStatsNative);
+    defineNative("gcCollect", gcCollectNative);
+    defineNative("gcStep", gcStepNative);
+
+    // Profiler
+    defineNative("profileStart", profileStartNative);
+    defineNative("profileStop", profileStopNative);
+
     // SDL3 functions
     defineNative("init", initNative);
     defineNative("quit", quitNative);
@@ -1858,9 +3825,11 @@ void initVM(void) {
     defineNative("setDrawColor", setDrawColorNative);
     defineNative("setBlendMode", setBlendModeNative);
     defineNative("fillRect", fillRectNative);
+    defineNative("fillRects", fillRectsNative);
     defineNative("drawRect", drawRectNative);
     defineNative("drawLine", drawLineNative);
     defineNative("pollEvent", pollEventNative);
+    defineNative("pollEvents", pollEventsNative);
     defineNative("eventKey", eventKeyNative);
     defineNative("isKeyDown", isKeyDownNative);
     defineNative("startTextInput", startTextInputNative);
@@ -1878,10 +3847,14 @@ void initVM(void) {
     defineNative("getTicks", getTicksNative);
     defineNative("loadTexture", loadTextureNative);
     defineNative("destroyTexture", destroyTextureNative);
+    defineNative("createRenderTarget", createRenderTargetNative);
+    defineNative("setRenderTarget", setRenderTargetNative);
     defineNative("drawTexture", drawTextureNative);
+    defineNative("drawTextures", drawTexturesNative);
     defineNative("getTextureSize", getTextureSizeNative);
     defineNative("random", randomNative);
     defineNative("randomFloat", randomFloatNative);
+    defineNative("seedRandom", seedRandomNative);
     // Math functions
     defineNative("sqrt", sqrtNative);
     defineNative("floor", floorNative);
@@ -1903,9 +3876,9 @@ void initVM(void) {
     defineNative("max", maxNative);
 
     // Math constants
-    tableSet(&vm.globals, copyString("PI", 2), FLOAT_VAL(3.14159265358979323846));
-    tableSet(&vm.globals, copyString("TAU", 3), FLOAT_VAL(6.28318530717958647693));
-    tableSet(&vm.globals, copyString("E", 1), FLOAT_VAL(2.71828182845904523536));
+    defineConstant("PI", FLOAT_VAL(3.14159265358979323846));
+    defineConstant("TAU", FLOAT_VAL(6.28318530717958647693));
+    defineConstant("E", FLOAT_VAL(2.71828182845904523536));
 
     // TTF functions
     defineNative("initTTF", initTTFNative);
@@ -1914,18 +3887,73 @@ void initVM(void) {
     defineNative("destroyFont", destroyFontNative);
     defineNative("drawText", drawTextNative);
     defineNative("getTextWidth", getTextWidthNative);
+    defineNative("textCacheStats", textCacheStatsNative);
+    defineNative("setTextCacheLimit", setTextCacheLimitNative);
+    defineNative("clearTextCache", clearTextCacheNative);
 
     // Array functions
     defineNative("len", lenNative);
     defineNative("push", pushNative);
     defineNative("pop", popNative);
 
+    // StructArray functions
+    defineNative("structArray", structArrayNative);
+    defineNative("structArrayColumn", structArrayColumnNative);
+
+    // Map functions
+    defineNative("mapGet", mapGetNative);
+    defineNative("mapSet", mapSetNative);
+    defineNative("mapHas", mapHasNative);
+    defineNative("mapDelete", mapDeleteNative);
+    defineNative("mapKeys", mapKeysNative);
+    defineNative("mapValues", mapValuesNative);
+
+    // Spatial grid (broadphase) functions
+    defineNative("spatialGrid", spatialGridNative);
+    defineNative("gridClear", gridClearNative);
+    defineNative("gridInsert", gridInsertNative);
+    defineNative("gridUpdate", gridUpdateNative);
+    defineNative("gridBuild", gridBuildNative);
+    defineNative("gridQueryPairs", gridQueryPairsNative);
+    defineNative("gridQueryRect", gridQueryRectNative);
+    defineNative("gridResolve", gridResolveNative);
+
+    // Typed array functions
+    defineNative("typedArray", typedArrayNative);
+    defineNative("vadd", vaddNative);
+    defineNative("vscale", vscaleNative);
+    defineNative("vfma", vfmaNative);
+    defineNative("vclamp", vclampNative);
+    defineNative("vsum", vsumNative);
+    defineNative("vbounce", vbounceNative);
+    defineNative("parallelMap", parallelMapNative);
+    defineNative("setParallelThreads", setParallelThreadsNative);
+    defineNative("parallelThreads", parallelThreadsNative);
+
     // TCP sockets
     defineNative("tcpListen", tcpListenNative);
     defineNative("tcpAccept", tcpAcceptNative);
     defineNative("tcpRecv", tcpRecvNative);
     defineNative("tcpSend", tcpSendNative);
     defineNative("tcpClose", tcpCloseNative);
+    defineNative("tcpSetNonBlocking", tcpSetNonBlockingNative);
+    defineNative("tcpSendFile", tcpSendFileNative);
+    defineNative("tcpSendParts", tcpSendPartsNative);
+    defineNative("netWatch", netWatchNative);
+    defineNative("netUnwatch", netUnwatchNative);
+    defineNative("netPoll", netPollNative);
+    defineConstant("NET_READ", INT_VAL(NET_READ));
+    defineConstant("NET_WRITE", INT_VAL(NET_WRITE));
+    defineConstant("NET_HUP", INT_VAL(NET_HUP));
+    defineConstant("NET_ERROR", INT_VAL(NET_ERROR));
+
+    // Workers
+    defineNative("spawnWorker", spawnWorkerNative);
+    defineNative("workerChannel", workerChannelNative);
+    defineNative("send", sendNative);
+    defineNative("recv", recvNative);
+    defineNative("channelOpen", channelOpenNative);
+    defineNative("channelClose", channelCloseNative);
 
     // String functions
     defineNative("chr", chrNative);
@@ -1943,6 +3971,13 @@ void initVM(void) {
     defineNative("replace", replaceNative);
     defineNative("charCodeAt", charCodeAtNative);
 
+    // String builder functions
+    defineNative("stringBuilder", stringBuilderNative);
+    defineNative("sbAppend", sbAppendNative);
+    defineNative("sbAppendInt", sbAppendIntNative);
+    defineNative("sbToString", sbToStringNative);
+    defineNative("sbClear", sbClearNative);
+
     // File I/O functions
     defineNative("readFile", readFileNative);
     defineNative("writeFile", writeFileNative);
@@ -1966,6 +4001,7 @@ void initVM(void) {
     defineNative("noteOff", noteOffNative);
     defineNative("allNotesOff", allNotesOffNative);
     defineNative("setSynthVolume", setSynthVolumeNative);
+    defineNative("setSynthPolyphony", setSynthPolyphonyNative);
 
     // MIDI functions
     defineNative("loadMidi", loadMidiNative);
@@ -1974,12 +4010,35 @@ void initVM(void) {
     defineNative("getMidiTicksPerBeat", getMidiTicksPerBeatNative);
     defineNative("getMidiTempo", getMidiTempoNative);
     defineNative("destroyMidi", destroyMidiNative);
+
+    // Async asset loading
+    defineNative("loadTextureAsync", loadTextureAsyncNative);
+    defineNative("loadSoundAsync", loadSoundAsyncNative);
+    defineNative("loadMidiAsync", loadMidiAsyncNative);
+    defineNative("isReady", isReadyNative);
+    defineNative("assetValue", assetValueNative);
+    defineNative("waitAsset", waitAssetNative);
 }
 
 void freeVM(void) {
     freeTable(&vm.globals);
+    freeValueArray(&vm.globalValues);
+    freeValueArray(&vm.globalNames);
+    freeTable(&vm.modules);
+    // The text cache and the thread pool belong to the main thread
+    if (vm.workerChannel == NULL) {
+        textCacheClear();
+        freeParallel();
+    }
+    freeProfiler();
     freeTable(&vm.strings);
     freeObjects();
+    // After freeObjects, which lets go of any unfinished loads
+    if (vm.workerChannel == NULL) freeAssets();
+    free(vm.frames);
+    free(vm.stack);
+    vm.frames = NULL;
+    vm.stack = NULL;
 }
 
 void push(Value value) {
@@ -2026,6 +4085,7 @@ static void closeUpvalues(Value* last) {
         ObjUpvalue* upvalue = vm.openUpvalues;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
+        WRITE_BARRIER(upvalue, upvalue->closed);
         vm.openUpvalues = upvalue->next;
     }
 }
@@ -2046,25 +4106,25 @@ static void concatenate(void) {
     push(OBJ_VAL(result));
 }
 
-// Convert value to string for concatenation
-static ObjString* valueToString(Value value) {
-    char buffer[64];
-    int len = 0;
-
+// Text of a non-string value as + formats it; returns the length
+static int valueText(Value value, char* buffer, size_t size) {
     if (IS_INT(value)) {
-        len = snprintf(buffer, sizeof(buffer), "%lld", (long long)AS_INT(value));
+        return snprintf(buffer, size, "%lld", (long long)AS_INT(value));
     } else if (IS_FLOAT(value)) {
-        len = snprintf(buffer, sizeof(buffer), "%g", AS_FLOAT(value));
+        return snprintf(buffer, size, "%g", AS_FLOAT(value));
     } else if (IS_BOOL(value)) {
-        len = snprintf(buffer, sizeof(buffer), "%s", AS_BOOL(value) ? "true" : "false");
+        return snprintf(buffer, size, "%s", AS_BOOL(value) ? "true" : "false");
     } else if (IS_NIL(value)) {
-        len = snprintf(buffer, sizeof(buffer), "nil");
-    } else if (IS_STRING(value)) {
-        return AS_STRING(value);
-    } else {
-        len = snprintf(buffer, sizeof(buffer), "<object>");
+        return snprintf(buffer, size, "nil");
     }
+    return snprintf(buffer, size, "<object>");
+}
 
+// Convert value to string for concatenation
+static ObjString* valueToString(Value value) {
+    if (IS_STRING(value)) return AS_STRING(value);
+    char buffer[64];
+    int len = valueText(value, buffer, sizeof(buffer));
     return copyString(buffer, len);
 }
 
@@ -2076,6 +4136,7 @@ static void concatenateAny(void) {
     ObjString* b = valueToString(bVal);
     push(OBJ_VAL(b)); // protect from GC
     ObjString* a = valueToString(aVal);
+    push(OBJ_VAL(a)); // protect from GC
 
     int length = a->length + b->length;
     char* chars = ALLOCATE(char, length + 1);
@@ -2085,11 +4146,470 @@ static void concatenateAny(void) {
 
     ObjString* result = takeString(chars, length);
     pop(); // pop GC protection
+    pop(); // pop GC protection
     pop(); // pop b
     pop(); // pop a
     push(OBJ_VAL(result));
 }
 
+// OP_CONCAT: a + b + c + ... with one allocation for the result. Adds
+// left to right like OP_ADD while the running value is a number; once a
+// string is involved every remaining operand is appended.
+static bool concatenateValues(int count) {
+    Value* operands = vm.stackTop - count;
+    Value acc = operands[0];
+    int first = 1;
+    for (; first < count; first++) {
+        Value b = operands[first];
+        if (IS_STRING(acc) || IS_STRING(b)) break;
+        if (IS_INT(acc) && IS_INT(b)) {
+            acc = INT_VAL(AS_INT(acc) + AS_INT(b));
+        } else if (IS_NUMBER(acc) && IS_NUMBER(b)) {
+            acc = FLOAT_VAL(AS_NUMBER(acc) + AS_NUMBER(b));
+        } else {
+            runtimeError("Operands must be two numbers or two strings.");
+            return false;
+        }
+    }
+    if (first == count) {
+        vm.stackTop = operands;
+        push(acc);
+        return true;
+    }
+
+    // Pieces are operands[first - 1 .. count - 1], the first being acc
+    operands[first - 1] = acc;
+    char buffer[64];
+    int length = 0;
+    for (int i = first - 1; i < count; i++) {
+        length += IS_STRING(operands[i])
+            ? AS_STRING(operands[i])->length
+            : valueText(operands[i], buffer, sizeof(buffer));
+    }
+
+    char* chars = ALLOCATE(char, length + 1);
+    char* dst = chars;
+    for (int i = first - 1; i < count; i++) {
+        if (IS_STRING(operands[i])) {
+            ObjString* string = AS_STRING(operands[i]);
+            memcpy(dst, string->chars, string->length);
+            dst += string->length;
+        } else {
+            int n = valueText(operands[i], buffer, sizeof(buffer));
+            memcpy(dst, buffer, n);
+            dst += n;
+        }
+    }
+    chars[length] = '\0';
+
+    ObjString* result = takeString(chars, length);
+    vm.stackTop = operands;
+    push(OBJ_VAL(result));
+    return true;
+}
+
+// Slow path of reserveFrame: double the frame array
+static bool growFrames(void) {
+    CallFrame* frames = vm.frameCapacity < FRAMES_MAX
+        ? realloc(vm.frames, sizeof(CallFrame) * vm.frameCapacity * 2)
+        : NULL;
+    if (frames == NULL) {
+        runtimeError("Stack overflow.");
+        return false;
+    }
+    vm.frames = frames;
+    vm.frameCapacity *= 2;
+    return true;
+}
+
+// Slow path of reserveStack. The new value stack is a different block, so
+// stackTop, every frame's slots and every open upvalue are rebased onto it.
+static bool growStack(int slots) {
+    int used = (int)(vm.stackTop - vm.stack);
+    int capacity = vm.stackCapacity * 2;
+    while (used + slots + STACK_HEADROOM > capacity) capacity *= 2;
+    Value* stack = malloc(sizeof(Value) * capacity);
+    if (stack == NULL) {
+        runtimeError("Stack overflow.");
+        return false;
+    }
+    memcpy(stack, vm.stack, sizeof(Value) * used);
+    for (int i = 0; i < vm.frameCount; i++) {
+        vm.frames[i].slots = stack + (vm.frames[i].slots - vm.stack);
+    }
+    for (ObjUpvalue* upvalue = vm.openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+        upvalue->location = stack + (upvalue->location - vm.stack);
+    }
+    free(vm.stack);
+    vm.stack = stack;
+    vm.stackTop = stack + used;
+    vm.stackCapacity = capacity;
+    return true;
+}
+
+// Make room for slots values (a function's maxSlots) plus STACK_HEADROOM
+// above stackTop. Only starting a function grows the stack, which keeps a
+// native's args pointer valid for the whole call.
+static inline bool reserveStack(int slots) {
+    if (vm.stackTop + slots + STACK_HEADROOM <= vm.stack + vm.stackCapacity) return true;
+    return growStack(slots);
+}
+
+// Room for one more frame, running function
+static inline bool reserveFrame(ObjFunction* function) {
+    if (vm.frameCount == vm.frameCapacity && !growFrames()) return false;
+    return reserveStack(function->maxSlots);
+}
+
+// Push a call frame for a closure whose arguments are already on the stack
+static bool callClosure(ObjClosure* closure, int argCount) {
+    if (argCount != closure->function->arity) {
+        runtimeError("Expected %d arguments but got %d.",
+                     closure->function->arity, argCount);
+        return false;
+    }
+    if (!reserveFrame(closure->function)) return false;
+    CallFrame* frame = &vm.frames[vm.frameCount++];
+    frame->closure = closure;
+    frame->ip = closure->function->chunk->code;
+    frame->slots = vm.stackTop - argCount - 1;
+    frame->discardResult = false;
+    return true;
+}
+
+// return f(args) into a closure: the caller's frame is done, so the callee
+// and its arguments slide down over its slots and the frame restarts on the
+// callee. Tail recursion then runs in one frame.
+static bool tailCallClosure(CallFrame* frame, ObjClosure* closure, int argCount) {
+    if (argCount != closure->function->arity) {
+        runtimeError("Expected %d arguments but got %d.",
+                     closure->function->arity, argCount);
+        return false;
+    }
+    // The callee may need more stack than the caller did
+    if (!reserveStack(closure->function->maxSlots)) return false;
+    Value* callee = vm.stackTop - argCount - 1;
+    closeUpvalues(frame->slots);
+    memmove(frame->slots, callee, sizeof(Value) * (argCount + 1));
+    vm.stackTop = frame->slots + argCount + 1;
+    frame->closure = closure;
+    frame->ip = closure->function->chunk->code;
+    return true;
+}
+
+// ============ Modules ============
+
+// Absolute path with "." and ".." segments folded away, so every spelling
+// of a module's path maps to one registry entry. Purely lexical: symlinks
+// are not resolved.
+static ObjString* canonicalModulePath(const char* path) {
+    char buffer[4096];
+    size_t length = 0;
+    if (path[0] != '/') {
+        if (getcwd(buffer, sizeof(buffer)) == NULL) {
+            return copyString(path, (int)strlen(path));
+        }
+        length = strlen(buffer);
+        if (length == 1) length = 0;  // cwd is "/"
+    }
+
+    const char* p = path;
+    while (*p != '\0') {
+        while (*p == '/') p++;
+        const char* segment = p;
+        while (*p != '\0' && *p != '/') p++;
+        size_t segmentLength = (size_t)(p - segment);
+
+        if (segmentLength == 0) continue;
+        if (segmentLength == 1 && segment[0] == '.') continue;
+        if (segmentLength == 2 && segment[0] == '.' && segment[1] == '.') {
+            while (length > 0 && buffer[length - 1] != '/') length--;
+            if (length > 0) length--;
+            continue;
+        }
+        if (length + 1 + segmentLength >= sizeof(buffer)) {
+            return copyString(path, (int)strlen(path));
+        }
+        buffer[length++] = '/';
+        memcpy(buffer + length, segment, segmentLength);
+        length += segmentLength;
+    }
+    if (length == 0) buffer[length++] = '/';
+    return copyString(buffer, (int)length);
+}
+
+// Run a module's top-level code in a new frame. It shares globals with the
+// importer, and its frame returns nothing.
+static bool beginModule(ObjFunction* function) {
+    if (!reserveFrame(function)) return false;
+    push(OBJ_VAL(function));
+    ObjClosure* closure = newClosure(function);
+    pop();
+    push(OBJ_VAL(closure));
+
+    CallFrame* frame = &vm.frames[vm.frameCount++];
+    frame->closure = closure;
+    frame->ip = function->chunk->code;
+    frame->slots = vm.stackTop - 1;
+    frame->discardResult = true;
+    return true;
+}
+
+// import "path" runs the module unless it was already imported; import
+// lazy "path" compiles it and leaves it pending in vm.modules until one of
+// its globals is first read or assigned. The registry entry becomes true
+// before the body runs, so import cycles terminate.
+static bool importModule(ObjString* path, bool lazy) {
+    ObjString* key = canonicalModulePath(path->chars);
+    push(OBJ_VAL(key));
+
+    Value entry;
+    bool known = tableGet(&vm.modules, key, &entry);
+    if (known && !IS_FUNCTION(entry)) {
+        pop();
+        return true;
+    }
+
+    ObjFunction* function;
+    if (known) {
+        function = AS_FUNCTION(entry);
+    } else {
+        bool found;
+        function = compileModule(path->chars, &found);
+        if (!found) {
+            runtimeError("Could not open module '%s'.", path->chars);
+            return false;
+        }
+        if (function == NULL) {
+            runtimeError("Error compiling module '%s'.", path->chars);
+            return false;
+        }
+    }
+
+    push(OBJ_VAL(function));
+    if (lazy) {
+        tableSet(&vm.modules, key, OBJ_VAL(function));
+    } else {
+        tableSet(&vm.modules, key, BOOL_VAL(true));
+    }
+    pop();
+    pop();
+    return lazy || beginModule(function);
+}
+
+static bool definesGlobal(Chunk* chunk, uint16_t slot) {
+    for (int offset = 0; offset < chunk->count;
+         offset += instructionLength(chunk, offset)) {
+        if (chunk->code[offset] == OP_DEFINE_GLOBAL_SLOT &&
+            ((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]) == slot) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A global slot was used before being defined: start the pending lazy
+// module that defines it. 1 if one started, 0 if there is none, -1 on error.
+static int runPendingModuleFor(uint16_t slot) {
+    for (int i = 0; i < vm.modules.capacity; i++) {
+        Entry* entry = &vm.modules.entries[i];
+        if (entry->key == NULL || !IS_FUNCTION(entry->value)) continue;
+
+        ObjFunction* function = AS_FUNCTION(entry->value);
+        if (!definesGlobal(function->chunk, slot)) continue;
+
+        entry->value = BOOL_VAL(true);
+        return beginModule(function) ? 1 : -1;
+    }
+    return 0;
+}
+
+static bool callValue(Value callee, int argCount) {
+    if (IS_NATIVE(callee)) {
+        NativeFn native = AS_NATIVE(callee);
+        Value result = vm.profiling
+            ? profileNativeCall(native, argCount, vm.stackTop - argCount)
+            : native(argCount, vm.stackTop - argCount);
+        if (vm.nativeFailed) {
+            // runtimeError already unwound the stack
+            vm.nativeFailed = false;
+            return false;
+        }
+        vm.stackTop -= argCount + 1;
+        push(result);
+        return true;
+    } else if (IS_CLOSURE(callee)) {
+        return callClosure(AS_CLOSURE(callee), argCount);
+    } else if (IS_STRUCT_DEF(callee)) {
+        // Struct constructor call: Point(10, 20)
+        ObjStructDef* def = AS_STRUCT_DEF(callee);
+        if (argCount != def->fieldCount) {
+            runtimeError("Expected %d arguments but got %d.",
+                         def->fieldCount, argCount);
+            return false;
+        }
+        ObjStruct* instance = newStruct(def);
+        // Fill fields from stack args
+        for (int i = 0; i < argCount; i++) {
+            instance->fields[i] = peek(argCount - 1 - i);
+            WRITE_BARRIER(instance, instance->fields[i]);
+        }
+        // Pop args and struct def, push instance
+        vm.stackTop -= argCount + 1;
+        push(OBJ_VAL(instance));
+        return true;
+    } else if (IS_BOUND_METHOD(callee)) {
+        // Put receiver in slot 0
+        ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
+        vm.stackTop[-argCount - 1] = bound->receiver;
+        return callClosure(bound->method, argCount);
+    }
+    runtimeError("Can only call functions.");
+    return false;
+}
+
+// OP_TAIL_CALL: closures and bound methods reuse the current frame; other
+// callees run as usual and the OP_RETURN after the call returns their result
+static bool tailCallValue(CallFrame* frame, Value callee, int argCount) {
+    if (IS_CLOSURE(callee)) {
+        return tailCallClosure(frame, AS_CLOSURE(callee), argCount);
+    } else if (IS_BOUND_METHOD(callee)) {
+        ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
+        vm.stackTop[-argCount - 1] = bound->receiver;
+        return tailCallClosure(frame, bound->method, argCount);
+    }
+    return callValue(callee, argCount);
+}
+
+// ============ Inline Caches ============
+
+// Slow path: find a field's slot by name, or -1
+static int findField(ObjStructDef* def, ObjString* name) {
+    // Linear search for small structs (faster), hash table for large
+    if (def->fieldCount <= 8) {
+        for (int i = 0; i < def->fieldCount; i++) {
+            if (def->fieldNames[i] == name) return i;
+        }
+        return -1;
+    }
+    Value indexVal;
+    if (tableGet(&def->fieldIndices, name, &indexVal)) {
+        return (int)AS_INT(indexVal);
+    }
+    return -1;
+}
+
+// Resolve a name on a struct type (fields first, then methods) into an
+// instruction's cache. Returns false if the type has neither.
+static bool updateCache(InlineCache* cache, ObjStructDef* def, ObjString* name) {
+    int index = findField(def, name);
+    ObjClosure* method = NULL;
+    if (index == -1) {
+        Value value;
+        if (!tableGet(&def->methods, name, &value)) return false;
+        method = AS_CLOSURE(value);
+    }
+
+    cache->def = def;
+    cache->index = index;
+    cache->method = method;
+    // The function owning the cache may already be black
+    if (vm.gcPhase == GC_PHASE_MARK) {
+        markObject((Obj*)def);
+        markObject((Obj*)method);
+    }
+    return true;
+}
+
+// ============ StructArray Access ============
+
+static bool structArrayIndex(ObjStructArray* array, Value indexVal, int* index) {
+    if (!IS_INT(indexVal)) {
+        runtimeError("Array index must be an integer.");
+        return false;
+    }
+    int64_t i = AS_INT(indexVal);
+    if (i < 0 || i >= array->count) {
+        runtimeError("Array index %lld out of bounds [0, %d).",
+                     (long long)i, array->count);
+        return false;
+    }
+    *index = (int)i;
+    return true;
+}
+
+// Column for name, resolved through the same inline cache as OP_GET_FIELD
+static int structArrayField(ObjStructArray* array, InlineCache* cache, ObjString* name) {
+    if (cache->def != array->definition &&
+        !updateCache(cache, array->definition, name)) {
+        runtimeError("Undefined property '%s'.", name->chars);
+        return -1;
+    }
+    if (cache->index < 0) {
+        runtimeError("Methods need an instance; read arr[i] into a variable first.");
+        return -1;
+    }
+    return cache->index;
+}
+
+static bool storeStructArrayField(ObjStructArray* array, int field, int index, Value value) {
+    if (!structArraySet(array, field, index, value)) {
+        runtimeError("Field '%s' is a float column; got a non-number.",
+                     array->definition->fieldNames[field]->chars);
+        return false;
+    }
+    return true;
+}
+
+// arr[i] on a StructArray: a copy of the row (the array must be on the stack)
+static ObjStruct* structArrayRow(ObjStructArray* array, int index) {
+    ObjStruct* instance = newStruct(array->definition);
+    for (int i = 0; i < array->fieldCount; i++) {
+        instance->fields[i] = structArrayGet(array, i, index);
+    }
+    return instance;
+}
+
+// arr[i] = instance on a StructArray: copies the fields into row i
+static bool storeStructArrayRow(ObjStructArray* array, int index, Value value) {
+    if (!IS_STRUCT(value) || AS_STRUCT(value)->definition != array->definition) {
+        runtimeError("StructArray of %s can only store %s instances.",
+                     array->definition->name->chars, array->definition->name->chars);
+        return false;
+    }
+    ObjStruct* instance = AS_STRUCT(value);
+    for (int i = 0; i < array->fieldCount; i++) {
+        if (!storeStructArrayField(array, i, index, instance->fields[i])) return false;
+    }
+    return true;
+}
+
+// arr[i] for the fused field ops when arr is not a StructArray
+static bool indexElement(Value arrayVal, Value indexVal, Value* element) {
+    if (IS_MAP(arrayVal)) {
+        *element = mapGet(AS_MAP(arrayVal), indexVal);
+        return true;
+    }
+    if (!IS_ARRAY(arrayVal) && !IS_TYPED_ARRAY(arrayVal)) {
+        runtimeError("Can only index arrays.");
+        return false;
+    }
+    if (!IS_INT(indexVal)) {
+        runtimeError("Array index must be an integer.");
+        return false;
+    }
+    int64_t index = AS_INT(indexVal);
+    int count = IS_ARRAY(arrayVal) ? AS_ARRAY(arrayVal)->count
+                                   : AS_TYPED_ARRAY(arrayVal)->count;
+    if (index < 0 || index >= count) {
+        runtimeError("Array index %lld out of bounds [0, %d).", (long long)index, count);
+        return false;
+    }
+    *element = IS_ARRAY(arrayVal) ? AS_ARRAY(arrayVal)->elements[index]
+                                  : typedArrayGet(AS_TYPED_ARRAY(arrayVal), (int)index);
+    return true;
+}
+
 static InterpretResult run(void) {
     CallFrame* frame = &vm.frames[vm.frameCount - 1];
 
@@ -2102,24 +4622,33 @@ static InterpretResult run(void) {
     (frame->closure->function->chunk->constants.values[READ_SHORT()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
 #define READ_STRING_LONG() AS_STRING(READ_CONSTANT_LONG())
+#define READ_CACHE() \
+    (&frame->closure->function->chunk->caches[READ_SHORT()])
 
-#define BINARY_OP_INT(op) \
+// Typed ops are emitted from compile-time type hints, which annotations do
+// not enforce, so a mismatch falls back to the generic instruction.
+#define BINARY_OP_INT(op, generic) \
     do { \
-        if (!IS_INT(peek(0)) || !IS_INT(peek(1))) { \
-            runtimeError("Operands must be integers."); \
-            return INTERPRET_RUNTIME_ERROR; \
-        } \
+        if (!IS_INT(peek(0)) || !IS_INT(peek(1))) goto do_##generic; \
         int64_t b = AS_INT(pop()); \
         int64_t a = AS_INT(pop()); \
         push(INT_VAL(a op b)); \
     } while (false)
 
-#define BINARY_OP_FLOAT(op) \
+// Division by zero also takes the generic path, which reports it
+#define BINARY_OP_INT_DIV(op, generic) \
     do { \
-        if (!IS_FLOAT(peek(0)) || !IS_FLOAT(peek(1))) { \
-            runtimeError("Operands must be floats."); \
-            return INTERPRET_RUNTIME_ERROR; \
+        if (!IS_INT(peek(0)) || !IS_INT(peek(1)) || AS_INT(peek(0)) == 0) { \
+            goto do_##generic; \
         } \
+        int64_t b = AS_INT(pop()); \
+        int64_t a = AS_INT(pop()); \
+        push(INT_VAL(a op b)); \
+    } while (false)
+
+#define BINARY_OP_FLOAT(op, generic) \
+    do { \
+        if (!IS_FLOAT(peek(0)) || !IS_FLOAT(peek(1))) goto do_##generic; \
         double b = AS_FLOAT(pop()); \
         double a = AS_FLOAT(pop()); \
         push(FLOAT_VAL(a op b)); \
@@ -2141,6 +4670,26 @@ static InterpretResult run(void) {
         } \
     } while (false)
 
+// Fused relational compare and branch: pops both operands, jumps when the
+// comparison is false
+#define COMPARE_JUMP(op) \
+    do { \
+        uint16_t offset = READ_SHORT(); \
+        Value b = peek(0); \
+        Value a = peek(1); \
+        bool holds; \
+        if (IS_INT(a) && IS_INT(b)) { \
+            holds = AS_INT(a) op AS_INT(b); \
+        } else if (IS_NUMBER(a) && IS_NUMBER(b)) { \
+            holds = AS_NUMBER(a) op AS_NUMBER(b); \
+        } else { \
+            runtimeError("Operands must be numbers."); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        vm.stackTop -= 2; \
+        if (!holds) frame->ip += offset; \
+    } while (false)
+
 #ifdef COMPUTED_GOTO
     // Dispatch table for computed goto - must match OpCode enum order
     static void* dispatch_table[] = {
@@ -2160,6 +4709,9 @@ static InterpretResult run(void) {
         &&do_DEFINE_GLOBAL_LONG, // OP_DEFINE_GLOBAL_LONG
         &&do_SET_GLOBAL,     // OP_SET_GLOBAL
         &&do_SET_GLOBAL_LONG, // OP_SET_GLOBAL_LONG
+        &&do_GET_GLOBAL_SLOT, // OP_GET_GLOBAL_SLOT
+        &&do_DEFINE_GLOBAL_SLOT, // OP_DEFINE_GLOBAL_SLOT
+        &&do_SET_GLOBAL_SLOT, // OP_SET_GLOBAL_SLOT
         &&do_GET_UPVALUE,    // OP_GET_UPVALUE
         &&do_SET_UPVALUE,    // OP_SET_UPVALUE
         &&do_UNUSED,         // OP_GET_PROPERTY (unused)
@@ -2187,13 +4739,19 @@ static InterpretResult run(void) {
         &&do_DIVIDE,         // OP_DIVIDE
         &&do_MODULO,         // OP_MODULO
         &&do_NEGATE,         // OP_NEGATE
+        &&do_CONCAT,         // OP_CONCAT
         &&do_NOT,            // OP_NOT
         &&do_INT_TO_FLOAT,   // OP_INT_TO_FLOAT
         &&do_FLOAT_TO_INT,   // OP_FLOAT_TO_INT
         &&do_JUMP,           // OP_JUMP
         &&do_JUMP_IF_FALSE,  // OP_JUMP_IF_FALSE
         &&do_LOOP,           // OP_LOOP
+        &&do_JUMP_IF_NOT_LESS,          // OP_JUMP_IF_NOT_LESS
+        &&do_JUMP_IF_NOT_LESS_EQUAL,    // OP_JUMP_IF_NOT_LESS_EQUAL
+        &&do_JUMP_IF_NOT_GREATER,       // OP_JUMP_IF_NOT_GREATER
+        &&do_JUMP_IF_NOT_GREATER_EQUAL, // OP_JUMP_IF_NOT_GREATER_EQUAL
         &&do_CALL,           // OP_CALL
+        &&do_TAIL_CALL,      // OP_TAIL_CALL
         &&do_CLOSURE,        // OP_CLOSURE
         &&do_CLOSE_UPVALUE,  // OP_CLOSE_UPVALUE
         &&do_RETURN,         // OP_RETURN
@@ -2209,10 +4767,16 @@ static InterpretResult run(void) {
         &&do_ARRAY,          // OP_ARRAY
         &&do_INDEX_GET,      // OP_INDEX_GET
         &&do_INDEX_SET,      // OP_INDEX_SET
+        &&do_INDEX_GET_FIELD, // OP_INDEX_GET_FIELD
+        &&do_INDEX_SET_FIELD, // OP_INDEX_SET_FIELD
+        &&do_MAP,            // OP_MAP
         &&do_METHOD,         // OP_METHOD
         &&do_INVOKE,         // OP_INVOKE
+        &&do_INVOKE_LONG,    // OP_INVOKE_LONG
+        &&do_TAIL_INVOKE,    // OP_TAIL_INVOKE
         &&do_UNUSED,         // OP_GET_SELF (unused)
         &&do_IMPORT,         // OP_IMPORT
+        &&do_IMPORT_LAZY,    // OP_IMPORT_LAZY
         // Superinstructions
         &&do_GET_LOCAL_0,    // OP_GET_LOCAL_0
         &&do_GET_LOCAL_1,    // OP_GET_LOCAL_1
@@ -2222,12 +4786,27 @@ static InterpretResult run(void) {
         &&do_ADD_LOCAL_CONST,    // OP_ADD_LOCAL_CONST
         &&do_LESS_LOCAL_CONST,   // OP_LESS_LOCAL_CONST
         &&do_INDEX_GET_LOCAL,    // OP_INDEX_GET_LOCAL
+        &&do_SET_LOCAL_POP,      // OP_SET_LOCAL_POP
+        &&do_ADD_LOCALS,         // OP_ADD_LOCALS
+        &&do_GET_LOCAL_FIELD,    // OP_GET_LOCAL_FIELD
+        &&do_JUMP_IF_NOT_LESS_LOCALS,      // OP_JUMP_IF_NOT_LESS_LOCALS
+        &&do_JUMP_IF_NOT_LESS_LOCAL_CONST, // OP_JUMP_IF_NOT_LESS_LOCAL_CONST
     };
 
+    // While profiling, every opcode goes through do_PROFILE first. The
+    // table is picked again after calls, where profileStart/Stop can run.
+    static THREAD_LOCAL void* profile_table[256];
+    if (profile_table[0] == NULL) {
+        for (int i = 0; i < 256; i++) profile_table[i] = &&do_PROFILE;
+    }
+    void** dispatch = vm.profiling ? profile_table : dispatch_table;
+
+#define SELECT_DISPATCH() (dispatch = vm.profiling ? profile_table : dispatch_table)
+
 #define DISPATCH() \
     do { \
         DEBUG_TRACE(); \
-        goto *dispatch_table[READ_BYTE()]; \
+        goto *dispatch[READ_BYTE()]; \
     } while (false)
 
 #ifdef DEBUG_TRACE_EXECUTION
@@ -2254,6 +4833,12 @@ static InterpretResult run(void) {
         runtimeError("Invalid opcode.");
         return INTERPRET_RUNTIME_ERROR;
 
+    do_PROFILE: {
+        uint8_t instruction = frame->ip[-1];
+        profileInstruction(instruction);
+        goto *dispatch_table[instruction];
+    }
+
     do_CONSTANT: {
         Value constant = READ_CONSTANT();
         push(constant);
@@ -2291,8 +4876,9 @@ static InterpretResult run(void) {
     }
     do_GET_GLOBAL: {
         ObjString* name = READ_STRING();
-        Value value;
-        if (!tableGet(&vm.globals, name, &value)) {
+        int slot = globalSlot(name);
+        Value value = vm.globalValues.values[slot];
+        if (IS_UNDEFINED_GLOBAL(value)) {
             runtimeError("Undefined variable '%s'.", name->chars);
             return INTERPRET_RUNTIME_ERROR;
         }
@@ -2300,10 +4886,10 @@ static InterpretResult run(void) {
         DISPATCH();
     }
     do_GET_GLOBAL_LONG: {
-        uint16_t index = READ_SHORT();
-        ObjString* name = AS_STRING(frame->closure->function->chunk->constants.values[index]);
-        Value value;
-        if (!tableGet(&vm.globals, name, &value)) {
+        ObjString* name = READ_STRING_LONG();
+        int slot = globalSlot(name);
+        Value value = vm.globalValues.values[slot];
+        if (IS_UNDEFINED_GLOBAL(value)) {
             runtimeError("Undefined variable '%s'.", name->chars);
             return INTERPRET_RUNTIME_ERROR;
         }
@@ -2312,34 +4898,78 @@ static InterpretResult run(void) {
     }
     do_DEFINE_GLOBAL: {
         ObjString* name = READ_STRING();
-        tableSet(&vm.globals, name, peek(0));
+        int slot = globalSlot(name);
+        vm.globalValues.values[slot] = peek(0);
         pop();
         DISPATCH();
     }
     do_DEFINE_GLOBAL_LONG: {
-        uint16_t index = READ_SHORT();
-        ObjString* name = AS_STRING(frame->closure->function->chunk->constants.values[index]);
-        tableSet(&vm.globals, name, peek(0));
+        ObjString* name = READ_STRING_LONG();
+        int slot = globalSlot(name);
+        vm.globalValues.values[slot] = peek(0);
         pop();
         DISPATCH();
     }
     do_SET_GLOBAL: {
         ObjString* name = READ_STRING();
-        if (tableSet(&vm.globals, name, peek(0))) {
-            tableDelete(&vm.globals, name);
+        int slot = globalSlot(name);
+        if (IS_UNDEFINED_GLOBAL(vm.globalValues.values[slot])) {
             runtimeError("Undefined variable '%s'.", name->chars);
             return INTERPRET_RUNTIME_ERROR;
         }
+        vm.globalValues.values[slot] = peek(0);
         DISPATCH();
     }
     do_SET_GLOBAL_LONG: {
-        uint16_t index = READ_SHORT();
-        ObjString* name = AS_STRING(frame->closure->function->chunk->constants.values[index]);
-        if (tableSet(&vm.globals, name, peek(0))) {
-            tableDelete(&vm.globals, name);
+        ObjString* name = READ_STRING_LONG();
+        int slot = globalSlot(name);
+        if (IS_UNDEFINED_GLOBAL(vm.globalValues.values[slot])) {
             runtimeError("Undefined variable '%s'.", name->chars);
             return INTERPRET_RUNTIME_ERROR;
         }
+        vm.globalValues.values[slot] = peek(0);
+        DISPATCH();
+    }
+    do_GET_GLOBAL_SLOT: {
+        uint16_t slot = READ_SHORT();
+        Value value = vm.globalValues.values[slot];
+        if (IS_UNDEFINED_GLOBAL(value)) {
+            int started = runPendingModuleFor(slot);
+            if (started < 0) return INTERPRET_RUNTIME_ERROR;
+            if (started > 0) {
+                // Re-run this instruction once the module body returns. Rewind by
+                // index: pushing the module's frame may have moved the array.
+                vm.frames[vm.frameCount - 2].ip -= 3;
+                frame = &vm.frames[vm.frameCount - 1];
+                DISPATCH();
+            }
+            runtimeError("Undefined variable '%s'.", AS_CSTRING(vm.globalNames.values[slot]));
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        push(value);
+        DISPATCH();
+    }
+    do_DEFINE_GLOBAL_SLOT: {
+        uint16_t slot = READ_SHORT();
+        vm.globalValues.values[slot] = peek(0);
+        pop();
+        DISPATCH();
+    }
+    do_SET_GLOBAL_SLOT: {
+        uint16_t slot = READ_SHORT();
+        if (IS_UNDEFINED_GLOBAL(vm.globalValues.values[slot])) {
+            int started = runPendingModuleFor(slot);
+            if (started < 0) return INTERPRET_RUNTIME_ERROR;
+            if (started > 0) {
+                // Rewind by index, the frame array may have moved
+                vm.frames[vm.frameCount - 2].ip -= 3;
+                frame = &vm.frames[vm.frameCount - 1];
+                DISPATCH();
+            }
+            runtimeError("Undefined variable '%s'.", AS_CSTRING(vm.globalNames.values[slot]));
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        vm.globalValues.values[slot] = peek(0);
         DISPATCH();
     }
     do_GET_UPVALUE: {
@@ -2350,6 +4980,7 @@ static InterpretResult run(void) {
     do_SET_UPVALUE: {
         uint8_t slot = READ_BYTE();
         *frame->closure->upvalues[slot]->location = peek(0);
+        WRITE_BARRIER(frame->closure->upvalues[slot], peek(0));
         DISPATCH();
     }
 
@@ -2370,29 +5001,23 @@ static InterpretResult run(void) {
     do_LESS:          BINARY_OP_NUMERIC(BOOL_VAL, <); DISPATCH();
     do_LESS_EQUAL:    BINARY_OP_NUMERIC(BOOL_VAL, <=); DISPATCH();
 
-    do_ADD_INT:      BINARY_OP_INT(+); DISPATCH();
-    do_SUBTRACT_INT: BINARY_OP_INT(-); DISPATCH();
-    do_MULTIPLY_INT: BINARY_OP_INT(*); DISPATCH();
-    do_DIVIDE_INT:   BINARY_OP_INT(/); DISPATCH();
-    do_MODULO_INT:   BINARY_OP_INT(%); DISPATCH();
+    do_ADD_INT:      BINARY_OP_INT(+, ADD); DISPATCH();
+    do_SUBTRACT_INT: BINARY_OP_INT(-, SUBTRACT); DISPATCH();
+    do_MULTIPLY_INT: BINARY_OP_INT(*, MULTIPLY); DISPATCH();
+    do_DIVIDE_INT:   BINARY_OP_INT_DIV(/, DIVIDE); DISPATCH();
+    do_MODULO_INT:   BINARY_OP_INT_DIV(%, MODULO); DISPATCH();
     do_NEGATE_INT: {
-        if (!IS_INT(peek(0))) {
-            runtimeError("Operand must be an integer.");
-            return INTERPRET_RUNTIME_ERROR;
-        }
+        if (!IS_INT(peek(0))) goto do_NEGATE;
         push(INT_VAL(-AS_INT(pop())));
         DISPATCH();
     }
 
-    do_ADD_FLOAT:      BINARY_OP_FLOAT(+); DISPATCH();
-    do_SUBTRACT_FLOAT: BINARY_OP_FLOAT(-); DISPATCH();
-    do_MULTIPLY_FLOAT: BINARY_OP_FLOAT(*); DISPATCH();
-    do_DIVIDE_FLOAT:   BINARY_OP_FLOAT(/); DISPATCH();
+    do_ADD_FLOAT:      BINARY_OP_FLOAT(+, ADD); DISPATCH();
+    do_SUBTRACT_FLOAT: BINARY_OP_FLOAT(-, SUBTRACT); DISPATCH();
+    do_MULTIPLY_FLOAT: BINARY_OP_FLOAT(*, MULTIPLY); DISPATCH();
+    do_DIVIDE_FLOAT:   BINARY_OP_FLOAT(/, DIVIDE); DISPATCH();
     do_NEGATE_FLOAT: {
-        if (!IS_FLOAT(peek(0))) {
-            runtimeError("Operand must be a float.");
-            return INTERPRET_RUNTIME_ERROR;
-        }
+        if (!IS_FLOAT(peek(0))) goto do_NEGATE;
         push(FLOAT_VAL(-AS_FLOAT(pop())));
         DISPATCH();
     }
@@ -2490,6 +5115,10 @@ static InterpretResult run(void) {
         }
         DISPATCH();
     }
+    do_CONCAT: {
+        if (!concatenateValues(READ_BYTE())) return INTERPRET_RUNTIME_ERROR;
+        DISPATCH();
+    }
 
     do_NOT:
         push(BOOL_VAL(isFalsey(pop())));
@@ -2527,66 +5156,28 @@ static InterpretResult run(void) {
         frame->ip -= offset;
         DISPATCH();
     }
+    do_JUMP_IF_NOT_LESS:          COMPARE_JUMP(<); DISPATCH();
+    do_JUMP_IF_NOT_LESS_EQUAL:    COMPARE_JUMP(<=); DISPATCH();
+    do_JUMP_IF_NOT_GREATER:       COMPARE_JUMP(>); DISPATCH();
+    do_JUMP_IF_NOT_GREATER_EQUAL: COMPARE_JUMP(>=); DISPATCH();
 
     do_CALL: {
         int argCount = READ_BYTE();
-        Value callee = peek(argCount);
-        if (IS_NATIVE(callee)) {
-            NativeFn native = AS_NATIVE(callee);
-            Value result = native(argCount, vm.stackTop - argCount);
-            vm.stackTop -= argCount + 1;
-            push(result);
-        } else if (IS_CLOSURE(callee)) {
-            ObjClosure* closure = AS_CLOSURE(callee);
-            if (argCount != closure->function->arity) {
-                runtimeError("Expected %d arguments but got %d.",
-                             closure->function->arity, argCount);
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            if (vm.frameCount == FRAMES_MAX) {
-                runtimeError("Stack overflow.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            CallFrame* newFrame = &vm.frames[vm.frameCount++];
-            newFrame->closure = closure;
-            newFrame->ip = closure->function->chunk->code;
-            newFrame->slots = vm.stackTop - argCount - 1;
-            frame = newFrame;
-        } else if (IS_STRUCT_DEF(callee)) {
-            ObjStructDef* def = AS_STRUCT_DEF(callee);
-            if (argCount != def->fieldCount) {
-                runtimeError("Expected %d arguments but got %d.",
-                             def->fieldCount, argCount);
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            ObjStruct* instance = newStruct(def);
-            for (int i = 0; i < argCount; i++) {
-                instance->fields[i] = peek(argCount - 1 - i);
-            }
-            vm.stackTop -= argCount + 1;
-            push(OBJ_VAL(instance));
-        } else if (IS_BOUND_METHOD(callee)) {
-            ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
-            ObjClosure* closure = bound->method;
-            if (argCount != closure->function->arity) {
-                runtimeError("Expected %d arguments but got %d.",
-                             closure->function->arity, argCount);
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            if (vm.frameCount == FRAMES_MAX) {
-                runtimeError("Stack overflow.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            vm.stackTop[-argCount - 1] = bound->receiver;
-            CallFrame* newFrame = &vm.frames[vm.frameCount++];
-            newFrame->closure = closure;
-            newFrame->ip = closure->function->chunk->code;
-            newFrame->slots = vm.stackTop - argCount - 1;
-            frame = newFrame;
-        } else {
-            runtimeError("Can only call functions.");
+        if (!callValue(peek(argCount), argCount)) {
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        frame = &vm.frames[vm.frameCount - 1];
+        SELECT_DISPATCH();
+        DISPATCH();
+    }
+
+    do_TAIL_CALL: {
+        int argCount = READ_BYTE();
+        if (!tailCallValue(frame, peek(argCount), argCount)) {
             return INTERPRET_RUNTIME_ERROR;
         }
+        frame = &vm.frames[vm.frameCount - 1];
+        SELECT_DISPATCH();
         DISPATCH();
     }
 
@@ -2602,6 +5193,7 @@ static InterpretResult run(void) {
             } else {
                 closure->upvalues[i] = frame->closure->upvalues[index];
             }
+            WRITE_BARRIER(closure, OBJ_VAL(closure->upvalues[i]));
         }
         DISPATCH();
     }
@@ -2620,7 +5212,7 @@ static InterpretResult run(void) {
             return INTERPRET_OK;
         }
         vm.stackTop = frame->slots;
-        push(result);
+        if (!frame->discardResult) push(result);
         frame = &vm.frames[vm.frameCount - 1];
         DISPATCH();
     }
@@ -2643,9 +5235,49 @@ static InterpretResult run(void) {
         DISPATCH();
     }
 
+    do_MAP: {
+        int count = READ_BYTE();
+        ObjMap* map = newMap();
+        push(OBJ_VAL(map));
+        for (int i = count - 1; i >= 0; i--) {
+            if (!mapStore(map, peek(2 * i + 2), peek(2 * i + 1))) {
+                runtimeError("Map keys can't be nil.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+        }
+        vm.stackTop -= 2 * count + 1;
+        push(OBJ_VAL(map));
+        DISPATCH();
+    }
+
     do_INDEX_GET: {
         Value indexVal = pop();
         Value arrayVal = pop();
+        if (IS_MAP(arrayVal)) {
+            push(mapGet(AS_MAP(arrayVal), indexVal));
+            DISPATCH();
+        }
+        if (IS_TYPED_ARRAY(arrayVal) && IS_INT(indexVal)) {
+            ObjTypedArray* array = AS_TYPED_ARRAY(arrayVal);
+            int64_t index = AS_INT(indexVal);
+            if (index < 0 || index >= array->count) {
+                runtimeError("Array index %lld out of bounds [0, %d).",
+                             (long long)index, array->count);
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            push(typedArrayGet(array, (int)index));
+            DISPATCH();
+        }
+        if (IS_STRUCT_ARRAY(arrayVal)) {
+            int index;
+            if (!structArrayIndex(AS_STRUCT_ARRAY(arrayVal), indexVal, &index)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            push(arrayVal);
+            ObjStruct* row = structArrayRow(AS_STRUCT_ARRAY(arrayVal), index);
+            vm.stackTop[-1] = OBJ_VAL(row);
+            DISPATCH();
+        }
         if (!IS_ARRAY(arrayVal)) {
             runtimeError("Can only index arrays.");
             return INTERPRET_RUNTIME_ERROR;
@@ -2666,9 +5298,45 @@ static InterpretResult run(void) {
     }
 
     do_INDEX_SET: {
-        Value value = pop();
-        Value indexVal = pop();
-        Value arrayVal = pop();
+        Value value = peek(0);
+        Value indexVal = peek(1);
+        Value arrayVal = peek(2);
+        if (IS_MAP(arrayVal)) {
+            // The operands stay on the stack through mapStore, which can collect
+            if (!mapStore(AS_MAP(arrayVal), indexVal, value)) {
+                runtimeError("Map keys can't be nil.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            vm.stackTop -= 3;
+            push(value);
+            DISPATCH();
+        }
+        vm.stackTop -= 3;
+        if (IS_TYPED_ARRAY(arrayVal) && IS_INT(indexVal)) {
+            ObjTypedArray* array = AS_TYPED_ARRAY(arrayVal);
+            int64_t index = AS_INT(indexVal);
+            if (index < 0 || index >= array->count) {
+                runtimeError("Array index %lld out of bounds [0, %d).",
+                             (long long)index, array->count);
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            if (!IS_NUMBER(value)) {
+                runtimeError("Typed array elements must be numbers.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            typedArraySet(array, (int)index, value);
+            push(value);
+            DISPATCH();
+        }
+        if (IS_STRUCT_ARRAY(arrayVal)) {
+            int index;
+            if (!structArrayIndex(AS_STRUCT_ARRAY(arrayVal), indexVal, &index) ||
+                !storeStructArrayRow(AS_STRUCT_ARRAY(arrayVal), index, value)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            push(value);
+            DISPATCH();
+        }
         if (!IS_ARRAY(arrayVal)) {
             runtimeError("Can only index arrays.");
             return INTERPRET_RUNTIME_ERROR;
@@ -2685,31 +5353,86 @@ static InterpretResult run(void) {
             return INTERPRET_RUNTIME_ERROR;
         }
         array->elements[index] = value;
+        WRITE_BARRIER(array, value);
         push(value);
         DISPATCH();
     }
 
+    do_INDEX_GET_FIELD: {
+        Value indexVal = peek(0);
+        Value arrayVal = peek(1);
+        if (IS_STRUCT_ARRAY(arrayVal)) {
+            ObjString* name = READ_STRING();
+            InlineCache* cache = READ_CACHE();
+            ObjStructArray* array = AS_STRUCT_ARRAY(arrayVal);
+            int field = structArrayField(array, cache, name);
+            int index;
+            if (field < 0 || !structArrayIndex(array, indexVal, &index)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            vm.stackTop--;
+            vm.stackTop[-1] = structArrayGet(array, field, index);
+            DISPATCH();
+        }
+        // Any other array: index it, then read the field from the element
+        Value element;
+        if (!indexElement(arrayVal, indexVal, &element)) return INTERPRET_RUNTIME_ERROR;
+        vm.stackTop--;
+        vm.stackTop[-1] = element;
+        goto do_GET_FIELD;
+    }
+
+    do_INDEX_SET_FIELD: {
+        Value value = peek(0);
+        Value indexVal = peek(1);
+        Value arrayVal = peek(2);
+        if (IS_STRUCT_ARRAY(arrayVal)) {
+            ObjString* name = READ_STRING();
+            InlineCache* cache = READ_CACHE();
+            ObjStructArray* array = AS_STRUCT_ARRAY(arrayVal);
+            int field = structArrayField(array, cache, name);
+            int index;
+            if (field < 0 || !structArrayIndex(array, indexVal, &index) ||
+                !storeStructArrayField(array, field, index, value)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            vm.stackTop -= 2;
+            vm.stackTop[-1] = value;
+            DISPATCH();
+        }
+        Value element;
+        if (!indexElement(arrayVal, indexVal, &element)) return INTERPRET_RUNTIME_ERROR;
+        vm.stackTop--;
+        vm.stackTop[-2] = element;
+        vm.stackTop[-1] = value;
+        goto do_SET_FIELD;
+    }
+
     do_STRUCT_DEF: {
         int fieldCount = READ_BYTE();
         ObjString* name = READ_STRING();
         ObjStructDef* def = newStructDef(name);
-        def->fieldCount = fieldCount;
+        push(OBJ_VAL(def));
         def->fieldNames = ALLOCATE(ObjString*, fieldCount);
         for (int i = 0; i < fieldCount; i++) {
             def->fieldNames[i] = NULL;
         }
-        push(OBJ_VAL(def));
+        def->fieldKinds = ALLOCATE(uint8_t, fieldCount);
+        def->fieldCount = fieldCount;
         DISPATCH();
     }
 
     do_STRUCT_FIELD: {
         ObjString* fieldName = READ_STRING();
+        uint8_t kind = READ_BYTE();
         ObjStructDef* def = AS_STRUCT_DEF(peek(0));
         for (int i = 0; i < def->fieldCount; i++) {
             if (def->fieldNames[i] == NULL) {
                 def->fieldNames[i] = fieldName;
+                def->fieldKinds[i] = kind;
                 // O(1) lookup table: fieldName -> index
                 tableSet(&def->fieldIndices, fieldName, INT_VAL(i));
+                WRITE_BARRIER(def, OBJ_VAL(fieldName));
                 break;
             }
         }
@@ -2717,145 +5440,92 @@ static InterpretResult run(void) {
     }
 
     do_GET_FIELD: {
+        ObjString* name = READ_STRING();
+        InlineCache* cache = READ_CACHE();
         if (!IS_STRUCT(peek(0))) {
             runtimeError("Only struct instances have fields.");
             return INTERPRET_RUNTIME_ERROR;
         }
-        Value receiver = peek(0);
-        ObjStruct* instance = AS_STRUCT(receiver);
-        ObjString* name = READ_STRING();
-        int fieldIndex = -1;
-        // Linear search for small structs (faster), hash table for large
-        if (instance->definition->fieldCount <= 8) {
-            for (int i = 0; i < instance->definition->fieldCount; i++) {
-                if (instance->definition->fieldNames[i] == name) {
-                    fieldIndex = i;
-                    break;
-                }
-            }
-        } else {
-            Value indexVal;
-            if (tableGet(&instance->definition->fieldIndices, name, &indexVal)) {
-                fieldIndex = AS_INT(indexVal);
-            }
-        }
-        if (fieldIndex != -1) {
-            pop();
-            push(instance->fields[fieldIndex]);
-            DISPATCH();
+        ObjStruct* instance = AS_STRUCT(peek(0));
+        if (cache->def != instance->definition &&
+            !updateCache(cache, instance->definition, name)) {
+            runtimeError("Undefined property '%s'.", name->chars);
+            return INTERPRET_RUNTIME_ERROR;
         }
-        // Check methods if not a field
-        Value method;
-        if (tableGet(&instance->definition->methods, name, &method)) {
-            pop();
-            ObjBoundMethod* bound = newBoundMethod(receiver, AS_CLOSURE(method));
-            push(OBJ_VAL(bound));
+        if (cache->index >= 0) {
+            vm.stackTop[-1] = instance->fields[cache->index];
             DISPATCH();
         }
-        runtimeError("Undefined property '%s'.", name->chars);
-        return INTERPRET_RUNTIME_ERROR;
+        // Method used as a value; the receiver stays rooted until replaced
+        ObjBoundMethod* bound = newBoundMethod(peek(0), cache->method);
+        vm.stackTop[-1] = OBJ_VAL(bound);
+        DISPATCH();
     }
 
     do_GET_FIELD_LONG: {
+        ObjString* name = READ_STRING_LONG();
+        InlineCache* cache = READ_CACHE();
         if (!IS_STRUCT(peek(0))) {
             runtimeError("Only struct instances have fields.");
             return INTERPRET_RUNTIME_ERROR;
         }
-        Value receiver = peek(0);
-        ObjStruct* instance = AS_STRUCT(receiver);
-        ObjString* name = READ_STRING_LONG();
-        int fieldIndex = -1;
-        if (instance->definition->fieldCount <= 8) {
-            for (int i = 0; i < instance->definition->fieldCount; i++) {
-                if (instance->definition->fieldNames[i] == name) {
-                    fieldIndex = i;
-                    break;
-                }
-            }
-        } else {
-            Value indexVal;
-            if (tableGet(&instance->definition->fieldIndices, name, &indexVal)) {
-                fieldIndex = AS_INT(indexVal);
-            }
-        }
-        if (fieldIndex != -1) {
-            pop();
-            push(instance->fields[fieldIndex]);
-            DISPATCH();
+        ObjStruct* instance = AS_STRUCT(peek(0));
+        if (cache->def != instance->definition &&
+            !updateCache(cache, instance->definition, name)) {
+            runtimeError("Undefined property '%s'.", name->chars);
+            return INTERPRET_RUNTIME_ERROR;
         }
-        Value method;
-        if (tableGet(&instance->definition->methods, name, &method)) {
-            pop();
-            ObjBoundMethod* bound = newBoundMethod(receiver, AS_CLOSURE(method));
-            push(OBJ_VAL(bound));
+        if (cache->index >= 0) {
+            vm.stackTop[-1] = instance->fields[cache->index];
             DISPATCH();
         }
-        runtimeError("Undefined property '%s'.", name->chars);
-        return INTERPRET_RUNTIME_ERROR;
+        // Method used as a value; the receiver stays rooted until replaced
+        ObjBoundMethod* bound = newBoundMethod(peek(0), cache->method);
+        vm.stackTop[-1] = OBJ_VAL(bound);
+        DISPATCH();
     }
 
     do_SET_FIELD: {
+        ObjString* name = READ_STRING();
+        InlineCache* cache = READ_CACHE();
         if (!IS_STRUCT(peek(1))) {
             runtimeError("Only struct instances have fields.");
             return INTERPRET_RUNTIME_ERROR;
         }
         ObjStruct* instance = AS_STRUCT(peek(1));
-        ObjString* name = READ_STRING();
-        Value value = pop();
-        int fieldIndex = -1;
-        // Linear search for small structs (faster), hash table for large
-        if (instance->definition->fieldCount <= 8) {
-            for (int i = 0; i < instance->definition->fieldCount; i++) {
-                if (instance->definition->fieldNames[i] == name) {
-                    fieldIndex = i;
-                    break;
-                }
-            }
-        } else {
-            Value indexVal;
-            if (tableGet(&instance->definition->fieldIndices, name, &indexVal)) {
-                fieldIndex = AS_INT(indexVal);
-            }
+        if (cache->def != instance->definition) {
+            updateCache(cache, instance->definition, name);
         }
-        if (fieldIndex == -1) {
+        if (cache->def != instance->definition || cache->index < 0) {
             runtimeError("Undefined field '%s'.", name->chars);
             return INTERPRET_RUNTIME_ERROR;
         }
-        instance->fields[fieldIndex] = value;
-        pop();
-        push(value);
+        Value value = pop();
+        instance->fields[cache->index] = value;
+        WRITE_BARRIER(instance, value);
+        vm.stackTop[-1] = value;
         DISPATCH();
     }
 
     do_SET_FIELD_LONG: {
+        ObjString* name = READ_STRING_LONG();
+        InlineCache* cache = READ_CACHE();
         if (!IS_STRUCT(peek(1))) {
             runtimeError("Only struct instances have fields.");
             return INTERPRET_RUNTIME_ERROR;
         }
         ObjStruct* instance = AS_STRUCT(peek(1));
-        ObjString* name = READ_STRING_LONG();
-        Value value = pop();
-        int fieldIndex = -1;
-        if (instance->definition->fieldCount <= 8) {
-            for (int i = 0; i < instance->definition->fieldCount; i++) {
-                if (instance->definition->fieldNames[i] == name) {
-                    fieldIndex = i;
-                    break;
-                }
-            }
-        } else {
-            Value indexVal;
-            if (tableGet(&instance->definition->fieldIndices, name, &indexVal)) {
-                fieldIndex = AS_INT(indexVal);
-            }
+        if (cache->def != instance->definition) {
+            updateCache(cache, instance->definition, name);
         }
-        if (fieldIndex == -1) {
+        if (cache->def != instance->definition || cache->index < 0) {
             runtimeError("Undefined field '%s'.", name->chars);
             return INTERPRET_RUNTIME_ERROR;
         }
-        instance->fields[fieldIndex] = value;
-        pop();
-        push(value);
+        Value value = pop();
+        instance->fields[cache->index] = value;
+        WRITE_BARRIER(instance, value);
+        vm.stackTop[-1] = value;
         DISPATCH();
     }
 
@@ -2864,6 +5534,7 @@ static InterpretResult run(void) {
         Value method = peek(0);
         ObjStructDef* def = AS_STRUCT_DEF(peek(1));
         tableSet(&def->methods, name, method);
+        WRITE_BARRIER(def, method);
         pop();
         DISPATCH();
     }
@@ -2871,57 +5542,97 @@ static InterpretResult run(void) {
     do_INVOKE: {
         ObjString* methodName = READ_STRING();
         int argCount = READ_BYTE();
+        InlineCache* cache = READ_CACHE();
         Value receiver = peek(argCount);
         if (!IS_STRUCT(receiver)) {
             runtimeError("Only struct instances have methods.");
             return INTERPRET_RUNTIME_ERROR;
         }
         ObjStruct* instance = AS_STRUCT(receiver);
-        Value method;
-        if (!tableGet(&instance->definition->methods, methodName, &method)) {
+        if (cache->def != instance->definition &&
+            !updateCache(cache, instance->definition, methodName)) {
             runtimeError("Undefined method '%s'.", methodName->chars);
             return INTERPRET_RUNTIME_ERROR;
         }
-        ObjClosure* closure = AS_CLOSURE(method);
-        if (argCount != closure->function->arity) {
-            runtimeError("Expected %d arguments but got %d.",
-                closure->function->arity, argCount);
+        if (cache->index >= 0) {
+            // Field holding a callable: obj.callback(args)
+            Value callee = instance->fields[cache->index];
+            vm.stackTop[-argCount - 1] = callee;
+            if (!callValue(callee, argCount)) return INTERPRET_RUNTIME_ERROR;
+        } else if (!callClosure(cache->method, argCount)) {
+            // Method with receiver in slot 0
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        frame = &vm.frames[vm.frameCount - 1];
+        SELECT_DISPATCH();
+        DISPATCH();
+    }
+
+    do_INVOKE_LONG: {
+        ObjString* methodName = READ_STRING_LONG();
+        int argCount = READ_BYTE();
+        InlineCache* cache = READ_CACHE();
+        Value receiver = peek(argCount);
+        if (!IS_STRUCT(receiver)) {
+            runtimeError("Only struct instances have methods.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        ObjStruct* instance = AS_STRUCT(receiver);
+        if (cache->def != instance->definition &&
+            !updateCache(cache, instance->definition, methodName)) {
+            runtimeError("Undefined method '%s'.", methodName->chars);
             return INTERPRET_RUNTIME_ERROR;
         }
-        if (vm.frameCount == FRAMES_MAX) {
-            runtimeError("Stack overflow.");
+        if (cache->index >= 0) {
+            // Field holding a callable: obj.callback(args)
+            Value callee = instance->fields[cache->index];
+            vm.stackTop[-argCount - 1] = callee;
+            if (!callValue(callee, argCount)) return INTERPRET_RUNTIME_ERROR;
+        } else if (!callClosure(cache->method, argCount)) {
+            // Method with receiver in slot 0
             return INTERPRET_RUNTIME_ERROR;
         }
-        CallFrame* newFrame = &vm.frames[vm.frameCount++];
-        newFrame->closure = closure;
-        newFrame->ip = closure->function->chunk->code;
-        newFrame->slots = vm.stackTop - argCount - 1;
-        frame = newFrame;
+        frame = &vm.frames[vm.frameCount - 1];
+        SELECT_DISPATCH();
         DISPATCH();
     }
 
-    do_IMPORT: {
-        ObjString* path = READ_STRING();
-        char* source = readFile(path->chars);
-        if (source == NULL) {
-            runtimeError("Could not open module '%s'.", path->chars);
+    do_TAIL_INVOKE: {
+        ObjString* methodName = READ_STRING();
+        int argCount = READ_BYTE();
+        InlineCache* cache = READ_CACHE();
+        Value receiver = peek(argCount);
+        if (!IS_STRUCT(receiver)) {
+            runtimeError("Only struct instances have methods.");
             return INTERPRET_RUNTIME_ERROR;
         }
-        ObjFunction* moduleFunc = compile(source);
-        free(source);
-        if (moduleFunc == NULL) {
-            runtimeError("Error compiling module '%s'.", path->chars);
+        ObjStruct* instance = AS_STRUCT(receiver);
+        if (cache->def != instance->definition &&
+            !updateCache(cache, instance->definition, methodName)) {
+            runtimeError("Undefined method '%s'.", methodName->chars);
             return INTERPRET_RUNTIME_ERROR;
         }
-        push(OBJ_VAL(moduleFunc));
-        ObjClosure* moduleClosure = newClosure(moduleFunc);
-        pop();
-        push(OBJ_VAL(moduleClosure));
-        CallFrame* moduleFrame = &vm.frames[vm.frameCount++];
-        moduleFrame->closure = moduleClosure;
-        moduleFrame->ip = moduleFunc->chunk->code;
-        moduleFrame->slots = vm.stackTop - 1;
-        frame = moduleFrame;
+        if (cache->index >= 0) {
+            Value callee = instance->fields[cache->index];
+            vm.stackTop[-argCount - 1] = callee;
+            if (!tailCallValue(frame, callee, argCount)) return INTERPRET_RUNTIME_ERROR;
+        } else if (!tailCallClosure(frame, cache->method, argCount)) {
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        frame = &vm.frames[vm.frameCount - 1];
+        SELECT_DISPATCH();
+        DISPATCH();
+    }
+
+    do_IMPORT: {
+        ObjString* path = READ_STRING();
+        if (!importModule(path, false)) return INTERPRET_RUNTIME_ERROR;
+        frame = &vm.frames[vm.frameCount - 1];
+        DISPATCH();
+    }
+    do_IMPORT_LAZY: {
+        ObjString* path = READ_STRING();
+        if (!importModule(path, true)) return INTERPRET_RUNTIME_ERROR;
         DISPATCH();
     }
 
@@ -2941,8 +5652,13 @@ static InterpretResult run(void) {
             frame->slots[slot] = INT_VAL(AS_INT(val) + 1);
         } else if (IS_FLOAT(val)) {
             frame->slots[slot] = FLOAT_VAL(AS_FLOAT(val) + 1.0);
+        } else if (IS_STRING(val)) {
+            push(val);
+            push(INT_VAL(1));
+            concatenateAny();
+            frame->slots[slot] = pop();
         } else {
-            runtimeError("Operand must be a number.");
+            runtimeError("Operands must be two numbers or two strings.");
             return INTERPRET_RUNTIME_ERROR;
         }
         DISPATCH();
@@ -2956,13 +5672,11 @@ static InterpretResult run(void) {
         // Fast path for ints
         if (IS_INT(local) && IS_INT(constant)) {
             push(INT_VAL(AS_INT(local) + AS_INT(constant)));
-        } else if (IS_NUMBER(local) && IS_NUMBER(constant)) {
-            push(FLOAT_VAL(AS_NUMBER(local) + AS_NUMBER(constant)));
-        } else {
-            runtimeError("Operands must be numbers.");
-            return INTERPRET_RUNTIME_ERROR;
+            DISPATCH();
         }
-        DISPATCH();
+        push(local);
+        push(constant);
+        goto do_ADD;
     }
 
     // Compare local < constant: push(local[slot] < const[idx])
@@ -2970,39 +5684,96 @@ static InterpretResult run(void) {
         uint8_t slot = READ_BYTE();
         Value constant = READ_CONSTANT();
         Value local = frame->slots[slot];
-        if (IS_NUMBER(local) && IS_NUMBER(constant)) {
-            push(BOOL_VAL(AS_NUMBER(local) < AS_NUMBER(constant)));
-        } else {
-            runtimeError("Operands must be numbers.");
-            return INTERPRET_RUNTIME_ERROR;
+        if (IS_INT(local) && IS_INT(constant)) {
+            push(BOOL_VAL(AS_INT(local) < AS_INT(constant)));
+            DISPATCH();
         }
-        DISPATCH();
+        push(local);
+        push(constant);
+        goto do_LESS;
     }
 
     // Array index with local: push(stack[-1][local[slot]])
     do_INDEX_GET_LOCAL: {
         uint8_t slot = READ_BYTE();
-        Value arrayVal = pop();
-        if (!IS_ARRAY(arrayVal)) {
-            runtimeError("Can only index arrays.");
-            return INTERPRET_RUNTIME_ERROR;
-        }
+        Value arrayVal = peek(0);
         Value indexVal = frame->slots[slot];
-        if (!IS_INT(indexVal)) {
-            runtimeError("Array index must be an integer.");
-            return INTERPRET_RUNTIME_ERROR;
-        }
-        ObjArray* array = AS_ARRAY(arrayVal);
-        int64_t index = AS_INT(indexVal);
-        if (index < 0 || index >= array->count) {
-            runtimeError("Array index %lld out of bounds [0, %d).",
-                         (long long)index, array->count);
-            return INTERPRET_RUNTIME_ERROR;
+        if (IS_ARRAY(arrayVal) && IS_INT(indexVal)) {
+            ObjArray* array = AS_ARRAY(arrayVal);
+            int64_t index = AS_INT(indexVal);
+            if (index >= 0 && index < array->count) {
+                vm.stackTop[-1] = array->elements[index];
+                DISPATCH();
+            }
+        } else if (IS_TYPED_ARRAY(arrayVal) && IS_INT(indexVal)) {
+            ObjTypedArray* array = AS_TYPED_ARRAY(arrayVal);
+            int64_t index = AS_INT(indexVal);
+            if (index >= 0 && index < array->count) {
+                vm.stackTop[-1] = typedArrayGet(array, (int)index);
+                DISPATCH();
+            }
         }
-        push(array->elements[index]);
+        // Anything unusual, including the out-of-bounds error, goes generic
+        push(indexVal);
+        goto do_INDEX_GET;
+    }
+
+    // Fused by the peephole optimizer (optimizer.c); each falls back to the
+    // generic instruction by pushing its operands and jumping to its handler
+
+    // Assignment statement: local[slot] = pop()
+    do_SET_LOCAL_POP: {
+        uint8_t slot = READ_BYTE();
+        frame->slots[slot] = pop();
         DISPATCH();
     }
 
+    // push(local[a] + local[b])
+    do_ADD_LOCALS: {
+        Value a = frame->slots[READ_BYTE()];
+        Value b = frame->slots[READ_BYTE()];
+        if (IS_INT(a) && IS_INT(b)) {
+            push(INT_VAL(AS_INT(a) + AS_INT(b)));
+            DISPATCH();
+        }
+        push(a);
+        push(b);
+        goto do_ADD;
+    }
+
+    // Field of a local; the remaining operands are laid out as GET_FIELD's
+    do_GET_LOCAL_FIELD:
+        push(frame->slots[READ_BYTE()]);
+        goto do_GET_FIELD;
+
+    // Loop header: jump if !(local[a] < local[b])
+    do_JUMP_IF_NOT_LESS_LOCALS: {
+        Value a = frame->slots[READ_BYTE()];
+        Value b = frame->slots[READ_BYTE()];
+        if (IS_INT(a) && IS_INT(b)) {
+            uint16_t offset = READ_SHORT();
+            if (AS_INT(a) >= AS_INT(b)) frame->ip += offset;
+            DISPATCH();
+        }
+        push(a);
+        push(b);
+        goto do_JUMP_IF_NOT_LESS;
+    }
+
+    // Loop header: jump if !(local[slot] < const[idx])
+    do_JUMP_IF_NOT_LESS_LOCAL_CONST: {
+        Value a = frame->slots[READ_BYTE()];
+        Value b = READ_CONSTANT();
+        if (IS_INT(a) && IS_INT(b)) {
+            uint16_t offset = READ_SHORT();
+            if (AS_INT(a) >= AS_INT(b)) frame->ip += offset;
+            DISPATCH();
+        }
+        push(a);
+        push(b);
+        goto do_JUMP_IF_NOT_LESS;
+    }
+
 #undef DISPATCH
 #undef DEBUG_TRACE
 
@@ -3021,8 +5792,9 @@ static InterpretResult run(void) {
                                (int)(frame->ip - frame->closure->function->chunk->code));
 #endif
 
-        uint8_t instruction;
-        switch (instruction = READ_BYTE()) {
+        uint8_t instruction = READ_BYTE();
+        if (vm.profiling) profileInstruction(instruction);
+        switch (instruction) {
             case OP_CONSTANT: {
                 Value constant = READ_CONSTANT();
                 push(constant);
@@ -3060,8 +5832,9 @@ static InterpretResult run(void) {
             }
             case OP_GET_GLOBAL: {
                 ObjString* name = READ_STRING();
-                Value value;
-                if (!tableGet(&vm.globals, name, &value)) {
+                int slot = globalSlot(name);
+                Value value = vm.globalValues.values[slot];
+                if (IS_UNDEFINED_GLOBAL(value)) {
                     runtimeError("Undefined variable '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -3069,10 +5842,10 @@ static InterpretResult run(void) {
                 break;
             }
             case OP_GET_GLOBAL_LONG: {
-                uint16_t index = READ_SHORT();
-                ObjString* name = AS_STRING(frame->closure->function->chunk->constants.values[index]);
-                Value value;
-                if (!tableGet(&vm.globals, name, &value)) {
+                ObjString* name = READ_STRING_LONG();
+                int slot = globalSlot(name);
+                Value value = vm.globalValues.values[slot];
+                if (IS_UNDEFINED_GLOBAL(value)) {
                     runtimeError("Undefined variable '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
@@ -3081,34 +5854,78 @@ static InterpretResult run(void) {
             }
             case OP_DEFINE_GLOBAL: {
                 ObjString* name = READ_STRING();
-                tableSet(&vm.globals, name, peek(0));
+                int slot = globalSlot(name);
+                vm.globalValues.values[slot] = peek(0);
                 pop();
                 break;
             }
             case OP_DEFINE_GLOBAL_LONG: {
-                uint16_t index = READ_SHORT();
-                ObjString* name = AS_STRING(frame->closure->function->chunk->constants.values[index]);
-                tableSet(&vm.globals, name, peek(0));
+                ObjString* name = READ_STRING_LONG();
+                int slot = globalSlot(name);
+                vm.globalValues.values[slot] = peek(0);
                 pop();
                 break;
             }
             case OP_SET_GLOBAL: {
                 ObjString* name = READ_STRING();
-                if (tableSet(&vm.globals, name, peek(0))) {
-                    tableDelete(&vm.globals, name);
+                int slot = globalSlot(name);
+                if (IS_UNDEFINED_GLOBAL(vm.globalValues.values[slot])) {
                     runtimeError("Undefined variable '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
+                vm.globalValues.values[slot] = peek(0);
                 break;
             }
             case OP_SET_GLOBAL_LONG: {
-                uint16_t index = READ_SHORT();
-                ObjString* name = AS_STRING(frame->closure->function->chunk->constants.values[index]);
-                if (tableSet(&vm.globals, name, peek(0))) {
-                    tableDelete(&vm.globals, name);
+                ObjString* name = READ_STRING_LONG();
+                int slot = globalSlot(name);
+                if (IS_UNDEFINED_GLOBAL(vm.globalValues.values[slot])) {
                     runtimeError("Undefined variable '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
+                vm.globalValues.values[slot] = peek(0);
+                break;
+            }
+            case OP_GET_GLOBAL_SLOT: {
+                uint16_t slot = READ_SHORT();
+                Value value = vm.globalValues.values[slot];
+                if (IS_UNDEFINED_GLOBAL(value)) {
+                    int started = runPendingModuleFor(slot);
+                    if (started < 0) return INTERPRET_RUNTIME_ERROR;
+                    if (started > 0) {
+                        // Re-run this instruction once the module body returns. Rewind by
+                        // index: pushing the module's frame may have moved the array.
+                        vm.frames[vm.frameCount - 2].ip -= 3;
+                        frame = &vm.frames[vm.frameCount - 1];
+                        break;
+                    }
+                    runtimeError("Undefined variable '%s'.", AS_CSTRING(vm.globalNames.values[slot]));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                push(value);
+                break;
+            }
+            case OP_DEFINE_GLOBAL_SLOT: {
+                uint16_t slot = READ_SHORT();
+                vm.globalValues.values[slot] = peek(0);
+                pop();
+                break;
+            }
+            case OP_SET_GLOBAL_SLOT: {
+                uint16_t slot = READ_SHORT();
+                if (IS_UNDEFINED_GLOBAL(vm.globalValues.values[slot])) {
+                    int started = runPendingModuleFor(slot);
+                    if (started < 0) return INTERPRET_RUNTIME_ERROR;
+                    if (started > 0) {
+                        // Rewind by index, the frame array may have moved
+                        vm.frames[vm.frameCount - 2].ip -= 3;
+                        frame = &vm.frames[vm.frameCount - 1];
+                        break;
+                    }
+                    runtimeError("Undefined variable '%s'.", AS_CSTRING(vm.globalNames.values[slot]));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                vm.globalValues.values[slot] = peek(0);
                 break;
             }
 
@@ -3126,37 +5943,31 @@ static InterpretResult run(void) {
             }
             case OP_GREATER:       BINARY_OP_NUMERIC(BOOL_VAL, >); break;
             case OP_GREATER_EQUAL: BINARY_OP_NUMERIC(BOOL_VAL, >=); break;
-            case OP_LESS:          BINARY_OP_NUMERIC(BOOL_VAL, <); break;
+            case OP_LESS: do_LESS: BINARY_OP_NUMERIC(BOOL_VAL, <); break;
             case OP_LESS_EQUAL:    BINARY_OP_NUMERIC(BOOL_VAL, <=); break;
 
-            case OP_ADD_INT:      BINARY_OP_INT(+); break;
-            case OP_SUBTRACT_INT: BINARY_OP_INT(-); break;
-            case OP_MULTIPLY_INT: BINARY_OP_INT(*); break;
-            case OP_DIVIDE_INT:   BINARY_OP_INT(/); break;
-            case OP_MODULO_INT:   BINARY_OP_INT(%); break;
+            case OP_ADD_INT:      BINARY_OP_INT(+, ADD); break;
+            case OP_SUBTRACT_INT: BINARY_OP_INT(-, SUBTRACT); break;
+            case OP_MULTIPLY_INT: BINARY_OP_INT(*, MULTIPLY); break;
+            case OP_DIVIDE_INT:   BINARY_OP_INT_DIV(/, DIVIDE); break;
+            case OP_MODULO_INT:   BINARY_OP_INT_DIV(%, MODULO); break;
             case OP_NEGATE_INT: {
-                if (!IS_INT(peek(0))) {
-                    runtimeError("Operand must be an integer.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+                if (!IS_INT(peek(0))) goto do_NEGATE;
                 push(INT_VAL(-AS_INT(pop())));
                 break;
             }
 
-            case OP_ADD_FLOAT:      BINARY_OP_FLOAT(+); break;
-            case OP_SUBTRACT_FLOAT: BINARY_OP_FLOAT(-); break;
-            case OP_MULTIPLY_FLOAT: BINARY_OP_FLOAT(*); break;
-            case OP_DIVIDE_FLOAT:   BINARY_OP_FLOAT(/); break;
+            case OP_ADD_FLOAT:      BINARY_OP_FLOAT(+, ADD); break;
+            case OP_SUBTRACT_FLOAT: BINARY_OP_FLOAT(-, SUBTRACT); break;
+            case OP_MULTIPLY_FLOAT: BINARY_OP_FLOAT(*, MULTIPLY); break;
+            case OP_DIVIDE_FLOAT:   BINARY_OP_FLOAT(/, DIVIDE); break;
             case OP_NEGATE_FLOAT: {
-                if (!IS_FLOAT(peek(0))) {
-                    runtimeError("Operand must be a float.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+                if (!IS_FLOAT(peek(0))) goto do_NEGATE;
                 push(FLOAT_VAL(-AS_FLOAT(pop())));
                 break;
             }
 
-            case OP_ADD: {
+            case OP_ADD: do_ADD: {
                 if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
                     concatenate();
                 } else if (IS_STRING(peek(0)) || IS_STRING(peek(1))) {
@@ -3175,7 +5986,7 @@ static InterpretResult run(void) {
                 }
                 break;
             }
-            case OP_SUBTRACT: {
+            case OP_SUBTRACT: do_SUBTRACT: {
                 if (IS_INT(peek(0)) && IS_INT(peek(1))) {
                     int64_t b = AS_INT(pop());
                     int64_t a = AS_INT(pop());
@@ -3190,7 +6001,7 @@ static InterpretResult run(void) {
                 }
                 break;
             }
-            case OP_MULTIPLY: {
+            case OP_MULTIPLY: do_MULTIPLY: {
                 if (IS_INT(peek(0)) && IS_INT(peek(1))) {
                     int64_t b = AS_INT(pop());
                     int64_t a = AS_INT(pop());
@@ -3205,7 +6016,7 @@ static InterpretResult run(void) {
                 }
                 break;
             }
-            case OP_DIVIDE: {
+            case OP_DIVIDE: do_DIVIDE: {
                 if (IS_INT(peek(0)) && IS_INT(peek(1))) {
                     int64_t b = AS_INT(pop());
                     int64_t a = AS_INT(pop());
@@ -3224,7 +6035,7 @@ static InterpretResult run(void) {
                 }
                 break;
             }
-            case OP_MODULO: {
+            case OP_MODULO: do_MODULO: {
                 if (!IS_INT(peek(0)) || !IS_INT(peek(1))) {
                     runtimeError("Operands must be integers for modulo.");
                     return INTERPRET_RUNTIME_ERROR;
@@ -3238,7 +6049,7 @@ static InterpretResult run(void) {
                 push(INT_VAL(a % b));
                 break;
             }
-            case OP_NEGATE: {
+            case OP_NEGATE: do_NEGATE: {
                 if (IS_INT(peek(0))) {
                     push(INT_VAL(-AS_INT(pop())));
                 } else if (IS_FLOAT(peek(0))) {
@@ -3249,6 +6060,10 @@ static InterpretResult run(void) {
                 }
                 break;
             }
+            case OP_CONCAT: {
+                if (!concatenateValues(READ_BYTE())) return INTERPRET_RUNTIME_ERROR;
+                break;
+            }
 
             case OP_NOT:
                 push(BOOL_VAL(isFalsey(pop())));
@@ -3286,71 +6101,26 @@ static InterpretResult run(void) {
                 frame->ip -= offset;
                 break;
             }
+            case OP_JUMP_IF_NOT_LESS: do_JUMP_IF_NOT_LESS: COMPARE_JUMP(<); break;
+            case OP_JUMP_IF_NOT_LESS_EQUAL:    COMPARE_JUMP(<=); break;
+            case OP_JUMP_IF_NOT_GREATER:       COMPARE_JUMP(>); break;
+            case OP_JUMP_IF_NOT_GREATER_EQUAL: COMPARE_JUMP(>=); break;
 
             case OP_CALL: {
                 int argCount = READ_BYTE();
-                Value callee = peek(argCount);
-                if (IS_NATIVE(callee)) {
-                    NativeFn native = AS_NATIVE(callee);
-                    Value result = native(argCount, vm.stackTop - argCount);
-                    vm.stackTop -= argCount + 1;
-                    push(result);
-                } else if (IS_CLOSURE(callee)) {
-                    ObjClosure* closure = AS_CLOSURE(callee);
-                    if (argCount != closure->function->arity) {
-                        runtimeError("Expected %d arguments but got %d.",
-                                     closure->function->arity, argCount);
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    if (vm.frameCount == FRAMES_MAX) {
-                        runtimeError("Stack overflow.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    CallFrame* newFrame = &vm.frames[vm.frameCount++];
-                    newFrame->closure = closure;
-                    newFrame->ip = closure->function->chunk->code;
-                    newFrame->slots = vm.stackTop - argCount - 1;
-                    frame = newFrame;
-                } else if (IS_STRUCT_DEF(callee)) {
-                    // Struct constructor call: Point(10, 20)
-                    ObjStructDef* def = AS_STRUCT_DEF(callee);
-                    if (argCount != def->fieldCount) {
-                        runtimeError("Expected %d arguments but got %d.",
-                                     def->fieldCount, argCount);
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    ObjStruct* instance = newStruct(def);
-                    // Fill fields from stack args
-                    for (int i = 0; i < argCount; i++) {
-                        instance->fields[i] = peek(argCount - 1 - i);
-                    }
-                    // Pop args and struct def, push instance
-                    vm.stackTop -= argCount + 1;
-                    push(OBJ_VAL(instance));
-                } else if (IS_BOUND_METHOD(callee)) {
-                    // Bound method call
-                    ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
-                    ObjClosure* closure = bound->method;
-                    if (argCount != closure->function->arity) {
-                        runtimeError("Expected %d arguments but got %d.",
-                                     closure->function->arity, argCount);
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    if (vm.frameCount == FRAMES_MAX) {
-                        runtimeError("Stack overflow.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-                    // Put receiver in slot 0
-                    vm.stackTop[-argCount - 1] = bound->receiver;
-                    CallFrame* newFrame = &vm.frames[vm.frameCount++];
-                    newFrame->closure = closure;
-                    newFrame->ip = closure->function->chunk->code;
-                    newFrame->slots = vm.stackTop - argCount - 1;
-                    frame = newFrame;
-                } else {
-                    runtimeError("Can only call functions.");
+                if (!callValue(peek(argCount), argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm.frames[vm.frameCount - 1];
+                break;
+            }
+
+            case OP_TAIL_CALL: {
+                int argCount = READ_BYTE();
+                if (!tailCallValue(frame, peek(argCount), argCount)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
+                frame = &vm.frames[vm.frameCount - 1];
                 break;
             }
 
@@ -3366,6 +6136,7 @@ static InterpretResult run(void) {
                     } else {
                         closure->upvalues[i] = frame->closure->upvalues[index];
                     }
+                    WRITE_BARRIER(closure, OBJ_VAL(closure->upvalues[i]));
                 }
                 break;
             }
@@ -3379,6 +6150,7 @@ static InterpretResult run(void) {
             case OP_SET_UPVALUE: {
                 uint8_t slot = READ_BYTE();
                 *frame->closure->upvalues[slot]->location = peek(0);
+                WRITE_BARRIER(frame->closure->upvalues[slot], peek(0));
                 break;
             }
 
@@ -3412,10 +6184,54 @@ static InterpretResult run(void) {
                 break;
             }
 
-            case OP_INDEX_GET: {
+            case OP_MAP: {
+                int count = READ_BYTE();
+                ObjMap* map = newMap();
+                push(OBJ_VAL(map));
+                // Pairs are on the stack as [k0, v0, ..., kN-1, vN-1, map]
+                for (int i = count - 1; i >= 0; i--) {
+                    if (!mapStore(map, peek(2 * i + 2), peek(2 * i + 1))) {
+                        runtimeError("Map keys can't be nil.");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                }
+                vm.stackTop -= 2 * count + 1;
+                push(OBJ_VAL(map));
+                break;
+            }
+
+            case OP_INDEX_GET: do_INDEX_GET: {
                 Value indexVal = pop();
                 Value arrayVal = pop();
 
+                if (IS_MAP(arrayVal)) {
+                    push(mapGet(AS_MAP(arrayVal), indexVal));
+                    break;
+                }
+
+                if (IS_TYPED_ARRAY(arrayVal) && IS_INT(indexVal)) {
+                    ObjTypedArray* array = AS_TYPED_ARRAY(arrayVal);
+                    int64_t index = AS_INT(indexVal);
+                    if (index < 0 || index >= array->count) {
+                        runtimeError("Array index %lld out of bounds [0, %d).",
+                                     (long long)index, array->count);
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    push(typedArrayGet(array, (int)index));
+                    break;
+                }
+
+                if (IS_STRUCT_ARRAY(arrayVal)) {
+                    int index;
+                    if (!structArrayIndex(AS_STRUCT_ARRAY(arrayVal), indexVal, &index)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    push(arrayVal);
+                    ObjStruct* row = structArrayRow(AS_STRUCT_ARRAY(arrayVal), index);
+                    vm.stackTop[-1] = OBJ_VAL(row);
+                    break;
+                }
+
                 if (!IS_ARRAY(arrayVal)) {
                     runtimeError("Can only index arrays.");
                     return INTERPRET_RUNTIME_ERROR;
@@ -3439,9 +6255,48 @@ static InterpretResult run(void) {
             }
 
             case OP_INDEX_SET: {
-                Value value = pop();
-                Value indexVal = pop();
-                Value arrayVal = pop();
+                Value value = peek(0);
+                Value indexVal = peek(1);
+                Value arrayVal = peek(2);
+
+                if (IS_MAP(arrayVal)) {
+                    // The operands stay on the stack through mapStore, which can collect
+                    if (!mapStore(AS_MAP(arrayVal), indexVal, value)) {
+                        runtimeError("Map keys can't be nil.");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    vm.stackTop -= 3;
+                    push(value);
+                    break;
+                }
+                vm.stackTop -= 3;
+
+                if (IS_TYPED_ARRAY(arrayVal) && IS_INT(indexVal)) {
+                    ObjTypedArray* array = AS_TYPED_ARRAY(arrayVal);
+                    int64_t index = AS_INT(indexVal);
+                    if (index < 0 || index >= array->count) {
+                        runtimeError("Array index %lld out of bounds [0, %d).",
+                                     (long long)index, array->count);
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    if (!IS_NUMBER(value)) {
+                        runtimeError("Typed array elements must be numbers.");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    typedArraySet(array, (int)index, value);
+                    push(value);
+                    break;
+                }
+
+                if (IS_STRUCT_ARRAY(arrayVal)) {
+                    int index;
+                    if (!structArrayIndex(AS_STRUCT_ARRAY(arrayVal), indexVal, &index) ||
+                        !storeStructArrayRow(AS_STRUCT_ARRAY(arrayVal), index, value)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    push(value);
+                    break;
+                }
 
                 if (!IS_ARRAY(arrayVal)) {
                     runtimeError("Can only index arrays.");
@@ -3462,187 +6317,182 @@ static InterpretResult run(void) {
                 }
 
                 array->elements[index] = value;
+                WRITE_BARRIER(array, value);
                 push(value);
                 break;
             }
 
+            case OP_INDEX_GET_FIELD: {
+                Value indexVal = peek(0);
+                Value arrayVal = peek(1);
+                if (IS_STRUCT_ARRAY(arrayVal)) {
+                    ObjString* name = READ_STRING();
+                    InlineCache* cache = READ_CACHE();
+                    ObjStructArray* array = AS_STRUCT_ARRAY(arrayVal);
+                    int field = structArrayField(array, cache, name);
+                    int index;
+                    if (field < 0 || !structArrayIndex(array, indexVal, &index)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    vm.stackTop--;
+                    vm.stackTop[-1] = structArrayGet(array, field, index);
+                    break;
+                }
+                // Any other array: index it, then read the field from the element
+                Value element;
+                if (!indexElement(arrayVal, indexVal, &element)) return INTERPRET_RUNTIME_ERROR;
+                vm.stackTop--;
+                vm.stackTop[-1] = element;
+                goto do_GET_FIELD;
+            }
+
+            case OP_INDEX_SET_FIELD: {
+                Value value = peek(0);
+                Value indexVal = peek(1);
+                Value arrayVal = peek(2);
+                if (IS_STRUCT_ARRAY(arrayVal)) {
+                    ObjString* name = READ_STRING();
+                    InlineCache* cache = READ_CACHE();
+                    ObjStructArray* array = AS_STRUCT_ARRAY(arrayVal);
+                    int field = structArrayField(array, cache, name);
+                    int index;
+                    if (field < 0 || !structArrayIndex(array, indexVal, &index) ||
+                        !storeStructArrayField(array, field, index, value)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    vm.stackTop -= 2;
+                    vm.stackTop[-1] = value;
+                    break;
+                }
+                Value element;
+                if (!indexElement(arrayVal, indexVal, &element)) return INTERPRET_RUNTIME_ERROR;
+                vm.stackTop--;
+                vm.stackTop[-2] = element;
+                vm.stackTop[-1] = value;
+                goto do_SET_FIELD;
+            }
+
             case OP_STRUCT_DEF: {
                 int fieldCount = READ_BYTE();
                 ObjString* name = READ_STRING();
                 ObjStructDef* def = newStructDef(name);
-                def->fieldCount = fieldCount;
+                push(OBJ_VAL(def));
                 def->fieldNames = ALLOCATE(ObjString*, fieldCount);
                 // Initialize all field names to NULL
                 for (int i = 0; i < fieldCount; i++) {
                     def->fieldNames[i] = NULL;
                 }
+                def->fieldKinds = ALLOCATE(uint8_t, fieldCount);
+                def->fieldCount = fieldCount;
                 // Field names will be added by OP_STRUCT_FIELD
-                push(OBJ_VAL(def));
                 break;
             }
 
             case OP_STRUCT_FIELD: {
                 ObjString* fieldName = READ_STRING();
+                uint8_t kind = READ_BYTE();
                 ObjStructDef* def = AS_STRUCT_DEF(peek(0));
                 // Find next empty slot in fieldNames
                 for (int i = 0; i < def->fieldCount; i++) {
                     if (def->fieldNames[i] == NULL) {
                         def->fieldNames[i] = fieldName;
+                        def->fieldKinds[i] = kind;
                         // O(1) lookup table: fieldName -> index
                         tableSet(&def->fieldIndices, fieldName, INT_VAL(i));
+                        WRITE_BARRIER(def, OBJ_VAL(fieldName));
                         break;
                     }
                 }
                 break;
             }
 
-            case OP_GET_FIELD: {
+            case OP_GET_FIELD: do_GET_FIELD: {
+                ObjString* name = READ_STRING();
+                InlineCache* cache = READ_CACHE();
                 if (!IS_STRUCT(peek(0))) {
                     runtimeError("Only struct instances have fields.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-
-                Value receiver = peek(0);
-                ObjStruct* instance = AS_STRUCT(receiver);
-                ObjString* name = READ_STRING();
-
-                int fieldIndex = -1;
-                // Linear search for small structs (faster), hash table for large
-                if (instance->definition->fieldCount <= 8) {
-                    for (int i = 0; i < instance->definition->fieldCount; i++) {
-                        if (instance->definition->fieldNames[i] == name) {
-                            fieldIndex = i;
-                            break;
-                        }
-                    }
-                } else {
-                    Value indexVal;
-                    if (tableGet(&instance->definition->fieldIndices, name, &indexVal)) {
-                        fieldIndex = AS_INT(indexVal);
-                    }
-                }
-                if (fieldIndex != -1) {
-                    pop(); // pop instance
-                    push(instance->fields[fieldIndex]);
-                    break;
+                ObjStruct* instance = AS_STRUCT(peek(0));
+                if (cache->def != instance->definition &&
+                    !updateCache(cache, instance->definition, name)) {
+                    runtimeError("Undefined property '%s'.", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
                 }
-
-                // Not a field - try to find a method
-                Value method;
-                if (tableGet(&instance->definition->methods, name, &method)) {
-                    pop(); // pop instance
-                    ObjBoundMethod* bound = newBoundMethod(receiver, AS_CLOSURE(method));
-                    push(OBJ_VAL(bound));
+                if (cache->index >= 0) {
+                    vm.stackTop[-1] = instance->fields[cache->index];
                     break;
                 }
-
-                runtimeError("Undefined property '%s'.", name->chars);
-                return INTERPRET_RUNTIME_ERROR;
+                // Method used as a value; the receiver stays rooted until replaced
+                ObjBoundMethod* bound = newBoundMethod(peek(0), cache->method);
+                vm.stackTop[-1] = OBJ_VAL(bound);
+                break;
             }
 
             case OP_GET_FIELD_LONG: {
+                ObjString* name = READ_STRING_LONG();
+                InlineCache* cache = READ_CACHE();
                 if (!IS_STRUCT(peek(0))) {
                     runtimeError("Only struct instances have fields.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                Value receiver = peek(0);
-                ObjStruct* instance = AS_STRUCT(receiver);
-                ObjString* name = READ_STRING_LONG();
-                int fieldIndex = -1;
-                if (instance->definition->fieldCount <= 8) {
-                    for (int i = 0; i < instance->definition->fieldCount; i++) {
-                        if (instance->definition->fieldNames[i] == name) {
-                            fieldIndex = i;
-                            break;
-                        }
-                    }
-                } else {
-                    Value indexVal;
-                    if (tableGet(&instance->definition->fieldIndices, name, &indexVal)) {
-                        fieldIndex = AS_INT(indexVal);
-                    }
-                }
-                if (fieldIndex != -1) {
-                    pop();
-                    push(instance->fields[fieldIndex]);
-                    break;
+                ObjStruct* instance = AS_STRUCT(peek(0));
+                if (cache->def != instance->definition &&
+                    !updateCache(cache, instance->definition, name)) {
+                    runtimeError("Undefined property '%s'.", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
                 }
-                Value method;
-                if (tableGet(&instance->definition->methods, name, &method)) {
-                    pop();
-                    ObjBoundMethod* bound = newBoundMethod(receiver, AS_CLOSURE(method));
-                    push(OBJ_VAL(bound));
+                if (cache->index >= 0) {
+                    vm.stackTop[-1] = instance->fields[cache->index];
                     break;
                 }
-                runtimeError("Undefined property '%s'.", name->chars);
-                return INTERPRET_RUNTIME_ERROR;
+                // Method used as a value; the receiver stays rooted until replaced
+                ObjBoundMethod* bound = newBoundMethod(peek(0), cache->method);
+                vm.stackTop[-1] = OBJ_VAL(bound);
+                break;
             }
 
-            case OP_SET_FIELD: {
+            case OP_SET_FIELD: do_SET_FIELD: {
+                ObjString* name = READ_STRING();
+                InlineCache* cache = READ_CACHE();
                 if (!IS_STRUCT(peek(1))) {
                     runtimeError("Only struct instances have fields.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-
                 ObjStruct* instance = AS_STRUCT(peek(1));
-                ObjString* name = READ_STRING();
-                Value value = pop();
-
-                int fieldIndex = -1;
-                // Linear search for small structs (faster), hash table for large
-                if (instance->definition->fieldCount <= 8) {
-                    for (int i = 0; i < instance->definition->fieldCount; i++) {
-                        if (instance->definition->fieldNames[i] == name) {
-                            fieldIndex = i;
-                            break;
-                        }
-                    }
-                } else {
-                    Value indexVal;
-                    if (tableGet(&instance->definition->fieldIndices, name, &indexVal)) {
-                        fieldIndex = AS_INT(indexVal);
-                    }
+                if (cache->def != instance->definition) {
+                    updateCache(cache, instance->definition, name);
                 }
-                if (fieldIndex == -1) {
+                if (cache->def != instance->definition || cache->index < 0) {
                     runtimeError("Undefined field '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
-
-                instance->fields[fieldIndex] = value;
-                pop(); // pop instance
-                push(value);
+                Value value = pop();
+                instance->fields[cache->index] = value;
+                WRITE_BARRIER(instance, value);
+                vm.stackTop[-1] = value;
                 break;
             }
 
             case OP_SET_FIELD_LONG: {
+                ObjString* name = READ_STRING_LONG();
+                InlineCache* cache = READ_CACHE();
                 if (!IS_STRUCT(peek(1))) {
                     runtimeError("Only struct instances have fields.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 ObjStruct* instance = AS_STRUCT(peek(1));
-                ObjString* name = READ_STRING_LONG();
-                Value value = pop();
-                int fieldIndex = -1;
-                if (instance->definition->fieldCount <= 8) {
-                    for (int i = 0; i < instance->definition->fieldCount; i++) {
-                        if (instance->definition->fieldNames[i] == name) {
-                            fieldIndex = i;
-                            break;
-                        }
-                    }
-                } else {
-                    Value indexVal;
-                    if (tableGet(&instance->definition->fieldIndices, name, &indexVal)) {
-                        fieldIndex = AS_INT(indexVal);
-                    }
+                if (cache->def != instance->definition) {
+                    updateCache(cache, instance->definition, name);
                 }
-                if (fieldIndex == -1) {
+                if (cache->def != instance->definition || cache->index < 0) {
                     runtimeError("Undefined field '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                instance->fields[fieldIndex] = value;
-                pop();
-                push(value);
+                Value value = pop();
+                instance->fields[cache->index] = value;
+                WRITE_BARRIER(instance, value);
+                vm.stackTop[-1] = value;
                 break;
             }
 
@@ -3651,6 +6501,7 @@ static InterpretResult run(void) {
                 Value method = peek(0);
                 ObjStructDef* def = AS_STRUCT_DEF(peek(1));
                 tableSet(&def->methods, name, method);
+                WRITE_BARRIER(def, method);
                 pop(); // pop the closure
                 break;
             }
@@ -3658,80 +6509,102 @@ static InterpretResult run(void) {
             case OP_INVOKE: {
                 ObjString* methodName = READ_STRING();
                 int argCount = READ_BYTE();
-
+                InlineCache* cache = READ_CACHE();
                 Value receiver = peek(argCount);
                 if (!IS_STRUCT(receiver)) {
                     runtimeError("Only struct instances have methods.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-
                 ObjStruct* instance = AS_STRUCT(receiver);
-
-                // Look up method
-                Value method;
-                if (!tableGet(&instance->definition->methods, methodName, &method)) {
+                if (cache->def != instance->definition &&
+                    !updateCache(cache, instance->definition, methodName)) {
                     runtimeError("Undefined method '%s'.", methodName->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
-
-                // Call method with receiver in slot 0
-                ObjClosure* closure = AS_CLOSURE(method);
-                if (argCount != closure->function->arity) {
-                    runtimeError("Expected %d arguments but got %d.",
-                        closure->function->arity, argCount);
+                if (cache->index >= 0) {
+                    // Field holding a callable: obj.callback(args)
+                    Value callee = instance->fields[cache->index];
+                    vm.stackTop[-argCount - 1] = callee;
+                    if (!callValue(callee, argCount)) return INTERPRET_RUNTIME_ERROR;
+                } else if (!callClosure(cache->method, argCount)) {
+                    // Method with receiver in slot 0
                     return INTERPRET_RUNTIME_ERROR;
                 }
+                frame = &vm.frames[vm.frameCount - 1];
+                break;
+            }
 
-                if (vm.frameCount == FRAMES_MAX) {
-                    runtimeError("Stack overflow.");
+            case OP_INVOKE_LONG: {
+                ObjString* methodName = READ_STRING_LONG();
+                int argCount = READ_BYTE();
+                InlineCache* cache = READ_CACHE();
+                Value receiver = peek(argCount);
+                if (!IS_STRUCT(receiver)) {
+                    runtimeError("Only struct instances have methods.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-
-                CallFrame* newFrame = &vm.frames[vm.frameCount++];
-                newFrame->closure = closure;
-                newFrame->ip = closure->function->chunk->code;
-                newFrame->slots = vm.stackTop - argCount - 1;
-                frame = newFrame;
+                ObjStruct* instance = AS_STRUCT(receiver);
+                if (cache->def != instance->definition &&
+                    !updateCache(cache, instance->definition, methodName)) {
+                    runtimeError("Undefined method '%s'.", methodName->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (cache->index >= 0) {
+                    // Field holding a callable: obj.callback(args)
+                    Value callee = instance->fields[cache->index];
+                    vm.stackTop[-argCount - 1] = callee;
+                    if (!callValue(callee, argCount)) return INTERPRET_RUNTIME_ERROR;
+                } else if (!callClosure(cache->method, argCount)) {
+                    // Method with receiver in slot 0
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm.frames[vm.frameCount - 1];
                 break;
             }
 
-            case OP_IMPORT: {
-                ObjString* path = READ_STRING();
-
-                // Read the module file
-                char* source = readFile(path->chars);
-                if (source == NULL) {
-                    runtimeError("Could not open module '%s'.", path->chars);
+            case OP_TAIL_INVOKE: {
+                ObjString* methodName = READ_STRING();
+                int argCount = READ_BYTE();
+                InlineCache* cache = READ_CACHE();
+                Value receiver = peek(argCount);
+                if (!IS_STRUCT(receiver)) {
+                    runtimeError("Only struct instances have methods.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-
-                // Compile the module
-                ObjFunction* moduleFunc = compile(source);
-                free(source);
-
-                if (moduleFunc == NULL) {
-                    runtimeError("Error compiling module '%s'.", path->chars);
+                ObjStruct* instance = AS_STRUCT(receiver);
+                if (cache->def != instance->definition &&
+                    !updateCache(cache, instance->definition, methodName)) {
+                    runtimeError("Undefined method '%s'.", methodName->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
+                if (cache->index >= 0) {
+                    Value callee = instance->fields[cache->index];
+                    vm.stackTop[-argCount - 1] = callee;
+                    if (!tailCallValue(frame, callee, argCount)) return INTERPRET_RUNTIME_ERROR;
+                } else if (!tailCallClosure(frame, cache->method, argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm.frames[vm.frameCount - 1];
+                break;
+            }
 
-                // Execute the module - it shares globals with the main script
-                push(OBJ_VAL(moduleFunc));
-                ObjClosure* moduleClosure = newClosure(moduleFunc);
-                pop();
-                push(OBJ_VAL(moduleClosure));
-
-                CallFrame* moduleFrame = &vm.frames[vm.frameCount++];
-                moduleFrame->closure = moduleClosure;
-                moduleFrame->ip = moduleFunc->chunk->code;
-                moduleFrame->slots = vm.stackTop - 1;
+            case OP_IMPORT: {
+                ObjString* path = READ_STRING();
+                // Runs in a new frame that shares globals with the importer
+                if (!importModule(path, false)) return INTERPRET_RUNTIME_ERROR;
+                frame = &vm.frames[vm.frameCount - 1];
+                break;
+            }
 
-                // Continue execution in the module
-                frame = moduleFrame;
+            case OP_IMPORT_LAZY: {
+                ObjString* path = READ_STRING();
+                if (!importModule(path, true)) return INTERPRET_RUNTIME_ERROR;
                 break;
             }
 
             case OP_RETURN: {
                 Value result = pop();
+                closeUpvalues(frame->slots);
                 vm.frameCount--;
                 if (vm.frameCount == 0) {
                     pop();
@@ -3739,7 +6612,7 @@ static InterpretResult run(void) {
                 }
 
                 vm.stackTop = frame->slots;
-                push(result);
+                if (!frame->discardResult) push(result);
                 frame = &vm.frames[vm.frameCount - 1];
                 break;
             }
@@ -3757,64 +6630,128 @@ static InterpretResult run(void) {
                     frame->slots[slot] = INT_VAL(AS_INT(val) + 1);
                 } else if (IS_FLOAT(val)) {
                     frame->slots[slot] = FLOAT_VAL(AS_FLOAT(val) + 1.0);
+                } else if (IS_STRING(val)) {
+                    push(val);
+                    push(INT_VAL(1));
+                    concatenateAny();
+                    frame->slots[slot] = pop();
                 } else {
-                    runtimeError("Operand must be a number.");
+                    runtimeError("Operands must be two numbers or two strings.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 break;
             }
 
+            // Load local + constant, add: push(local[slot] + const[idx])
             case OP_ADD_LOCAL_CONST: {
                 uint8_t slot = READ_BYTE();
                 Value constant = READ_CONSTANT();
                 Value local = frame->slots[slot];
+                // Fast path for ints
                 if (IS_INT(local) && IS_INT(constant)) {
                     push(INT_VAL(AS_INT(local) + AS_INT(constant)));
-                } else if (IS_NUMBER(local) && IS_NUMBER(constant)) {
-                    push(FLOAT_VAL(AS_NUMBER(local) + AS_NUMBER(constant)));
-                } else {
-                    runtimeError("Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    break;
                 }
-                break;
+                push(local);
+                push(constant);
+                goto do_ADD;
             }
 
+            // Compare local < constant: push(local[slot] < const[idx])
             case OP_LESS_LOCAL_CONST: {
                 uint8_t slot = READ_BYTE();
                 Value constant = READ_CONSTANT();
                 Value local = frame->slots[slot];
-                if (IS_NUMBER(local) && IS_NUMBER(constant)) {
-                    push(BOOL_VAL(AS_NUMBER(local) < AS_NUMBER(constant)));
-                } else {
-                    runtimeError("Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
+                if (IS_INT(local) && IS_INT(constant)) {
+                    push(BOOL_VAL(AS_INT(local) < AS_INT(constant)));
+                    break;
                 }
-                break;
+                push(local);
+                push(constant);
+                goto do_LESS;
             }
 
+            // Array index with local: push(stack[-1][local[slot]])
             case OP_INDEX_GET_LOCAL: {
                 uint8_t slot = READ_BYTE();
-                Value arrayVal = pop();
-                if (!IS_ARRAY(arrayVal)) {
-                    runtimeError("Can only index arrays.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+                Value arrayVal = peek(0);
                 Value indexVal = frame->slots[slot];
-                if (!IS_INT(indexVal)) {
-                    runtimeError("Array index must be an integer.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                ObjArray* array = AS_ARRAY(arrayVal);
-                int64_t index = AS_INT(indexVal);
-                if (index < 0 || index >= array->count) {
-                    runtimeError("Array index %lld out of bounds [0, %d).",
-                                 (long long)index, array->count);
-                    return INTERPRET_RUNTIME_ERROR;
+                if (IS_ARRAY(arrayVal) && IS_INT(indexVal)) {
+                    ObjArray* array = AS_ARRAY(arrayVal);
+                    int64_t index = AS_INT(indexVal);
+                    if (index >= 0 && index < array->count) {
+                        vm.stackTop[-1] = array->elements[index];
+                        break;
+                    }
+                } else if (IS_TYPED_ARRAY(arrayVal) && IS_INT(indexVal)) {
+                    ObjTypedArray* array = AS_TYPED_ARRAY(arrayVal);
+                    int64_t index = AS_INT(indexVal);
+                    if (index >= 0 && index < array->count) {
+                        vm.stackTop[-1] = typedArrayGet(array, (int)index);
+                        break;
+                    }
                 }
-                push(array->elements[index]);
+                // Anything unusual, including the out-of-bounds error, goes generic
+                push(indexVal);
+                goto do_INDEX_GET;
+            }
+
+            // Fused by the peephole optimizer (optimizer.c); each falls back to the
+            // generic instruction by pushing its operands and jumping to its handler
+
+            // Assignment statement: local[slot] = pop()
+            case OP_SET_LOCAL_POP: {
+                uint8_t slot = READ_BYTE();
+                frame->slots[slot] = pop();
                 break;
             }
 
+            // push(local[a] + local[b])
+            case OP_ADD_LOCALS: {
+                Value a = frame->slots[READ_BYTE()];
+                Value b = frame->slots[READ_BYTE()];
+                if (IS_INT(a) && IS_INT(b)) {
+                    push(INT_VAL(AS_INT(a) + AS_INT(b)));
+                    break;
+                }
+                push(a);
+                push(b);
+                goto do_ADD;
+            }
+
+            // Field of a local; the remaining operands are laid out as GET_FIELD's
+            case OP_GET_LOCAL_FIELD:
+                push(frame->slots[READ_BYTE()]);
+                goto do_GET_FIELD;
+
+            // Loop header: jump if !(local[a] < local[b])
+            case OP_JUMP_IF_NOT_LESS_LOCALS: {
+                Value a = frame->slots[READ_BYTE()];
+                Value b = frame->slots[READ_BYTE()];
+                if (IS_INT(a) && IS_INT(b)) {
+                    uint16_t offset = READ_SHORT();
+                    if (AS_INT(a) >= AS_INT(b)) frame->ip += offset;
+                    break;
+                }
+                push(a);
+                push(b);
+                goto do_JUMP_IF_NOT_LESS;
+            }
+
+            // Loop header: jump if !(local[slot] < const[idx])
+            case OP_JUMP_IF_NOT_LESS_LOCAL_CONST: {
+                Value a = frame->slots[READ_BYTE()];
+                Value b = READ_CONSTANT();
+                if (IS_INT(a) && IS_INT(b)) {
+                    uint16_t offset = READ_SHORT();
+                    if (AS_INT(a) >= AS_INT(b)) frame->ip += offset;
+                    break;
+                }
+                push(a);
+                push(b);
+                goto do_JUMP_IF_NOT_LESS;
+            }
+
             default:
                 runtimeError("Unknown opcode %d", instruction);
                 return INTERPRET_RUNTIME_ERROR;
@@ -3827,14 +6764,18 @@ static InterpretResult run(void) {
 #undef READ_SHORT
 #undef READ_CONSTANT
 #undef READ_STRING
+#undef READ_CACHE
 #undef BINARY_OP_INT
+#undef BINARY_OP_INT_DIV
 #undef BINARY_OP_FLOAT
 #undef BINARY_OP_NUMERIC
+#undef COMPARE_JUMP
 }
 
 InterpretResult interpret(const char* source) {
     ObjFunction* function = compile(source);
     if (function == NULL) return INTERPRET_COMPILE_ERROR;
+    if (!reserveStack(function->maxSlots)) return INTERPRET_RUNTIME_ERROR;
 
     push(OBJ_VAL(function));
     ObjClosure* closure = newClosure(function);
@@ -3845,6 +6786,8 @@ InterpretResult interpret(const char* source) {
     frame->closure = closure;
     frame->ip = function->chunk->code;
     frame->slots = vm.stack;
+    frame->discardResult = false;
 
+    if (vm.profiling) profileSkip();
     return run();
 }
@@ -5,25 +5,47 @@
 #include "object.h"
 #include "table.h"
 #include "value.h"
+#include "worker.h"
 
-#define FRAMES_MAX 64
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+// The frame array and value stack start small and double on demand, up to
+// FRAMES_MAX frames. Starting a function makes sure its maxSlots values (as
+// counted by the compiler) and STACK_HEADROOM more fit above stackTop, so
+// push() itself never has to grow the stack. The headroom covers values the
+// VM and natives push for a moment on top of a frame.
+#define FRAMES_INITIAL 64
+#define FRAMES_MAX (1 << 18)
+#define STACK_INITIAL (4 * UINT8_COUNT)
+#define STACK_HEADROOM UINT8_COUNT
+
+// Incremental collector state
+typedef enum {
+    GC_PHASE_IDLE,
+    GC_PHASE_MARK,
+    GC_PHASE_SWEEP,
+} GCPhase;
 
 // Call frame for function execution
 typedef struct {
     ObjClosure* closure;
     uint8_t* ip;
     Value* slots;
+    bool discardResult;         // Module body: OP_RETURN pushes nothing
 } CallFrame;
 
 typedef struct {
-    CallFrame frames[FRAMES_MAX];
+    CallFrame* frames;
     int frameCount;
+    int frameCapacity;
 
-    Value stack[STACK_MAX];
+    Value* stack;               // Moves when it grows (see reserveFrame)
     Value* stackTop;
+    int stackCapacity;
 
-    Table globals;
+    Table globals;              // Global name -> slot index
+    ValueArray globalValues;    // Slot -> value, shared by all modules
+    ValueArray globalNames;     // Slot -> name (for error messages)
+    Table modules;              // Canonical path -> true once run, or the
+                                // compiled function of a pending lazy import
     Table strings;
 
     ObjUpvalue* openUpvalues;
@@ -35,6 +57,23 @@ typedef struct {
     int grayCount;
     int grayCapacity;
     Obj** grayStack;
+    bool gcRunning;
+    bool gcIncremental;         // Set once the script drives the GC with gcStep()
+    GCPhase gcPhase;
+    Obj* sweepCursor;           // Next object to sweep
+    Obj* sweepPrev;             // Last surviving object before sweepCursor
+
+    // GC statistics
+    uint64_t gcCount;
+    uint64_t gcLastPauseUs;
+    uint64_t gcMaxPauseUs;
+    uint64_t gcTotalPauseUs;
+    size_t gcLastFreed;
+    size_t gcCycleStartBytes;
+
+    bool profiling;             // Sampling profiler hook active (profiler.h)
+    bool nativeFailed;          // The running native called nativeError
+    Channel* workerChannel;     // In a worker, end 1 of its parent channel
 } VM;
 
 typedef enum {
@@ -43,7 +82,7 @@ typedef enum {
     INTERPRET_RUNTIME_ERROR,
 } InterpretResult;
 
-extern VM vm;
+extern THREAD_LOCAL VM vm;
 
 void initVM(void);
 void freeVM(void);
@@ -51,5 +90,6 @@ InterpretResult interpret(const char* source);
 void push(Value value);
 Value pop(void);
 Value peek(int distance);
+int globalSlot(ObjString* name);
 
 #endif
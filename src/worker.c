@@ -0,0 +1,491 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL3/SDL.h>
+
+#include "memory.h"
+#include "worker.h"
+#include "vm.h"
+
+// Containers nested deeper than this (or a cycle) aren't sent
+#define MESSAGE_MAX_DEPTH 64
+
+typedef enum {
+    MSG_NIL,
+    MSG_TRUE,
+    MSG_FALSE,
+    MSG_INT,
+    MSG_FLOAT,
+    MSG_STRING,
+    MSG_ARRAY,
+    MSG_MAP,
+    MSG_TYPED_ARRAY,
+    MSG_STRUCT,
+} MessageTag;
+
+// Plain malloc throughout: a message belongs to no VM while it's queued
+struct Message {
+    Message* next;
+    uint8_t* data;
+    size_t count;
+    size_t capacity;
+    size_t position;            // Read cursor while decoding
+    bool ok;                    // Cleared when an allocation fails
+};
+
+struct Channel {
+    SDL_Mutex* lock;
+    SDL_Condition* ready[2];    // Signalled when end i gets a message or
+                                // the other end closes
+    Message* head[2];           // Messages waiting for end i, oldest first
+    Message* tail[2];
+    int refs[2];
+    bool closed[2];
+};
+
+// ============ Channels ============
+
+Channel* createChannel(void) {
+    Channel* channel = calloc(1, sizeof(Channel));
+    if (channel == NULL) return NULL;
+    channel->lock = SDL_CreateMutex();
+    channel->ready[0] = SDL_CreateCondition();
+    channel->ready[1] = SDL_CreateCondition();
+    if (channel->lock == NULL || channel->ready[0] == NULL || channel->ready[1] == NULL) {
+        SDL_DestroyMutex(channel->lock);
+        SDL_DestroyCondition(channel->ready[0]);
+        SDL_DestroyCondition(channel->ready[1]);
+        free(channel);
+        return NULL;
+    }
+    return channel;
+}
+
+static void destroyChannel(Channel* channel) {
+    for (int end = 0; end < 2; end++) {
+        Message* message = channel->head[end];
+        while (message != NULL) {
+            Message* next = message->next;
+            freeMessage(message);
+            message = next;
+        }
+        SDL_DestroyCondition(channel->ready[end]);
+    }
+    SDL_DestroyMutex(channel->lock);
+    free(channel);
+}
+
+void retainChannel(Channel* channel, int end) {
+    SDL_LockMutex(channel->lock);
+    channel->refs[end]++;
+    SDL_UnlockMutex(channel->lock);
+}
+
+void releaseChannel(Channel* channel, int end) {
+    SDL_LockMutex(channel->lock);
+    if (--channel->refs[end] == 0) {
+        channel->closed[end] = true;
+        SDL_BroadcastCondition(channel->ready[1 - end]);
+    }
+    bool unused = channel->refs[0] == 0 && channel->refs[1] == 0;
+    SDL_UnlockMutex(channel->lock);
+    if (unused) destroyChannel(channel);
+}
+
+void closeChannel(Channel* channel, int end) {
+    SDL_LockMutex(channel->lock);
+    channel->closed[end] = true;
+    SDL_BroadcastCondition(channel->ready[1 - end]);
+    SDL_UnlockMutex(channel->lock);
+}
+
+bool channelIsOpen(Channel* channel, int end) {
+    SDL_LockMutex(channel->lock);
+    bool open = !channel->closed[end] &&
+                (channel->head[end] != NULL || !channel->closed[1 - end]);
+    SDL_UnlockMutex(channel->lock);
+    return open;
+}
+
+bool channelSend(Channel* channel, int end, Message* message) {
+    int to = 1 - end;
+    SDL_LockMutex(channel->lock);
+    bool open = !channel->closed[end] && !channel->closed[to];
+    if (open) {
+        message->next = NULL;
+        if (channel->tail[to] == NULL) {
+            channel->head[to] = message;
+        } else {
+            channel->tail[to]->next = message;
+        }
+        channel->tail[to] = message;
+        SDL_SignalCondition(channel->ready[to]);
+    }
+    SDL_UnlockMutex(channel->lock);
+    if (!open) freeMessage(message);
+    return open;
+}
+
+Message* channelReceive(Channel* channel, int end, int timeoutMs) {
+    Uint64 deadline = SDL_GetTicks() + (Uint64)(timeoutMs > 0 ? timeoutMs : 0);
+    SDL_LockMutex(channel->lock);
+    // Waits can wake early, so each one is for the time left
+    while (channel->head[end] == NULL && !channel->closed[end] &&
+           !channel->closed[1 - end] && timeoutMs != 0) {
+        if (timeoutMs < 0) {
+            SDL_WaitCondition(channel->ready[end], channel->lock);
+            continue;
+        }
+        Uint64 now = SDL_GetTicks();
+        if (now >= deadline) break;
+        SDL_WaitConditionTimeout(channel->ready[end], channel->lock, (Sint32)(deadline - now));
+    }
+
+    Message* message = NULL;
+    if (!channel->closed[end]) message = channel->head[end];
+    if (message != NULL) {
+        channel->head[end] = message->next;
+        if (channel->head[end] == NULL) channel->tail[end] = NULL;
+        message->next = NULL;
+    }
+    SDL_UnlockMutex(channel->lock);
+    return message;
+}
+
+// ============ Encoding ============
+
+static void writeBytes(Message* message, const void* bytes, size_t count) {
+    if (!message->ok || count == 0) return;
+    if (message->count + count > message->capacity) {
+        size_t capacity = message->capacity < 64 ? 64 : message->capacity;
+        while (capacity < message->count + count) capacity *= 2;
+        uint8_t* data = realloc(message->data, capacity);
+        if (data == NULL) {
+            message->ok = false;
+            return;
+        }
+        message->data = data;
+        message->capacity = capacity;
+    }
+    memcpy(message->data + message->count, bytes, count);
+    message->count += count;
+}
+
+static void writeTag(Message* message, MessageTag tag) {
+    uint8_t byte = (uint8_t)tag;
+    writeBytes(message, &byte, 1);
+}
+
+static void writeCount(Message* message, int count) {
+    int32_t value = count;
+    writeBytes(message, &value, sizeof(value));
+}
+
+static void writeString(Message* message, ObjString* string) {
+    writeCount(message, string->length);
+    writeBytes(message, string->chars, (size_t)string->length);
+}
+
+static bool encodeValue(Message* message, Value value, int depth) {
+    if (depth > MESSAGE_MAX_DEPTH) return false;
+
+    if (IS_NIL(value)) {
+        writeTag(message, MSG_NIL);
+    } else if (IS_BOOL(value)) {
+        writeTag(message, AS_BOOL(value) ? MSG_TRUE : MSG_FALSE);
+    } else if (IS_INT(value)) {
+        int64_t number = AS_INT(value);
+        writeTag(message, MSG_INT);
+        writeBytes(message, &number, sizeof(number));
+    } else if (IS_FLOAT(value)) {
+        double number = AS_FLOAT(value);
+        writeTag(message, MSG_FLOAT);
+        writeBytes(message, &number, sizeof(number));
+    } else if (IS_STRING(value)) {
+        writeTag(message, MSG_STRING);
+        writeString(message, AS_STRING(value));
+    } else if (IS_ARRAY(value)) {
+        ObjArray* array = AS_ARRAY(value);
+        writeTag(message, MSG_ARRAY);
+        writeCount(message, array->count);
+        for (int i = 0; i < array->count; i++) {
+            if (!encodeValue(message, array->elements[i], depth + 1)) return false;
+        }
+    } else if (IS_MAP(value)) {
+        ValueTable* table = &AS_MAP(value)->table;
+        writeTag(message, MSG_MAP);
+        writeCount(message, table->size);
+        for (int i = 0; i < table->capacity; i++) {
+            ValueEntry* entry = &table->entries[i];
+            if (IS_NIL(entry->key)) continue;
+            if (!encodeValue(message, entry->key, depth + 1) ||
+                !encodeValue(message, entry->value, depth + 1)) {
+                return false;
+            }
+        }
+    } else if (IS_TYPED_ARRAY(value)) {
+        ObjTypedArray* array = AS_TYPED_ARRAY(value);
+        uint8_t kind = (uint8_t)array->kind;
+        writeTag(message, MSG_TYPED_ARRAY);
+        writeBytes(message, &kind, 1);
+        writeCount(message, array->count);
+        writeBytes(message, array->data, typedElementSize(array->kind) * (size_t)array->count);
+    } else if (IS_STRUCT(value)) {
+        ObjStruct* instance = AS_STRUCT(value);
+        ObjStructDef* def = instance->definition;
+        writeTag(message, MSG_STRUCT);
+        writeString(message, def->name);
+        writeCount(message, instance->fieldCount);
+        for (int i = 0; i < instance->fieldCount; i++) {
+            writeString(message, def->fieldNames[i]);
+            if (!encodeValue(message, instance->fields[i], depth + 1)) return false;
+        }
+    } else {
+        return false;
+    }
+    return message->ok;
+}
+
+Message* encodeMessage(Value value) {
+    Message* message = calloc(1, sizeof(Message));
+    if (message == NULL) return NULL;
+    message->ok = true;
+    if (!encodeValue(message, value, 0)) {
+        freeMessage(message);
+        return NULL;
+    }
+    return message;
+}
+
+void freeMessage(Message* message) {
+    free(message->data);
+    free(message);
+}
+
+// ============ Decoding ============
+// Everything read here was written by encodeValue in this process, so the
+// reader trusts the layout. Objects under construction stay on the VM
+// stack while their contents are decoded.
+
+static void readBytes(Message* message, void* bytes, size_t count) {
+    memcpy(bytes, message->data + message->position, count);
+    message->position += count;
+}
+
+static int readCount(Message* message) {
+    int32_t value;
+    readBytes(message, &value, sizeof(value));
+    return value;
+}
+
+static ObjString* readString(Message* message) {
+    int length = readCount(message);
+    const char* chars = (const char*)message->data + message->position;
+    message->position += (size_t)length;
+    return copyString(chars, length);
+}
+
+static Value decodeValue(Message* message);
+
+static void storeEntry(ObjMap* map, Value key, Value value) {
+    valueTableSet(&map->table, key, value);
+    WRITE_BARRIER(map, key);
+    WRITE_BARRIER(map, value);
+}
+
+// The receiver's struct type with this name and these field names, if any
+static ObjStructDef* findStructDef(ObjString* name, ObjArray* fields) {
+    Value slot;
+    if (!tableGet(&vm.globals, name, &slot)) return NULL;
+    Value type = vm.globalValues.values[AS_INT(slot)];
+    if (!IS_STRUCT_DEF(type)) return NULL;
+
+    ObjStructDef* def = AS_STRUCT_DEF(type);
+    if (def->fieldCount * 2 != fields->count) return NULL;
+    for (int i = 0; i < def->fieldCount; i++) {
+        if (AS_STRING(fields->elements[2 * i]) != def->fieldNames[i]) return NULL;
+    }
+    return def;
+}
+
+static Value decodeStruct(Message* message) {
+    ObjString* name = readString(message);
+    push(OBJ_VAL(name));
+    int fieldCount = readCount(message);
+
+    // Field names and values alternate
+    ObjArray* fields = newArray();
+    push(OBJ_VAL(fields));
+    for (int i = 0; i < fieldCount; i++) {
+        ObjString* fieldName = readString(message);
+        push(OBJ_VAL(fieldName));
+        writeArray(fields, OBJ_VAL(fieldName));
+        pop();
+        Value field = decodeValue(message);
+        push(field);
+        writeArray(fields, field);
+        pop();
+    }
+
+    Value result;
+    ObjStructDef* def = findStructDef(name, fields);
+    if (def != NULL) {
+        ObjStruct* instance = newStruct(def);
+        for (int i = 0; i < fieldCount; i++) {
+            instance->fields[i] = fields->elements[2 * i + 1];
+            WRITE_BARRIER(instance, instance->fields[i]);
+        }
+        result = OBJ_VAL(instance);
+    } else {
+        ObjMap* map = newMap();
+        push(OBJ_VAL(map));
+        for (int i = 0; i < fieldCount; i++) {
+            storeEntry(map, fields->elements[2 * i], fields->elements[2 * i + 1]);
+        }
+        pop();
+        result = OBJ_VAL(map);
+    }
+    pop();
+    pop();
+    return result;
+}
+
+static Value decodeValue(Message* message) {
+    uint8_t tag;
+    readBytes(message, &tag, 1);
+
+    switch ((MessageTag)tag) {
+        case MSG_NIL:   return NIL_VAL;
+        case MSG_TRUE:  return BOOL_VAL(true);
+        case MSG_FALSE: return BOOL_VAL(false);
+        case MSG_INT: {
+            int64_t number;
+            readBytes(message, &number, sizeof(number));
+            return INT_VAL(number);
+        }
+        case MSG_FLOAT: {
+            double number;
+            readBytes(message, &number, sizeof(number));
+            return FLOAT_VAL(number);
+        }
+        case MSG_STRING:
+            return OBJ_VAL(readString(message));
+        case MSG_ARRAY: {
+            int count = readCount(message);
+            ObjArray* array = newArray();
+            push(OBJ_VAL(array));
+            for (int i = 0; i < count; i++) {
+                Value element = decodeValue(message);
+                push(element);
+                writeArray(array, element);
+                pop();
+            }
+            pop();
+            return OBJ_VAL(array);
+        }
+        case MSG_MAP: {
+            int count = readCount(message);
+            ObjMap* map = newMap();
+            push(OBJ_VAL(map));
+            for (int i = 0; i < count; i++) {
+                Value key = decodeValue(message);
+                push(key);
+                Value value = decodeValue(message);
+                push(value);
+                storeEntry(map, key, value);
+                pop();
+                pop();
+            }
+            pop();
+            return OBJ_VAL(map);
+        }
+        case MSG_TYPED_ARRAY: {
+            uint8_t kind;
+            readBytes(message, &kind, 1);
+            int count = readCount(message);
+            ObjTypedArray* array = newTypedArray((TypedArrayKind)kind, count);
+            if (count > 0) {
+                readBytes(message, array->data, typedElementSize(array->kind) * (size_t)count);
+            }
+            return OBJ_VAL(array);
+        }
+        case MSG_STRUCT:
+            return decodeStruct(message);
+    }
+    return NIL_VAL;
+}
+
+Value decodeMessage(Message* message) {
+    message->position = 0;
+    Value value = decodeValue(message);
+    freeMessage(message);
+    return value;
+}
+
+// ============ Worker threads ============
+
+typedef struct {
+    char* path;
+    Channel* channel;
+} WorkerStart;
+
+static char* readSource(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0L, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    char* buffer = size < 0 ? NULL : malloc((size_t)size + 1);
+    if (buffer != NULL) {
+        size_t bytesRead = fread(buffer, 1, (size_t)size, file);
+        buffer[bytesRead] = '\0';
+    }
+    fclose(file);
+    return buffer;
+}
+
+static int runWorker(void* data) {
+    WorkerStart* start = (WorkerStart*)data;
+
+    initVM();
+    vm.workerChannel = start->channel;
+    char* source = readSource(start->path);
+    if (source == NULL) {
+        fprintf(stderr, "Could not open worker script \"%s\".\n", start->path);
+    } else {
+        interpret(source);
+        free(source);
+    }
+    freeVM();
+
+    releaseChannel(start->channel, 1);
+    free(start->path);
+    free(start);
+    return 0;
+}
+
+bool spawnWorker(const char* path, Channel* channel) {
+    WorkerStart* start = malloc(sizeof(WorkerStart));
+    if (start == NULL) return false;
+    start->path = malloc(strlen(path) + 1);
+    if (start->path == NULL) {
+        free(start);
+        return false;
+    }
+    strcpy(start->path, path);
+    start->channel = channel;
+    retainChannel(channel, 1);
+
+    SDL_Thread* thread = SDL_CreateThread(runWorker, "sharo worker", start);
+    if (thread == NULL) {
+        releaseChannel(channel, 1);
+        free(start->path);
+        free(start);
+        return false;
+    }
+    SDL_DetachThread(thread);
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef sharo_worker_h
+#define sharo_worker_h
+
+#include "object.h"
+
+// Workers run a script on an OS thread of their own, with a VM of their
+// own (interpreter state is THREAD_LOCAL). The only link between two VMs is
+// a channel: a pair of message queues, one per direction. A message is a
+// value serialized into a malloc'd buffer, so the sender's objects never
+// cross over and each heap keeps its own collector.
+//
+// A channel has two ends, 0 and 1; end 0 receives what end 1 sends and
+// vice versa. Each end is reference counted by the ObjChannels (in
+// whichever VM) and the threads holding it. Once no one holds an end it is
+// closed: receiving from the other end returns nothing once the queue has
+// drained, and sending to it fails.
+
+typedef struct Channel Channel;
+typedef struct Message Message;
+
+Channel* createChannel(void);
+void retainChannel(Channel* channel, int end);
+void releaseChannel(Channel* channel, int end);
+// Close an end while it's still referenced (scripts' channelClose)
+void closeChannel(Channel* channel, int end);
+// Whether anything more can arrive at this end: messages are queued for it
+// or the other end is still open
+bool channelIsOpen(Channel* channel, int end);
+
+// Serialize a value: nil, bools, numbers, strings, arrays, maps, typed
+// arrays and structs (nested up to a fixed depth, since cycles can't be
+// copied). NULL for anything else.
+Message* encodeMessage(Value value);
+// Rebuild a message in the current VM and free it. A struct becomes an
+// instance of the receiver's global type of the same name and field
+// count, or a map of its fields when there's no such type.
+Value decodeMessage(Message* message);
+void freeMessage(Message* message);
+
+// Queue a message from this end to the other; false (and the message is
+// freed) if the other end is closed
+bool channelSend(Channel* channel, int end, Message* message);
+// Next message sent to this end, waiting up to timeoutMs (-1: until one
+// arrives or the sending end closes). NULL if none came.
+Message* channelReceive(Channel* channel, int end, int timeoutMs);
+
+// Start a thread running the script at path, with end 1 of channel as its
+// parent channel. The thread holds its own reference to end 1.
+bool spawnWorker(const char* path, Channel* channel);
+
+#endif